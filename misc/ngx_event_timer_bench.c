@@ -0,0 +1,153 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * The event timers: the given number of timers with random timeouts
+ * of up to a minute are added, deleted, added again and expired while
+ * the time goes on a millisecond at a time.  The time per timer of each
+ * operation is reported.  The timers are kept either in the rbtree or,
+ * if nginx is configured with --with-timer-wheel, in the timing wheel,
+ * so the two builds are compared by the same program.
+ *
+ *     ngx_event_timer_bench [timers]
+ */
+
+
+#include <ngx_misc.h>
+#include <ngx_event.h>
+
+
+#define NGX_EVENT_TIMER_BENCH_MAX  60000
+
+
+static void ngx_event_timer_bench_handler(ngx_event_t *ev);
+
+
+static ngx_event_t  *ngx_event_timer_bench_events;
+static ngx_msec_t   *ngx_event_timer_bench_timeouts;
+static ngx_uint_t    ngx_event_timer_bench_expired;
+
+
+int
+main(int argc, char *argv[])
+{
+    uint64_t      start;
+    ngx_uint_t    i, n;
+    ngx_msec_t   *timeouts;
+    ngx_event_t  *ev;
+
+    ngx_misc_init();
+
+    n = (argc > 1) ? (ngx_uint_t) atoi(argv[1]) : 1000000;
+
+    if (n == 0) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                      "usage: ngx_event_timer_bench [timers]");
+        return 1;
+    }
+
+    ev = ngx_calloc(n * sizeof(ngx_event_t), &ngx_misc_log);
+    if (ev == NULL) {
+        return 1;
+    }
+
+    timeouts = ngx_alloc(n * sizeof(ngx_msec_t), &ngx_misc_log);
+    if (timeouts == NULL) {
+        return 1;
+    }
+
+    ngx_event_timer_bench_events = ev;
+    ngx_event_timer_bench_timeouts = timeouts;
+
+    for (i = 0; i < n; i++) {
+        ev[i].log = &ngx_misc_log;
+        ev[i].handler = ngx_event_timer_bench_handler;
+
+        timeouts[i] = 1 + ngx_misc_random() % NGX_EVENT_TIMER_BENCH_MAX;
+    }
+
+    ngx_current_msec = 0;
+
+    if (ngx_event_timer_init(&ngx_misc_log) != NGX_OK) {
+        return 1;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, &ngx_misc_log, 0,
+#if (NGX_TIMER_WHEEL)
+                  "event timer bench: %ui timers in the timing wheel",
+#else
+                  "event timer bench: %ui timers in the rbtree",
+#endif
+                  n);
+
+    start = ngx_misc_nsec();
+
+    for (i = 0; i < n; i++) {
+        ngx_add_timer(&ev[i], timeouts[i]);
+    }
+
+    ngx_misc_report("insert", n, start);
+
+    start = ngx_misc_nsec();
+
+    for (i = 0; i < n; i++) {
+        ngx_del_timer(&ev[i]);
+    }
+
+    ngx_misc_report("delete", n, start);
+
+    if (!ngx_event_timer_empty()) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                      "timers are left after deletion");
+        return 1;
+    }
+
+    for (i = 0; i < n; i++) {
+        ngx_add_timer(&ev[i], timeouts[i]);
+    }
+
+    start = ngx_misc_nsec();
+
+    while (!ngx_event_timer_empty()) {
+        ngx_current_msec++;
+        ngx_event_expire_timers();
+
+        if (ngx_current_msec > NGX_EVENT_TIMER_BENCH_MAX) {
+            break;
+        }
+    }
+
+    ngx_misc_report("expire", n, start);
+
+    if (ngx_event_timer_bench_expired != n) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                      "%ui timers are expired instead of %ui",
+                      ngx_event_timer_bench_expired, n);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static void
+ngx_event_timer_bench_handler(ngx_event_t *ev)
+{
+    ngx_msec_t  timeout;
+
+    /* the time is started from 0, so the timeout is the expiration time */
+
+    timeout = ngx_event_timer_bench_timeouts[ev
+                                             - ngx_event_timer_bench_events];
+
+    if (timeout != ngx_current_msec) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                      "timer %M is expired at %M", timeout, ngx_current_msec);
+        exit(1);
+    }
+
+    ngx_event_timer_bench_expired++;
+}
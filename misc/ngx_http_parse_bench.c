@@ -0,0 +1,201 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * The request line and header parsers are timed on a request line with
+ * a long path, on one with arguments, and on browser-like headers.
+ * The runs are repeated without AVX2 if it is used.  The scalar state
+ * machine is timed by the same program linked with the parser compiled
+ * without the vector scanners, see misc/GNUmakefile.
+ */
+
+
+#include <ngx_misc.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_PARSE_BENCH_RUNS  1000000
+
+
+static ngx_int_t ngx_http_parse_bench(char *what);
+static ngx_int_t ngx_http_parse_bench_line(ngx_http_request_t *r,
+    ngx_buf_t *b, u_char *line, size_t len);
+static ngx_int_t ngx_http_parse_bench_header_lines(ngx_http_request_t *r,
+    ngx_buf_t *b, u_char *headers, size_t len);
+
+
+static u_char  ngx_http_parse_bench_path[] =
+    "GET /static/js/vendor/jquery-ui/1.10.3/themes/smoothness/images/"
+    "ui-bg_highlight-soft_75_cccccc_1x100.png HTTP/1.1" CRLF;
+
+static u_char  ngx_http_parse_bench_args[] =
+    "GET /search?q=nginx+shared+memory&client=firefox-a&rls=org.mozilla"
+    "%3Aen-US%3Aofficial&channel=fflb&ie=UTF-8&oe=UTF-8 HTTP/1.1" CRLF;
+
+static u_char  ngx_http_parse_bench_headers[] =
+    "Host: www.example.com" CRLF
+    "User-Agent: Mozilla/5.0 (Windows NT 6.1; WOW64; rv:21.0) "
+        "Gecko/20100101 Firefox/21.0" CRLF
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+        "*/*;q=0.8" CRLF
+    "Accept-Language: en-US,en;q=0.5" CRLF
+    "Accept-Encoding: gzip, deflate" CRLF
+    "Referer: http://www.example.com/search?q=nginx&client=firefox-a" CRLF
+    "Cookie: __utma=111872281.1385422470.1370427227.1370427227.1370427227.1;"
+        " __utmz=111872281.1370427227.1.1.utmcsr=(direct)|utmccn=(direct)|"
+        "utmcmd=(none); session=5f2b1c8e9a7d4e3f" CRLF
+    "Connection: keep-alive" CRLF
+    "Cache-Control: max-age=0" CRLF
+    "If-Modified-Since: Wed, 05 Jun 2013 10:20:30 GMT" CRLF
+    "If-None-Match: \"51af1a4e-1f3c\"" CRLF
+    CRLF;
+
+
+int
+main(int argc, char *argv[])
+{
+    ngx_misc_init();
+
+#if (NGX_HAVE_SSE2)
+
+    if (ngx_http_parse_bench("as detected") != NGX_OK) {
+        return 1;
+    }
+
+#else
+
+    if (ngx_http_parse_bench("without vector scanners") != NGX_OK) {
+        return 1;
+    }
+
+#endif
+
+#if (NGX_HAVE_AVX2)
+
+    if (ngx_cpu_features & NGX_CPU_AVX2) {
+        ngx_cpu_features &= ~NGX_CPU_AVX2;
+
+        if (ngx_http_parse_bench("without AVX2") != NGX_OK) {
+            return 1;
+        }
+    }
+
+#endif
+
+    return 0;
+}
+
+
+static ngx_int_t
+ngx_http_parse_bench(char *what)
+{
+    size_t               len;
+    uint64_t             start;
+    ngx_buf_t            b;
+    ngx_uint_t           i;
+    ngx_http_request_t   r;
+
+    ngx_memzero(&r, sizeof(ngx_http_request_t));
+    ngx_memzero(&b, sizeof(ngx_buf_t));
+
+    ngx_log_error(NGX_LOG_NOTICE, &ngx_misc_log, 0,
+                  "http parse bench %s", what);
+
+    len = sizeof(ngx_http_parse_bench_path) - 1;
+
+    start = ngx_misc_nsec();
+
+    for (i = 0; i < NGX_HTTP_PARSE_BENCH_RUNS; i++) {
+        if (ngx_http_parse_bench_line(&r, &b, ngx_http_parse_bench_path, len)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_misc_report("request line with a path", i, start);
+
+    len = sizeof(ngx_http_parse_bench_args) - 1;
+
+    start = ngx_misc_nsec();
+
+    for (i = 0; i < NGX_HTTP_PARSE_BENCH_RUNS; i++) {
+        if (ngx_http_parse_bench_line(&r, &b, ngx_http_parse_bench_args, len)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_misc_report("request line with arguments", i, start);
+
+    len = sizeof(ngx_http_parse_bench_headers) - 1;
+
+    start = ngx_misc_nsec();
+
+    for (i = 0; i < NGX_HTTP_PARSE_BENCH_RUNS; i++) {
+        if (ngx_http_parse_bench_header_lines(&r, &b,
+                                              ngx_http_parse_bench_headers,
+                                              len)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_misc_report("headers", i, start);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_parse_bench_line(ngx_http_request_t *r, ngx_buf_t *b, u_char *line,
+    size_t len)
+{
+    ngx_int_t  rc;
+
+    b->pos = line;
+    b->last = line + len;
+
+    r->state = 0;
+
+    rc = ngx_http_parse_request_line(r, b);
+
+    if (rc != NGX_OK || b->pos != b->last) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                      "request line \"%*s\" is not parsed: %i",
+                      len - 2, line, rc);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_parse_bench_header_lines(ngx_http_request_t *r, ngx_buf_t *b,
+    u_char *headers, size_t len)
+{
+    ngx_int_t  rc;
+
+    b->pos = headers;
+    b->last = headers + len;
+
+    r->state = 0;
+
+    do {
+        rc = ngx_http_parse_header_line(r, b, 0);
+    } while (rc == NGX_OK);
+
+    if (rc != NGX_HTTP_PARSE_HEADER_DONE || b->pos != b->last) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                      "headers are not parsed: %i", rc);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
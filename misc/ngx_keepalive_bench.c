@@ -0,0 +1,256 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * A keepalive load generator: the given number of connections send
+ * requests one after another to a local port for the given time, and
+ * the number of responses per second is reported.  It is used by
+ * "make -f misc/GNUmakefile bench-events" to compare the events methods.
+ *
+ *     ngx_keepalive_bench port [connections [seconds]]
+ */
+
+
+#include <ngx_misc.h>
+#include <sys/epoll.h>
+
+
+#define NGX_KEEPALIVE_BENCH_BUFSIZE  16384
+
+
+typedef struct {
+    ngx_socket_t    fd;
+    size_t          len;
+    u_char          buf[NGX_KEEPALIVE_BENCH_BUFSIZE];
+} ngx_keepalive_bench_conn_t;
+
+
+static ngx_int_t ngx_keepalive_bench_read(ngx_keepalive_bench_conn_t *c,
+    ngx_uint_t *responses);
+static ngx_int_t ngx_keepalive_bench_send(ngx_keepalive_bench_conn_t *c);
+
+
+static char  ngx_keepalive_bench_request[] =
+    "GET / HTTP/1.1" CRLF
+    "Host: localhost" CRLF
+    CRLF;
+
+
+int
+main(int argc, char *argv[])
+{
+    int                          ep, n;
+    uint64_t                     start, end, now;
+    ngx_uint_t                   i, conns, seconds, responses;
+    struct epoll_event           ee, events[64];
+    struct sockaddr_in           sin;
+    ngx_keepalive_bench_conn_t  *c;
+
+    ngx_misc_init();
+
+    if (argc < 2) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                      "usage: ngx_keepalive_bench port "
+                      "[connections [seconds]]");
+        return 1;
+    }
+
+    conns = (argc > 2) ? (ngx_uint_t) atoi(argv[2]) : 64;
+    seconds = (argc > 3) ? (ngx_uint_t) atoi(argv[3]) : 5;
+
+    ngx_memzero(&sin, sizeof(struct sockaddr_in));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(atoi(argv[1]));
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    c = ngx_alloc(conns * sizeof(ngx_keepalive_bench_conn_t), &ngx_misc_log);
+    if (c == NULL) {
+        return 1;
+    }
+
+    ep = epoll_create(conns);
+    if (ep == -1) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, ngx_errno,
+                      "epoll_create() failed");
+        return 1;
+    }
+
+    for (i = 0; i < conns; i++) {
+
+        c[i].len = 0;
+
+        c[i].fd = ngx_socket(AF_INET, SOCK_STREAM, 0);
+        if (c[i].fd == (ngx_socket_t) -1) {
+            ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, ngx_socket_errno,
+                          ngx_socket_n " failed");
+            return 1;
+        }
+
+        if (connect(c[i].fd, (struct sockaddr *) &sin, sizeof(sin)) == -1) {
+            ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, ngx_socket_errno,
+                          "connect() to port %s failed", argv[1]);
+            return 1;
+        }
+
+        if (ngx_nonblocking(c[i].fd) == -1) {
+            ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, ngx_socket_errno,
+                          ngx_nonblocking_n " failed");
+            return 1;
+        }
+
+        ee.events = EPOLLIN;
+        ee.data.ptr = &c[i];
+
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, c[i].fd, &ee) == -1) {
+            ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, ngx_errno,
+                          "epoll_ctl() failed");
+            return 1;
+        }
+    }
+
+    responses = 0;
+
+    start = ngx_misc_nsec();
+    end = start + (uint64_t) seconds * 1000000000;
+
+    for (i = 0; i < conns; i++) {
+        if (ngx_keepalive_bench_send(&c[i]) != NGX_OK) {
+            return 1;
+        }
+    }
+
+    for ( ;; ) {
+
+        now = ngx_misc_nsec();
+
+        if (now >= end) {
+            break;
+        }
+
+        n = epoll_wait(ep, events, 64, 1000);
+
+        if (n == -1) {
+            if (ngx_errno == NGX_EINTR) {
+                continue;
+            }
+
+            ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, ngx_errno,
+                          "epoll_wait() failed");
+            return 1;
+        }
+
+        for (i = 0; i < (ngx_uint_t) n; i++) {
+            if (ngx_keepalive_bench_read(events[i].data.ptr, &responses)
+                != NGX_OK)
+            {
+                return 1;
+            }
+        }
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, &ngx_misc_log, 0,
+                  "keepalive bench: %ui connections, %uL ms, %ui responses, "
+                  "%uL requests/s",
+                  conns, (now - start) / 1000000, responses,
+                  (uint64_t) responses * 1000000000 / (now - start));
+
+    return 0;
+}
+
+
+static ngx_int_t
+ngx_keepalive_bench_read(ngx_keepalive_bench_conn_t *c, ngx_uint_t *responses)
+{
+    u_char   *p, *h;
+    size_t    size;
+    ssize_t   n;
+
+    for ( ;; ) {
+
+        n = recv(c->fd, c->buf + c->len, NGX_KEEPALIVE_BENCH_BUFSIZE - c->len,
+                 0);
+
+        if (n == -1) {
+            if (ngx_socket_errno == NGX_EAGAIN) {
+                return NGX_OK;
+            }
+
+            ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, ngx_socket_errno,
+                          "recv() failed");
+            return NGX_ERROR;
+        }
+
+        if (n == 0) {
+            ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                          "connection closed by server");
+            return NGX_ERROR;
+        }
+
+        c->len += n;
+
+        /* the end of the header and the body of Content-Length bytes */
+
+        for ( ;; ) {
+
+            h = ngx_strlcasestrn(c->buf, c->buf + c->len,
+                                 (u_char *) CRLF CRLF, 4 - 1);
+            if (h == NULL) {
+                break;
+            }
+
+            h += 4;
+
+            p = ngx_strlcasestrn(c->buf, h, (u_char *) "content-length: ",
+                                 16 - 1);
+            if (p == NULL) {
+                ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                              "no Content-Length in response");
+                return NGX_ERROR;
+            }
+
+            size = (h - c->buf) + atoi((char *) p + 16);
+
+            if (size > NGX_KEEPALIVE_BENCH_BUFSIZE) {
+                ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                              "too large response");
+                return NGX_ERROR;
+            }
+
+            if (c->len < size) {
+                break;
+            }
+
+            (*responses)++;
+
+            c->len -= size;
+            ngx_memmove(c->buf, c->buf + size, c->len);
+
+            if (ngx_keepalive_bench_send(c) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_keepalive_bench_send(ngx_keepalive_bench_conn_t *c)
+{
+    ssize_t  n;
+
+    /* a request is small enough to be sent at once */
+
+    n = send(c->fd, ngx_keepalive_bench_request,
+             sizeof(ngx_keepalive_bench_request) - 1, 0);
+
+    if (n != sizeof(ngx_keepalive_bench_request) - 1) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, ngx_socket_errno,
+                      "send() failed");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
@@ -0,0 +1,132 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_misc.h>
+
+
+/*
+ * the globals which are defined in the nginx objects that are not linked
+ * to the test programs: the cycle, the logging and the process data
+ */
+
+volatile ngx_cycle_t  *ngx_cycle;
+ngx_pid_t              ngx_pid;
+ngx_int_t              ngx_ncpu;
+
+ngx_log_t              ngx_misc_log;
+
+static ngx_cycle_t     ngx_misc_cycle;
+static ngx_open_file_t ngx_misc_stderr;
+static uint32_t        ngx_misc_seed = 2463534242;
+
+
+#if (NGX_HAVE_VARIADIC_MACROS)
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+
+#else
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, va_list args)
+
+#endif
+{
+#if (NGX_HAVE_VARIADIC_MACROS)
+    va_list  args;
+#endif
+    u_char  *p, *last;
+    u_char   errstr[NGX_MAX_ERROR_STR];
+
+    last = errstr + NGX_MAX_ERROR_STR - 1;
+
+#if (NGX_HAVE_VARIADIC_MACROS)
+
+    va_start(args, fmt);
+    p = ngx_vslprintf(errstr, last, fmt, args);
+    va_end(args);
+
+#else
+
+    p = ngx_vslprintf(errstr, last, fmt, args);
+
+#endif
+
+    if (err) {
+        p = ngx_slprintf(p, last, " (%d)", err);
+    }
+
+    *p++ = LF;
+
+    (void) ngx_write_fd(ngx_stderr, errstr, p - errstr);
+}
+
+
+void
+ngx_misc_init(void)
+{
+    ngx_pid = ngx_getpid();
+    ngx_pagesize = getpagesize();
+    ngx_cacheline_size = NGX_CPU_CACHE_LINE;
+
+#if (NGX_HAVE_SC_NPROCESSORS_ONLN)
+    ngx_ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    if (ngx_ncpu < 1) {
+        ngx_ncpu = 1;
+    }
+
+    ngx_cpuinfo();
+
+    ngx_misc_stderr.fd = ngx_stderr;
+
+    ngx_misc_log.file = &ngx_misc_stderr;
+    ngx_misc_log.log_level = NGX_LOG_NOTICE;
+
+    ngx_misc_cycle.log = &ngx_misc_log;
+    ngx_cycle = &ngx_misc_cycle;
+}
+
+
+uint64_t
+ngx_misc_nsec(void)
+{
+    struct timespec  ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+uint32_t
+ngx_misc_random(void)
+{
+    /* xorshift32, the sequence is the same in all runs */
+
+    ngx_misc_seed ^= ngx_misc_seed << 13;
+    ngx_misc_seed ^= ngx_misc_seed >> 17;
+    ngx_misc_seed ^= ngx_misc_seed << 5;
+
+    return ngx_misc_seed;
+}
+
+
+void
+ngx_misc_report(char *name, ngx_uint_t n, uint64_t start)
+{
+    uint64_t  ns;
+
+    /* in tenths of a nanosecond per operation */
+
+    ns = (ngx_misc_nsec() - start) * 10 / n;
+
+    ngx_log_error(NGX_LOG_NOTICE, &ngx_misc_log, 0,
+                  "%s: %uL.%uL ns", name, ns / 10, ns % 10);
+}
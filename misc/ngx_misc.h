@@ -0,0 +1,24 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_MISC_H_INCLUDED_
+#define _NGX_MISC_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+void ngx_misc_init(void);
+uint64_t ngx_misc_nsec(void);
+uint32_t ngx_misc_random(void);
+void ngx_misc_report(char *name, ngx_uint_t n, uint64_t start);
+
+
+extern ngx_log_t  ngx_misc_log;
+
+
+#endif /* _NGX_MISC_H_INCLUDED_ */
@@ -0,0 +1,156 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * Contention of the shared memory mutex: a number of processes take
+ * the mutex the same number of times each and increment a shared counter
+ * in a critical section of the given length.  The total time, the spread
+ * of the times the processes finish at, and the counter are reported.
+ *
+ *     ngx_shmtx_bench [processes [locks [section]]]
+ */
+
+
+#include <ngx_misc.h>
+
+
+typedef struct {
+    ngx_shmtx_sh_t       lock;
+    ngx_atomic_t         start;
+    ngx_uint_t           counter;
+    uint64_t             done[1];
+} ngx_shmtx_bench_t;
+
+
+static void ngx_shmtx_bench_process(ngx_shmtx_bench_t *sh, ngx_shmtx_t *mtx,
+    ngx_uint_t n, ngx_uint_t locks, ngx_uint_t section);
+
+
+int
+main(int argc, char *argv[])
+{
+    pid_t               pid;
+    uint64_t            start, first, last, total;
+    ngx_shm_t           shm;
+    ngx_uint_t          i, processes, locks, section;
+    ngx_shmtx_t         mtx;
+    ngx_shmtx_bench_t  *sh;
+
+    ngx_misc_init();
+
+    processes = (argc > 1) ? (ngx_uint_t) atoi(argv[1]) : 32;
+    locks = (argc > 2) ? (ngx_uint_t) atoi(argv[2]) : 20000;
+    section = (argc > 3) ? (ngx_uint_t) atoi(argv[3]) : 20;
+
+    if (processes == 0 || locks == 0) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                      "usage: ngx_shmtx_bench [processes [locks [section]]]");
+        return 1;
+    }
+
+    shm.size = sizeof(ngx_shmtx_bench_t) + processes * sizeof(uint64_t);
+    shm.log = &ngx_misc_log;
+
+    if (ngx_shm_alloc(&shm) != NGX_OK) {
+        return 1;
+    }
+
+    sh = (ngx_shmtx_bench_t *) shm.addr;
+
+    ngx_memzero(&mtx, sizeof(ngx_shmtx_t));
+
+    if (ngx_shmtx_create(&mtx, &sh->lock, NULL) != NGX_OK) {
+        return 1;
+    }
+
+    for (i = 0; i < processes; i++) {
+
+        pid = fork();
+
+        if (pid == -1) {
+            ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, ngx_errno,
+                          "fork() failed");
+            return 1;
+        }
+
+        if (pid == 0) {
+            ngx_shmtx_bench_process(sh, &mtx, i, locks, section);
+            exit(0);
+        }
+    }
+
+    /* all processes start at once */
+
+    start = ngx_misc_nsec();
+    sh->start = 1;
+
+    for (i = 0; i < processes; i++) {
+        (void) wait(NULL);
+    }
+
+    total = ngx_misc_nsec() - start;
+
+    first = (uint64_t) -1;
+    last = 0;
+
+    for (i = 0; i < processes; i++) {
+        first = ngx_min(first, sh->done[i] - start);
+        last = ngx_max(last, sh->done[i] - start);
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, &ngx_misc_log, 0,
+                  "shmtx bench: %ui processes, %ui locks each, "
+                  "%ui-op section, %i cpus",
+                  processes, locks, section, ngx_ncpu);
+
+    ngx_log_error(NGX_LOG_NOTICE, &ngx_misc_log, 0,
+                  "total: %uL ms, first process done: %uL ms, "
+                  "last process done: %uL ms",
+                  total / 1000000, first / 1000000, last / 1000000);
+
+    if (sh->counter != processes * locks) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                      "counter is %ui instead of %ui",
+                      sh->counter, processes * locks);
+        return 1;
+    }
+
+    ngx_shm_free(&shm);
+
+    return 0;
+}
+
+
+static void
+ngx_shmtx_bench_process(ngx_shmtx_bench_t *sh, ngx_shmtx_t *mtx,
+    ngx_uint_t n, ngx_uint_t locks, ngx_uint_t section)
+{
+    ngx_uint_t           i, j;
+    volatile ngx_uint_t  work;
+
+    ngx_pid = ngx_getpid();
+
+    work = 0;
+
+    while (sh->start == 0) {
+        ngx_sched_yield();
+    }
+
+    for (i = 0; i < locks; i++) {
+
+        ngx_shmtx_lock(mtx);
+
+        sh->counter++;
+
+        for (j = 0; j < section; j++) {
+            work = j;
+        }
+
+        ngx_shmtx_unlock(mtx);
+    }
+
+    sh->done[n] = ngx_misc_nsec();
+}
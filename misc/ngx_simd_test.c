@@ -0,0 +1,844 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * The vectorized string primitives are compared byte for byte with
+ * the scalar versions they replaced, on random strings of mixed character
+ * classes and on strings which end right before an unmapped page.  The
+ * comparison is done with and without SSSE3.  With "-b" the functions are
+ * timed on a typical URI with arguments.
+ */
+
+
+#include <ngx_misc.h>
+#include <sys/mman.h>
+
+
+#define NGX_SIMD_TEST_RUNS     200000
+#define NGX_SIMD_TEST_MAXLEN   300
+#define NGX_SIMD_BENCH_RUNS    1000000
+
+
+static void ngx_simd_test_fill(u_char *p, size_t len);
+static ngx_int_t ngx_simd_test_run(u_char *src, size_t len, u_char *s2);
+static ngx_int_t ngx_simd_test_all(char *what);
+static void ngx_simd_bench(void);
+
+static void ngx_scalar_strlow(u_char *dst, u_char *src, size_t n);
+static ngx_int_t ngx_scalar_strncasecmp(u_char *s1, u_char *s2, size_t n);
+static ngx_uint_t ngx_scalar_hash_strlow(u_char *dst, u_char *src, size_t n);
+static uintptr_t ngx_scalar_escape_uri(u_char *dst, u_char *src, size_t size,
+    ngx_uint_t type);
+static void ngx_scalar_unescape_uri(u_char **dst, u_char **src, size_t size,
+    ngx_uint_t type);
+static uintptr_t ngx_scalar_escape_html(u_char *dst, u_char *src, size_t size);
+
+
+static u_char  *ngx_simd_page;
+
+static u_char   ngx_simd_src[NGX_SIMD_TEST_MAXLEN + 64];
+static u_char   ngx_simd_s2[NGX_SIMD_TEST_MAXLEN + 64];
+static u_char   ngx_simd_d1[NGX_SIMD_TEST_MAXLEN * 6 + 64];
+static u_char   ngx_simd_d2[NGX_SIMD_TEST_MAXLEN * 6 + 64];
+
+static uintptr_t  ngx_simd_sink;
+
+
+int
+main(int argc, char *argv[])
+{
+    ngx_misc_init();
+
+    if (argc > 1 && ngx_strcmp(argv[1], "-b") == 0) {
+        ngx_simd_bench();
+        return 0;
+    }
+
+    /* the last page of the string is followed by an unmapped one */
+
+    ngx_simd_page = mmap(NULL, 2 * ngx_pagesize, PROT_READ|PROT_WRITE,
+                         MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (ngx_simd_page == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, ngx_errno,
+                      "mmap() failed");
+        return 1;
+    }
+
+    if (mprotect(ngx_simd_page + ngx_pagesize, ngx_pagesize, PROT_NONE)
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, ngx_errno,
+                      "mprotect() failed");
+        return 1;
+    }
+
+    if (ngx_simd_test_all("as detected") != NGX_OK) {
+        return 1;
+    }
+
+#if (NGX_HAVE_SSSE3)
+
+    if (ngx_cpu_features & NGX_CPU_SSSE3) {
+        ngx_cpu_features &= ~NGX_CPU_SSSE3;
+
+        if (ngx_simd_test_all("without SSSE3") != NGX_OK) {
+            return 1;
+        }
+    }
+
+#endif
+
+    return 0;
+}
+
+
+static ngx_int_t
+ngx_simd_test_all(char *what)
+{
+    u_char      *src;
+    size_t       len;
+    ngx_uint_t   i;
+
+    for (i = 0; i < NGX_SIMD_TEST_RUNS; i++) {
+
+        len = ngx_misc_random() % (NGX_SIMD_TEST_MAXLEN + 1);
+
+        if (i & 1) {
+            src = ngx_simd_page + ngx_pagesize - len;
+
+        } else {
+            src = ngx_simd_src + ngx_misc_random() % 32;
+        }
+
+        ngx_simd_test_fill(src, len);
+
+        if (ngx_simd_test_run(src, len, ngx_simd_s2) != NGX_OK) {
+            ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                          "simd test %s: run %ui, length %uz: \"%*s\"",
+                          what, i, len, len, src);
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, &ngx_misc_log, 0,
+                  "simd test %s: %ui runs ok", what, i);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_simd_test_fill(u_char *p, size_t len)
+{
+    char        *set;
+    ngx_uint_t   classes, raw, c;
+
+    static char  *sets[] = {
+        "abcdefghijklmnopqrstuvwxyz",
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZ",
+        "0123456789",
+        "/-._~",
+        "%?#&+= \"'<>",
+        "%2f%3F%25%41%7e%zz%0a%a%"
+    };
+
+    /* each string has its own mix of the character classes */
+
+    classes = ngx_misc_random() % 63 + 1;
+    raw = ngx_misc_random() % 4 ? 0 : ngx_misc_random() % 64 + 1;
+
+    while (len--) {
+
+        if (raw && ngx_misc_random() % raw == 0) {
+            *p++ = (u_char) ngx_misc_random();
+            continue;
+        }
+
+        do {
+            c = ngx_misc_random() % 6;
+        } while (!(classes & (1 << c)));
+
+        set = sets[c];
+
+        *p++ = set[ngx_misc_random() % ngx_strlen(set)];
+    }
+}
+
+
+static ngx_int_t
+ngx_simd_test_run(u_char *src, size_t len, u_char *s2)
+{
+    u_char      *d1, *d2, *s1, *e1, *e2;
+    size_t       n, size;
+    uintptr_t    r1, r2;
+    ngx_int_t    c1, c2;
+    ngx_uint_t   i, type;
+
+    size = sizeof(ngx_simd_d1);
+
+    /* ngx_strlow() and ngx_hash_strlow() */
+
+    ngx_memset(ngx_simd_d1, 0xa5, size);
+    ngx_memset(ngx_simd_d2, 0xa5, size);
+
+    ngx_strlow(ngx_simd_d1, src, len);
+    ngx_scalar_strlow(ngx_simd_d2, src, len);
+
+    if (ngx_memcmp(ngx_simd_d1, ngx_simd_d2, size) != 0) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0, "ngx_strlow() differs");
+        return NGX_ERROR;
+    }
+
+    ngx_memset(ngx_simd_d1, 0xa5, size);
+
+    r1 = ngx_hash_strlow(ngx_simd_d1, src, len);
+    r2 = ngx_scalar_hash_strlow(ngx_simd_d2, src, len);
+
+    if (r1 != r2 || ngx_memcmp(ngx_simd_d1, ngx_simd_d2, size) != 0) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                      "ngx_hash_strlow() differs");
+        return NGX_ERROR;
+    }
+
+    /* ngx_strncasecmp() with case changes, a difference or a NUL */
+
+    for (i = 0; i < len; i++) {
+        s2[i] = src[i];
+
+        if (ngx_misc_random() % 2
+            && (s2[i] | 0x20) >= 'a' && (s2[i] | 0x20) <= 'z')
+        {
+            s2[i] ^= 0x20;
+        }
+    }
+
+    s2[len] = '\0';
+
+    if (len && ngx_misc_random() % 2) {
+        s2[ngx_misc_random() % len] = (u_char) ngx_misc_random();
+    }
+
+    n = len ? ngx_misc_random() % (len + 1) : 0;
+
+    c1 = ngx_strncasecmp(src, s2, n);
+    c2 = ngx_scalar_strncasecmp(src, s2, n);
+
+    if (c1 != c2) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                      "ngx_strncasecmp(%uz) differs: %i, %i", n, c1, c2);
+        return NGX_ERROR;
+    }
+
+    c1 = ngx_strncasecmp(s2, src, n);
+    c2 = ngx_scalar_strncasecmp(s2, src, n);
+
+    if (c1 != c2) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                      "ngx_strncasecmp(%uz) reversed differs: %i, %i",
+                      n, c1, c2);
+        return NGX_ERROR;
+    }
+
+    /* ngx_escape_uri(), counting and escaping */
+
+    for (type = NGX_ESCAPE_URI; type <= NGX_ESCAPE_MAIL_AUTH; type++) {
+
+        r1 = ngx_escape_uri(NULL, src, len, type);
+        r2 = ngx_scalar_escape_uri(NULL, src, len, type);
+
+        if (r1 != r2) {
+            ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                          "ngx_escape_uri(NULL, %ui) differs: %uz, %uz",
+                          type, r1, r2);
+            return NGX_ERROR;
+        }
+
+        ngx_memset(ngx_simd_d1, 0xa5, size);
+        ngx_memset(ngx_simd_d2, 0xa5, size);
+
+        r1 = ngx_escape_uri(ngx_simd_d1, src, len, type)
+             - (uintptr_t) ngx_simd_d1;
+        r2 = ngx_scalar_escape_uri(ngx_simd_d2, src, len, type)
+             - (uintptr_t) ngx_simd_d2;
+
+        if (r1 != r2 || ngx_memcmp(ngx_simd_d1, ngx_simd_d2, size) != 0) {
+            ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                          "ngx_escape_uri(%ui) differs", type);
+            return NGX_ERROR;
+        }
+    }
+
+    /* ngx_escape_html(), counting and escaping */
+
+    r1 = ngx_escape_html(NULL, src, len);
+    r2 = ngx_scalar_escape_html(NULL, src, len);
+
+    if (r1 != r2) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                      "ngx_escape_html(NULL) differs: %uz, %uz", r1, r2);
+        return NGX_ERROR;
+    }
+
+    ngx_memset(ngx_simd_d1, 0xa5, size);
+    ngx_memset(ngx_simd_d2, 0xa5, size);
+
+    r1 = ngx_escape_html(ngx_simd_d1, src, len) - (uintptr_t) ngx_simd_d1;
+    r2 = ngx_scalar_escape_html(ngx_simd_d2, src, len)
+         - (uintptr_t) ngx_simd_d2;
+
+    if (r1 != r2 || ngx_memcmp(ngx_simd_d1, ngx_simd_d2, size) != 0) {
+        ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                      "ngx_escape_html() differs");
+        return NGX_ERROR;
+    }
+
+    /* ngx_unescape_uri(), to another buffer and in place */
+
+    for (type = 0; type <= NGX_UNESCAPE_REDIRECT; type++) {
+
+        ngx_memset(ngx_simd_d1, 0xa5, size);
+        ngx_memset(ngx_simd_d2, 0xa5, size);
+
+        d1 = ngx_simd_d1;
+        s1 = src;
+        ngx_unescape_uri(&d1, &s1, len, type);
+
+        d2 = ngx_simd_d2;
+        e2 = src;
+        ngx_scalar_unescape_uri(&d2, &e2, len, type);
+
+        if (d1 - ngx_simd_d1 != d2 - ngx_simd_d2 || s1 != e2
+            || ngx_memcmp(ngx_simd_d1, ngx_simd_d2, size) != 0)
+        {
+            ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                          "ngx_unescape_uri(%ui) differs", type);
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(ngx_simd_d1, src, len);
+        ngx_memcpy(ngx_simd_d2, src, len);
+
+        d1 = ngx_simd_d1;
+        s1 = ngx_simd_d1;
+        ngx_unescape_uri(&d1, &s1, len, type);
+
+        d2 = ngx_simd_d2;
+        e1 = ngx_simd_d2;
+        ngx_scalar_unescape_uri(&d2, &e1, len, type);
+
+        if (d1 - ngx_simd_d1 != d2 - ngx_simd_d2
+            || s1 - ngx_simd_d1 != e1 - ngx_simd_d2
+            || ngx_memcmp(ngx_simd_d1, ngx_simd_d2, size) != 0)
+        {
+            ngx_log_error(NGX_LOG_EMERG, &ngx_misc_log, 0,
+                          "ngx_unescape_uri(%ui) in place differs", type);
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_simd_bench(void)
+{
+    u_char      *d, *s;
+    size_t       len;
+    uint64_t     start;
+    ngx_uint_t   i;
+
+    static u_char  uri[] =
+        "/catalog/Electronics/Audio%20Equipment/Headphones/"
+        "Over-Ear?color=Black&size=Large&sort=price_asc&page=2"
+        "&utm_source=News%2Bletter";
+
+    len = sizeof(uri) - 1;
+
+    ngx_log_error(NGX_LOG_NOTICE, &ngx_misc_log, 0,
+                  "simd bench: %uz-byte URI, scalar and vectorized", len);
+
+#define ngx_simd_bench_run(name, code)                                        \
+    start = ngx_misc_nsec();                                                  \
+    for (i = 0; i < NGX_SIMD_BENCH_RUNS; i++) {                               \
+        code;                                                                 \
+        __asm__ volatile ("" ::: "memory");                                   \
+    }                                                                         \
+    ngx_misc_report(name, NGX_SIMD_BENCH_RUNS, start)
+
+    ngx_simd_bench_run("strlow scalar",
+        ngx_scalar_strlow(ngx_simd_d1, uri, len));
+    ngx_simd_bench_run("strlow",
+        ngx_strlow(ngx_simd_d1, uri, len));
+
+    ngx_memcpy(ngx_simd_s2, uri, len + 1);
+
+    ngx_simd_bench_run("strncasecmp scalar",
+        ngx_simd_sink += ngx_scalar_strncasecmp(uri, ngx_simd_s2, len));
+    ngx_simd_bench_run("strncasecmp",
+        ngx_simd_sink += ngx_strncasecmp(uri, ngx_simd_s2, len));
+
+    ngx_simd_bench_run("hash_strlow scalar",
+        ngx_simd_sink += ngx_scalar_hash_strlow(ngx_simd_d1, uri, len));
+    ngx_simd_bench_run("hash_strlow",
+        ngx_simd_sink += ngx_hash_strlow(ngx_simd_d1, uri, len));
+
+    ngx_simd_bench_run("escape_uri scalar",
+        ngx_simd_sink += ngx_scalar_escape_uri(ngx_simd_d1, uri, len,
+                                               NGX_ESCAPE_ARGS));
+    ngx_simd_bench_run("escape_uri",
+        ngx_simd_sink += ngx_escape_uri(ngx_simd_d1, uri, len,
+                                        NGX_ESCAPE_ARGS));
+
+    ngx_simd_bench_run("unescape_uri scalar",
+        d = ngx_simd_d1; s = uri;
+        ngx_scalar_unescape_uri(&d, &s, len, 0));
+    ngx_simd_bench_run("unescape_uri",
+        d = ngx_simd_d1; s = uri;
+        ngx_unescape_uri(&d, &s, len, 0));
+
+    ngx_simd_bench_run("escape_html scalar",
+        ngx_simd_sink += ngx_scalar_escape_html(ngx_simd_d1, uri, len));
+    ngx_simd_bench_run("escape_html",
+        ngx_simd_sink += ngx_escape_html(ngx_simd_d1, uri, len));
+
+#undef ngx_simd_bench_run
+}
+
+
+/* the scalar versions, as they were before the vectorization */
+
+
+static void
+ngx_scalar_strlow(u_char *dst, u_char *src, size_t n)
+{
+    while (n) {
+        *dst = ngx_tolower(*src);
+        dst++;
+        src++;
+        n--;
+    }
+}
+
+
+static ngx_int_t
+ngx_scalar_strncasecmp(u_char *s1, u_char *s2, size_t n)
+{
+    ngx_uint_t  c1, c2;
+
+    while (n) {
+        c1 = (ngx_uint_t) *s1++;
+        c2 = (ngx_uint_t) *s2++;
+
+        c1 = (c1 >= 'A' && c1 <= 'Z') ? (c1 | 0x20) : c1;
+        c2 = (c2 >= 'A' && c2 <= 'Z') ? (c2 | 0x20) : c2;
+
+        if (c1 == c2) {
+
+            if (c1) {
+                n--;
+                continue;
+            }
+
+            return 0;
+        }
+
+        return c1 - c2;
+    }
+
+    return 0;
+}
+
+
+static ngx_uint_t
+ngx_scalar_hash_strlow(u_char *dst, u_char *src, size_t n)
+{
+    ngx_uint_t  key;
+
+    key = 0;
+
+    while (n--) {
+        *dst = ngx_tolower(*src);
+        key = ngx_hash(key, *dst);
+        dst++;
+        src++;
+    }
+
+    return key;
+}
+
+
+static uintptr_t
+ngx_scalar_escape_uri(u_char *dst, u_char *src, size_t size,
+    ngx_uint_t type)
+{
+    ngx_uint_t      n;
+    uint32_t       *escape;
+    static u_char   hex[] = "0123456789abcdef";
+
+                    /* " ", "#", "%", "?", %00-%1F, %7F-%FF */
+
+    static uint32_t   uri[] = {
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+
+                    /* ?>=< ;:98 7654 3210  /.-, +*)( '&%$ #"!  */
+        0x80000029, /* 1000 0000 0000 0000  0000 0000 0010 1001 */
+
+                    /* _^]\ [ZYX WVUT SRQP  ONML KJIH GFED CBA@ */
+        0x00000000, /* 0000 0000 0000 0000  0000 0000 0000 0000 */
+
+                    /*  ~}| {zyx wvut srqp  onml kjih gfed cba` */
+        0x80000000, /* 1000 0000 0000 0000  0000 0000 0000 0000 */
+
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+        0xffffffff  /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+    };
+
+                    /* " ", "#", "%", "&", "+", "?", %00-%1F, %7F-%FF */
+
+    static uint32_t   args[] = {
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+
+                    /* ?>=< ;:98 7654 3210  /.-, +*)( '&%$ #"!  */
+        0x88000869, /* 1000 1000 0000 0000  0000 1000 0110 1001 */
+
+                    /* _^]\ [ZYX WVUT SRQP  ONML KJIH GFED CBA@ */
+        0x00000000, /* 0000 0000 0000 0000  0000 0000 0000 0000 */
+
+                    /*  ~}| {zyx wvut srqp  onml kjih gfed cba` */
+        0x80000000, /* 1000 0000 0000 0000  0000 0000 0000 0000 */
+
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+        0xffffffff  /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+    };
+
+                    /* not ALPHA, DIGIT, "-", ".", "_", "~" */
+
+    static uint32_t   uri_component[] = {
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+
+                    /* ?>=< ;:98 7654 3210  /.-, +*)( '&%$ #"!  */
+        0xfc009fff, /* 1111 1100 0000 0000  1001 1111 1111 1111 */
+
+                    /* _^]\ [ZYX WVUT SRQP  ONML KJIH GFED CBA@ */
+        0x78000001, /* 0111 1000 0000 0000  0000 0000 0000 0001 */
+
+                    /*  ~}| {zyx wvut srqp  onml kjih gfed cba` */
+        0xb8000001, /* 1011 1000 0000 0000  0000 0000 0000 0001 */
+
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+        0xffffffff  /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+    };
+
+                    /* " ", "#", """, "%", "'", %00-%1F, %7F-%FF */
+
+    static uint32_t   html[] = {
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+
+                    /* ?>=< ;:98 7654 3210  /.-, +*)( '&%$ #"!  */
+        0x000000ad, /* 0000 0000 0000 0000  0000 0000 1010 1101 */
+
+                    /* _^]\ [ZYX WVUT SRQP  ONML KJIH GFED CBA@ */
+        0x00000000, /* 0000 0000 0000 0000  0000 0000 0000 0000 */
+
+                    /*  ~}| {zyx wvut srqp  onml kjih gfed cba` */
+        0x80000000, /* 1000 0000 0000 0000  0000 0000 0000 0000 */
+
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+        0xffffffff  /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+    };
+
+                    /* " ", """, "%", "'", %00-%1F, %7F-%FF */
+
+    static uint32_t   refresh[] = {
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+
+                    /* ?>=< ;:98 7654 3210  /.-, +*)( '&%$ #"!  */
+        0x00000085, /* 0000 0000 0000 0000  0000 0000 1000 0101 */
+
+                    /* _^]\ [ZYX WVUT SRQP  ONML KJIH GFED CBA@ */
+        0x00000000, /* 0000 0000 0000 0000  0000 0000 0000 0000 */
+
+                    /*  ~}| {zyx wvut srqp  onml kjih gfed cba` */
+        0x80000000, /* 1000 0000 0000 0000  0000 0000 0000 0000 */
+
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+        0xffffffff  /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+    };
+
+                    /* " ", "%", %00-%1F */
+
+    static uint32_t   memcached[] = {
+        0xffffffff, /* 1111 1111 1111 1111  1111 1111 1111 1111 */
+
+                    /* ?>=< ;:98 7654 3210  /.-, +*)( '&%$ #"!  */
+        0x00000021, /* 0000 0000 0000 0000  0000 0000 0010 0001 */
+
+                    /* _^]\ [ZYX WVUT SRQP  ONML KJIH GFED CBA@ */
+        0x00000000, /* 0000 0000 0000 0000  0000 0000 0000 0000 */
+
+                    /*  ~}| {zyx wvut srqp  onml kjih gfed cba` */
+        0x00000000, /* 0000 0000 0000 0000  0000 0000 0000 0000 */
+
+        0x00000000, /* 0000 0000 0000 0000  0000 0000 0000 0000 */
+        0x00000000, /* 0000 0000 0000 0000  0000 0000 0000 0000 */
+        0x00000000, /* 0000 0000 0000 0000  0000 0000 0000 0000 */
+        0x00000000, /* 0000 0000 0000 0000  0000 0000 0000 0000 */
+    };
+
+                    /* mail_auth is the same as memcached */
+
+    static uint32_t  *map[] =
+        { uri, args, uri_component, html, refresh, memcached, memcached };
+
+
+    escape = map[type];
+
+    if (dst == NULL) {
+
+        /* find the number of the characters to be escaped */
+
+        n = 0;
+
+        while (size) {
+            if (escape[*src >> 5] & (1 << (*src & 0x1f))) {
+                n++;
+            }
+            src++;
+            size--;
+        }
+
+        return (uintptr_t) n;
+    }
+
+    while (size) {
+        if (escape[*src >> 5] & (1 << (*src & 0x1f))) {
+            *dst++ = '%';
+            *dst++ = hex[*src >> 4];
+            *dst++ = hex[*src & 0xf];
+            src++;
+
+        } else {
+            *dst++ = *src++;
+        }
+        size--;
+    }
+
+    return (uintptr_t) dst;
+}
+
+
+static void
+ngx_scalar_unescape_uri(u_char **dst, u_char **src, size_t size,
+    ngx_uint_t type)
+{
+    u_char  *d, *s, ch, c, decoded;
+    enum {
+        sw_usual = 0,
+        sw_quoted,
+        sw_quoted_second
+    } state;
+
+    d = *dst;
+    s = *src;
+
+    state = 0;
+    decoded = 0;
+
+    while (size--) {
+
+        ch = *s++;
+
+        switch (state) {
+        case sw_usual:
+            if (ch == '?'
+                && (type & (NGX_UNESCAPE_URI|NGX_UNESCAPE_REDIRECT)))
+            {
+                *d++ = ch;
+                goto done;
+            }
+
+            if (ch == '%') {
+                state = sw_quoted;
+                break;
+            }
+
+            *d++ = ch;
+            break;
+
+        case sw_quoted:
+
+            if (ch >= '0' && ch <= '9') {
+                decoded = (u_char) (ch - '0');
+                state = sw_quoted_second;
+                break;
+            }
+
+            c = (u_char) (ch | 0x20);
+            if (c >= 'a' && c <= 'f') {
+                decoded = (u_char) (c - 'a' + 10);
+                state = sw_quoted_second;
+                break;
+            }
+
+            /* the invalid quoted character */
+
+            state = sw_usual;
+
+            *d++ = ch;
+
+            break;
+
+        case sw_quoted_second:
+
+            state = sw_usual;
+
+            if (ch >= '0' && ch <= '9') {
+                ch = (u_char) ((decoded << 4) + ch - '0');
+
+                if (type & NGX_UNESCAPE_REDIRECT) {
+                    if (ch > '%' && ch < 0x7f) {
+                        *d++ = ch;
+                        break;
+                    }
+
+                    *d++ = '%'; *d++ = *(s - 2); *d++ = *(s - 1);
+
+                    break;
+                }
+
+                *d++ = ch;
+
+                break;
+            }
+
+            c = (u_char) (ch | 0x20);
+            if (c >= 'a' && c <= 'f') {
+                ch = (u_char) ((decoded << 4) + c - 'a' + 10);
+
+                if (type & NGX_UNESCAPE_URI) {
+                    if (ch == '?') {
+                        *d++ = ch;
+                        goto done;
+                    }
+
+                    *d++ = ch;
+                    break;
+                }
+
+                if (type & NGX_UNESCAPE_REDIRECT) {
+                    if (ch == '?') {
+                        *d++ = ch;
+                        goto done;
+                    }
+
+                    if (ch > '%' && ch < 0x7f) {
+                        *d++ = ch;
+                        break;
+                    }
+
+                    *d++ = '%'; *d++ = *(s - 2); *d++ = *(s - 1);
+                    break;
+                }
+
+                *d++ = ch;
+
+                break;
+            }
+
+            /* the invalid quoted character */
+
+            break;
+        }
+    }
+
+done:
+
+    *dst = d;
+    *src = s;
+}
+
+
+static uintptr_t
+ngx_scalar_escape_html(u_char *dst, u_char *src, size_t size)
+{
+    u_char      ch;
+    ngx_uint_t  len;
+
+    if (dst == NULL) {
+
+        len = 0;
+
+        while (size) {
+            switch (*src++) {
+
+            case '<':
+                len += sizeof("&lt;") - 2;
+                break;
+
+            case '>':
+                len += sizeof("&gt;") - 2;
+                break;
+
+            case '&':
+                len += sizeof("&amp;") - 2;
+                break;
+
+            case '"':
+                len += sizeof("&quot;") - 2;
+                break;
+
+            default:
+                break;
+            }
+            size--;
+        }
+
+        return (uintptr_t) len;
+    }
+
+    while (size) {
+        ch = *src++;
+
+        switch (ch) {
+
+        case '<':
+            *dst++ = '&'; *dst++ = 'l'; *dst++ = 't'; *dst++ = ';';
+            break;
+
+        case '>':
+            *dst++ = '&'; *dst++ = 'g'; *dst++ = 't'; *dst++ = ';';
+            break;
+
+        case '&':
+            *dst++ = '&'; *dst++ = 'a'; *dst++ = 'm'; *dst++ = 'p';
+            *dst++ = ';';
+            break;
+
+        case '"':
+            *dst++ = '&'; *dst++ = 'q'; *dst++ = 'u'; *dst++ = 'o';
+            *dst++ = 't'; *dst++ = ';';
+            break;
+
+        default:
+            *dst++ = ch;
+            break;
+        }
+        size--;
+    }
+
+    return (uintptr_t) dst;
+}
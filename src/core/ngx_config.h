@@ -44,6 +44,19 @@
 #endif
 
 
+#if (NGX_HAVE_SSE2)
+#include <emmintrin.h>
+#endif
+
+#if (NGX_HAVE_SSSE3)
+#include <tmmintrin.h>
+#endif
+
+#if (NGX_HAVE_AVX2)
+#include <immintrin.h>
+#endif
+
+
 #ifndef NGX_HAVE_SO_SNDLOWAT
 #define NGX_HAVE_SO_SNDLOWAT     1
 #endif
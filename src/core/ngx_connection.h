@@ -61,6 +61,8 @@ struct ngx_listening_s {
 		/* 当前监听句柄对应的ngx_connection_t结构体 */
     ngx_connection_t   *connection;
 
+    ngx_uint_t          worker;
+
 		/* 为1时表示当前监听句柄有效，且执行ngx_init_cycle时不关闭监听端口，为0时则正常关闭
 		 * 该标志为框架代码会自动设置 */
     unsigned            open:1;
@@ -86,6 +88,8 @@ struct ngx_listening_s {
 #if (NGX_HAVE_INET6 && defined IPV6_V6ONLY)
     unsigned            ipv6only:1;
 #endif
+    unsigned            reuseport:1;
+    unsigned            add_reuseport:1;
     unsigned            keepalive:2;
 
 #if (NGX_HAVE_DEFERRED_ACCEPT)
@@ -128,6 +132,7 @@ typedef enum {
 
 #define NGX_LOWLEVEL_BUFFERED  0x0f
 #define NGX_SSL_BUFFERED       0x01
+#define NGX_IO_URING_BUFFERED  0x02
 
 
 struct ngx_connection_s {
@@ -225,6 +230,7 @@ struct ngx_connection_s {
 
 ngx_listening_t *ngx_create_listening(ngx_conf_t *cf, void *sockaddr,
     socklen_t socklen);
+ngx_int_t ngx_clone_listening(ngx_conf_t *cf, ngx_listening_t *ls);
 ngx_int_t ngx_set_inherited_sockets(ngx_cycle_t *cycle);
 ngx_int_t ngx_open_listening_sockets(ngx_cycle_t *cycle);
 void ngx_configure_listening_sockets(ngx_cycle_t *cycle);
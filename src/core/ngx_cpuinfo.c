@@ -9,10 +9,14 @@
 #include <ngx_core.h>
 
 
+ngx_uint_t  ngx_cpu_features;
+
+
 #if (( __i386__ || __amd64__ ) && ( __GNUC__ || __INTEL_COMPILER ))
 
 
 static ngx_inline void ngx_cpuid(uint32_t i, uint32_t *buf);
+static ngx_inline uint32_t ngx_xgetbv(void);
 
 
 #if ( __i386__ )
@@ -31,6 +35,7 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 
     "    mov    %%ebx, %%esi;  "
 
+    "    xor    %%ecx, %%ecx;  "
     "    cpuid;                "
     "    mov    %%eax, (%1);   "
     "    mov    %%ebx, 4(%1);  "
@@ -55,7 +60,7 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 
         "cpuid"
 
-    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (i) );
+    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (i), "c" (0) );
 
     buf[0] = eax;
     buf[1] = ebx;
@@ -67,6 +72,23 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 #endif
 
 
+static ngx_inline uint32_t
+ngx_xgetbv(void)
+{
+    uint32_t  eax, edx;
+
+    /* the "xgetbv" instruction, old assemblers do not know it */
+
+    __asm__ (
+
+        ".byte 0x0f, 0x01, 0xd0"
+
+    : "=a" (eax), "=d" (edx) : "c" (0) );
+
+    return eax;
+}
+
+
 /* auto detect the L2 cache line size of modern and widespread CPUs */
 
 void
@@ -125,6 +147,27 @@ ngx_cpuinfo(void)
     } else if (ngx_strcmp(vendor, "AuthenticAMD") == 0) {
         ngx_cacheline_size = 64;
     }
+
+    if (cpu[3] & 0x200) {
+        ngx_cpu_features |= NGX_CPU_SSSE3;
+    }
+
+    /*
+     * AVX2 requires the AVX and OSXSAVE bits, the OS support
+     * of the YMM state, and the bit 5 of the leaf 7 %ebx
+     */
+
+    if ((cpu[3] & 0x18000000) != 0x18000000 || (ngx_xgetbv() & 6) != 6) {
+        return;
+    }
+
+    if (vbuf[0] >= 7) {
+        ngx_cpuid(7, cpu);
+
+        if (cpu[1] & 0x20) {
+            ngx_cpu_features |= NGX_CPU_AVX2;
+        }
+    }
 }
 
 #else
@@ -634,9 +634,29 @@ ngx_uint_t
 ngx_hash_strlow(u_char *dst, u_char *src, size_t n)
 {
     ngx_uint_t  key;
+#if (NGX_HAVE_SSE2)
+    ngx_uint_t  i;
+#endif
 
     key = 0;
 
+#if (NGX_HAVE_SSE2)
+
+    while (n >= 16) {
+        _mm_storeu_si128((__m128i *) dst,
+                         ngx_tolower_sse2(_mm_loadu_si128((__m128i *) src)));
+
+        for (i = 0; i < 16; i++) {
+            key = ngx_hash(key, dst[i]);
+        }
+
+        dst += 16;
+        src += 16;
+        n -= 16;
+    }
+
+#endif
+
     while (n--) {
         *dst = ngx_tolower(*src);
         key = ngx_hash(key, *dst);
@@ -48,6 +48,37 @@ typedef struct {
 } ngx_resolver_an_t;
 
 
+typedef struct {
+    ngx_rbtree_t              rbtree;
+    ngx_rbtree_node_t         sentinel;
+    ngx_queue_t               queue;
+} ngx_resolver_cache_sh_t;
+
+
+typedef struct {
+    ngx_resolver_cache_sh_t  *sh;
+    ngx_slab_pool_t          *shpool;
+} ngx_resolver_cache_t;
+
+
+typedef struct {
+    ngx_str_node_t            sn;
+    ngx_queue_t               queue;
+
+    time_t                    valid;
+    time_t                    prefetch;
+    uint32_t                  ttl;
+
+    u_short                   naddrs;
+    u_short                   naddrs6;
+    u_short                   cnlen;
+    u_char                    ipv6;
+
+    /* addresses, IPv6 addresses, name, canonical name */
+    u_char                    data[1];
+} ngx_resolver_cache_node_t;
+
+
 ngx_int_t ngx_udp_connect(ngx_udp_connection_t *uc);
 
 
@@ -55,12 +86,20 @@ static void ngx_resolver_cleanup(void *data);
 static void ngx_resolver_cleanup_tree(ngx_resolver_t *r, ngx_rbtree_t *tree);
 static ngx_int_t ngx_resolve_name_locked(ngx_resolver_t *r,
     ngx_resolver_ctx_t *ctx);
+static ngx_int_t ngx_resolver_found(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn, ngx_resolver_ctx_t *ctx, ngx_uint_t rotate);
+static ngx_int_t ngx_resolver_resolve_srv_names(ngx_resolver_t *r,
+    ngx_resolver_ctx_t *ctx, ngx_resolver_node_t *rn);
+static void ngx_resolver_srv_names_handler(ngx_resolver_ctx_t *cctx);
+static void ngx_resolver_report_srv(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx);
+static void ngx_resolver_prefetch(ngx_resolver_t *r, ngx_resolver_node_t *rn,
+    ngx_int_t type);
 static void ngx_resolver_expire(ngx_resolver_t *r, ngx_rbtree_t *tree,
     ngx_queue_t *queue);
 static ngx_int_t ngx_resolver_send_query(ngx_resolver_t *r,
     ngx_resolver_node_t *rn);
-static ngx_int_t ngx_resolver_create_name_query(ngx_resolver_node_t *rn,
-    ngx_resolver_ctx_t *ctx);
+static ngx_int_t ngx_resolver_create_name_query(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn, ngx_str_t *name, ngx_int_t type);
 static ngx_int_t ngx_resolver_create_addr_query(ngx_resolver_node_t *rn,
     ngx_resolver_ctx_t *ctx);
 static void ngx_resolver_resend_handler(ngx_event_t *ev);
@@ -70,11 +109,17 @@ static void ngx_resolver_read_response(ngx_event_t *rev);
 static void ngx_resolver_process_response(ngx_resolver_t *r, u_char *buf,
     size_t n);
 static void ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
-    ngx_uint_t ident, ngx_uint_t code, ngx_uint_t nan, ngx_uint_t ans);
+    ngx_uint_t ident, ngx_uint_t code, ngx_uint_t qtype, ngx_uint_t nan,
+    ngx_uint_t ans);
+static void ngx_resolver_complete_name(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
+static void ngx_resolver_process_srv(ngx_resolver_t *r, u_char *buf,
+    size_t n, ngx_uint_t ident, ngx_uint_t code, ngx_uint_t nan,
+    ngx_uint_t ans);
 static void ngx_resolver_process_ptr(ngx_resolver_t *r, u_char *buf, size_t n,
     ngx_uint_t ident, ngx_uint_t code, ngx_uint_t nan);
 static ngx_resolver_node_t *ngx_resolver_lookup_name(ngx_resolver_t *r,
-    ngx_str_t *name, uint32_t hash);
+    ngx_rbtree_t *tree, ngx_str_t *name, uint32_t hash);
 static ngx_resolver_node_t *ngx_resolver_lookup_addr(ngx_resolver_t *r,
     in_addr_t addr);
 static void ngx_resolver_rbtree_insert_value(ngx_rbtree_node_t *temp,
@@ -82,13 +127,24 @@ static void ngx_resolver_rbtree_insert_value(ngx_rbtree_node_t *temp,
 static ngx_int_t ngx_resolver_copy(ngx_resolver_t *r, ngx_str_t *name,
     u_char *buf, u_char *src, u_char *last);
 static void ngx_resolver_timeout_handler(ngx_event_t *ev);
+static void ngx_resolver_free_answer(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
 static void ngx_resolver_free_node(ngx_resolver_t *r, ngx_resolver_node_t *rn);
 static void *ngx_resolver_alloc(ngx_resolver_t *r, size_t size);
 static void *ngx_resolver_calloc(ngx_resolver_t *r, size_t size);
 static void ngx_resolver_free(ngx_resolver_t *r, void *p);
 static void ngx_resolver_free_locked(ngx_resolver_t *r, void *p);
 static void *ngx_resolver_dup(ngx_resolver_t *r, void *src, size_t size);
-static in_addr_t *ngx_resolver_rotate(ngx_resolver_t *r, in_addr_t *src,
+static ngx_addr_t *ngx_resolver_export(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn, ngx_uint_t rotate);
+static ngx_int_t ngx_resolver_init_zone(ngx_shm_zone_t *shm_zone, void *data);
+static ngx_int_t ngx_resolver_cache_lookup(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn, ngx_uint_t prefetch);
+static ngx_int_t ngx_resolver_cache_copy(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn, ngx_resolver_cache_node_t *cn);
+static void ngx_resolver_cache_store(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
+static void ngx_resolver_cache_expire(ngx_resolver_cache_t *cache,
     ngx_uint_t n);
 static u_char *ngx_resolver_log_error(ngx_log_t *log, u_char *buf, size_t len);
 
@@ -96,12 +152,15 @@ static u_char *ngx_resolver_log_error(ngx_log_t *log, u_char *buf, size_t len);
 ngx_resolver_t *
 ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
 {
-    ngx_str_t              s;
+    u_char                *p;
+    ssize_t                size;
+    ngx_str_t              s, name;
     ngx_url_t              u;
     ngx_uint_t             i, j;
     ngx_resolver_t        *r;
     ngx_pool_cleanup_t    *cln;
     ngx_udp_connection_t  *uc;
+    ngx_resolver_cache_t  *cache;
 
     cln = ngx_pool_cleanup_add(cf->pool, 0);
     if (cln == NULL) {
@@ -125,15 +184,24 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
     ngx_rbtree_init(&r->name_rbtree, &r->name_sentinel,
                     ngx_resolver_rbtree_insert_value);
 
+    ngx_rbtree_init(&r->srv_rbtree, &r->srv_sentinel,
+                    ngx_resolver_rbtree_insert_value);
+
     ngx_rbtree_init(&r->addr_rbtree, &r->addr_sentinel,
                     ngx_rbtree_insert_value);
 
     ngx_queue_init(&r->name_resend_queue);
+    ngx_queue_init(&r->srv_resend_queue);
     ngx_queue_init(&r->addr_resend_queue);
 
     ngx_queue_init(&r->name_expire_queue);
+    ngx_queue_init(&r->srv_expire_queue);
     ngx_queue_init(&r->addr_expire_queue);
 
+#if (NGX_HAVE_INET6)
+    r->ipv6 = 1;
+#endif
+
     r->event->handler = ngx_resolver_resend_handler;
     r->event->data = r;
     r->event->log = &cf->cycle->new_log;
@@ -171,6 +239,75 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
             continue;
         }
 
+#if (NGX_HAVE_INET6)
+        if (ngx_strncmp(names[i].data, "ipv6=", 5) == 0) {
+
+            if (ngx_strcmp(&names[i].data[5], "on") == 0) {
+                r->ipv6 = 1;
+
+            } else if (ngx_strcmp(&names[i].data[5], "off") == 0) {
+                r->ipv6 = 0;
+
+            } else {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid parameter: %V", &names[i]);
+                return NULL;
+            }
+
+            continue;
+        }
+#endif
+
+        if (ngx_strncmp(names[i].data, "zone=", 5) == 0) {
+
+            name.data = names[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &names[i]);
+                return NULL;
+            }
+
+            name.len = p - name.data;
+
+            s.data = p + 1;
+            s.len = names[i].data + names[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &names[i]);
+                return NULL;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &names[i]);
+                return NULL;
+            }
+
+            r->shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                                &ngx_core_module);
+            if (r->shm_zone == NULL) {
+                return NULL;
+            }
+
+            if (r->shm_zone->data == NULL) {
+                cache = ngx_pcalloc(cf->pool, sizeof(ngx_resolver_cache_t));
+                if (cache == NULL) {
+                    return NULL;
+                }
+
+                r->shm_zone->init = ngx_resolver_init_zone;
+                r->shm_zone->data = cache;
+            }
+
+            continue;
+        }
+
         ngx_memzero(&u, sizeof(ngx_url_t));
 
         u.url = names[i];
@@ -218,6 +355,8 @@ ngx_resolver_cleanup(void *data)
 
         ngx_resolver_cleanup_tree(r, &r->name_rbtree);
 
+        ngx_resolver_cleanup_tree(r, &r->srv_rbtree);
+
         ngx_resolver_cleanup_tree(r, &r->addr_rbtree);
 
         if (r->event) {
@@ -281,7 +420,11 @@ ngx_resolve_start(ngx_resolver_t *r, ngx_resolver_ctx_t *temp)
             temp->state = NGX_OK;
             temp->naddrs = 1;
             temp->addrs = &temp->addr;
-            temp->addr = addr;
+            temp->addr.sockaddr = (struct sockaddr *) &temp->sin;
+            temp->addr.socklen = sizeof(struct sockaddr_in);
+            ngx_memzero(&temp->sin, sizeof(struct sockaddr_in));
+            temp->sin.sin_family = AF_INET;
+            temp->sin.sin_addr.s_addr = addr;
             temp->quick = 1;
 
             return temp;
@@ -348,6 +491,9 @@ void
 ngx_resolve_name_done(ngx_resolver_ctx_t *ctx)
 {
     uint32_t              hash;
+    ngx_uint_t            i;
+    ngx_queue_t          *queue;
+    ngx_rbtree_t         *tree;
     ngx_resolver_t       *r;
     ngx_resolver_ctx_t   *w, **p;
     ngx_resolver_node_t  *rn;
@@ -365,13 +511,44 @@ ngx_resolve_name_done(ngx_resolver_ctx_t *ctx)
         ngx_del_timer(ctx->event);
     }
 
+    if (ctx->type == NGX_RESOLVE_SRV) {
+        tree = &r->srv_rbtree;
+        queue = &r->srv_expire_queue;
+
+    } else {
+        tree = &r->name_rbtree;
+        queue = &r->name_expire_queue;
+    }
+
     /* lock name mutex */
 
+    if (ctx->srvs) {
+
+        /* the SRV answer is received, the names may be still resolved */
+
+        for (i = 0; i < ctx->nsrvs; i++) {
+            if (ctx->srvs[i].ctx) {
+                ngx_resolve_name_done(ctx->srvs[i].ctx);
+            }
+
+            if (ctx->srvs[i].addrs) {
+                ngx_resolver_free(r, ctx->srvs[i].addrs->sockaddr);
+                ngx_resolver_free(r, ctx->srvs[i].addrs);
+            }
+
+            ngx_resolver_free(r, ctx->srvs[i].name.data);
+        }
+
+        ngx_resolver_free(r, ctx->srvs);
+
+        goto done;
+    }
+
     if (ctx->state == NGX_AGAIN || ctx->state == NGX_RESOLVE_TIMEDOUT) {
 
         hash = ngx_crc32_short(ctx->name.data, ctx->name.len);
 
-        rn = ngx_resolver_lookup_name(r, &ctx->name, hash);
+        rn = ngx_resolver_lookup_name(r, tree, &ctx->name, hash);
 
         if (rn) {
             p = &rn->waiting;
@@ -395,7 +572,7 @@ ngx_resolve_name_done(ngx_resolver_ctx_t *ctx)
 
 done:
 
-    ngx_resolver_expire(r, &r->name_rbtree, &r->name_expire_queue);
+    ngx_resolver_expire(r, tree, queue);
 
     /* unlock name mutex */
 
@@ -411,96 +588,99 @@ done:
 }
 
 
-/* NGX_RESOLVE_A only */
+/* NGX_RESOLVE_A (with NGX_RESOLVE_AAAA) and NGX_RESOLVE_SRV */
 
 static ngx_int_t
 ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx)
 {
     uint32_t              hash;
-    in_addr_t             addr, *addrs;
     ngx_int_t             rc;
     ngx_uint_t            naddrs;
-    ngx_resolver_ctx_t   *next;
+    ngx_queue_t          *resend_queue, *expire_queue;
+    ngx_rbtree_t         *tree;
+    ngx_resolver_ctx_t   *next, *last;
     ngx_resolver_node_t  *rn;
 
-    hash = ngx_crc32_short(ctx->name.data, ctx->name.len);
-
-    rn = ngx_resolver_lookup_name(r, &ctx->name, hash);
-
-    if (rn) {
+    if (ctx->type == NGX_RESOLVE_SRV) {
+        tree = &r->srv_rbtree;
+        resend_queue = &r->srv_resend_queue;
+        expire_queue = &r->srv_expire_queue;
 
-        if (rn->valid >= ngx_time()) {
+    } else {
+        tree = &r->name_rbtree;
+        resend_queue = &r->name_resend_queue;
+        expire_queue = &r->name_expire_queue;
+    }
 
-            ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0, "resolve cached");
+    /* ctx may be a list of contexts waiting for the same name */
 
-            ngx_queue_remove(&rn->queue);
+    for (last = ctx; last->next; last = last->next) { /* void */ }
 
-            rn->expire = ngx_time() + r->expire;
+    hash = ngx_crc32_short(ctx->name.data, ctx->name.len);
 
-            ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
+    rn = ngx_resolver_lookup_name(r, tree, &ctx->name, hash);
 
-            naddrs = rn->naddrs;
+    if (rn == NULL) {
 
-            if (naddrs) {
+        rn = ngx_resolver_calloc(r, sizeof(ngx_resolver_node_t));
+        if (rn == NULL) {
+            return NGX_ERROR;
+        }
 
-                /* NGX_RESOLVE_A answer */
+        rn->name = ngx_resolver_dup(r, ctx->name.data, ctx->name.len);
+        if (rn->name == NULL) {
+            ngx_resolver_free(r, rn);
+            return NGX_ERROR;
+        }
 
-                if (naddrs != 1) {
-                    addr = 0;
-                    addrs = ngx_resolver_rotate(r, rn->u.addrs, naddrs);
-                    if (addrs == NULL) {
-                        return NGX_ERROR;
-                    }
+        rn->node.key = hash;
+        rn->nlen = (u_short) ctx->name.len;
 
-                } else {
-                    addr = rn->u.addr;
-                    addrs = NULL;
-                }
+        ngx_queue_init(&rn->queue);
 
-                ctx->next = rn->waiting;
-                rn->waiting = NULL;
+        ngx_rbtree_insert(tree, &rn->node);
+    }
 
-                /* unlock name mutex */
+    if (rn->valid < ngx_time()
+        && rn->waiting == NULL
+        && r->shm_zone
+        && ctx->type != NGX_RESOLVE_SRV)
+    {
+        /* the answer may be received by another worker process */
 
-                do {
-                    ctx->state = NGX_OK;
-                    ctx->naddrs = naddrs;
-                    ctx->addrs = (naddrs == 1) ? &ctx->addr : addrs;
-                    ctx->addr = addr;
-                    next = ctx->next;
+        (void) ngx_resolver_cache_lookup(r, rn, 0);
+    }
 
-                    ctx->handler(ctx);
+    if (rn->valid >= ngx_time()) {
 
-                    ctx = next;
-                } while (ctx);
+        ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0, "resolve cached");
 
-                if (addrs) {
-                    ngx_resolver_free(r, addrs);
-                }
+        /* the node being refreshed is kept in the resend queue */
 
-                return NGX_OK;
-            }
+        if (!rn->prefetch) {
+            ngx_queue_remove(&rn->queue);
 
-            /* NGX_RESOLVE_CNAME */
+            rn->expire = ngx_time() + r->expire;
 
-            if (ctx->recursion++ < NGX_RESOLVER_MAX_RECURSION) {
+            ngx_queue_insert_head(expire_queue, &rn->queue);
 
-                ctx->name.len = rn->cnlen;
-                ctx->name.data = rn->u.cname;
+            ngx_resolver_prefetch(r, rn, ctx->type);
+        }
 
-                return ngx_resolve_name_locked(r, ctx);
-            }
+        last->next = rn->waiting;
+        rn->waiting = NULL;
 
-            ctx->next = rn->waiting;
-            rn->waiting = NULL;
+        if (ctx->type == NGX_RESOLVE_SRV) {
 
             /* unlock name mutex */
 
             do {
-                ctx->state = NGX_RESOLVE_NXDOMAIN;
                 next = ctx->next;
 
-                ctx->handler(ctx);
+                if (ngx_resolver_resolve_srv_names(r, ctx, rn) != NGX_OK) {
+                    ctx->state = NGX_ERROR;
+                    ctx->handler(ctx);
+                }
 
                 ctx = next;
             } while (ctx);
@@ -508,69 +688,78 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx)
             return NGX_OK;
         }
 
-        if (rn->waiting) {
+        naddrs = rn->naddrs;
+#if (NGX_HAVE_INET6)
+        naddrs += rn->naddrs6;
+#endif
 
-            ctx->next = rn->waiting;
-            rn->waiting = ctx;
-            ctx->state = NGX_AGAIN;
+        if (naddrs) {
 
-            return NGX_AGAIN;
+            /* NGX_RESOLVE_A and NGX_RESOLVE_AAAA answers */
+
+            return ngx_resolver_found(r, rn, ctx, 1);
         }
 
-        ngx_queue_remove(&rn->queue);
+        /* NGX_RESOLVE_CNAME */
 
-        /* lock alloc mutex */
+        if (ctx->recursion++ < NGX_RESOLVER_MAX_RECURSION) {
 
-        if (rn->query) {
-            ngx_resolver_free_locked(r, rn->query);
-            rn->query = NULL;
-        }
+            for (next = ctx; next; next = next->next) {
+                next->name.len = rn->cnlen;
+                next->name.data = rn->cname;
+            }
 
-        if (rn->cnlen) {
-            ngx_resolver_free_locked(r, rn->u.cname);
+            return ngx_resolve_name_locked(r, ctx);
         }
 
-        if (rn->naddrs > 1) {
-            ngx_resolver_free_locked(r, rn->u.addrs);
-        }
+        /* unlock name mutex */
 
-        /* unlock alloc mutex */
+        do {
+            ctx->state = NGX_RESOLVE_NXDOMAIN;
+            next = ctx->next;
 
-    } else {
+            ctx->handler(ctx);
 
-        rn = ngx_resolver_alloc(r, sizeof(ngx_resolver_node_t));
-        if (rn == NULL) {
-            return NGX_ERROR;
-        }
+            ctx = next;
+        } while (ctx);
 
-        rn->name = ngx_resolver_dup(r, ctx->name.data, ctx->name.len);
-        if (rn->name == NULL) {
-            ngx_resolver_free(r, rn);
-            return NGX_ERROR;
-        }
+        return NGX_OK;
+    }
 
-        rn->node.key = hash;
-        rn->nlen = (u_short) ctx->name.len;
-        rn->query = NULL;
+    if (rn->waiting) {
 
-        ngx_rbtree_insert(&r->name_rbtree, &rn->node);
+        last->next = rn->waiting;
+        rn->waiting = ctx;
+        ctx->state = NGX_AGAIN;
+
+        return NGX_AGAIN;
     }
 
-    rc = ngx_resolver_create_name_query(rn, ctx);
+    ngx_queue_remove(&rn->queue);
+
+    ngx_resolver_free_answer(r, rn);
+
+    rc = ngx_resolver_create_name_query(r, rn, &ctx->name, ctx->type);
 
     if (rc == NGX_ERROR) {
         goto failed;
     }
 
     if (rc == NGX_DECLINED) {
-        ngx_rbtree_delete(&r->name_rbtree, &rn->node);
+        ngx_rbtree_delete(tree, &rn->node);
 
-        ngx_resolver_free(r, rn->query);
-        ngx_resolver_free(r, rn->name);
-        ngx_resolver_free(r, rn);
+        ngx_resolver_free_node(r, rn);
 
-        ctx->state = NGX_RESOLVE_NXDOMAIN;
-        ctx->handler(ctx);
+        /* unlock name mutex */
+
+        do {
+            ctx->state = NGX_RESOLVE_NXDOMAIN;
+            next = ctx->next;
+
+            ctx->handler(ctx);
+
+            ctx = next;
+        } while (ctx);
 
         return NGX_OK;
     }
@@ -593,140 +782,485 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx)
         ngx_add_timer(ctx->event, ctx->timeout);
     }
 
-    if (ngx_queue_empty(&r->name_resend_queue)) {
+    if (ngx_queue_empty(resend_queue)) {
         ngx_add_timer(r->event, (ngx_msec_t) (r->resend_timeout * 1000));
     }
 
     rn->expire = ngx_time() + r->resend_timeout;
 
-    ngx_queue_insert_head(&r->name_resend_queue, &rn->queue);
+    ngx_queue_insert_head(resend_queue, &rn->queue);
 
-    rn->cnlen = 0;
-    rn->naddrs = 0;
+    rn->code = 0;
+    rn->prefetch = 0;
+    rn->ttl = NGX_MAX_INT32_VALUE;
     rn->valid = 0;
     rn->waiting = ctx;
 
-    ctx->state = NGX_AGAIN;
+    for (next = ctx; next; next = next->next) {
+        next->state = NGX_AGAIN;
+    }
 
     return NGX_AGAIN;
 
 failed:
 
-    ngx_rbtree_delete(&r->name_rbtree, &rn->node);
-
-    if (rn->query) {
-        ngx_resolver_free(r, rn->query);
-    }
-
-    ngx_resolver_free(r, rn->name);
+    ngx_rbtree_delete(tree, &rn->node);
 
-    ngx_resolver_free(r, rn);
+    ngx_resolver_free_node(r, rn);
 
     return NGX_ERROR;
 }
 
 
-ngx_int_t
-ngx_resolve_addr(ngx_resolver_ctx_t *ctx)
+static ngx_int_t
+ngx_resolver_found(ngx_resolver_t *r, ngx_resolver_node_t *rn,
+    ngx_resolver_ctx_t *ctx, ngx_uint_t rotate)
 {
-    u_char               *name;
-    ngx_resolver_t       *r;
-    ngx_resolver_node_t  *rn;
+    ngx_uint_t           naddrs;
+    ngx_addr_t          *addrs;
+    ngx_resolver_ctx_t  *next;
 
-    r = ctx->resolver;
+    naddrs = rn->naddrs;
+#if (NGX_HAVE_INET6)
+    naddrs += rn->naddrs6;
+#endif
 
-    ctx->addr = ntohl(ctx->addr);
+    if (naddrs == 1 && rn->naddrs == 1) {
 
-    /* lock addr mutex */
+        /* a single IPv4 address is stored in the context itself */
 
-    rn = ngx_resolver_lookup_addr(r, ctx->addr);
+        addrs = NULL;
 
-    if (rn) {
+    } else {
+        addrs = ngx_resolver_export(r, rn, rotate);
+        if (addrs == NULL) {
+            return NGX_ERROR;
+        }
+    }
 
-        if (rn->valid >= ngx_time()) {
+    /* unlock name mutex */
 
-            ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0, "resolve cached");
+    do {
+        ctx->state = NGX_OK;
+        ctx->valid = rn->valid;
+        ctx->naddrs = naddrs;
+
+        if (addrs == NULL) {
+            ctx->addrs = &ctx->addr;
+            ctx->addr.sockaddr = (struct sockaddr *) &ctx->sin;
+            ctx->addr.socklen = sizeof(struct sockaddr_in);
+            ngx_memzero(&ctx->sin, sizeof(struct sockaddr_in));
+            ctx->sin.sin_family = AF_INET;
+            ctx->sin.sin_addr.s_addr = rn->u.addr;
 
-            ngx_queue_remove(&rn->queue);
+        } else {
+            ctx->addrs = addrs;
+        }
 
-            rn->expire = ngx_time() + r->expire;
+        next = ctx->next;
 
-            ngx_queue_insert_head(&r->addr_expire_queue, &rn->queue);
+        ctx->handler(ctx);
 
-            name = ngx_resolver_dup(r, rn->name, rn->nlen);
-            if (name == NULL) {
-                goto failed;
-            }
+        ctx = next;
+    } while (ctx);
 
-            ctx->name.len = rn->nlen;
-            ctx->name.data = name;
+    if (addrs) {
+        ngx_resolver_free(r, addrs->sockaddr);
+        ngx_resolver_free(r, addrs);
+    }
 
-            /* unlock addr mutex */
+    return NGX_OK;
+}
 
-            ctx->state = NGX_OK;
 
-            ctx->handler(ctx);
+static ngx_int_t
+ngx_resolver_resolve_srv_names(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
+    ngx_resolver_node_t *rn)
+{
+    ngx_uint_t                i;
+    ngx_resolver_ctx_t       *cctx;
+    ngx_resolver_srv_t       *srv;
+    ngx_resolver_srv_name_t  *srvs;
 
-            ngx_resolver_free(r, name);
+    srvs = ngx_resolver_calloc(r, rn->nsrvs * sizeof(ngx_resolver_srv_name_t));
+    if (srvs == NULL) {
+        return NGX_ERROR;
+    }
 
-            return NGX_OK;
-        }
+    ctx->srvs = srvs;
+    ctx->nsrvs = rn->nsrvs;
+    ctx->valid = rn->valid;
+    ctx->state = NGX_AGAIN;
 
-        if (rn->waiting) {
+    /* an extra reference keeps the context while the names are started */
 
-            ctx->next = rn->waiting;
-            rn->waiting = ctx;
-            ctx->state = NGX_AGAIN;
+    ctx->count = rn->nsrvs + 1;
 
-            /* unlock addr mutex */
+    for (i = 0; i < rn->nsrvs; i++) {
+        srv = &rn->u.srvs[i];
 
-            return NGX_OK;
-        }
+        srvs[i].priority = srv->priority;
+        srvs[i].weight = srv->weight;
+        srvs[i].port = srv->port;
+        srvs[i].state = NGX_ERROR;
 
-        ngx_queue_remove(&rn->queue);
+        srvs[i].name.data = ngx_resolver_dup(r, srv->name.data, srv->name.len);
+        if (srvs[i].name.data == NULL) {
+            ctx->count--;
+            continue;
+        }
 
-        ngx_resolver_free(r, rn->query);
-        rn->query = NULL;
+        srvs[i].name.len = srv->name.len;
 
-    } else {
-        rn = ngx_resolver_alloc(r, sizeof(ngx_resolver_node_t));
-        if (rn == NULL) {
-            goto failed;
+        cctx = ngx_resolver_calloc(r, sizeof(ngx_resolver_ctx_t));
+        if (cctx == NULL) {
+            ctx->count--;
+            continue;
         }
 
-        rn->node.key = ctx->addr;
-        rn->query = NULL;
+        cctx->resolver = r;
+        cctx->name = srvs[i].name;
+        cctx->type = NGX_RESOLVE_A;
+        cctx->handler = ngx_resolver_srv_names_handler;
+        cctx->data = ctx;
+        cctx->timeout = ctx->timeout;
 
-        ngx_rbtree_insert(&r->addr_rbtree, &rn->node);
-    }
+        srvs[i].ctx = cctx;
 
-    if (ngx_resolver_create_addr_query(rn, ctx) != NGX_OK) {
-        goto failed;
-    }
+        if (ngx_resolve_name_locked(r, cctx) == NGX_ERROR) {
+            srvs[i].ctx = NULL;
+            ctx->count--;
 
-    if (ngx_resolver_send_query(r, rn) != NGX_OK) {
-        goto failed;
-    }
+            if (cctx->event) {
+                ngx_resolver_free(r, cctx->event);
+            }
 
-    ctx->event = ngx_resolver_calloc(r, sizeof(ngx_event_t));
-    if (ctx->event == NULL) {
-        goto failed;
+            ngx_resolver_free(r, cctx);
+        }
     }
 
-    ctx->event->handler = ngx_resolver_timeout_handler;
-    ctx->event->data = ctx;
-    ctx->event->log = r->log;
-    ctx->ident = -1;
-
-    ngx_add_timer(ctx->event, ctx->timeout);
-
-    if (ngx_queue_empty(&r->addr_resend_queue)) {
-        ngx_add_timer(r->event, (ngx_msec_t) (r->resend_timeout * 1000));
+    if (--ctx->count == 0) {
+        ngx_resolver_report_srv(r, ctx);
     }
 
-    rn->expire = ngx_time() + r->resend_timeout;
+    return NGX_OK;
+}
 
-    ngx_queue_insert_head(&r->addr_resend_queue, &rn->queue);
+
+static void
+ngx_resolver_srv_names_handler(ngx_resolver_ctx_t *cctx)
+{
+    u_char                    (*sockaddr)[NGX_SOCKADDRLEN];
+    in_port_t                  port;
+    ngx_uint_t                 i;
+    ngx_addr_t                *addrs;
+    ngx_resolver_t            *r;
+    struct sockaddr_in        *sin;
+    ngx_resolver_ctx_t        *ctx;
+    ngx_resolver_srv_name_t   *srv;
+#if (NGX_HAVE_INET6)
+    struct sockaddr_in6       *sin6;
+#endif
+
+    r = cctx->resolver;
+    ctx = cctx->data;
+
+    for (i = 0; i < ctx->nsrvs; i++) {
+        if (ctx->srvs[i].ctx == cctx) {
+            break;
+        }
+    }
+
+    srv = &ctx->srvs[i];
+
+    srv->ctx = NULL;
+    srv->state = cctx->state;
+
+    if (cctx->state == NGX_OK) {
+
+        addrs = ngx_resolver_calloc(r, cctx->naddrs * sizeof(ngx_addr_t));
+        sockaddr = ngx_resolver_calloc(r, cctx->naddrs * NGX_SOCKADDRLEN);
+
+        if (addrs == NULL || sockaddr == NULL) {
+            if (addrs) {
+                ngx_resolver_free(r, addrs);
+            }
+
+            if (sockaddr) {
+                ngx_resolver_free(r, sockaddr);
+            }
+
+            srv->state = NGX_ERROR;
+            goto done;
+        }
+
+        port = htons(srv->port);
+
+        for (i = 0; i < cctx->naddrs; i++) {
+            ngx_memcpy(sockaddr[i], cctx->addrs[i].sockaddr,
+                       cctx->addrs[i].socklen);
+
+            addrs[i].sockaddr = (struct sockaddr *) sockaddr[i];
+            addrs[i].socklen = cctx->addrs[i].socklen;
+
+            switch (addrs[i].sockaddr->sa_family) {
+
+#if (NGX_HAVE_INET6)
+            case AF_INET6:
+                sin6 = (struct sockaddr_in6 *) addrs[i].sockaddr;
+                sin6->sin6_port = port;
+                break;
+#endif
+
+            default: /* AF_INET */
+                sin = (struct sockaddr_in *) addrs[i].sockaddr;
+                sin->sin_port = port;
+            }
+        }
+
+        srv->naddrs = cctx->naddrs;
+        srv->addrs = addrs;
+
+        if (cctx->valid < ctx->valid) {
+            ctx->valid = cctx->valid;
+        }
+    }
+
+done:
+
+    ngx_resolve_name_done(cctx);
+
+    if (--ctx->count == 0) {
+        ngx_resolver_report_srv(r, ctx);
+    }
+}
+
+
+static void
+ngx_resolver_report_srv(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx)
+{
+    ngx_uint_t  i;
+
+    ctx->state = NGX_RESOLVE_NXDOMAIN;
+
+    for (i = 0; i < ctx->nsrvs; i++) {
+
+        if (ctx->srvs[i].state == NGX_OK) {
+            ctx->state = NGX_OK;
+            break;
+        }
+
+        if (ctx->srvs[i].state > 0) {
+            ctx->state = ctx->srvs[i].state;
+        }
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolve srv \"%V\" done: %i", &ctx->name, ctx->state);
+
+    ctx->handler(ctx);
+}
+
+
+static void
+ngx_resolver_prefetch(ngx_resolver_t *r, ngx_resolver_node_t *rn,
+    ngx_int_t type)
+{
+    time_t        period;
+    ngx_str_t     name;
+    ngx_queue_t  *resend_queue;
+
+    /* the answer is being refreshed or its refresh has failed */
+
+    if (rn->query || rn->code) {
+        return;
+    }
+
+#if (NGX_HAVE_INET6)
+    if (rn->query6) {
+        return;
+    }
+#endif
+
+    /*
+     * an answer used during the last tenth of its validity time
+     * is requested again in advance, so requests do not wait for it
+     */
+
+    period = r->valid ? r->valid : (time_t) rn->ttl;
+
+    if (period == 0 || (rn->valid - ngx_time()) * 10 > period) {
+        return;
+    }
+
+    if (r->shm_zone
+        && type != NGX_RESOLVE_SRV
+        && ngx_resolver_cache_lookup(r, rn, 1) != NGX_OK)
+    {
+        /* refreshed or being refreshed by another worker process */
+        return;
+    }
+
+    name.len = rn->nlen;
+    name.data = rn->name;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolver prefetch \"%V\"", &name);
+
+    if (ngx_resolver_create_name_query(r, rn, &name, type) != NGX_OK) {
+        return;
+    }
+
+    rn->prefetch = 1;
+    rn->ttl = NGX_MAX_INT32_VALUE;
+
+    if (ngx_resolver_send_query(r, rn) != NGX_OK) {
+        rn->code = NGX_RESOLVE_SERVFAIL;
+        rn->prefetch = 0;
+
+        ngx_resolver_free(r, rn->query);
+        rn->query = NULL;
+
+#if (NGX_HAVE_INET6)
+        if (rn->query6) {
+            ngx_resolver_free(r, rn->query6);
+            rn->query6 = NULL;
+        }
+#endif
+
+        return;
+    }
+
+    /*
+     * the query is resent as the one of a request, the node is returned
+     * to the expire queue when the answer is refreshed or the refresh fails
+     */
+
+    resend_queue = (type == NGX_RESOLVE_SRV) ? &r->srv_resend_queue
+                                             : &r->name_resend_queue;
+
+    if (ngx_queue_empty(resend_queue)) {
+        ngx_add_timer(r->event, (ngx_msec_t) (r->resend_timeout * 1000));
+    }
+
+    ngx_queue_remove(&rn->queue);
+
+    rn->expire = ngx_time() + r->resend_timeout;
+
+    ngx_queue_insert_head(resend_queue, &rn->queue);
+}
+
+
+ngx_int_t
+ngx_resolve_addr(ngx_resolver_ctx_t *ctx)
+{
+    u_char               *name;
+    in_addr_t             addr;
+    ngx_resolver_t       *r;
+    struct sockaddr_in   *sin;
+    ngx_resolver_node_t  *rn;
+
+    r = ctx->resolver;
+
+    /* AF_INET only */
+
+    if (ctx->addr.sockaddr->sa_family != AF_INET) {
+        ngx_resolver_free(r, ctx);
+        return NGX_ERROR;
+    }
+
+    sin = (struct sockaddr_in *) ctx->addr.sockaddr;
+    addr = ntohl(sin->sin_addr.s_addr);
+
+    /* lock addr mutex */
+
+    rn = ngx_resolver_lookup_addr(r, addr);
+
+    if (rn) {
+
+        if (rn->valid >= ngx_time()) {
+
+            ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0, "resolve cached");
+
+            ngx_queue_remove(&rn->queue);
+
+            rn->expire = ngx_time() + r->expire;
+
+            ngx_queue_insert_head(&r->addr_expire_queue, &rn->queue);
+
+            name = ngx_resolver_dup(r, rn->name, rn->nlen);
+            if (name == NULL) {
+                goto failed;
+            }
+
+            ctx->name.len = rn->nlen;
+            ctx->name.data = name;
+
+            /* unlock addr mutex */
+
+            ctx->state = NGX_OK;
+
+            ctx->handler(ctx);
+
+            ngx_resolver_free(r, name);
+
+            return NGX_OK;
+        }
+
+        if (rn->waiting) {
+
+            ctx->next = rn->waiting;
+            rn->waiting = ctx;
+            ctx->state = NGX_AGAIN;
+
+            /* unlock addr mutex */
+
+            return NGX_OK;
+        }
+
+        ngx_queue_remove(&rn->queue);
+
+        ngx_resolver_free(r, rn->query);
+        rn->query = NULL;
+
+    } else {
+        rn = ngx_resolver_calloc(r, sizeof(ngx_resolver_node_t));
+        if (rn == NULL) {
+            goto failed;
+        }
+
+        rn->node.key = addr;
+
+        ngx_rbtree_insert(&r->addr_rbtree, &rn->node);
+    }
+
+    if (ngx_resolver_create_addr_query(rn, ctx) != NGX_OK) {
+        goto failed;
+    }
+
+    if (ngx_resolver_send_query(r, rn) != NGX_OK) {
+        goto failed;
+    }
+
+    ctx->event = ngx_resolver_calloc(r, sizeof(ngx_event_t));
+    if (ctx->event == NULL) {
+        goto failed;
+    }
+
+    ctx->event->handler = ngx_resolver_timeout_handler;
+    ctx->event->data = ctx;
+    ctx->event->log = r->log;
+    ctx->ident = -1;
+
+    ngx_add_timer(ctx->event, ctx->timeout);
+
+    if (ngx_queue_empty(&r->addr_resend_queue)) {
+        ngx_add_timer(r->event, (ngx_msec_t) (r->resend_timeout * 1000));
+    }
+
+    rn->expire = ngx_time() + r->resend_timeout;
+
+    ngx_queue_insert_head(&r->addr_resend_queue, &rn->queue);
 
     rn->cnlen = 0;
     rn->naddrs = 0;
@@ -770,6 +1304,7 @@ ngx_resolve_addr_done(ngx_resolver_ctx_t *ctx)
 {
     in_addr_t             addr;
     ngx_resolver_t       *r;
+    struct sockaddr_in   *sin;
     ngx_resolver_ctx_t   *w, **p;
     ngx_resolver_node_t  *rn;
 
@@ -786,7 +1321,10 @@ ngx_resolve_addr_done(ngx_resolver_ctx_t *ctx)
 
     if (ctx->state == NGX_AGAIN || ctx->state == NGX_RESOLVE_TIMEDOUT) {
 
-        rn = ngx_resolver_lookup_addr(r, ctx->addr);
+        sin = (struct sockaddr_in *) ctx->addr.sockaddr;
+        addr = ntohl(sin->sin_addr.s_addr);
+
+        rn = ngx_resolver_lookup_addr(r, addr);
 
         if (rn) {
             p = &rn->waiting;
@@ -804,8 +1342,6 @@ ngx_resolve_addr_done(ngx_resolver_ctx_t *ctx)
             }
         }
 
-        addr = ntohl(ctx->addr);
-
         ngx_log_error(NGX_LOG_ALERT, r->log, 0,
                       "could not cancel %ud.%ud.%ud.%ud resolving",
                       (addr >> 24) & 0xff, (addr >> 16) & 0xff,
@@ -896,17 +1432,36 @@ ngx_resolver_send_query(ngx_resolver_t *r, ngx_resolver_node_t *rn)
         uc->connection->read->resolver = 1;
     }
 
-    n = ngx_send(uc->connection, rn->query, rn->qlen);
+    if (rn->query) {
+        n = ngx_send(uc->connection, rn->query, rn->qlen);
 
-    if (n == -1) {
-        return NGX_ERROR;
+        if (n == -1) {
+            return NGX_ERROR;
+        }
+
+        if ((size_t) n != (size_t) rn->qlen) {
+            ngx_log_error(NGX_LOG_CRIT, &uc->log, 0, "send() incomplete");
+            return NGX_ERROR;
+        }
     }
 
-    if ((size_t) n != (size_t) rn->qlen) {
-        ngx_log_error(NGX_LOG_CRIT, &uc->log, 0, "send() incomplete");
-        return NGX_ERROR;
+#if (NGX_HAVE_INET6)
+
+    if (rn->query6) {
+        n = ngx_send(uc->connection, rn->query6, rn->qlen);
+
+        if (n == -1) {
+            return NGX_ERROR;
+        }
+
+        if ((size_t) n != (size_t) rn->qlen) {
+            ngx_log_error(NGX_LOG_CRIT, &uc->log, 0, "send() incomplete");
+            return NGX_ERROR;
+        }
     }
 
+#endif
+
     return NGX_OK;
 }
 
@@ -914,7 +1469,7 @@ ngx_resolver_send_query(ngx_resolver_t *r, ngx_resolver_node_t *rn)
 static void
 ngx_resolver_resend_handler(ngx_event_t *ev)
 {
-    time_t           timer, atimer, ntimer;
+    time_t           timer, atimer, stimer, ntimer;
     ngx_resolver_t  *r;
 
     r = ev->data;
@@ -926,6 +1481,8 @@ ngx_resolver_resend_handler(ngx_event_t *ev)
 
     ntimer = ngx_resolver_resend(r, &r->name_rbtree, &r->name_resend_queue);
 
+    stimer = ngx_resolver_resend(r, &r->srv_rbtree, &r->srv_resend_queue);
+
     /* unlock name mutex */
 
     /* lock addr mutex */
@@ -934,14 +1491,14 @@ ngx_resolver_resend_handler(ngx_event_t *ev)
 
     /* unlock addr mutex */
 
-    if (ntimer == 0) {
-        timer = atimer;
+    timer = ntimer;
 
-    } else if (atimer == 0) {
-        timer = ntimer;
+    if (timer == 0 || (stimer && stimer < timer)) {
+        timer = stimer;
+    }
 
-    } else {
-        timer = (atimer < ntimer) ? atimer : ntimer;
+    if (timer == 0 || (atimer && atimer < timer)) {
+        timer = atimer;
     }
 
     if (timer) {
@@ -978,7 +1535,12 @@ ngx_resolver_resend(ngx_resolver_t *r, ngx_rbtree_t *tree, ngx_queue_t *queue)
 
         ngx_queue_remove(q);
 
-        if (rn->waiting) {
+        /*
+         * a refresh is resent while the answer is valid,
+         * an expired answer is freed as it cannot be used anyway
+         */
+
+        if (rn->waiting || (rn->prefetch && now < rn->valid)) {
 
             (void) ngx_resolver_send_query(r, rn);
 
@@ -1060,19 +1622,28 @@ ngx_resolver_process_response(ngx_resolver_t *r, u_char *buf, size_t n)
         times = 0;
 
         for (q = ngx_queue_head(&r->name_resend_queue);
-             q != ngx_queue_sentinel(&r->name_resend_queue) || times++ < 100;
+             q != ngx_queue_sentinel(&r->name_resend_queue) && times++ < 100;
              q = ngx_queue_next(q))
         {
             rn = ngx_queue_data(q, ngx_resolver_node_t, queue);
-            qident = (rn->query[0] << 8) + rn->query[1];
 
-            if (qident == ident) {
-                ngx_log_error(r->log_level, r->log, 0,
-                              "DNS error (%ui: %s), query id:%ui, name:\"%*s\"",
-                              code, ngx_resolver_strerror(code), ident,
-                              rn->nlen, rn->name);
-                return;
+            if (rn->query) {
+                qident = (rn->query[0] << 8) + rn->query[1];
+
+                if (qident == ident) {
+                    goto dns_error_name;
+                }
+            }
+
+#if (NGX_HAVE_INET6)
+            if (rn->query6) {
+                qident = (rn->query6[0] << 8) + rn->query6[1];
+
+                if (qident == ident) {
+                    goto dns_error_name;
+                }
             }
+#endif
         }
 
         goto dns_error;
@@ -1130,12 +1701,22 @@ found:
     switch (qtype) {
 
     case NGX_RESOLVE_A:
+#if (NGX_HAVE_INET6)
+    case NGX_RESOLVE_AAAA:
+#endif
 
-        ngx_resolver_process_a(r, buf, n, ident, code, nan,
+        ngx_resolver_process_a(r, buf, n, ident, code, qtype, nan,
                                i + sizeof(ngx_resolver_qs_t));
 
         break;
 
+    case NGX_RESOLVE_SRV:
+
+        ngx_resolver_process_srv(r, buf, n, ident, code, nan,
+                                 i + sizeof(ngx_resolver_qs_t));
+
+        break;
+
     case NGX_RESOLVE_PTR:
 
         ngx_resolver_process_ptr(r, buf, n, ident, code, nan);
@@ -1150,9 +1731,17 @@ found:
 
     return;
 
-short_response:
+dns_error_name:
 
-    err = "short dns response";
+    ngx_log_error(r->log_level, r->log, 0,
+                  "DNS error (%ui: %s), query id:%ui, name:\"%*s\"",
+                  code, ngx_resolver_strerror(code), ident,
+                  rn->nlen, rn->name);
+    return;
+
+short_response:
+
+    err = "short dns response";
 
 done:
 
@@ -1171,19 +1760,22 @@ dns_error:
 
 static void
 ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t last,
-    ngx_uint_t ident, ngx_uint_t code, ngx_uint_t nan, ngx_uint_t ans)
+    ngx_uint_t ident, ngx_uint_t code, ngx_uint_t qtype, ngx_uint_t nan,
+    ngx_uint_t ans)
 {
     char                 *err;
-    u_char               *cname;
-    size_t                len;
+    u_char               *cname, **query;
+    size_t                len, size;
     int32_t               ttl;
     uint32_t              hash;
-    in_addr_t             addr, *addrs;
+    in_addr_t            *addrs;
     ngx_str_t             name;
-    ngx_uint_t            qtype, qident, naddrs, a, i, n, start;
+    ngx_uint_t            type, qident, naddrs, a, i, n, start;
     ngx_resolver_an_t    *an;
-    ngx_resolver_ctx_t   *ctx, *next;
     ngx_resolver_node_t  *rn;
+#if (NGX_HAVE_INET6)
+    struct in6_addr      *addrs6;
+#endif
 
     if (ngx_resolver_copy(r, &name, buf, &buf[12], &buf[last]) != NGX_OK) {
         return;
@@ -1195,15 +1787,25 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t last,
 
     /* lock name mutex */
 
-    rn = ngx_resolver_lookup_name(r, &name, hash);
+    rn = ngx_resolver_lookup_name(r, &r->name_rbtree, &name, hash);
 
-    if (rn == NULL || rn->query == NULL) {
+    query = NULL;
+
+    if (rn) {
+#if (NGX_HAVE_INET6)
+        query = (qtype == NGX_RESOLVE_AAAA) ? &rn->query6 : &rn->query;
+#else
+        query = &rn->query;
+#endif
+    }
+
+    if (query == NULL || *query == NULL) {
         ngx_log_error(r->log_level, r->log, 0,
                       "unexpected response for %V", &name);
         goto failed;
     }
 
-    qident = (rn->query[0] << 8) + rn->query[1];
+    qident = ((*query)[0] << 8) + (*query)[1];
 
     if (ident != qident) {
         ngx_log_error(r->log_level, r->log, 0,
@@ -1214,40 +1816,23 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t last,
 
     ngx_resolver_free(r, name.data);
 
-    if (code == 0 && nan == 0) {
-        code = 3; /* NXDOMAIN */
-    }
+    size = (qtype == NGX_RESOLVE_A) ? sizeof(in_addr_t)
+                                    : sizeof(struct in6_addr);
 
     if (code) {
-        next = rn->waiting;
-        rn->waiting = NULL;
-
-        ngx_queue_remove(&rn->queue);
-
-        ngx_rbtree_delete(&r->name_rbtree, &rn->node);
 
-        ngx_resolver_free_node(r, rn);
-
-        /* unlock name mutex */
+        /* the answer of the other query may be still useful */
 
-        while (next) {
-             ctx = next;
-             ctx->state = code;
-             next = ctx->next;
-
-             ctx->handler(ctx);
+        if (rn->code == 0) {
+            rn->code = (u_char) code;
         }
 
-        return;
+        goto next;
     }
 
     i = ans;
     naddrs = 0;
-    addr = 0;
-    addrs = NULL;
     cname = NULL;
-    qtype = 0;
-    ttl = 0;
 
     for (a = 0; a < nan; a++) {
 
@@ -1285,7 +1870,7 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t last,
 
         an = (ngx_resolver_an_t *) &buf[i];
 
-        qtype = (an->type_hi << 8) + an->type_lo;
+        type = (an->type_hi << 8) + an->type_lo;
         len = (an->len_hi << 8) + an->len_lo;
         ttl = (an->ttl[0] << 24) + (an->ttl[1] << 16)
             + (an->ttl[2] << 8) + (an->ttl[3]);
@@ -1294,174 +1879,577 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t last,
             ttl = 0;
         }
 
-        if (qtype == NGX_RESOLVE_A) {
+        if ((uint32_t) ttl < rn->ttl) {
+            rn->ttl = ttl;
+        }
 
-            i += sizeof(ngx_resolver_an_t);
+        i += sizeof(ngx_resolver_an_t);
 
-            if (i + len > last) {
-                goto short_response;
-            }
+        if (i + len > last) {
+            goto short_response;
+        }
 
-            addr = htonl((buf[i] << 24) + (buf[i + 1] << 16)
-                         + (buf[i + 2] << 8) + (buf[i + 3]));
+        if (type == qtype) {
+
+            if (len != size) {
+                err = "invalid address length in DNS response";
+                goto invalid;
+            }
 
             naddrs++;
 
-            i += len;
+        } else if (type == NGX_RESOLVE_CNAME) {
+            cname = &buf[i];
 
-        } else if (qtype == NGX_RESOLVE_CNAME) {
-            cname = &buf[i] + sizeof(ngx_resolver_an_t);
-            i += sizeof(ngx_resolver_an_t) + len;
+        } else if (type != NGX_RESOLVE_DNAME) {
+            ngx_log_error(r->log_level, r->log, 0,
+                          "unexpected qtype %ui", type);
+        }
 
-        } else if (qtype == NGX_RESOLVE_DNAME) {
-            i += sizeof(ngx_resolver_an_t) + len;
+        i += len;
+    }
 
-        } else {
+    ngx_log_debug4(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolver qt:%ui naddrs:%ui cname:%p ttl:%uD",
+                   qtype, naddrs, cname, rn->ttl);
+
+    if (naddrs == 0 && cname == NULL) {
+
+        /* no addresses of this type */
+
+        if (nan) {
             ngx_log_error(r->log_level, r->log, 0,
-                          "unexpected qtype %ui", qtype);
+                          "no %s or CNAME types in DNS response",
+                          (qtype == NGX_RESOLVE_A) ? "A" : "AAAA");
         }
+
+        goto clear;
     }
 
-    ngx_log_debug3(NGX_LOG_DEBUG_CORE, r->log, 0,
-                   "resolver naddrs:%ui cname:%p ttl:%d",
-                   naddrs, cname, ttl);
+    if (naddrs == 0) {
 
-    if (naddrs) {
+        /* CNAME only */
 
-        if (naddrs == 1) {
-            rn->u.addr = addr;
+        if (ngx_resolver_copy(r, &name, buf, cname, &buf[last]) != NGX_OK) {
+            return;
+        }
 
-        } else {
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, r->log, 0,
+                       "resolver cname:\"%V\"", &name);
 
-            addrs = ngx_resolver_alloc(r, naddrs * sizeof(in_addr_t));
-            if (addrs == NULL) {
-                return;
-            }
+        if (rn->cnlen) {
+            ngx_resolver_free(r, rn->cname);
+        }
 
-            n = 0;
-            i = ans;
+        rn->cnlen = (u_short) name.len;
+        rn->cname = name.data;
 
-            for (a = 0; a < nan; a++) {
+        goto clear;
+    }
 
-                for ( ;; ) {
+    /* the addresses are copied in the second pass */
 
-                    if (buf[i] & 0xc0) {
-                        i += 2;
-                        goto ok;
-                    }
+    addrs = ngx_resolver_alloc(r, naddrs * size);
+    if (addrs == NULL) {
+        return;
+    }
 
-                    if (buf[i] == 0) {
-                        i++;
-                        goto ok;
-                    }
+    n = 0;
+    i = ans;
 
-                    i += 1 + buf[i];
-                }
+    for (a = 0; a < nan; a++) {
 
-            ok:
+        for ( ;; ) {
 
-                an = (ngx_resolver_an_t *) &buf[i];
+            if (buf[i] & 0xc0) {
+                i += 2;
+                break;
+            }
 
-                qtype = (an->type_hi << 8) + an->type_lo;
-                len = (an->len_hi << 8) + an->len_lo;
+            if (buf[i] == 0) {
+                i++;
+                break;
+            }
+
+            i += 1 + buf[i];
+        }
 
-                i += sizeof(ngx_resolver_an_t);
+        an = (ngx_resolver_an_t *) &buf[i];
 
-                if (qtype == NGX_RESOLVE_A) {
+        type = (an->type_hi << 8) + an->type_lo;
+        len = (an->len_hi << 8) + an->len_lo;
 
-                    addrs[n++] = htonl((buf[i] << 24) + (buf[i + 1] << 16)
-                                       + (buf[i + 2] << 8) + (buf[i + 3]));
+        i += sizeof(ngx_resolver_an_t);
 
-                    if (n == naddrs) {
-                        break;
-                    }
-                }
+        if (type == qtype) {
+            ngx_memcpy((u_char *) addrs + n++ * size, &buf[i], size);
 
-                i += len;
+            if (n == naddrs) {
+                break;
             }
+        }
 
-            rn->u.addrs = addrs;
+        i += len;
+    }
 
-            addrs = ngx_resolver_dup(r, rn->u.addrs,
-                                     naddrs * sizeof(in_addr_t));
-            if (addrs == NULL) {
-                return;
-            }
+    /* the answer replaces the one of the same type */
+
+#if (NGX_HAVE_INET6)
+
+    if (qtype == NGX_RESOLVE_AAAA) {
+
+        if (rn->naddrs6 > 1) {
+            ngx_resolver_free(r, rn->u6.addrs6);
+        }
+
+        addrs6 = (struct in6_addr *) addrs;
+
+        if (naddrs == 1) {
+            rn->u6.addr6 = addrs6[0];
+            ngx_resolver_free(r, addrs6);
+
+        } else {
+            rn->u6.addrs6 = addrs6;
+        }
+
+        rn->naddrs6 = (u_short) naddrs;
+
+        goto next;
+    }
+
+#endif
+
+    if (rn->naddrs > 1) {
+        ngx_resolver_free(r, rn->u.addrs);
+    }
+
+    if (naddrs == 1) {
+        rn->u.addr = addrs[0];
+        ngx_resolver_free(r, addrs);
+
+    } else {
+        rn->u.addrs = addrs;
+    }
+
+    rn->naddrs = (u_short) naddrs;
+
+    goto next;
+
+clear:
+
+#if (NGX_HAVE_INET6)
+
+    if (qtype == NGX_RESOLVE_AAAA) {
+
+        if (rn->naddrs6 > 1) {
+            ngx_resolver_free(r, rn->u6.addrs6);
         }
 
-        rn->naddrs = (u_short) naddrs;
+        rn->naddrs6 = 0;
+
+        goto next;
+    }
+
+#endif
+
+    if (rn->naddrs > 1) {
+        ngx_resolver_free(r, rn->u.addrs);
+    }
+
+    rn->naddrs = 0;
+
+next:
+
+    ngx_resolver_free(r, *query);
+    *query = NULL;
+
+    if (rn->query) {
+        return;
+    }
+
+#if (NGX_HAVE_INET6)
+    if (rn->query6) {
+        return;
+    }
+#endif
+
+    ngx_resolver_complete_name(r, rn);
+
+    return;
+
+short_response:
+
+    err = "short dns response";
+
+invalid:
+
+    /* unlock name mutex */
+
+    ngx_log_error(r->log_level, r->log, 0, err);
+
+    return;
+
+failed:
+
+    /* unlock name mutex */
+
+    ngx_resolver_free(r, name.data);
+
+    return;
+}
+
+
+static void
+ngx_resolver_complete_name(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    ngx_uint_t            naddrs, code;
+    ngx_resolver_ctx_t   *ctx, *next;
+
+    naddrs = rn->naddrs;
+#if (NGX_HAVE_INET6)
+    naddrs += rn->naddrs6;
+#endif
+
+    if (rn->code && rn->prefetch) {
+
+        /*
+         * a failed refresh does not invalidate the answer,
+         * it is kept until it expires and is not refreshed again
+         */
+
+        ngx_log_debug2(NGX_LOG_DEBUG_CORE, r->log, 0,
+                       "resolver prefetch \"%*s\" failed",
+                       (size_t) rn->nlen, rn->name);
 
         ngx_queue_remove(&rn->queue);
 
-        rn->valid = ngx_time() + (r->valid ? r->valid : ttl);
+        rn->prefetch = 0;
         rn->expire = ngx_time() + r->expire;
 
         ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
 
-        next = rn->waiting;
+        return;
+    }
+
+    if (naddrs || rn->cnlen) {
+
+        if (naddrs && rn->cnlen) {
+            ngx_resolver_free(r, rn->cname);
+            rn->cnlen = 0;
+        }
+
+        ngx_queue_remove(&rn->queue);
+
+        rn->code = 0;
+        rn->prefetch = 0;
+        rn->valid = ngx_time() + (r->valid ? r->valid : (time_t) rn->ttl);
+        rn->expire = ngx_time() + r->expire;
+
+        ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
+
+        if (r->shm_zone) {
+            ngx_resolver_cache_store(r, rn);
+        }
+
+        ctx = rn->waiting;
         rn->waiting = NULL;
 
-        /* unlock name mutex */
+        if (ctx == NULL) {
+            return;
+        }
 
-        while (next) {
-             ctx = next;
-             ctx->state = NGX_OK;
-             ctx->naddrs = naddrs;
-             ctx->addrs = (naddrs == 1) ? &ctx->addr : addrs;
-             ctx->addr = addr;
-             next = ctx->next;
+        if (naddrs) {
 
-             ctx->handler(ctx);
+            if (ngx_resolver_found(r, rn, ctx, 0) == NGX_OK) {
+                return;
+            }
+
+            code = NGX_ERROR;
+
+            goto failed;
         }
 
-        if (naddrs > 1) {
-            ngx_resolver_free(r, addrs);
+        /* CNAME only */
+
+        if (ctx->recursion++ < NGX_RESOLVER_MAX_RECURSION) {
+
+            for (next = ctx; next; next = next->next) {
+                next->name.len = rn->cnlen;
+                next->name.data = rn->cname;
+            }
+
+            if (ngx_resolve_name_locked(r, ctx) != NGX_ERROR) {
+                return;
+            }
+
+            code = NGX_ERROR;
+
+        } else {
+            code = NGX_RESOLVE_NXDOMAIN;
         }
 
-        ngx_resolver_free(r, rn->query);
-        rn->query = NULL;
+        goto failed;
+    }
+
+    code = rn->code ? rn->code : NGX_RESOLVE_NXDOMAIN;
 
+    ctx = rn->waiting;
+    rn->waiting = NULL;
+
+    ngx_queue_remove(&rn->queue);
+
+    ngx_rbtree_delete(&r->name_rbtree, &rn->node);
+
+    ngx_resolver_free_node(r, rn);
+
+failed:
+
+    /* unlock name mutex */
+
+    while (ctx) {
+        next = ctx->next;
+
+        ctx->state = code;
+        ctx->handler(ctx);
+
+        ctx = next;
+    }
+}
+
+
+static void
+ngx_resolver_process_srv(ngx_resolver_t *r, u_char *buf, size_t last,
+    ngx_uint_t ident, ngx_uint_t code, ngx_uint_t nan, ngx_uint_t ans)
+{
+    char                 *err;
+    size_t                len;
+    int32_t               ttl;
+    uint32_t              hash;
+    ngx_str_t             name;
+    ngx_uint_t            type, qident, nsrvs, a, i, start;
+    ngx_resolver_an_t    *an;
+    ngx_resolver_srv_t   *srvs;
+    ngx_resolver_ctx_t   *ctx, *next;
+    ngx_resolver_node_t  *rn;
+
+    if (ngx_resolver_copy(r, &name, buf, &buf[12], &buf[last]) != NGX_OK) {
         return;
+    }
 
-    } else if (cname) {
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, r->log, 0, "resolver qs:%V", &name);
 
-        /* CNAME only */
+    hash = ngx_crc32_short(name.data, name.len);
 
-        if (ngx_resolver_copy(r, &name, buf, cname, &buf[last]) != NGX_OK) {
-            return;
+    /* lock name mutex */
+
+    rn = ngx_resolver_lookup_name(r, &r->srv_rbtree, &name, hash);
+
+    if (rn == NULL || rn->query == NULL) {
+        ngx_log_error(r->log_level, r->log, 0,
+                      "unexpected response for %V", &name);
+        ngx_resolver_free(r, name.data);
+        return;
+    }
+
+    qident = (rn->query[0] << 8) + rn->query[1];
+
+    if (ident != qident) {
+        ngx_log_error(r->log_level, r->log, 0,
+                      "wrong ident %ui response for %V, expect %ui",
+                      ident, &name, qident);
+        ngx_resolver_free(r, name.data);
+        return;
+    }
+
+    ngx_resolver_free(r, name.data);
+
+    srvs = NULL;
+    nsrvs = 0;
+
+    if (code == 0 && nan == 0) {
+        code = NGX_RESOLVE_NXDOMAIN;
+    }
+
+    if (code) {
+        goto error;
+    }
+
+    srvs = ngx_resolver_calloc(r, nan * sizeof(ngx_resolver_srv_t));
+    if (srvs == NULL) {
+        return;
+    }
+
+    i = ans;
+
+    for (a = 0; a < nan; a++) {
+
+        start = i;
+
+        while (i < last) {
+
+            if (buf[i] & 0xc0) {
+                i += 2;
+                goto found;
+            }
+
+            if (buf[i] == 0) {
+                i++;
+                goto test_length;
+            }
+
+            i += 1 + buf[i];
         }
 
-        ngx_log_debug1(NGX_LOG_DEBUG_CORE, r->log, 0,
-                       "resolver cname:\"%V\"", &name);
+        goto short_response;
 
-        ngx_queue_remove(&rn->queue);
+    test_length:
 
-        rn->cnlen = (u_short) name.len;
-        rn->u.cname = name.data;
+        if (i - start < 2) {
+            err = "invalid name in dns response";
+            goto invalid;
+        }
 
-        rn->valid = ngx_time() + (r->valid ? r->valid : ttl);
-        rn->expire = ngx_time() + r->expire;
+    found:
 
-        ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
+        if (i + sizeof(ngx_resolver_an_t) >= last) {
+            goto short_response;
+        }
 
-        ctx = rn->waiting;
-        rn->waiting = NULL;
+        an = (ngx_resolver_an_t *) &buf[i];
 
-        if (ctx) {
-            ctx->name = name;
+        type = (an->type_hi << 8) + an->type_lo;
+        len = (an->len_hi << 8) + an->len_lo;
+        ttl = (an->ttl[0] << 24) + (an->ttl[1] << 16)
+            + (an->ttl[2] << 8) + (an->ttl[3]);
 
-            (void) ngx_resolve_name_locked(r, ctx);
+        if (ttl < 0) {
+            ttl = 0;
         }
 
-        ngx_resolver_free(r, rn->query);
-        rn->query = NULL;
+        i += sizeof(ngx_resolver_an_t);
+
+        if (i + len > last) {
+            goto short_response;
+        }
+
+        if (type != NGX_RESOLVE_SRV) {
+            i += len;
+            continue;
+        }
+
+        if (len < 7) {
+            err = "invalid SRV record in DNS response";
+            goto invalid;
+        }
+
+        if (ngx_resolver_copy(r, &srvs[nsrvs].name, buf, &buf[i + 6],
+                              &buf[last])
+            != NGX_OK)
+        {
+            goto failed;
+        }
+
+        i += len;
+
+        /* the "." target means that the service is not available */
+
+        if (srvs[nsrvs].name.len == 0) {
+            continue;
+        }
+
+        srvs[nsrvs].priority = (buf[i - len] << 8) + buf[i - len + 1];
+        srvs[nsrvs].weight = (buf[i - len + 2] << 8) + buf[i - len + 3];
+        srvs[nsrvs].port = (buf[i - len + 4] << 8) + buf[i - len + 5];
+
+        ngx_log_debug4(NGX_LOG_DEBUG_CORE, r->log, 0,
+                       "resolver srv:\"%V\" %ui %ui %ui",
+                       &srvs[nsrvs].name, (ngx_uint_t) srvs[nsrvs].priority,
+                       (ngx_uint_t) srvs[nsrvs].weight,
+                       (ngx_uint_t) srvs[nsrvs].port);
+
+        if ((uint32_t) ttl < rn->ttl) {
+            rn->ttl = ttl;
+        }
+
+        nsrvs++;
+    }
+
+    if (nsrvs == 0) {
+        ngx_resolver_free(r, srvs);
+        code = NGX_RESOLVE_NXDOMAIN;
+        goto error;
+    }
+
+    ngx_resolver_free_answer(r, rn);
+
+    rn->u.srvs = srvs;
+    rn->nsrvs = (u_short) nsrvs;
+
+    ngx_queue_remove(&rn->queue);
+
+    rn->code = 0;
+    rn->prefetch = 0;
+    rn->valid = ngx_time() + (r->valid ? r->valid : (time_t) rn->ttl);
+    rn->expire = ngx_time() + r->expire;
+
+    ngx_queue_insert_head(&r->srv_expire_queue, &rn->queue);
+
+    next = rn->waiting;
+    rn->waiting = NULL;
+
+    /* unlock name mutex */
+
+    while (next) {
+        ctx = next;
+        next = ctx->next;
+
+        if (ngx_resolver_resolve_srv_names(r, ctx, rn) != NGX_OK) {
+            ctx->state = NGX_ERROR;
+            ctx->handler(ctx);
+        }
+    }
+
+    return;
+
+error:
+
+    ngx_resolver_free(r, rn->query);
+    rn->query = NULL;
+
+    if (rn->prefetch) {
+
+        /* the answer is kept until it expires */
+
+        ngx_queue_remove(&rn->queue);
+
+        rn->code = (u_char) code;
+        rn->prefetch = 0;
+        rn->expire = ngx_time() + r->expire;
+
+        ngx_queue_insert_head(&r->srv_expire_queue, &rn->queue);
 
         return;
     }
 
-    ngx_log_error(r->log_level, r->log, 0,
-               "no A or CNAME types in DNS responses, unknown query type: %ui",
-               qtype);
+    next = rn->waiting;
+    rn->waiting = NULL;
+
+    ngx_queue_remove(&rn->queue);
+
+    ngx_rbtree_delete(&r->srv_rbtree, &rn->node);
+
+    ngx_resolver_free_node(r, rn);
+
+    /* unlock name mutex */
+
+    while (next) {
+        ctx = next;
+        ctx->state = code;
+        next = ctx->next;
+
+        ctx->handler(ctx);
+    }
+
     return;
 
 short_response:
@@ -1470,17 +2458,17 @@ short_response:
 
 invalid:
 
-    /* unlock name mutex */
-
     ngx_log_error(r->log_level, r->log, 0, err);
 
-    return;
-
 failed:
 
     /* unlock name mutex */
 
-    ngx_resolver_free(r, name.data);
+    for (i = 0; i < nsrvs; i++) {
+        ngx_resolver_free(r, srvs[i].name.data);
+    }
+
+    ngx_resolver_free(r, srvs);
 
     return;
 }
@@ -1681,14 +2669,15 @@ failed:
 
 
 static ngx_resolver_node_t *
-ngx_resolver_lookup_name(ngx_resolver_t *r, ngx_str_t *name, uint32_t hash)
+ngx_resolver_lookup_name(ngx_resolver_t *r, ngx_rbtree_t *tree,
+    ngx_str_t *name, uint32_t hash)
 {
     ngx_int_t             rc;
     ngx_rbtree_node_t    *node, *sentinel;
     ngx_resolver_node_t  *rn;
 
-    node = r->name_rbtree.root;
-    sentinel = r->name_rbtree.sentinel;
+    node = tree->root;
+    sentinel = tree->sentinel;
 
     while (node != sentinel) {
 
@@ -1794,7 +2783,8 @@ ngx_resolver_rbtree_insert_value(ngx_rbtree_node_t *temp,
 
 
 static ngx_int_t
-ngx_resolver_create_name_query(ngx_resolver_node_t *rn, ngx_resolver_ctx_t *ctx)
+ngx_resolver_create_name_query(ngx_resolver_t *r, ngx_resolver_node_t *rn,
+    ngx_str_t *name, ngx_int_t type)
 {
     u_char                *p, *s;
     size_t                 len, nlen;
@@ -1802,11 +2792,11 @@ ngx_resolver_create_name_query(ngx_resolver_node_t *rn, ngx_resolver_ctx_t *ctx)
     ngx_resolver_qs_t     *qs;
     ngx_resolver_query_t  *query;
 
-    nlen = ctx->name.len ? (1 + ctx->name.len + 1) : 1;
+    nlen = name->len ? (1 + name->len + 1) : 1;
 
     len = sizeof(ngx_resolver_query_t) + nlen + sizeof(ngx_resolver_qs_t);
 
-    p = ngx_resolver_alloc(ctx->resolver, len);
+    p = ngx_resolver_alloc(r, len);
     if (p == NULL) {
         return NGX_ERROR;
     }
@@ -1818,8 +2808,8 @@ ngx_resolver_create_name_query(ngx_resolver_node_t *rn, ngx_resolver_ctx_t *ctx)
 
     ident = ngx_random();
 
-    ngx_log_debug2(NGX_LOG_DEBUG_CORE, ctx->resolver->log, 0,
-                   "resolve: \"%V\" %i", &ctx->name, ident & 0xffff);
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolve: \"%V\" %i %i", name, type, ident & 0xffff);
 
     query->ident_hi = (u_char) ((ident >> 8) & 0xff);
     query->ident_lo = (u_char) (ident & 0xff);
@@ -1838,7 +2828,7 @@ ngx_resolver_create_name_query(ngx_resolver_node_t *rn, ngx_resolver_ctx_t *ctx)
     qs = (ngx_resolver_qs_t *) p;
 
     /* query type */
-    qs->type_hi = 0; qs->type_lo = (u_char) ctx->type;
+    qs->type_hi = 0; qs->type_lo = (u_char) type;
 
     /* IP query class */
     qs->class_hi = 0; qs->class_lo = 1;
@@ -1849,34 +2839,71 @@ ngx_resolver_create_name_query(ngx_resolver_node_t *rn, ngx_resolver_ctx_t *ctx)
     p--;
     *p-- = '\0';
 
-    if (ctx->name.len == 0)  {
-        return NGX_DECLINED;
+    if (name->len == 0)  {
+        goto declined;
     }
 
-    for (s = ctx->name.data + ctx->name.len - 1; s >= ctx->name.data; s--) {
+    for (s = name->data + name->len - 1; s >= name->data; s--) {
         if (*s != '.') {
             *p = *s;
             len++;
 
         } else {
             if (len == 0 || len > 255) {
-                return NGX_DECLINED;
+                goto declined;
             }
 
-            *p = (u_char) len;
-            len = 0;
-        }
+            *p = (u_char) len;
+            len = 0;
+        }
+
+        p--;
+    }
+
+    if (len == 0 || len > 255) {
+        goto declined;
+    }
+
+    *p = (u_char) len;
+
+#if (NGX_HAVE_INET6)
+
+    if (type != NGX_RESOLVE_A || !r->ipv6) {
+        return NGX_OK;
+    }
+
+    /* the same query of the AAAA type is sent together */
+
+    p = ngx_resolver_dup(r, rn->query, rn->qlen);
+    if (p == NULL) {
+        ngx_resolver_free(r, rn->query);
+        rn->query = NULL;
+        return NGX_ERROR;
+    }
+
+    rn->query6 = p;
+
+    query = (ngx_resolver_query_t *) p;
+
+    ident = ngx_random();
 
-        p--;
-    }
+    query->ident_hi = (u_char) ((ident >> 8) & 0xff);
+    query->ident_lo = (u_char) (ident & 0xff);
 
-    if (len == 0 || len > 255) {
-        return NGX_DECLINED;
-    }
+    qs = (ngx_resolver_qs_t *) (p + rn->qlen - sizeof(ngx_resolver_qs_t));
 
-    *p = (u_char) len;
+    qs->type_lo = NGX_RESOLVE_AAAA;
+
+#endif
 
     return NGX_OK;
+
+declined:
+
+    ngx_resolver_free(r, rn->query);
+    rn->query = NULL;
+
+    return NGX_DECLINED;
 }
 
 
@@ -1920,7 +2947,7 @@ ngx_resolver_create_addr_query(ngx_resolver_node_t *rn, ngx_resolver_ctx_t *ctx)
     p += sizeof(ngx_resolver_query_t);
 
     for (n = 0; n < 32; n += 8) {
-        d = ngx_sprintf(&p[1], "%ud", (ctx->addr >> n) & 0xff);
+        d = ngx_sprintf(&p[1], "%ud", (rn->node.key >> n) & 0xff);
         *p = (u_char) (d - &p[1]);
         p = d;
     }
@@ -2045,26 +3072,67 @@ ngx_resolver_timeout_handler(ngx_event_t *ev)
 
 
 static void
-ngx_resolver_free_node(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+ngx_resolver_free_answer(ngx_resolver_t *r, ngx_resolver_node_t *rn)
 {
+    ngx_uint_t  i;
+
     /* lock alloc mutex */
 
     if (rn->query) {
         ngx_resolver_free_locked(r, rn->query);
+        rn->query = NULL;
     }
 
-    if (rn->name) {
-        ngx_resolver_free_locked(r, rn->name);
+#if (NGX_HAVE_INET6)
+
+    if (rn->query6) {
+        ngx_resolver_free_locked(r, rn->query6);
+        rn->query6 = NULL;
+    }
+
+    if (rn->naddrs6 > 1) {
+        ngx_resolver_free_locked(r, rn->u6.addrs6);
     }
 
+    rn->naddrs6 = 0;
+
+#endif
+
     if (rn->cnlen) {
-        ngx_resolver_free_locked(r, rn->u.cname);
+        ngx_resolver_free_locked(r, rn->cname);
+        rn->cnlen = 0;
     }
 
     if (rn->naddrs > 1) {
         ngx_resolver_free_locked(r, rn->u.addrs);
     }
 
+    rn->naddrs = 0;
+
+    if (rn->nsrvs) {
+        for (i = 0; i < rn->nsrvs; i++) {
+            ngx_resolver_free_locked(r, rn->u.srvs[i].name.data);
+        }
+
+        ngx_resolver_free_locked(r, rn->u.srvs);
+        rn->nsrvs = 0;
+    }
+
+    /* unlock alloc mutex */
+}
+
+
+static void
+ngx_resolver_free_node(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    ngx_resolver_free_answer(r, rn);
+
+    /* lock alloc mutex */
+
+    if (rn->name) {
+        ngx_resolver_free_locked(r, rn->name);
+    }
+
     ngx_resolver_free_locked(r, rn);
 
     /* unlock alloc mutex */
@@ -2136,32 +3204,453 @@ ngx_resolver_dup(ngx_resolver_t *r, void *src, size_t size)
 }
 
 
-static in_addr_t *
-ngx_resolver_rotate(ngx_resolver_t *r, in_addr_t *src, ngx_uint_t n)
+static ngx_addr_t *
+ngx_resolver_export(ngx_resolver_t *r, ngx_resolver_node_t *rn,
+    ngx_uint_t rotate)
 {
-    void        *dst, *p;
-    ngx_uint_t   j;
+    ngx_uint_t             d, i, j, n;
+    in_addr_t             *addr;
+    ngx_addr_t            *dst;
+    struct sockaddr_in    *sin;
+    u_char               (*sockaddr)[NGX_SOCKADDRLEN];
+#if (NGX_HAVE_INET6)
+    struct in6_addr       *addr6;
+    struct sockaddr_in6   *sin6;
+#endif
 
-    dst = ngx_resolver_alloc(r, n * sizeof(in_addr_t));
+    n = rn->naddrs;
+#if (NGX_HAVE_INET6)
+    n += rn->naddrs6;
+#endif
 
+    dst = ngx_resolver_calloc(r, n * sizeof(ngx_addr_t));
     if (dst == NULL) {
-        return dst;
+        return NULL;
+    }
+
+    sockaddr = ngx_resolver_calloc(r, n * NGX_SOCKADDRLEN);
+    if (sockaddr == NULL) {
+        ngx_resolver_free(r, dst);
+        return NULL;
     }
 
-    j = ngx_random() % n;
+    i = 0;
+    d = rotate ? ngx_random() % n : 0;
 
-    if (j == 0) {
-        ngx_memcpy(dst, src, n * sizeof(in_addr_t));
-        return dst;
+    if (rn->naddrs) {
+        j = rotate ? ngx_random() % rn->naddrs : 0;
+
+        addr = (rn->naddrs == 1) ? &rn->u.addr : rn->u.addrs;
+
+        do {
+            sin = (struct sockaddr_in *) sockaddr[d];
+            sin->sin_family = AF_INET;
+            sin->sin_addr.s_addr = addr[j++];
+            dst[d].sockaddr = (struct sockaddr *) sin;
+            dst[d++].socklen = sizeof(struct sockaddr_in);
+
+            if (d == n) {
+                d = 0;
+            }
+
+            if (j == rn->naddrs) {
+                j = 0;
+            }
+        } while (++i < rn->naddrs);
+    }
+
+#if (NGX_HAVE_INET6)
+
+    if (rn->naddrs6) {
+        j = rotate ? ngx_random() % rn->naddrs6 : 0;
+
+        addr6 = (rn->naddrs6 == 1) ? &rn->u6.addr6 : rn->u6.addrs6;
+
+        do {
+            sin6 = (struct sockaddr_in6 *) sockaddr[d];
+            sin6->sin6_family = AF_INET6;
+            ngx_memcpy(sin6->sin6_addr.s6_addr, addr6[j++].s6_addr, 16);
+            dst[d].sockaddr = (struct sockaddr *) sin6;
+            dst[d++].socklen = sizeof(struct sockaddr_in6);
+
+            if (d == n) {
+                d = 0;
+            }
+
+            if (j == rn->naddrs6) {
+                j = 0;
+            }
+        } while (++i < n);
     }
 
-    p = ngx_cpymem(dst, &src[j], (n - j) * sizeof(in_addr_t));
-    ngx_memcpy(p, src, j * sizeof(in_addr_t));
+#endif
 
     return dst;
 }
 
 
+static ngx_int_t
+ngx_resolver_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_resolver_cache_t  *ocache = data;
+
+    size_t                 len;
+    ngx_resolver_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = cache->shpool->data;
+
+        return NGX_OK;
+    }
+
+    cache->sh = ngx_slab_alloc(cache->shpool, sizeof(ngx_resolver_cache_sh_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    len = sizeof(" in resolver zone \"\"") + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
+    if (cache->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx, " in resolver zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    return NGX_OK;
+}
+
+
+/*
+ * prefetch == 0: copies a valid answer of the shared memory to the node,
+ *                returns NGX_DECLINED if there is no such answer;
+ * prefetch == 1: returns NGX_OK if the answer should be refreshed by this
+ *                worker process, NGX_DONE if it is refreshed already
+ *                and copied, NGX_BUSY if it is being refreshed
+ */
+
+static ngx_int_t
+ngx_resolver_cache_lookup(ngx_resolver_t *r, ngx_resolver_node_t *rn,
+    ngx_uint_t prefetch)
+{
+    time_t                      now;
+    ngx_int_t                   rc;
+    ngx_str_t                   name;
+    ngx_uint_t                  ipv6;
+    ngx_resolver_cache_t       *cache;
+    ngx_resolver_cache_node_t  *cn;
+
+    cache = r->shm_zone->data;
+
+    name.len = rn->nlen;
+    name.data = rn->name;
+
+#if (NGX_HAVE_INET6)
+    ipv6 = r->ipv6;
+#else
+    ipv6 = 0;
+#endif
+
+    now = ngx_time();
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    cn = (ngx_resolver_cache_node_t *)
+             ngx_str_rbtree_lookup(&cache->sh->rbtree, &name, rn->node.key);
+
+    if (cn == NULL || cn->valid < now || cn->ipv6 != ipv6) {
+        rc = prefetch ? NGX_OK : NGX_DECLINED;
+        goto done;
+    }
+
+    if (prefetch && cn->valid <= rn->valid) {
+
+        if (cn->prefetch >= now) {
+            rc = NGX_BUSY;
+            goto done;
+        }
+
+        cn->prefetch = now + r->resend_timeout;
+
+        rc = NGX_OK;
+        goto done;
+    }
+
+    rc = ngx_resolver_cache_copy(r, rn, cn);
+
+    if (rc == NGX_OK) {
+        ngx_log_debug2(NGX_LOG_DEBUG_CORE, r->log, 0,
+                       "resolver shared \"%V\" valid:%T",
+                       &name, cn->valid - now);
+
+        ngx_queue_remove(&cn->queue);
+        ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+        if (prefetch) {
+            rc = NGX_DONE;
+        }
+    }
+
+done:
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_resolver_cache_copy(ngx_resolver_t *r, ngx_resolver_node_t *rn,
+    ngx_resolver_cache_node_t *cn)
+{
+    u_char           *p, *cname;
+    in_addr_t        *addrs;
+#if (NGX_HAVE_INET6)
+    struct in6_addr  *addrs6;
+#endif
+
+    p = cn->data;
+
+    addrs = NULL;
+    cname = NULL;
+
+    if (cn->naddrs > 1) {
+        addrs = ngx_resolver_dup(r, p, cn->naddrs * sizeof(in_addr_t));
+        if (addrs == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+#if (NGX_HAVE_INET6)
+
+    addrs6 = NULL;
+
+    if (cn->naddrs6 > 1) {
+        addrs6 = ngx_resolver_dup(r, p + cn->naddrs * sizeof(in_addr_t),
+                                  cn->naddrs6 * sizeof(struct in6_addr));
+        if (addrs6 == NULL) {
+            goto failed;
+        }
+    }
+
+#endif
+
+    if (cn->cnlen) {
+        cname = ngx_resolver_dup(r, cn->sn.str.data + cn->sn.str.len,
+                                 cn->cnlen);
+        if (cname == NULL) {
+            goto failed;
+        }
+    }
+
+    ngx_resolver_free_answer(r, rn);
+
+    if (cn->naddrs == 1) {
+        ngx_memcpy(&rn->u.addr, p, sizeof(in_addr_t));
+
+    } else {
+        rn->u.addrs = addrs;
+    }
+
+    rn->naddrs = cn->naddrs;
+
+#if (NGX_HAVE_INET6)
+
+    if (cn->naddrs6 == 1) {
+        ngx_memcpy(&rn->u6.addr6, p + cn->naddrs * sizeof(in_addr_t),
+                   sizeof(struct in6_addr));
+
+    } else {
+        rn->u6.addrs6 = addrs6;
+    }
+
+    rn->naddrs6 = cn->naddrs6;
+
+#endif
+
+    rn->cname = cname;
+    rn->cnlen = cn->cnlen;
+
+    rn->code = 0;
+    rn->prefetch = 0;
+    rn->ttl = cn->ttl;
+    rn->valid = cn->valid;
+
+    return NGX_OK;
+
+failed:
+
+    if (addrs) {
+        ngx_resolver_free(r, addrs);
+    }
+
+#if (NGX_HAVE_INET6)
+    if (addrs6) {
+        ngx_resolver_free(r, addrs6);
+    }
+#endif
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_resolver_cache_store(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    u_char                     *p;
+    size_t                      size, naddrs6;
+    ngx_str_t                   name;
+    ngx_resolver_cache_t       *cache;
+    ngx_resolver_cache_node_t  *cn;
+
+    cache = r->shm_zone->data;
+
+    name.len = rn->nlen;
+    name.data = rn->name;
+
+#if (NGX_HAVE_INET6)
+    naddrs6 = rn->naddrs6;
+#else
+    naddrs6 = 0;
+#endif
+
+    size = offsetof(ngx_resolver_cache_node_t, data)
+           + rn->naddrs * sizeof(in_addr_t)
+           + naddrs6 * sizeof(struct in6_addr)
+           + rn->nlen + rn->cnlen;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    cn = (ngx_resolver_cache_node_t *)
+             ngx_str_rbtree_lookup(&cache->sh->rbtree, &name, rn->node.key);
+
+    if (cn) {
+        ngx_queue_remove(&cn->queue);
+        ngx_rbtree_delete(&cache->sh->rbtree, &cn->sn.node);
+        ngx_slab_free_locked(cache->shpool, cn);
+    }
+
+    ngx_resolver_cache_expire(cache, 1);
+
+    cn = ngx_slab_alloc_locked(cache->shpool, size);
+
+    if (cn == NULL) {
+        ngx_resolver_cache_expire(cache, 0);
+
+        cn = ngx_slab_alloc_locked(cache->shpool, size);
+        if (cn == NULL) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return;
+        }
+    }
+
+    cn->valid = rn->valid;
+    cn->prefetch = 0;
+    cn->ttl = rn->ttl;
+    cn->naddrs = rn->naddrs;
+    cn->naddrs6 = (u_short) naddrs6;
+    cn->cnlen = rn->cnlen;
+
+#if (NGX_HAVE_INET6)
+    cn->ipv6 = (u_char) r->ipv6;
+#else
+    cn->ipv6 = 0;
+#endif
+
+    p = cn->data;
+
+    if (rn->naddrs == 1) {
+        p = ngx_cpymem(p, &rn->u.addr, sizeof(in_addr_t));
+
+    } else {
+        p = ngx_cpymem(p, rn->u.addrs, rn->naddrs * sizeof(in_addr_t));
+    }
+
+#if (NGX_HAVE_INET6)
+
+    if (rn->naddrs6 == 1) {
+        p = ngx_cpymem(p, &rn->u6.addr6, sizeof(struct in6_addr));
+
+    } else {
+        p = ngx_cpymem(p, rn->u6.addrs6,
+                       rn->naddrs6 * sizeof(struct in6_addr));
+    }
+
+#endif
+
+    cn->sn.str.len = rn->nlen;
+    cn->sn.str.data = p;
+
+    p = ngx_cpymem(p, rn->name, rn->nlen);
+    ngx_memcpy(p, rn->cname, rn->cnlen);
+
+    cn->sn.node.key = rn->node.key;
+
+    ngx_rbtree_insert(&cache->sh->rbtree, &cn->sn.node);
+
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+
+static void
+ngx_resolver_cache_expire(ngx_resolver_cache_t *cache, ngx_uint_t n)
+{
+    time_t                      now;
+    ngx_queue_t                *q;
+    ngx_resolver_cache_node_t  *cn;
+
+    now = ngx_time();
+
+    /*
+     * n == 1 deletes one or two expired entries
+     * n == 0 deletes the least recently used entry
+     *        and then one or two expired entries
+     */
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&cache->sh->queue);
+
+        cn = ngx_queue_data(q, ngx_resolver_cache_node_t, queue);
+
+        if (n++ != 0 && cn->valid >= now) {
+            return;
+        }
+
+        ngx_queue_remove(q);
+
+        ngx_rbtree_delete(&cache->sh->rbtree, &cn->sn.node);
+
+        ngx_slab_free_locked(cache->shpool, cn);
+    }
+}
+
+
 char *
 ngx_resolver_strerror(ngx_int_t err)
 {
@@ -18,6 +18,8 @@
 #define NGX_RESOLVE_PTR       12
 #define NGX_RESOLVE_MX        15
 #define NGX_RESOLVE_TXT       16
+#define NGX_RESOLVE_AAAA      28
+#define NGX_RESOLVE_SRV       33
 #define NGX_RESOLVE_DNAME     39
 
 #define NGX_RESOLVE_FORMERR   1
@@ -47,27 +49,69 @@ typedef struct ngx_resolver_ctx_s  ngx_resolver_ctx_t;
 typedef void (*ngx_resolver_handler_pt)(ngx_resolver_ctx_t *ctx);
 
 
+typedef struct {
+    ngx_str_t                 name;
+    u_short                   priority;
+    u_short                   weight;
+    u_short                   port;
+} ngx_resolver_srv_t;
+
+
+typedef struct {
+    ngx_str_t                 name;
+    u_short                   priority;
+    u_short                   weight;
+    u_short                   port;
+
+    ngx_resolver_ctx_t       *ctx;
+    ngx_int_t                 state;
+
+    ngx_uint_t                naddrs;
+    ngx_addr_t               *addrs;
+} ngx_resolver_srv_name_t;
+
+
 typedef struct {
     ngx_rbtree_node_t         node;
     ngx_queue_t               queue;
 
-    /* PTR: resolved name, A: name to resolve */
+    /* PTR: resolved name, A and SRV: name to resolve */
     u_char                   *name;
 
     u_short                   nlen;
     u_short                   qlen;
 
+    /* A, SRV or PTR query, it is freed when the answer is received */
     u_char                   *query;
+#if (NGX_HAVE_INET6)
+    u_char                   *query6;
+#endif
 
     union {
         in_addr_t             addr;
         in_addr_t            *addrs;
-        u_char               *cname;
+        ngx_resolver_srv_t   *srvs;
     } u;
 
+    u_char                   *cname;
+
     u_short                   naddrs;
+    u_short                   nsrvs;
     u_short                   cnlen;
 
+#if (NGX_HAVE_INET6)
+    union {
+        struct in6_addr       addr6;
+        struct in6_addr      *addrs6;
+    } u6;
+
+    u_short                   naddrs6;
+#endif
+
+    u_char                    code;
+    u_char                    prefetch;
+    uint32_t                  ttl;
+
     time_t                    expire;
     time_t                    valid;
 
@@ -91,15 +135,27 @@ typedef struct {
     ngx_rbtree_t              name_rbtree;
     ngx_rbtree_node_t         name_sentinel;
 
+    ngx_rbtree_t              srv_rbtree;
+    ngx_rbtree_node_t         srv_sentinel;
+
     ngx_rbtree_t              addr_rbtree;
     ngx_rbtree_node_t         addr_sentinel;
 
     ngx_queue_t               name_resend_queue;
+    ngx_queue_t               srv_resend_queue;
     ngx_queue_t               addr_resend_queue;
 
     ngx_queue_t               name_expire_queue;
+    ngx_queue_t               srv_expire_queue;
     ngx_queue_t               addr_expire_queue;
 
+#if (NGX_HAVE_INET6)
+    ngx_uint_t                ipv6;  /* unsigned  ipv6:1; */
+#endif
+
+    /* answers shared by all worker processes */
+    ngx_shm_zone_t           *shm_zone;
+
     time_t                    resend_timeout;
     time_t                    expire;
     time_t                    valid;
@@ -120,9 +176,19 @@ struct ngx_resolver_ctx_s {
     ngx_int_t                 type;
     ngx_str_t                 name;
 
+    /* A: addresses, PTR: address to resolve */
     ngx_uint_t                naddrs;
-    in_addr_t                *addrs;
-    in_addr_t                 addr;
+    ngx_addr_t               *addrs;
+    ngx_addr_t                addr;
+    struct sockaddr_in        sin;
+
+    /* SRV: records with addresses of their names */
+    ngx_uint_t                nsrvs;
+    ngx_resolver_srv_name_t  *srvs;
+    ngx_uint_t                count;
+
+    /* time until the answer is valid, taken from TTL */
+    time_t                    valid;
 
     ngx_resolver_handler_pt   handler;
     void                     *data;
@@ -12,6 +12,19 @@
 #if (NGX_HAVE_ATOMIC_OPS)
 
 
+#if (NGX_HAVE_FUTEX)
+
+/* futex() works with 32-bit words, the low word of ngx_atomic_t is used */
+
+#if (NGX_PTR_SIZE == 8 && !(NGX_HAVE_LITTLE_ENDIAN))
+#define ngx_shmtx_futex(mtx)  ((uint32_t *) (mtx)->futex + 1)
+#else
+#define ngx_shmtx_futex(mtx)  ((uint32_t *) (mtx)->futex)
+#endif
+
+#endif
+
+
 static void ngx_shmtx_wakeup(ngx_shmtx_t *mtx);
 
 
@@ -26,7 +39,12 @@ ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
 
     mtx->spin = 2048;
 
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_FUTEX)
+
+    mtx->wait = &addr->wait;
+    mtx->futex = &addr->futex;
+
+#elif (NGX_HAVE_POSIX_SEM)
 
     mtx->wait = &addr->wait;
 
@@ -46,7 +64,7 @@ ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
 void
 ngx_shmtx_destroy(ngx_shmtx_t *mtx)
 {
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_POSIX_SEM && !(NGX_HAVE_FUTEX))
 
     if (mtx->semaphore) {
         if (sem_destroy(&mtx->sem) == -1) {
@@ -70,6 +88,10 @@ void
 ngx_shmtx_lock(ngx_shmtx_t *mtx)
 {
     ngx_uint_t         i, n;
+#if (NGX_HAVE_FUTEX)
+    uint32_t           seq;
+    ngx_err_t          err;
+#endif
 
     ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0, "shmtx lock");
 
@@ -95,12 +117,54 @@ ngx_shmtx_lock(ngx_shmtx_t *mtx)
             }
         }
 
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_FUTEX)
+
+        if (mtx->futex) {
+
+            /*
+             * the sequence is read before the lock is tested,
+             * so a wakeup after the test makes futex() return at once
+             */
+
+            seq = *ngx_shmtx_futex(mtx);
+
+            (void) ngx_atomic_fetch_add(mtx->wait, 1);
+
+            if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+                (void) ngx_atomic_fetch_add(mtx->wait, -1);
+                return;
+            }
+
+            ngx_log_debug1(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                           "shmtx wait %uA", *mtx->wait);
+
+            if (syscall(SYS_futex, ngx_shmtx_futex(mtx), FUTEX_WAIT, seq,
+                        NULL, NULL, 0)
+                == -1)
+            {
+                err = ngx_errno;
+
+                if (err != NGX_EAGAIN && err != NGX_EINTR) {
+                    ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, err,
+                                  "futex() failed while waiting on shmtx");
+                }
+            }
+
+            ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                           "shmtx awoke");
+
+            /* the awoken process spins again before it sleeps */
+
+            continue;
+        }
+
+#elif (NGX_HAVE_POSIX_SEM)
 
         if (mtx->semaphore) {
             (void) ngx_atomic_fetch_add(mtx->wait, 1);
 
             if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+                (void) ngx_atomic_fetch_add(mtx->wait, -1);
                 return;
             }
 
@@ -163,7 +227,42 @@ ngx_shmtx_force_unlock(ngx_shmtx_t *mtx, ngx_pid_t pid)
 static void
 ngx_shmtx_wakeup(ngx_shmtx_t *mtx)
 {
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_FUTEX)
+    ngx_atomic_uint_t  wait;
+
+    if (mtx->futex == NULL) {
+        return;
+    }
+
+    for ( ;; ) {
+
+        wait = *mtx->wait;
+
+        if ((ngx_atomic_int_t) wait <= 0) {
+            return;
+        }
+
+        if (ngx_atomic_cmp_set(mtx->wait, wait, wait - 1)) {
+            break;
+        }
+    }
+
+    (void) ngx_atomic_fetch_add(mtx->futex, 1);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "shmtx wake %uA", wait);
+
+    /* the kernel wakes up the waiters in the order they went to sleep */
+
+    if (syscall(SYS_futex, ngx_shmtx_futex(mtx), FUTEX_WAKE, 1,
+                NULL, NULL, 0)
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "futex() failed while wake shmtx");
+    }
+
+#elif (NGX_HAVE_POSIX_SEM)
     ngx_atomic_uint_t  wait;
 
     if (!mtx->semaphore) {
@@ -174,7 +273,7 @@ ngx_shmtx_wakeup(ngx_shmtx_t *mtx)
 
         wait = *mtx->wait;
 
-        if (wait == 0) {
+        if ((ngx_atomic_int_t) wait <= 0) {
             return;
         }
 
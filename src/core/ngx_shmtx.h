@@ -15,16 +15,22 @@
 
 typedef struct {
     ngx_atomic_t   lock;
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_FUTEX || NGX_HAVE_POSIX_SEM)
     ngx_atomic_t   wait;
 #endif
+#if (NGX_HAVE_FUTEX)
+    ngx_atomic_t   futex;
+#endif
 } ngx_shmtx_sh_t;
 
 
 typedef struct {
 #if (NGX_HAVE_ATOMIC_OPS)
     ngx_atomic_t  *lock;
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_FUTEX)
+    ngx_atomic_t  *wait;
+    ngx_atomic_t  *futex;
+#elif (NGX_HAVE_POSIX_SEM)
     ngx_atomic_t  *wait;
     ngx_uint_t     semaphore;
     sem_t          sem;
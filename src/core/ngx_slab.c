@@ -56,6 +56,68 @@
 
 #endif
 
+
+/*
+ * a worker keeps up to NGX_SLAB_CACHE_SIZE, but no more than
+ * NGX_SLAB_CACHE_BYTES, free chunks of each size in a private magazine;
+ * the magazines are refilled and drained in batches under the zone mutex.
+ * The magazines of all workers together take no more than
+ * 1/NGX_SLAB_CACHE_SHARE of the zone.
+ *
+ * The magazines are kept in the zone itself and are owned by the pid
+ * of the worker, so the magazines of a worker that has exited abnormally
+ * are released by the master process and are drained by the worker that
+ * takes them over, or by any worker that runs out of memory in the zone.
+ *
+ * The cache only shortens the critical section of the users that keep
+ * their own data under the zone mutex, such as the rbtree layout of the
+ * limit_req and limit_conn zones; the "stripes" layout of these zones
+ * does not take the zone mutex instead.
+ */
+
+#define NGX_SLAB_CACHE_SIZE       16
+#define NGX_SLAB_CACHE_BYTES      2048
+#define NGX_SLAB_CACHE_SHARE      16
+#define NGX_SLAB_CACHE_MIN_PAGES  128
+
+
+typedef struct {
+    ngx_uint_t                 n;
+    ngx_uint_t                 size;
+    void                      *chunk[NGX_SLAB_CACHE_SIZE];
+} ngx_slab_magazine_t;
+
+
+struct ngx_slab_cache_s {
+    /* the owner, 0 if the cache is free */
+    ngx_atomic_t               pid;
+    ngx_slab_cache_t          *next;
+    ngx_slab_magazine_t        magazine[1];
+};
+
+
+typedef struct ngx_slab_cache_ref_s  ngx_slab_cache_ref_t;
+
+struct ngx_slab_cache_ref_s {
+    ngx_slab_pool_t           *pool;
+    ngx_slab_cache_t          *cache;
+    ngx_slab_cache_ref_t      *next;
+};
+
+
+static ngx_uint_t ngx_slab_slot(ngx_slab_pool_t *pool, size_t size);
+static void *ngx_slab_alloc_nocache(ngx_slab_pool_t *pool, size_t size);
+static void ngx_slab_free_nocache(ngx_slab_pool_t *pool, void *p);
+static ngx_slab_magazine_t *ngx_slab_get_magazine(ngx_slab_pool_t *pool,
+    ngx_uint_t slot, ngx_uint_t locked);
+static ngx_slab_magazine_t *ngx_slab_chunk_magazine(ngx_slab_pool_t *pool,
+    void *p, ngx_uint_t locked);
+static ngx_slab_cache_t *ngx_slab_create_cache(ngx_slab_pool_t *pool);
+static ngx_uint_t ngx_slab_flush_cache(ngx_slab_pool_t *pool,
+    ngx_slab_cache_t *cache);
+static ngx_uint_t ngx_slab_flush_pool_caches(ngx_slab_pool_t *pool);
+static void ngx_slab_drain_magazine(ngx_slab_pool_t *pool,
+    ngx_slab_magazine_t *mag, ngx_uint_t n);
 static ngx_slab_page_t *ngx_slab_alloc_pages(ngx_slab_pool_t *pool,
     ngx_uint_t pages);
 static void ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
@@ -68,6 +130,8 @@ static ngx_uint_t  ngx_slab_max_size;
 static ngx_uint_t  ngx_slab_exact_size;
 static ngx_uint_t  ngx_slab_exact_shift;
 
+static ngx_slab_cache_ref_t  *ngx_slab_caches;
+
 
 void
 ngx_slab_init(ngx_slab_pool_t *pool)
@@ -106,6 +170,13 @@ ngx_slab_init(ngx_slab_pool_t *pool)
 
     p += n * sizeof(ngx_slab_page_t);
 
+    pool->stats = (ngx_slab_stat_t *) p;
+    ngx_memzero(pool->stats, n * sizeof(ngx_slab_stat_t));
+
+    p += n * sizeof(ngx_slab_stat_t);
+
+    size -= n * (sizeof(ngx_slab_page_t) + sizeof(ngx_slab_stat_t));
+
     pages = (ngx_uint_t) (size / (ngx_pagesize + sizeof(ngx_slab_page_t)));
 
     ngx_memzero(p, pages * sizeof(ngx_slab_page_t));
@@ -129,20 +200,85 @@ ngx_slab_init(ngx_slab_pool_t *pool)
         pool->pages->slab = pages;
     }
 
+    pool->pfree = pages;
+
+    /* per-worker caches would hold too large a share of a small zone */
+
+    pool->cache = (pages >= NGX_SLAB_CACHE_MIN_PAGES);
+    pool->caches = NULL;
+    pool->log_nomem = 1;
+
     pool->log_ctx = &pool->zero;
     pool->zero = '\0';
 }
 
 
+static ngx_uint_t
+ngx_slab_slot(ngx_slab_pool_t *pool, size_t size)
+{
+    size_t      s;
+    ngx_uint_t  shift;
+
+    if (size <= pool->min_size) {
+        return 0;
+    }
+
+    shift = 1;
+    for (s = size - 1; s >>= 1; shift++) { /* void */ }
+
+    return shift - pool->min_shift;
+}
+
+
 void *
 ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 {
-    void  *p;
+    void                 *p;
+    ngx_uint_t            i, slot;
+    ngx_slab_magazine_t  *mag;
+
+    slot = 0;
+
+    if (size < ngx_slab_max_size) {
+        slot = ngx_slab_slot(pool, size);
+
+        mag = ngx_slab_get_magazine(pool, slot, 0);
+
+        if (mag && mag->n) {
+            p = mag->chunk[--mag->n];
+
+            ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                           "slab alloc: %p cached", p);
+
+            return p;
+        }
+    }
 
     ngx_shmtx_lock(&pool->mutex);
 
     p = ngx_slab_alloc_locked(pool, size);
 
+    mag = NULL;
+
+    if (p && size < ngx_slab_max_size) {
+        mag = ngx_slab_get_magazine(pool, slot, 1);
+    }
+
+    if (mag) {
+
+        /* refill a half of the magazine while the mutex is held */
+
+        for (i = mag->size / 2; i; i--) {
+            mag->chunk[mag->n] = ngx_slab_alloc_nocache(pool, size);
+
+            if (mag->chunk[mag->n] == NULL) {
+                break;
+            }
+
+            mag->n++;
+        }
+    }
+
     ngx_shmtx_unlock(&pool->mutex);
 
     return p;
@@ -151,6 +287,67 @@ ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 
 void *
 ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
+{
+    void                 *p;
+    ngx_uint_t            slot;
+    ngx_slab_magazine_t  *mag;
+
+    if (size >= ngx_slab_max_size) {
+
+        p = ngx_slab_alloc_nocache(pool, size);
+
+        if (p == NULL && ngx_slab_flush_pool_caches(pool)) {
+            p = ngx_slab_alloc_nocache(pool, size);
+        }
+
+        if (p == NULL && pool->log_nomem) {
+            ngx_slab_error(pool, NGX_LOG_CRIT,
+                           "ngx_slab_alloc() failed: no memory");
+        }
+
+        return p;
+    }
+
+    slot = ngx_slab_slot(pool, size);
+
+    mag = ngx_slab_get_magazine(pool, slot, 1);
+
+    if (mag && mag->n) {
+        p = mag->chunk[--mag->n];
+
+        ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                       "slab alloc: %p cached", p);
+
+        return p;
+    }
+
+    p = ngx_slab_alloc_nocache(pool, size);
+
+    if (p == NULL && ngx_slab_flush_pool_caches(pool)) {
+        p = ngx_slab_alloc_nocache(pool, size);
+    }
+
+    if (p == NULL) {
+        pool->stats[slot].fails++;
+
+        if (!pool->log_nomem) {
+            return NULL;
+        }
+
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, 0,
+                      "ngx_slab_alloc() failed: no memory for %uz bytes, "
+                      "%ui of %ui chunks of %uz bytes used, %ui failures%s",
+                      size, pool->stats[slot].used, pool->stats[slot].total,
+                      (size_t) 1 << (slot + pool->min_shift),
+                      pool->stats[slot].fails, pool->log_ctx);
+    }
+
+    return p;
+}
+
+
+static void *
+ngx_slab_alloc_nocache(ngx_slab_pool_t *pool, size_t size)
 {
     size_t            s;
     uintptr_t         p, n, m, mask, *bitmap;
@@ -164,15 +361,17 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
         page = ngx_slab_alloc_pages(pool, (size >> ngx_pagesize_shift)
                                           + ((size % ngx_pagesize) ? 1 : 0));
-        if (page) {
-            p = (page - pool->pages) << ngx_pagesize_shift;
-            p += (uintptr_t) pool->start;
-
-        } else {
-            p = 0;
+        if (page == NULL) {
+            return NULL;
         }
 
-        goto done;
+        p = (page - pool->pages) << ngx_pagesize_shift;
+        p += (uintptr_t) pool->start;
+
+        ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                       "slab alloc: %p", p);
+
+        return (void *) p;
     }
 
     if (size > pool->min_size) {
@@ -189,6 +388,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
     ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
                    "slab alloc: %uz slot: %ui", size, slot);
 
+    pool->stats[slot].reqs++;
+
     slots = (ngx_slab_page_t *) ((u_char *) pool + sizeof(ngx_slab_pool_t));
     page = slots[slot].next;
 
@@ -340,6 +541,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
             bitmap[0] = (2 << n) - 1;
 
+            pool->stats[slot].total += (ngx_pagesize >> shift) - n;
+
             map = (1 << (ngx_pagesize_shift - shift)) / (sizeof(uintptr_t) * 8);
 
             for (i = 1; i < map; i++) {
@@ -363,6 +566,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
             page->next = &slots[slot];
             page->prev = (uintptr_t) &slots[slot] | NGX_SLAB_EXACT;
 
+            pool->stats[slot].total += 8 * sizeof(uintptr_t);
+
             slots[slot].next = page;
 
             p = (page - pool->pages) << ngx_pagesize_shift;
@@ -376,6 +581,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
             page->next = &slots[slot];
             page->prev = (uintptr_t) &slots[slot] | NGX_SLAB_BIG;
 
+            pool->stats[slot].total += ngx_pagesize >> shift;
+
             slots[slot].next = page;
 
             p = (page - pool->pages) << ngx_pagesize_shift;
@@ -385,10 +592,12 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
         }
     }
 
-    p = 0;
+    return NULL;
 
 done:
 
+    pool->stats[slot].used++;
+
     ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0, "slab alloc: %p", p);
 
     return (void *) p;
@@ -398,6 +607,19 @@ done:
 void
 ngx_slab_free(ngx_slab_pool_t *pool, void *p)
 {
+    ngx_slab_magazine_t  *mag;
+
+    mag = ngx_slab_chunk_magazine(pool, p, 0);
+
+    if (mag && mag->n < mag->size) {
+
+        ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                       "slab free: %p cached", p);
+
+        mag->chunk[mag->n++] = p;
+        return;
+    }
+
     ngx_shmtx_lock(&pool->mutex);
 
     ngx_slab_free_locked(pool, p);
@@ -408,6 +630,30 @@ ngx_slab_free(ngx_slab_pool_t *pool, void *p)
 
 void
 ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
+{
+    ngx_slab_magazine_t  *mag;
+
+    mag = ngx_slab_chunk_magazine(pool, p, 1);
+
+    if (mag) {
+
+        ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                       "slab free: %p cached", p);
+
+        if (mag->n == mag->size) {
+            ngx_slab_drain_magazine(pool, mag, (mag->size + 1) / 2);
+        }
+
+        mag->chunk[mag->n++] = p;
+        return;
+    }
+
+    ngx_slab_free_nocache(pool, p);
+}
+
+
+static void
+ngx_slab_free_nocache(ngx_slab_pool_t *pool, void *p)
 {
     size_t            size;
     uintptr_t         slab, m, *bitmap;
@@ -443,11 +689,11 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
         bitmap = (uintptr_t *) ((uintptr_t) p & ~(ngx_pagesize - 1));
 
         if (bitmap[n] & m) {
+            slot = shift - pool->min_shift;
 
             if (page->next == NULL) {
                 slots = (ngx_slab_page_t *)
                                    ((u_char *) pool + sizeof(ngx_slab_pool_t));
-                slot = shift - pool->min_shift;
 
                 page->next = slots[slot].next;
                 slots[slot].next = page;
@@ -458,6 +704,8 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
             bitmap[n] &= ~m;
 
+            pool->stats[slot].used--;
+
             n = (1 << (ngx_pagesize_shift - shift)) / 8 / (1 << shift);
 
             if (n == 0) {
@@ -476,6 +724,14 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
                 }
             }
 
+            n = (1 << (ngx_pagesize_shift - shift)) / 8 / (1 << shift);
+
+            if (n == 0) {
+                n = 1;
+            }
+
+            pool->stats[slot].total -= (ngx_pagesize >> shift) - n;
+
             ngx_slab_free_pages(pool, page, 1);
 
             goto done;
@@ -494,10 +750,11 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
         }
 
         if (slab & m) {
+            slot = ngx_slab_exact_shift - pool->min_shift;
+
             if (slab == NGX_SLAB_BUSY) {
                 slots = (ngx_slab_page_t *)
                                    ((u_char *) pool + sizeof(ngx_slab_pool_t));
-                slot = ngx_slab_exact_shift - pool->min_shift;
 
                 page->next = slots[slot].next;
                 slots[slot].next = page;
@@ -508,10 +765,14 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
             page->slab &= ~m;
 
+            pool->stats[slot].used--;
+
             if (page->slab) {
                 goto done;
             }
 
+            pool->stats[slot].total -= 8 * sizeof(uintptr_t);
+
             ngx_slab_free_pages(pool, page, 1);
 
             goto done;
@@ -532,11 +793,11 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
                               + NGX_SLAB_MAP_SHIFT);
 
         if (slab & m) {
+            slot = shift - pool->min_shift;
 
             if (page->next == NULL) {
                 slots = (ngx_slab_page_t *)
                                    ((u_char *) pool + sizeof(ngx_slab_pool_t));
-                slot = shift - pool->min_shift;
 
                 page->next = slots[slot].next;
                 slots[slot].next = page;
@@ -547,10 +808,14 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
             page->slab &= ~m;
 
+            pool->stats[slot].used--;
+
             if (page->slab & NGX_SLAB_MAP_MASK) {
                 goto done;
             }
 
+            pool->stats[slot].total -= ngx_pagesize >> shift;
+
             ngx_slab_free_pages(pool, page, 1);
 
             goto done;
@@ -642,6 +907,8 @@ ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
             page->next = NULL;
             page->prev = NGX_SLAB_PAGE;
 
+            pool->pfree -= pages;
+
             if (--pages == 0) {
                 return page;
             }
@@ -657,8 +924,6 @@ ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
         }
     }
 
-    ngx_slab_error(pool, NGX_LOG_CRIT, "ngx_slab_alloc() failed: no memory");
-
     return NULL;
 }
 
@@ -669,6 +934,8 @@ ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
 {
     ngx_slab_page_t  *prev;
 
+    pool->pfree += pages;
+
     page->slab = pages--;
 
     if (pages) {
@@ -690,6 +957,285 @@ ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
 }
 
 
+static ngx_slab_magazine_t *
+ngx_slab_get_magazine(ngx_slab_pool_t *pool, ngx_uint_t slot,
+    ngx_uint_t locked)
+{
+    ngx_slab_cache_t      *cache;
+    ngx_slab_cache_ref_t  *ref;
+
+    /*
+     * the chunks cached by the master process would be inherited
+     * by all workers, so only the workers keep the caches
+     */
+
+    if (!pool->cache || ngx_process != NGX_PROCESS_WORKER) {
+        return NULL;
+    }
+
+    for (ref = ngx_slab_caches; ref; ref = ref->next) {
+        if (ref->pool == pool) {
+            goto found;
+        }
+    }
+
+    /* the cache is allocated in the zone, so the mutex should be held */
+
+    if (!locked) {
+        return NULL;
+    }
+
+    ref = ngx_alloc(sizeof(ngx_slab_cache_ref_t), ngx_cycle->log);
+    if (ref == NULL) {
+        return NULL;
+    }
+
+    ref->pool = pool;
+    ref->cache = ngx_slab_create_cache(pool);
+
+    ref->next = ngx_slab_caches;
+    ngx_slab_caches = ref;
+
+found:
+
+    cache = ref->cache;
+
+    if (cache == NULL || cache->magazine[slot].size == 0) {
+        return NULL;
+    }
+
+    return &cache->magazine[slot];
+}
+
+
+static ngx_slab_magazine_t *
+ngx_slab_chunk_magazine(ngx_slab_pool_t *pool, void *p, ngx_uint_t locked)
+{
+    ngx_uint_t        shift;
+    ngx_slab_page_t  *page;
+
+    if (!pool->cache || ngx_process != NGX_PROCESS_WORKER) {
+        return NULL;
+    }
+
+    /* invalid pointers are left to ngx_slab_free_nocache() to report */
+
+    if ((u_char *) p < pool->start || (u_char *) p >= pool->end) {
+        return NULL;
+    }
+
+    page = &pool->pages[((u_char *) p - pool->start) >> ngx_pagesize_shift];
+
+    switch (page->prev & NGX_SLAB_PAGE_MASK) {
+
+    case NGX_SLAB_SMALL:
+    case NGX_SLAB_BIG:
+        shift = page->slab & NGX_SLAB_SHIFT_MASK;
+        break;
+
+    case NGX_SLAB_EXACT:
+        shift = ngx_slab_exact_shift;
+        break;
+
+    default: /* NGX_SLAB_PAGE */
+        return NULL;
+    }
+
+    if (shift < pool->min_shift
+        || ((uintptr_t) p & (((uintptr_t) 1 << shift) - 1)))
+    {
+        return NULL;
+    }
+
+    return ngx_slab_get_magazine(pool, shift - pool->min_shift, locked);
+}
+
+
+static ngx_slab_cache_t *
+ngx_slab_create_cache(ngx_slab_pool_t *pool)
+{
+    size_t             size, bytes;
+    ngx_int_t          workers;
+    ngx_uint_t         i, n;
+    ngx_core_conf_t   *ccf;
+    ngx_slab_cache_t  *cache;
+
+    n = ngx_pagesize_shift - pool->min_shift;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                           ngx_core_module);
+
+    workers = ngx_max(ccf->worker_processes, 1);
+
+    bytes = (pool->end - pool->start) / (NGX_SLAB_CACHE_SHARE * workers * n);
+    bytes = ngx_min(bytes, NGX_SLAB_CACHE_BYTES);
+
+    if ((bytes >> pool->min_shift) == 0) {
+        return NULL;
+    }
+
+    /* take over a cache released by an exited worker */
+
+    for (cache = pool->caches; cache; cache = cache->next) {
+        if (cache->pid == 0 && ngx_atomic_cmp_set(&cache->pid, 0, ngx_pid)) {
+            (void) ngx_slab_flush_cache(pool, cache);
+            goto found;
+        }
+    }
+
+    size = sizeof(ngx_slab_cache_t) + (n - 1) * sizeof(ngx_slab_magazine_t);
+
+    cache = ngx_slab_alloc_nocache(pool, size);
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    cache->pid = ngx_pid;
+
+    cache->next = pool->caches;
+    pool->caches = cache;
+
+found:
+
+    for (i = 0; i < n; i++) {
+        size = bytes >> (pool->min_shift + i);
+
+        cache->magazine[i].n = 0;
+        cache->magazine[i].size = ngx_min(size, NGX_SLAB_CACHE_SIZE);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                   "slab cache: %p, %uz bytes per size", cache, bytes);
+
+    return cache;
+}
+
+
+static ngx_uint_t
+ngx_slab_flush_cache(ngx_slab_pool_t *pool, ngx_slab_cache_t *cache)
+{
+    ngx_uint_t  i, n, flushed;
+
+    flushed = 0;
+    n = ngx_pagesize_shift - pool->min_shift;
+
+    for (i = 0; i < n; i++) {
+        flushed += cache->magazine[i].n;
+        ngx_slab_drain_magazine(pool, &cache->magazine[i],
+                                cache->magazine[i].n);
+    }
+
+    return flushed;
+}
+
+
+static ngx_uint_t
+ngx_slab_flush_pool_caches(ngx_slab_pool_t *pool)
+{
+    ngx_uint_t         flushed;
+    ngx_slab_cache_t  *cache;
+
+    /* the own cache of the worker and the caches of exited workers */
+
+    flushed = 0;
+
+    for (cache = pool->caches; cache; cache = cache->next) {
+        if (cache->pid == (ngx_atomic_uint_t) ngx_pid || cache->pid == 0) {
+            flushed += ngx_slab_flush_cache(pool, cache);
+        }
+    }
+
+    return flushed;
+}
+
+
+static void
+ngx_slab_drain_magazine(ngx_slab_pool_t *pool, ngx_slab_magazine_t *mag,
+    ngx_uint_t n)
+{
+    if (n == 0) {
+        return;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                   "slab drain: %ui of %ui", n, mag->n);
+
+    while (n--) {
+        ngx_slab_free_nocache(pool, mag->chunk[--mag->n]);
+    }
+}
+
+
+void
+ngx_slab_flush_caches(void)
+{
+    ngx_slab_cache_t      *cache;
+    ngx_slab_cache_ref_t  *ref;
+
+    for (ref = ngx_slab_caches; ref; ref = ref->next) {
+        cache = ref->cache;
+
+        if (cache == NULL) {
+            continue;
+        }
+
+        ngx_shmtx_lock(&ref->pool->mutex);
+
+        (void) ngx_slab_flush_cache(ref->pool, cache);
+
+        cache->pid = 0;
+
+        ngx_shmtx_unlock(&ref->pool->mutex);
+    }
+}
+
+
+void
+ngx_slab_release_caches(ngx_slab_pool_t *pool, ngx_pid_t pid)
+{
+    ngx_slab_cache_t  *cache;
+
+    /*
+     * the caches of an abnormally exited worker are left with their
+     * chunks, they are drained by a worker under the zone mutex
+     */
+
+    for (cache = pool->caches; cache; cache = cache->next) {
+        (void) ngx_atomic_cmp_set(&cache->pid, pid, 0);
+    }
+}
+
+
+void
+ngx_slab_log_stats(ngx_slab_pool_t *pool, ngx_log_t *log)
+{
+    ngx_uint_t  i, n;
+
+    ngx_log_error(NGX_LOG_INFO, log, 0,
+                  "slab: %ui of %ui pages free%s", pool->pfree,
+                  (ngx_uint_t) ((pool->end - pool->start)
+                                >> ngx_pagesize_shift),
+                  pool->log_ctx);
+
+    n = ngx_pagesize_shift - pool->min_shift;
+
+    for (i = 0; i < n; i++) {
+
+        if (pool->stats[i].reqs == 0) {
+            continue;
+        }
+
+        ngx_log_error(NGX_LOG_INFO, log, 0,
+                      "slab: %uz bytes: %ui of %ui chunks used, "
+                      "%ui requests, %ui failures%s",
+                      (size_t) 1 << (i + pool->min_shift),
+                      pool->stats[i].used, pool->stats[i].total,
+                      pool->stats[i].reqs, pool->stats[i].fails,
+                      pool->log_ctx);
+    }
+}
+
+
 static void
 ngx_slab_error(ngx_slab_pool_t *pool, ngx_uint_t level, char *text)
 {
@@ -22,6 +22,18 @@ struct ngx_slab_page_s {
 };
 
 
+typedef struct ngx_slab_cache_s  ngx_slab_cache_t;
+
+
+typedef struct {
+    ngx_uint_t        total;
+    ngx_uint_t        used;
+
+    ngx_uint_t        reqs;
+    ngx_uint_t        fails;
+} ngx_slab_stat_t;
+
+
 typedef struct {
     ngx_shmtx_sh_t    lock;
 
@@ -31,6 +43,11 @@ typedef struct {
     ngx_slab_page_t  *pages;
     ngx_slab_page_t   free;
 
+    ngx_slab_stat_t  *stats;
+    ngx_uint_t        pfree;
+
+    ngx_slab_cache_t *caches;
+
     u_char           *start;
     u_char           *end;
 
@@ -39,6 +56,9 @@ typedef struct {
     u_char           *log_ctx;
     u_char            zero;
 
+    unsigned          cache:1;
+    unsigned          log_nomem:1;
+
     void             *data;
     void             *addr;
 } ngx_slab_pool_t;
@@ -49,6 +69,9 @@ void *ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
 void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
+void ngx_slab_flush_caches(void);
+void ngx_slab_release_caches(ngx_slab_pool_t *pool, ngx_pid_t pid);
+void ngx_slab_log_stats(ngx_slab_pool_t *pool, ngx_log_t *log);
 
 
 #endif /* _NGX_SLAB_H_INCLUDED_ */
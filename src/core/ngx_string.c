@@ -13,11 +13,27 @@ static u_char *ngx_sprintf_num(u_char *buf, u_char *last, uint64_t ui64,
     u_char zero, ngx_uint_t hexadecimal, ngx_uint_t width);
 static ngx_int_t ngx_decode_base64_internal(ngx_str_t *dst, ngx_str_t *src,
     const u_char *basis);
+#if (NGX_HAVE_SSSE3)
+static size_t ngx_escape_uri_ssse3(u_char *src, size_t size, u_char *lut,
+    ngx_uint_t *n) __attribute__ ((target ("ssse3")));
+#endif
 
 
 void
 ngx_strlow(u_char *dst, u_char *src, size_t n)
 {
+#if (NGX_HAVE_SSE2)
+
+    while (n >= 16) {
+        _mm_storeu_si128((__m128i *) dst,
+                         ngx_tolower_sse2(_mm_loadu_si128((__m128i *) src)));
+        dst += 16;
+        src += 16;
+        n -= 16;
+    }
+
+#endif
+
     while (n) {
         *dst = ngx_tolower(*src);
         dst++;
@@ -591,6 +607,34 @@ ngx_int_t
 ngx_strncasecmp(u_char *s1, u_char *s2, size_t n)
 {
     ngx_uint_t  c1, c2;
+#if (NGX_HAVE_SSE2)
+    __m128i     x1, x2;
+
+    /*
+     * the strings may be shorter than n, so the vectors must not cross
+     * a page boundary; the block with a difference or a NUL is left to
+     * the loop below
+     */
+
+    while (n >= 16
+           && ((uintptr_t) s1 & 0xfff) <= 0x1000 - 16
+           && ((uintptr_t) s2 & 0xfff) <= 0x1000 - 16)
+    {
+        x1 = ngx_tolower_sse2(_mm_loadu_si128((__m128i *) s1));
+        x2 = ngx_tolower_sse2(_mm_loadu_si128((__m128i *) s2));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x1, x2)) != 0xffff
+            || _mm_movemask_epi8(_mm_cmpeq_epi8(x1, _mm_setzero_si128())))
+        {
+            break;
+        }
+
+        s1 += 16;
+        s2 += 16;
+        n -= 16;
+    }
+
+#endif
 
     while (n) {
         c1 = (ngx_uint_t) *s1++;
@@ -1342,6 +1386,12 @@ ngx_escape_uri(u_char *dst, u_char *src, size_t size, ngx_uint_t type)
 {
     ngx_uint_t      n;
     uint32_t       *escape;
+#if (NGX_HAVE_SSSE3)
+    size_t          len;
+    ngx_uint_t      c, ssse3;
+    static u_char   luts[7][32];
+    static ngx_uint_t  init;
+#endif
     static u_char   hex[] = "0123456789abcdef";
 
                     /* " ", "#", "%", "?", %00-%1F, %7F-%FF */
@@ -1472,12 +1522,45 @@ ngx_escape_uri(u_char *dst, u_char *src, size_t size, ngx_uint_t type)
 
     escape = map[type];
 
+#if (NGX_HAVE_SSSE3)
+
+    ssse3 = ngx_cpu_features & NGX_CPU_SSSE3;
+
+    if (ssse3 && !(init & (1 << type))) {
+
+        /*
+         * the escape map is split by the low nibble of a character,
+         * the bits of a byte are the high nibbles 0-7 in the first half
+         * of a table, and the high nibbles 8-15 in the second one
+         */
+
+        for (c = 0; c < 256; c++) {
+            if (escape[c >> 5] & (1 << (c & 0x1f))) {
+                luts[type][(c >> 7) * 16 + (c & 0xf)] |= 1 << ((c >> 4) & 7);
+            }
+        }
+
+        init |= 1 << type;
+    }
+
+#endif
+
     if (dst == NULL) {
 
         /* find the number of the characters to be escaped */
 
         n = 0;
 
+#if (NGX_HAVE_SSSE3)
+
+        if (ssse3 && size >= 16) {
+            len = ngx_escape_uri_ssse3(src, size, luts[type], &n);
+            src += len;
+            size -= len;
+        }
+
+#endif
+
         while (size) {
             if (escape[*src >> 5] & (1 << (*src & 0x1f))) {
                 n++;
@@ -1490,6 +1573,23 @@ ngx_escape_uri(u_char *dst, u_char *src, size_t size, ngx_uint_t type)
     }
 
     while (size) {
+
+#if (NGX_HAVE_SSSE3)
+
+        if (ssse3 && size >= 16) {
+            len = ngx_escape_uri_ssse3(src, size, luts[type], NULL);
+
+            dst = ngx_cpymem(dst, src, len);
+            src += len;
+            size -= len;
+
+            if (size == 0) {
+                break;
+            }
+        }
+
+#endif
+
         if (escape[*src >> 5] & (1 << (*src & 0x1f))) {
             *dst++ = '%';
             *dst++ = hex[*src >> 4];
@@ -1506,10 +1606,70 @@ ngx_escape_uri(u_char *dst, u_char *src, size_t size, ngx_uint_t type)
 }
 
 
+#if (NGX_HAVE_SSSE3)
+
+/*
+ * if n is NULL, returns the length of the prefix without characters
+ * to be escaped, otherwise counts such characters in the whole vectors
+ * and returns the length scanned
+ */
+
+static size_t
+ngx_escape_uri_ssse3(u_char *src, size_t size, u_char *lut, ngx_uint_t *n)
+{
+    int       m;
+    u_char   *p, *last;
+    __m128i   x, lo, hi, row, low, high, bits, f;
+
+    low = _mm_loadu_si128((__m128i *) lut);
+    high = _mm_loadu_si128((__m128i *) &lut[16]);
+    bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char) 128,
+                         1, 2, 4, 8, 16, 32, 64, (char) 128);
+    f = _mm_set1_epi8(0x0f);
+
+    p = src;
+    last = src + size;
+
+    while (last - p >= 16) {
+        x = _mm_loadu_si128((__m128i *) p);
+
+        lo = _mm_and_si128(x, f);
+        hi = _mm_and_si128(_mm_srli_epi16(x, 4), f);
+
+        row = _mm_cmpgt_epi8(hi, _mm_set1_epi8(7));
+        row = _mm_or_si128(_mm_andnot_si128(row, _mm_shuffle_epi8(low, lo)),
+                           _mm_and_si128(row, _mm_shuffle_epi8(high, lo)));
+
+        row = _mm_and_si128(row, _mm_shuffle_epi8(bits, hi));
+        x = _mm_cmpeq_epi8(row, _mm_setzero_si128());
+
+        m = _mm_movemask_epi8(x) ^ 0xffff;
+
+        if (m) {
+            if (n == NULL) {
+                return p - src + __builtin_ctz(m);
+            }
+
+            *n += __builtin_popcount(m);
+        }
+
+        p += 16;
+    }
+
+    return p - src;
+}
+
+#endif
+
+
 void
 ngx_unescape_uri(u_char **dst, u_char **src, size_t size, ngx_uint_t type)
 {
     u_char  *d, *s, ch, c, decoded;
+#if (NGX_HAVE_SSE2)
+    int      m;
+    __m128i  x, pct, stop;
+#endif
     enum {
         sw_usual = 0,
         sw_quoted,
@@ -1522,6 +1682,12 @@ ngx_unescape_uri(u_char **dst, u_char **src, size_t size, ngx_uint_t type)
     state = 0;
     decoded = 0;
 
+#if (NGX_HAVE_SSE2)
+    pct = _mm_set1_epi8('%');
+    stop = _mm_set1_epi8((type & (NGX_UNESCAPE_URI|NGX_UNESCAPE_REDIRECT))
+                         ? '?' : '%');
+#endif
+
     while (size--) {
 
         ch = *s++;
@@ -1541,6 +1707,41 @@ ngx_unescape_uri(u_char **dst, u_char **src, size_t size, ngx_uint_t type)
             }
 
             *d++ = ch;
+
+#if (NGX_HAVE_SSE2)
+
+            /*
+             * copy up to the next "%" or "?"; the destination
+             * may be the source itself, so a vector is loaded before
+             * it is stored, and the rest is copied bytewise
+             */
+
+            while (size >= 16) {
+                x = _mm_loadu_si128((__m128i *) s);
+
+                m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, pct),
+                                                   _mm_cmpeq_epi8(x, stop)));
+
+                if (m) {
+                    m = __builtin_ctz(m);
+                    size -= m;
+
+                    while (m--) {
+                        *d++ = *s++;
+                    }
+
+                    break;
+                }
+
+                _mm_storeu_si128((__m128i *) d, x);
+
+                d += 16;
+                s += 16;
+                size -= 16;
+            }
+
+#endif
+
             break;
 
         case sw_quoted:
@@ -1641,11 +1842,35 @@ ngx_escape_html(u_char *dst, u_char *src, size_t size)
 {
     u_char      ch;
     ngx_uint_t  len;
+#if (NGX_HAVE_SSE2)
+    int         m, lt, gt, amp, quot;
+    __m128i     x;
+#endif
 
     if (dst == NULL) {
 
         len = 0;
 
+#if (NGX_HAVE_SSE2)
+
+        while (size >= 16) {
+            x = _mm_loadu_si128((__m128i *) src);
+
+            lt = _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('<')));
+            gt = _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('>')));
+            amp = _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('&')));
+            quot = _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('"')));
+
+            len += __builtin_popcount(lt | gt) * (sizeof("&lt;") - 2)
+                   + __builtin_popcount(amp) * (sizeof("&amp;") - 2)
+                   + __builtin_popcount(quot) * (sizeof("&quot;") - 2);
+
+            src += 16;
+            size -= 16;
+        }
+
+#endif
+
         while (size) {
             switch (*src++) {
 
@@ -1675,6 +1900,38 @@ ngx_escape_html(u_char *dst, u_char *src, size_t size)
     }
 
     while (size) {
+
+#if (NGX_HAVE_SSE2)
+
+        if (size >= 16) {
+            x = _mm_loadu_si128((__m128i *) src);
+
+            m = _mm_movemask_epi8(
+                    _mm_or_si128(
+                        _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('<')),
+                                     _mm_cmpeq_epi8(x, _mm_set1_epi8('>'))),
+                        _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('&')),
+                                     _mm_cmpeq_epi8(x, _mm_set1_epi8('"')))));
+
+            if (m == 0) {
+                _mm_storeu_si128((__m128i *) dst, x);
+
+                dst += 16;
+                src += 16;
+                size -= 16;
+
+                continue;
+            }
+
+            m = __builtin_ctz(m);
+
+            dst = ngx_cpymem(dst, src, m);
+            src += m;
+            size -= m;
+        }
+
+#endif
+
         ch = *src++;
 
         switch (ch) {
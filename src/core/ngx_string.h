@@ -49,6 +49,21 @@ typedef struct {
 
 void ngx_strlow(u_char *dst, u_char *src, size_t n);
 
+#if (NGX_HAVE_SSE2)
+
+static ngx_inline __m128i
+ngx_tolower_sse2(__m128i x)
+{
+    __m128i  upper;
+
+    upper = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('A' - 1)),
+                          _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), x));
+
+    return _mm_or_si128(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+#endif
+
 
 #define ngx_strncmp(s1, s2, n)  strncmp((const char *) s1, (const char *) s2, n)
 
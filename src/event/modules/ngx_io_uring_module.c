@@ -0,0 +1,1428 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * The completion user_data of a connection poll request is the connection
+ * address with the instance bit, the file aio reads are marked by the second
+ * low bit, the socket sends are marked by the third low bit, and the poll
+ * update and removal requests have zero user_data.
+ */
+
+#define NGX_IO_URING_CONTROL  0
+#define NGX_IO_URING_AIO      2
+#define NGX_IO_URING_SEND     4
+
+
+#define NGX_IO_URING_ADD      0
+#define NGX_IO_URING_UPDATE   1
+#define NGX_IO_URING_REMOVE   2
+
+
+/*
+ * the data queued to a connection that is being closed are still sent,
+ * but not longer than this time
+ */
+
+#define NGX_IO_URING_SEND_LINGER  60000
+
+
+typedef struct {
+    ngx_uint_t             entries;
+    size_t                 send_buffer_size;
+} ngx_io_uring_conf_t;
+
+
+typedef struct ngx_io_uring_send_s  ngx_io_uring_send_t;
+
+struct ngx_io_uring_send_s {
+    /* NULL if the connection was closed while the data are being sent */
+    ngx_connection_t      *connection;
+
+    u_char                *pos;
+    u_char                *last;
+    u_char                *start;
+    u_char                *end;
+
+    /* the index of the submission entry */
+    uint32_t               sqe;
+
+    ngx_err_t              err;
+    unsigned               busy:1;
+
+    ngx_event_t            event;
+
+    ngx_io_uring_send_t   *next;
+};
+
+
+typedef struct {
+    uint32_t              *head;
+    uint32_t              *tail;
+    uint32_t              *flags;
+    uint32_t               mask;
+    uint32_t               entries;
+
+    /* the tail of the queued, but not yet published entries */
+    uint32_t               queued;
+
+    struct io_uring_sqe   *sqes;
+} ngx_io_uring_sq_t;
+
+
+typedef struct {
+    uint32_t              *head;
+    uint32_t              *tail;
+    uint32_t               mask;
+
+    struct io_uring_cqe   *cqes;
+} ngx_io_uring_cq_t;
+
+
+static ngx_int_t ngx_io_uring_init(ngx_cycle_t *cycle, ngx_msec_t timer);
+static ngx_int_t ngx_io_uring_setup_ring(ngx_cycle_t *cycle,
+    ngx_io_uring_conf_t *urcf);
+static void ngx_io_uring_done(ngx_cycle_t *cycle);
+static ngx_int_t ngx_io_uring_add_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_io_uring_del_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_io_uring_del_connection(ngx_connection_t *c,
+    ngx_uint_t flags);
+static ngx_int_t ngx_io_uring_process_events(ngx_cycle_t *cycle,
+    ngx_msec_t timer, ngx_uint_t flags);
+
+static ngx_int_t ngx_io_uring_poll(ngx_connection_t *c, ngx_uint_t op,
+    uint32_t events, ngx_uint_t level, ngx_log_t *log);
+static struct io_uring_sqe *ngx_io_uring_get_sqe(ngx_log_t *log);
+static ngx_int_t ngx_io_uring_submit(ngx_log_t *log);
+
+static ssize_t ngx_io_uring_send(ngx_connection_t *c, u_char *buf,
+    size_t size);
+static ngx_chain_t *ngx_io_uring_send_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+static ngx_int_t ngx_io_uring_send_pending(ngx_connection_t *c);
+static ngx_int_t ngx_io_uring_send_start(ngx_connection_t *c,
+    ngx_io_uring_send_t *s);
+static ngx_int_t ngx_io_uring_send_queue(ngx_io_uring_send_t *s,
+    ngx_log_t *log);
+static void ngx_io_uring_send_done(ngx_io_uring_send_t *s, int32_t res,
+    ngx_log_t *log);
+static ngx_int_t ngx_io_uring_send_close(ngx_connection_t *c);
+static void ngx_io_uring_send_linger_handler(ngx_event_t *ev);
+static ngx_io_uring_send_t *ngx_io_uring_alloc_send(ngx_connection_t *c);
+static void ngx_io_uring_free_send(ngx_io_uring_send_t *s);
+
+static void *ngx_io_uring_create_conf(ngx_cycle_t *cycle);
+static char *ngx_io_uring_init_conf(ngx_cycle_t *cycle, void *conf);
+
+
+static int                  ring = -1;
+static ngx_io_uring_sq_t    sq;
+static ngx_io_uring_cq_t    cq;
+
+static u_char              *sq_ring;
+static size_t               sq_ring_size;
+static u_char              *cq_ring;
+static size_t               cq_ring_size;
+static size_t               sqes_size;
+
+/* the sends in progress or failed, in the order of cycle->connections */
+static ngx_io_uring_send_t **sends;
+static ngx_uint_t           nsends;
+static ngx_io_uring_send_t *free_sends;
+static size_t               send_buffer_size;
+
+
+static ngx_os_io_t  ngx_io_uring_os_io;
+
+
+static ngx_str_t      io_uring_name = ngx_string("io_uring");
+
+static ngx_command_t  ngx_io_uring_commands[] = {
+
+    { ngx_string("io_uring_entries"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_io_uring_conf_t, entries),
+      NULL },
+
+    { ngx_string("io_uring_send_buffer_size"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      0,
+      offsetof(ngx_io_uring_conf_t, send_buffer_size),
+      NULL },
+
+      ngx_null_command
+};
+
+
+ngx_event_module_t  ngx_io_uring_module_ctx = {
+    &io_uring_name,
+    ngx_io_uring_create_conf,            /* create configuration */
+    ngx_io_uring_init_conf,              /* init configuration */
+
+    {
+        ngx_io_uring_add_event,          /* add an event */
+        ngx_io_uring_del_event,          /* delete an event */
+        ngx_io_uring_add_event,          /* enable an event */
+        ngx_io_uring_del_event,          /* disable an event */
+        NULL,                            /* add an connection */
+        ngx_io_uring_del_connection,     /* delete an connection */
+        NULL,                            /* process the changes */
+        ngx_io_uring_process_events,     /* process the events */
+        ngx_io_uring_init,               /* init the events */
+        ngx_io_uring_done,               /* done the events */
+    }
+};
+
+ngx_module_t  ngx_io_uring_module = {
+    NGX_MODULE_V1,
+    &ngx_io_uring_module_ctx,            /* module context */
+    ngx_io_uring_commands,               /* module directives */
+    NGX_EVENT_MODULE,                    /* module type */
+    NULL,                                /* init master */
+    NULL,                                /* init module */
+    NULL,                                /* init process */
+    NULL,                                /* init thread */
+    NULL,                                /* exit thread */
+    NULL,                                /* exit process */
+    NULL,                                /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+/*
+ * We call io_uring_setup() and io_uring_enter() directly as syscalls
+ * instead of liburing usage, because the library is not widely packaged
+ * and only a small part of its interface is needed.
+ */
+
+static int
+io_uring_setup(u_int entries, struct io_uring_params *p)
+{
+    return syscall(SYS_io_uring_setup, entries, p);
+}
+
+
+static int
+io_uring_enter(int fd, u_int to_submit, u_int min_complete, u_int flags,
+    void *arg, size_t size)
+{
+    return syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags,
+                   arg, size);
+}
+
+
+static ngx_int_t
+ngx_io_uring_init(ngx_cycle_t *cycle, ngx_msec_t timer)
+{
+    ngx_io_uring_conf_t  *urcf;
+
+    urcf = ngx_event_get_conf(cycle->conf_ctx, ngx_io_uring_module);
+
+    if (ring == -1) {
+        if (ngx_io_uring_setup_ring(cycle, urcf) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (nsends < cycle->connection_n) {
+        if (sends) {
+            ngx_free(sends);
+        }
+
+        sends = ngx_calloc(sizeof(ngx_io_uring_send_t *) * cycle->connection_n,
+                           cycle->log);
+        if (sends == NULL) {
+            return NGX_ERROR;
+        }
+
+        nsends = cycle->connection_n;
+    }
+
+    send_buffer_size = urcf->send_buffer_size;
+
+    /*
+     * the socket data are copied to a buffer and sent by the same
+     * io_uring_enter() call that waits for the events; the reading
+     * is not changed, because the sockets are read directly by OpenSSL,
+     * by the MSG_PEEK tests, and by splice(), so the data can not be
+     * received by the kernel in advance
+     */
+
+    ngx_io_uring_os_io = ngx_os_io;
+    ngx_io_uring_os_io.send = ngx_io_uring_send;
+    ngx_io_uring_os_io.send_chain = ngx_io_uring_send_chain;
+
+    ngx_io = ngx_io_uring_os_io;
+
+    ngx_event_actions = ngx_io_uring_module_ctx.actions;
+
+    /*
+     * the connection poll requests are multishot ones which
+     * report edges, just like epoll in the EPOLLET mode
+     */
+
+    ngx_event_flags = NGX_USE_CLEAR_EVENT
+                      |NGX_USE_GREEDY_EVENT
+                      |NGX_USE_IO_URING_EVENT;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_setup_ring(ngx_cycle_t *cycle, ngx_io_uring_conf_t *urcf)
+{
+    uint32_t                *array;
+    ngx_uint_t               i;
+    struct io_uring_params   p;
+
+    ngx_memzero(&p, sizeof(struct io_uring_params));
+
+    p.flags = IORING_SETUP_CQSIZE|IORING_SETUP_CLAMP;
+    p.cq_entries = urcf->entries * 4;
+
+    ring = io_uring_setup(urcf->entries, &p);
+
+    if (ring == -1) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "io_uring_setup() failed");
+        return NGX_ERROR;
+    }
+
+    /*
+     * IORING_FEAT_RSRC_TAGS has appeared in Linux 5.13 together
+     * with the multishot poll requests and the poll updates
+     */
+
+    if ((p.features & (IORING_FEAT_NODROP|IORING_FEAT_EXT_ARG
+                       |IORING_FEAT_RSRC_TAGS))
+        != (IORING_FEAT_NODROP|IORING_FEAT_EXT_ARG|IORING_FEAT_RSRC_TAGS))
+    {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "io_uring features 0x%uxD are not sufficient, "
+                      "at least Linux 5.13 is required", p.features);
+        goto failed;
+    }
+
+    sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_ring_size = ngx_max(sq_ring_size, cq_ring_size);
+        cq_ring_size = 0;
+    }
+
+    sq_ring = mmap(NULL, sq_ring_size, PROT_READ|PROT_WRITE,
+                   MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+
+    if (sq_ring == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQ_RING) failed");
+        sq_ring = NULL;
+        goto failed;
+    }
+
+    if (cq_ring_size) {
+        cq_ring = mmap(NULL, cq_ring_size, PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+
+        if (cq_ring == MAP_FAILED) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                          "mmap(IORING_OFF_CQ_RING) failed");
+            cq_ring = NULL;
+            goto failed;
+        }
+
+    } else {
+        cq_ring = sq_ring;
+    }
+
+    sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    sq.sqes = mmap(NULL, sqes_size, PROT_READ|PROT_WRITE,
+                   MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQES);
+
+    if (sq.sqes == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "mmap(IORING_OFF_SQES) failed");
+        sq.sqes = NULL;
+        goto failed;
+    }
+
+    sq.head = (uint32_t *) (sq_ring + p.sq_off.head);
+    sq.tail = (uint32_t *) (sq_ring + p.sq_off.tail);
+    sq.flags = (uint32_t *) (sq_ring + p.sq_off.flags);
+    sq.mask = *(uint32_t *) (sq_ring + p.sq_off.ring_mask);
+    sq.entries = *(uint32_t *) (sq_ring + p.sq_off.ring_entries);
+    sq.queued = *sq.tail;
+
+    /* the submission entries are always used in the ring order */
+
+    array = (uint32_t *) (sq_ring + p.sq_off.array);
+
+    for (i = 0; i < sq.entries; i++) {
+        array[i] = i;
+    }
+
+    cq.head = (uint32_t *) (cq_ring + p.cq_off.head);
+    cq.tail = (uint32_t *) (cq_ring + p.cq_off.tail);
+    cq.mask = *(uint32_t *) (cq_ring + p.cq_off.ring_mask);
+    cq.cqes = (struct io_uring_cqe *) (cq_ring + p.cq_off.cqes);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring: %d sq:%uD cq:%uD",
+                   ring, p.sq_entries, p.cq_entries);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_io_uring_done(cycle);
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_io_uring_done(ngx_cycle_t *cycle)
+{
+    ngx_io_uring_send_t  *s;
+
+    while (free_sends) {
+        s = free_sends;
+        free_sends = s->next;
+        ngx_free(s);
+    }
+
+    if (sends) {
+        ngx_free(sends);
+        sends = NULL;
+        nsends = 0;
+    }
+
+    if (sq.sqes && munmap(sq.sqes, sqes_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "munmap(IORING_OFF_SQES) failed");
+    }
+
+    if (cq_ring && cq_ring != sq_ring
+        && munmap(cq_ring, cq_ring_size) == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "munmap(IORING_OFF_CQ_RING) failed");
+    }
+
+    if (sq_ring && munmap(sq_ring, sq_ring_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "munmap(IORING_OFF_SQ_RING) failed");
+    }
+
+    if (close(ring) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ring = -1;
+
+    sq_ring = NULL;
+    cq_ring = NULL;
+
+    ngx_memzero(&sq, sizeof(ngx_io_uring_sq_t));
+    ngx_memzero(&cq, sizeof(ngx_io_uring_cq_t));
+}
+
+
+static ngx_int_t
+ngx_io_uring_add_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    uint32_t           events, prev;
+    ngx_uint_t         op, level;
+    ngx_event_t       *e;
+    ngx_connection_t  *c;
+
+    c = ev->data;
+
+    if (event == NGX_READ_EVENT) {
+        e = c->write;
+        prev = EPOLLOUT;
+        events = EPOLLIN;
+
+    } else {
+        e = c->read;
+        prev = EPOLLIN;
+        events = EPOLLOUT;
+    }
+
+    /*
+     * the level-triggered events, that is the listening sockets,
+     * use oneshot poll requests which are rearmed after each notification
+     */
+
+    level = (flags & NGX_CLEAR_EVENT) ? 0 : 1;
+
+    if (e->active) {
+        op = NGX_IO_URING_UPDATE;
+        events |= prev;
+        level |= e->oneshot;
+
+    } else if (ev->active) {
+        op = NGX_IO_URING_UPDATE;
+
+    } else {
+        op = NGX_IO_URING_ADD;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring add event: fd:%d op:%ui ev:%04XD",
+                   c->fd, op, events);
+
+    if (ngx_io_uring_poll(c, op, events, level, ev->log) == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    ev->active = 1;
+    ev->oneshot = (flags & NGX_CLEAR_EVENT) ? 0 : 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_del_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    uint32_t           prev;
+    ngx_uint_t         op;
+    ngx_event_t       *e;
+    ngx_connection_t  *c;
+
+    c = ev->data;
+
+    if (event == NGX_READ_EVENT) {
+        e = c->write;
+        prev = EPOLLOUT;
+
+    } else {
+        e = c->read;
+        prev = EPOLLIN;
+    }
+
+    /*
+     * unlike epoll, a poll request holds a reference to the file,
+     * so the request is removed even if the file is going to be closed
+     */
+
+    if (e->active && !(flags & NGX_CLOSE_EVENT)) {
+        op = NGX_IO_URING_UPDATE;
+
+    } else if (e->active || ev->active) {
+        op = NGX_IO_URING_REMOVE;
+        prev = 0;
+
+    } else {
+        return NGX_OK;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring del event: fd:%d op:%ui ev:%04XD",
+                   c->fd, op, prev);
+
+    if (ngx_io_uring_poll(c, op, prev, e->oneshot, ev->log) == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    ev->active = 0;
+    ev->oneshot = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_del_connection(ngx_connection_t *c, ngx_uint_t flags)
+{
+    if ((flags & NGX_CLOSE_EVENT)
+        && sends[c - ngx_cycle->connections]
+        && ngx_io_uring_send_close(c) == NGX_ERROR)
+    {
+        return NGX_ERROR;
+    }
+
+    if (!c->read->active && !c->write->active) {
+        return NGX_OK;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring del connection: fd:%d", c->fd);
+
+    if (ngx_io_uring_poll(c, NGX_IO_URING_REMOVE, 0, 0, c->log)
+        == NGX_ERROR)
+    {
+        return NGX_ERROR;
+    }
+
+    c->read->active = 0;
+    c->read->oneshot = 0;
+    c->write->active = 0;
+    c->write->oneshot = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_poll(ngx_connection_t *c, ngx_uint_t op, uint32_t events,
+    ngx_uint_t level, ngx_log_t *log)
+{
+    uint64_t              data;
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    data = (uintptr_t) c | c->read->instance;
+
+#if !(NGX_HAVE_LITTLE_ENDIAN)
+    events = (events << 16) | (events >> 16);
+#endif
+
+    switch (op) {
+
+    case NGX_IO_URING_ADD:
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = c->fd;
+        sqe->poll32_events = events;
+        sqe->len = level ? 0 : IORING_POLL_ADD_MULTI;
+        sqe->user_data = data;
+        break;
+
+    case NGX_IO_URING_UPDATE:
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = data;
+        sqe->poll32_events = events;
+        sqe->len = IORING_POLL_UPDATE_EVENTS
+                   | (level ? 0 : IORING_POLL_ADD_MULTI);
+        sqe->user_data = NGX_IO_URING_CONTROL;
+        break;
+
+    default: /* NGX_IO_URING_REMOVE */
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = data;
+        sqe->user_data = NGX_IO_URING_CONTROL;
+        break;
+    }
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HAVE_FILE_AIO)
+
+ngx_int_t
+ngx_io_uring_aio_read(ngx_event_aio_t *aio, u_char *buf, size_t size,
+    off_t offset)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_io_uring_get_sqe(aio->event.log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = aio->fd;
+    sqe->off = offset;
+    sqe->addr = (uintptr_t) buf;
+    sqe->len = size;
+    sqe->user_data = (uintptr_t) &aio->event | NGX_IO_URING_AIO;
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static ssize_t
+ngx_io_uring_send(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    ngx_int_t             rc;
+    ngx_io_uring_send_t  *s;
+
+    rc = ngx_io_uring_send_pending(c);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    s = ngx_io_uring_alloc_send(c);
+    if (s == NULL) {
+        return NGX_ERROR;
+    }
+
+    size = ngx_min(size, (size_t) (s->end - s->start));
+
+    s->last = ngx_cpymem(s->pos, buf, size);
+
+    if (ngx_io_uring_send_start(c, s) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return size;
+}
+
+
+static ngx_chain_t *
+ngx_io_uring_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
+{
+    u_char               *p;
+    size_t                size, n;
+    ngx_int_t             rc;
+    ngx_chain_t          *cl;
+    ngx_io_uring_send_t  *s;
+
+    rc = ngx_io_uring_send_pending(c);
+
+    if (rc == NGX_AGAIN) {
+        return in;
+    }
+
+    if (rc == NGX_ERROR) {
+        return NGX_CHAIN_ERROR;
+    }
+
+    /* the files and pipes are sent after the data that are already queued */
+
+    for (cl = in; cl; cl = cl->next) {
+        if (cl->buf->in_file) {
+            return ngx_os_io.send_chain(c, in, limit);
+        }
+    }
+
+    s = ngx_io_uring_alloc_send(c);
+    if (s == NULL) {
+        return NGX_CHAIN_ERROR;
+    }
+
+    size = s->end - s->start;
+
+    if (limit && limit < (off_t) size) {
+        size = (size_t) limit;
+    }
+
+    p = s->pos;
+
+    for (cl = in; cl && size; cl = cl->next) {
+
+        if (ngx_buf_special(cl->buf)) {
+            continue;
+        }
+
+        n = ngx_min((size_t) (cl->buf->last - cl->buf->pos), size);
+
+        p = ngx_cpymem(p, cl->buf->pos, n);
+
+        cl->buf->pos += n;
+        size -= n;
+    }
+
+    for (cl = in; cl; cl = cl->next) {
+        if (!ngx_buf_special(cl->buf) && cl->buf->pos != cl->buf->last) {
+            break;
+        }
+    }
+
+    s->last = p;
+
+    if (s->last == s->pos) {
+        ngx_io_uring_free_send(s);
+        return cl;
+    }
+
+    if (ngx_io_uring_send_start(c, s) != NGX_OK) {
+        return NGX_CHAIN_ERROR;
+    }
+
+    return cl;
+}
+
+
+static ngx_int_t
+ngx_io_uring_send_pending(ngx_connection_t *c)
+{
+    ngx_io_uring_send_t  *s;
+
+    s = sends[c - ngx_cycle->connections];
+
+    if (s == NULL) {
+        return NGX_OK;
+    }
+
+    if (s->busy) {
+        c->write->ready = 0;
+        return NGX_AGAIN;
+    }
+
+    c->write->error = 1;
+    (void) ngx_connection_error(c, s->err, "send() failed");
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_io_uring_send_start(ngx_connection_t *c, ngx_io_uring_send_t *s)
+{
+    size_t  size;
+
+    size = s->last - s->pos;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring send: fd:%d %uz", c->fd, size);
+
+    if (ngx_io_uring_send_queue(s, c->log) != NGX_OK) {
+        ngx_io_uring_free_send(s);
+        return NGX_ERROR;
+    }
+
+    s->busy = 1;
+    sends[c - ngx_cycle->connections] = s;
+
+    /*
+     * the connection is buffered until the data are sent, and
+     * the next data are not accepted until then as well
+     */
+
+    c->buffered |= NGX_IO_URING_BUFFERED;
+    c->write->ready = 0;
+    c->sent += size;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_send_queue(ngx_io_uring_send_t *s, ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = s->connection->fd;
+    sqe->addr = (uintptr_t) s->pos;
+    sqe->len = s->last - s->pos;
+    sqe->user_data = (uintptr_t) s | NGX_IO_URING_SEND;
+
+    s->sqe = sq.queued - 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_io_uring_send_done(ngx_io_uring_send_t *s, int32_t res, ngx_log_t *log)
+{
+    ngx_event_t       *wev;
+    ngx_connection_t  *c;
+
+    c = s->connection;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring send done: %p %D of %uz",
+                   s, res, (size_t) (s->last - s->pos));
+
+    if (c == NULL) {
+
+        if (s->event.timer_set) {
+            ngx_del_timer(&s->event);
+        }
+
+        ngx_io_uring_free_send(s);
+        return;
+    }
+
+    if (res >= 0) {
+        s->pos += res;
+
+        if (s->pos == s->last) {
+            sends[c - ngx_cycle->connections] = NULL;
+            ngx_io_uring_free_send(s);
+
+            c->buffered &= ~NGX_IO_URING_BUFFERED;
+
+            goto done;
+        }
+
+        /* a part of the data was sent, the rest is queued again */
+
+        if (ngx_io_uring_send_queue(s, log) == NGX_OK) {
+            return;
+        }
+
+        res = -NGX_ENOMEM;
+    }
+
+    s->err = -res;
+    s->busy = 0;
+
+done:
+
+    wev = c->write;
+    wev->ready = 1;
+
+    ngx_locked_post_event(wev, &ngx_posted_events);
+}
+
+
+static ngx_int_t
+ngx_io_uring_send_close(ngx_connection_t *c)
+{
+    uint64_t              data;
+    ngx_io_uring_send_t  *s;
+    struct io_uring_sqe  *sqe;
+
+    s = sends[c - ngx_cycle->connections];
+    sends[c - ngx_cycle->connections] = NULL;
+
+    if (!s->busy) {
+        ngx_io_uring_free_send(s);
+        return NGX_OK;
+    }
+
+    s->connection = NULL;
+
+    data = (uintptr_t) s | NGX_IO_URING_SEND;
+
+    if (c->timedout) {
+
+        /* the peer does not read the data */
+
+        if ((int32_t) (s->sqe - *sq.tail) >= 0) {
+
+            /* the request is not submitted yet */
+
+            sqe = &sq.sqes[s->sqe & sq.mask];
+
+            ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+            sqe->opcode = IORING_OP_NOP;
+            sqe->user_data = data;
+
+            return NGX_OK;
+        }
+
+        sqe = ngx_io_uring_get_sqe(c->log);
+        if (sqe == NULL) {
+            return NGX_ERROR;
+        }
+
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = data;
+        sqe->user_data = NGX_IO_URING_CONTROL;
+
+        return NGX_OK;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring send linger: fd:%d %p", c->fd, s);
+
+    /*
+     * the request holds a reference to the file after it is submitted,
+     * so it is submitted before the descriptor is closed and reused
+     */
+
+    if ((int32_t) (s->sqe - *sq.tail) >= 0
+        && ngx_io_uring_submit(c->log) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    s->event.data = s;
+    s->event.handler = ngx_io_uring_send_linger_handler;
+    s->event.log = ngx_cycle->log;
+
+    ngx_add_timer(&s->event, NGX_IO_URING_SEND_LINGER);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_io_uring_send_linger_handler(ngx_event_t *ev)
+{
+    ngx_io_uring_send_t  *s;
+    struct io_uring_sqe  *sqe;
+
+    s = ev->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring send linger timeout: %p", s);
+
+    sqe = ngx_io_uring_get_sqe(ev->log);
+    if (sqe == NULL) {
+        return;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t) s | NGX_IO_URING_SEND;
+    sqe->user_data = NGX_IO_URING_CONTROL;
+}
+
+
+static ngx_io_uring_send_t *
+ngx_io_uring_alloc_send(ngx_connection_t *c)
+{
+    ngx_io_uring_send_t  *s;
+
+    s = free_sends;
+
+    if (s) {
+        free_sends = s->next;
+
+    } else {
+        s = ngx_alloc(sizeof(ngx_io_uring_send_t) + send_buffer_size, c->log);
+        if (s == NULL) {
+            return NULL;
+        }
+
+        ngx_memzero(s, sizeof(ngx_io_uring_send_t));
+
+        s->start = (u_char *) s + sizeof(ngx_io_uring_send_t);
+        s->end = s->start + send_buffer_size;
+    }
+
+    s->connection = c;
+    s->pos = s->start;
+    s->last = s->start;
+    s->err = 0;
+    s->busy = 0;
+    s->next = NULL;
+
+    return s;
+}
+
+
+static void
+ngx_io_uring_free_send(ngx_io_uring_send_t *s)
+{
+    s->next = free_sends;
+    free_sends = s;
+}
+
+
+static struct io_uring_sqe *
+ngx_io_uring_get_sqe(ngx_log_t *log)
+{
+    uint32_t              head;
+    struct io_uring_sqe  *sqe;
+
+    head = *sq.head;
+    ngx_memory_barrier();
+
+    if (sq.queued - head == sq.entries) {
+
+        /* the submission queue is full, submit it without waiting */
+
+        if (ngx_io_uring_submit(log) != NGX_OK) {
+            return NULL;
+        }
+
+        head = *sq.head;
+        ngx_memory_barrier();
+
+        if (sq.queued - head == sq.entries) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "io_uring submission queue overflow");
+            return NULL;
+        }
+    }
+
+    sqe = &sq.sqes[sq.queued & sq.mask];
+    sq.queued++;
+
+    ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+    return sqe;
+}
+
+
+static ngx_int_t
+ngx_io_uring_submit(ngx_log_t *log)
+{
+    ngx_memory_barrier();
+
+    *sq.tail = sq.queued;
+
+    ngx_memory_barrier();
+
+    if (io_uring_enter(ring, sq.queued - *sq.head, 0, 0, NULL, 0) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "io_uring_enter() failed");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
+    ngx_uint_t flags)
+{
+    int                             n;
+    int32_t                         res;
+    uint32_t                        head, tail, revents, more;
+    uint64_t                        data;
+    ngx_int_t                       instance;
+    ngx_uint_t                      level;
+    ngx_err_t                       err;
+    ngx_event_t                    *rev, *wev, **queue;
+    ngx_connection_t               *c;
+    struct io_uring_sqe            *sqe;
+    struct io_uring_cqe            *cqe;
+    struct __kernel_timespec        ts;
+    struct io_uring_getevents_arg   arg;
+#if (NGX_HAVE_FILE_AIO)
+    ngx_event_t                    *e;
+    ngx_event_aio_t                *aio;
+#endif
+
+    /* NGX_TIMER_INFINITE == INFTIM */
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring timer: %M", timer);
+
+    ngx_memzero(&arg, sizeof(struct io_uring_getevents_arg));
+
+    if (timer != NGX_TIMER_INFINITE) {
+        ts.tv_sec = timer / 1000;
+        ts.tv_nsec = (timer % 1000) * 1000000;
+        arg.ts = (uintptr_t) &ts;
+    }
+
+    /* the pending changes are submitted by the same call */
+
+    ngx_memory_barrier();
+
+    *sq.tail = sq.queued;
+
+    ngx_memory_barrier();
+
+    n = io_uring_enter(ring, sq.queued - *sq.head, 1,
+                       IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG,
+                       &arg, sizeof(struct io_uring_getevents_arg));
+
+    err = (n == -1) ? ngx_errno : 0;
+
+    if (flags & NGX_UPDATE_TIME || ngx_event_timer_alarm) {
+        ngx_time_update();
+    }
+
+    if (err) {
+        if (err == NGX_EINTR) {
+
+            if (ngx_event_timer_alarm) {
+                ngx_event_timer_alarm = 0;
+                return NGX_OK;
+            }
+
+            level = NGX_LOG_INFO;
+
+        } else if (err == ETIME || err == NGX_EAGAIN || err == NGX_EBUSY) {
+
+            /* timeout or the completion queue is overflown */
+
+            level = 0;
+
+        } else {
+            level = NGX_LOG_ALERT;
+        }
+
+        if (level) {
+            ngx_log_error(level, cycle->log, err, "io_uring_enter() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_mutex_lock(ngx_posted_events_mutex);
+
+    for ( ;; ) {
+
+        head = *cq.head;
+        tail = *cq.tail;
+
+        ngx_memory_barrier();
+
+        if (head == tail) {
+
+            if (!(*sq.flags & IORING_SQ_CQ_OVERFLOW)) {
+                break;
+            }
+
+            /* flush the completions kept by kernel on overflow */
+
+            if (io_uring_enter(ring, 0, 0, IORING_ENTER_GETEVENTS, NULL, 0)
+                == -1)
+            {
+                ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                              "io_uring_enter() failed");
+                break;
+            }
+
+            continue;
+        }
+
+        cqe = &cq.cqes[head & cq.mask];
+
+        data = cqe->user_data;
+        res = cqe->res;
+        more = cqe->flags & IORING_CQE_F_MORE;
+
+        ngx_memory_barrier();
+
+        *cq.head = head + 1;
+
+        if (data == NGX_IO_URING_CONTROL) {
+
+            /*
+             * a request that has just completed can not be updated
+             * or removed, its completion is handled separately
+             */
+
+            if (res < 0 && res != -ENOENT && res != -EALREADY) {
+                ngx_log_error(NGX_LOG_ALERT, cycle->log, -res,
+                              "io_uring poll update failed");
+            }
+
+            continue;
+        }
+
+#if (NGX_HAVE_FILE_AIO)
+
+        if (data & NGX_IO_URING_AIO) {
+            e = (ngx_event_t *) (uintptr_t) (data & ~NGX_IO_URING_AIO);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring aio: %p %D", e, res);
+
+            e->complete = 1;
+            e->active = 0;
+            e->ready = 1;
+
+            aio = e->data;
+            aio->res = res;
+
+            ngx_locked_post_event(e, &ngx_posted_events);
+
+            continue;
+        }
+
+#endif
+
+        if (data & NGX_IO_URING_SEND) {
+            ngx_io_uring_send_done((ngx_io_uring_send_t *)
+                                       (uintptr_t) (data & ~NGX_IO_URING_SEND),
+                                   res, cycle->log);
+            continue;
+        }
+
+        c = (ngx_connection_t *) (uintptr_t) data;
+
+        instance = (uintptr_t) c & 1;
+        c = (ngx_connection_t *) ((uintptr_t) c & (uintptr_t) ~1);
+
+        rev = c->read;
+
+        if (c->fd == -1 || rev->instance != instance) {
+
+            /*
+             * the stale event from a file descriptor
+             * that was just closed in this iteration
+             */
+
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring: stale event %p", c);
+
+            if (more) {
+                /* the stale multishot request still holds the file */
+
+                sqe = ngx_io_uring_get_sqe(cycle->log);
+
+                if (sqe) {
+                    sqe->opcode = IORING_OP_POLL_REMOVE;
+                    sqe->fd = -1;
+                    sqe->addr = data;
+                    sqe->user_data = NGX_IO_URING_CONTROL;
+                }
+            }
+
+            continue;
+        }
+
+        if (res == -ECANCELED) {
+            /* the request was removed */
+            continue;
+        }
+
+        revents = (res < 0) ? EPOLLERR : (uint32_t) res;
+
+        ngx_log_debug4(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: fd:%d ev:%04XD d:%p m:%uD",
+                       c->fd, revents, data, more);
+
+        if (revents & (EPOLLERR|EPOLLHUP)) {
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring error on fd:%d ev:%04XD",
+                           c->fd, revents);
+        }
+
+        if ((revents & (EPOLLERR|EPOLLHUP))
+             && (revents & (EPOLLIN|EPOLLOUT)) == 0)
+        {
+            /*
+             * if the error events were returned without EPOLLIN or EPOLLOUT,
+             * then add these flags to handle the events at least in one
+             * active handler
+             */
+
+            revents |= EPOLLIN|EPOLLOUT;
+        }
+
+        if ((revents & EPOLLIN) && rev->active) {
+
+            if ((flags & NGX_POST_THREAD_EVENTS) && !rev->accept) {
+                rev->posted_ready = 1;
+
+            } else {
+                rev->ready = 1;
+            }
+
+            if (flags & NGX_POST_EVENTS) {
+                queue = (ngx_event_t **) (rev->accept ?
+                               &ngx_posted_accept_events : &ngx_posted_events);
+
+                ngx_locked_post_event(rev, queue);
+
+            } else {
+                rev->handler(rev);
+            }
+        }
+
+        wev = c->write;
+
+        if ((revents & EPOLLOUT) && wev->active) {
+
+            if (c->fd == -1 || wev->instance != instance) {
+
+                /*
+                 * the stale event from a file descriptor
+                 * that was just closed in this iteration
+                 */
+
+                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                               "io_uring: stale event %p", c);
+                continue;
+            }
+
+            if (flags & NGX_POST_THREAD_EVENTS) {
+                wev->posted_ready = 1;
+
+            } else {
+                wev->ready = 1;
+            }
+
+            if (flags & NGX_POST_EVENTS) {
+                ngx_locked_post_event(wev, &ngx_posted_events);
+
+            } else {
+                wev->handler(wev);
+            }
+        }
+
+        if (more || c->fd == -1 || rev->instance != instance) {
+            continue;
+        }
+
+        /* rearm the terminated request, it is always so for oneshot ones */
+
+        revents = 0;
+        level = 0;
+
+        if (rev->active) {
+            revents |= EPOLLIN;
+            level |= rev->oneshot;
+        }
+
+        if (wev->active) {
+            revents |= EPOLLOUT;
+            level |= wev->oneshot;
+        }
+
+        if (revents) {
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring rearm: fd:%d ev:%04XD", c->fd, revents);
+
+            if (ngx_io_uring_poll(c, NGX_IO_URING_ADD, revents, level,
+                                  cycle->log)
+                == NGX_ERROR)
+            {
+                ngx_mutex_unlock(ngx_posted_events_mutex);
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    ngx_mutex_unlock(ngx_posted_events_mutex);
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_io_uring_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_io_uring_conf_t  *urcf;
+
+    urcf = ngx_palloc(cycle->pool, sizeof(ngx_io_uring_conf_t));
+    if (urcf == NULL) {
+        return NULL;
+    }
+
+    urcf->entries = NGX_CONF_UNSET;
+    urcf->send_buffer_size = NGX_CONF_UNSET_SIZE;
+
+    return urcf;
+}
+
+
+static char *
+ngx_io_uring_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_io_uring_conf_t *urcf = conf;
+
+    ngx_conf_init_uint_value(urcf->entries, 512);
+    ngx_conf_init_size_value(urcf->send_buffer_size, 16384);
+
+    return NGX_CONF_OK;
+}
@@ -645,6 +645,26 @@ ngx_event_process_init(ngx_cycle_t *cycle)
         ngx_use_accept_mutex = 0;
     }
 
+#if (NGX_HAVE_REUSEPORT)
+
+    if (ngx_use_accept_mutex) {
+
+        /* the mutex is useless if every listening socket is per worker */
+
+        ls = cycle->listening.elts;
+        for (i = 0; i < cycle->listening.nelts; i++) {
+            if (!ls[i].reuseport) {
+                break;
+            }
+        }
+
+        if (i == cycle->listening.nelts) {
+            ngx_use_accept_mutex = 0;
+        }
+    }
+
+#endif
+
 #if (NGX_WIN32)
 
     /*
@@ -810,6 +830,12 @@ ngx_event_process_init(ngx_cycle_t *cycle)
     ls = cycle->listening.elts;
     for (i = 0; i < cycle->listening.nelts; i++) {
 
+#if (NGX_HAVE_REUSEPORT)
+        if (ls[i].reuseport && ccf->master && ls[i].worker != ngx_worker) {
+            continue;
+        }
+#endif
+
 			  /* 为所有的listeging_t结构分配连接，同时读事件的回调设为ngx_event_acceptex */
         c = ngx_get_connection(ls[i].fd, cycle->log);
 
@@ -893,6 +919,20 @@ ngx_event_process_init(ngx_cycle_t *cycle)
         /* 设置listen句柄的callback,这个回调里面会accept，然后进行后续处理 */
         rev->handler = ngx_event_accept;
 
+#if (NGX_HAVE_REUSEPORT)
+
+        /* the worker's own socket is not shared, so no accept mutex */
+
+        if (ls[i].reuseport) {
+            if (ngx_add_event(rev, NGX_READ_EVENT, 0) == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            continue;
+        }
+
+#endif
+
         /* 这里比较关键的就是如果使用了ngx_use_accept_mutex，则现在不会将事件
          * 加入到epoll中，而是等到在ngx_process_events_and_timers中将句柄加入，
          * 这是因为nginx为了防止惊群，采取了串行化处理accpet，也就是同时只有一
@@ -78,6 +78,9 @@ struct ngx_event_s {
 		/* 表示事件是否在定时器中 */
     unsigned         timer_set:1;
 
+    /* the timer does not prevent a worker process from exiting */
+    unsigned         cancelable:1;
+
     unsigned         delayed:1;
 
     unsigned         read_discarded:1;
@@ -148,6 +151,10 @@ struct ngx_event_s {
 		/* 定时器节点 */
     ngx_rbtree_node_t   timer;
 
+#if (NGX_TIMER_WHEEL)
+    ngx_queue_t      timer_queue;
+#endif
+
     unsigned         closed:1;
 
     /* to test on worker exit */
@@ -342,6 +349,11 @@ extern ngx_event_actions_t   ngx_event_actions;
  */
 #define NGX_USE_VNODE_EVENT      0x00002000
 
+/*
+ * The event filter is io_uring, it may also complete file aio reads.
+ */
+#define NGX_USE_IO_URING_EVENT   0x00004000
+
 
 /*
  * The event filter is deleted just before the closing file.
@@ -572,6 +584,12 @@ u_char *ngx_acceptex_log_error(ngx_log_t *log, u_char *buf, size_t len);
 ngx_int_t ngx_send_lowat(ngx_connection_t *c, size_t lowat);
 
 
+#if (NGX_HAVE_IO_URING && NGX_HAVE_FILE_AIO)
+ngx_int_t ngx_io_uring_aio_read(ngx_event_aio_t *aio, u_char *buf, size_t size,
+    off_t offset);
+#endif
+
+
 /* used in ngx_log_debugX() */
 #define ngx_event_ident(p)  ((ngx_connection_t *) (p))->fd
 
@@ -12,6 +12,9 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 
+/* the deprecated API is still used with OpenSSL 3.0 */
+#define OPENSSL_SUPPRESS_DEPRECATED
+
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <openssl/conf.h>
@@ -26,9 +29,18 @@
 #define ngx_ssl_conn_t          SSL
 
 
+typedef struct {
+    size_t                      size;
+    ngx_uint_t                  threshold;
+    ngx_msec_t                  timeout;
+} ngx_ssl_dyn_rec_t;
+
+
 typedef struct {
     SSL_CTX                    *ctx;
     ngx_log_t                  *log;
+    size_t                      buffer_size;
+    ngx_ssl_dyn_rec_t           dyn_rec;
 } ngx_ssl_t;
 
 
@@ -37,6 +49,14 @@ typedef struct {
 
     ngx_int_t                   last;
     ngx_buf_t                  *buf;
+    size_t                      buffer_size;
+
+    ngx_ssl_dyn_rec_t           dyn_rec;
+    ngx_msec_t                  dyn_rec_last_write;
+    ngx_uint_t                  dyn_rec_records;
+
+    ngx_uint_t                  records;
+    ngx_uint_t                  small_records;
 
     ngx_connection_handler_pt   handler;
 
@@ -48,6 +68,7 @@ typedef struct {
     unsigned                    buffer:1;
     unsigned                    no_wait_shutdown:1;
     unsigned                    no_send_shutdown:1;
+    unsigned                    sendfile:1;
 } ngx_ssl_connection_t;
 
 
@@ -154,6 +175,10 @@ ngx_int_t ngx_ssl_get_serial_number(ngx_connection_t *c, ngx_pool_t *pool,
     ngx_str_t *s);
 ngx_int_t ngx_ssl_get_client_verify(ngx_connection_t *c, ngx_pool_t *pool,
     ngx_str_t *s);
+ngx_int_t ngx_ssl_get_records(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s);
+ngx_int_t ngx_ssl_get_small_records(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s);
 
 
 ngx_int_t ngx_ssl_handshake(ngx_connection_t *c);
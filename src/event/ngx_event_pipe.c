@@ -17,6 +17,10 @@ static ngx_int_t ngx_event_pipe_write_to_downstream(ngx_event_pipe_t *p);
 static ngx_int_t ngx_event_pipe_write_chain_to_temp_file(ngx_event_pipe_t *p);
 static ngx_inline void ngx_event_pipe_remove_shadow_links(ngx_buf_t *buf);
 static ngx_int_t ngx_event_pipe_drain_chains(ngx_event_pipe_t *p);
+#if (NGX_HAVE_SPLICE)
+static ngx_int_t ngx_event_pipe_splice_upstream(ngx_event_pipe_t *p);
+static void ngx_event_pipe_splice_cleanup(void *data);
+#endif
 
 
 ngx_int_t
@@ -167,6 +171,40 @@ ngx_event_pipe_read_upstream(ngx_event_pipe_t *p)
             }
 #endif
 
+#if (NGX_HAVE_SPLICE)
+
+            if (p->splice) {
+                rc = ngx_event_pipe_splice_upstream(p);
+
+                if (rc == NGX_ABORT) {
+                    return NGX_ABORT;
+                }
+
+                if (rc == NGX_ERROR) {
+                    p->upstream_error = 1;
+                    return NGX_ERROR;
+                }
+
+                if (rc == NGX_OK) {
+                    continue;
+                }
+
+                if (rc == NGX_BUSY
+                    && (p->in || p->out)
+                    && p->downstream->data == p->output_ctx
+                    && p->downstream->write->ready
+                    && !p->downstream->write->delayed)
+                {
+                    /* the pipe is full, write the spliced data first */
+
+                    p->upstream_blocked = 1;
+                }
+
+                break;
+            }
+
+#endif
+
             if (p->free_raw_bufs) {
 
                 /* use the free bufs if they exist */
@@ -568,6 +606,18 @@ ngx_event_pipe_write_to_downstream(ngx_event_pipe_t *p)
             goto flush;
         }
 
+#if (NGX_HAVE_SPLICE)
+
+        if (p->splice && p->busy && p->in == NULL && p->out == NULL) {
+
+            /* the spliced data are not in the busy bufs size, flush them */
+
+            flush = 1;
+            goto flush;
+        }
+
+#endif
+
         flush = 0;
         ll = NULL;
         prev_last_shadow = 1;
@@ -985,6 +1035,218 @@ ngx_event_pipe_add_free_buf(ngx_event_pipe_t *p, ngx_buf_t *b)
 }
 
 
+#if (NGX_HAVE_SPLICE)
+
+ngx_int_t
+ngx_event_pipe_init_splice(ngx_event_pipe_t *p)
+{
+    int                  fd[2], n;
+    size_t               size;
+    ngx_file_t          *file;
+    ngx_pool_cleanup_t  *cln;
+
+    file = ngx_pcalloc(p->pool, sizeof(ngx_file_t));
+    if (file == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(p->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (pipe(fd) == -1) {
+        ngx_log_error(NGX_LOG_ERR, p->log, ngx_errno, "pipe() failed");
+        return NGX_ERROR;
+    }
+
+    if (ngx_nonblocking(fd[0]) == -1 || ngx_nonblocking(fd[1]) == -1) {
+        ngx_log_error(NGX_LOG_ERR, p->log, ngx_errno,
+                      ngx_nonblocking_n " failed");
+
+        (void) close(fd[0]);
+        (void) close(fd[1]);
+
+        return NGX_ERROR;
+    }
+
+    /*
+     * the data are kept in the pipe instead of the buffers,
+     * so the pipe size is limited by the buffers size
+     */
+
+    size = p->bufs.num * p->bufs.size;
+
+#if defined F_SETPIPE_SZ && defined F_GETPIPE_SZ
+
+    if (size > 65536 && fcntl(fd[1], F_SETPIPE_SZ, size) == -1) {
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, p->log, ngx_errno,
+                       "fcntl(F_SETPIPE_SZ, %uz) failed", size);
+    }
+
+    n = fcntl(fd[1], F_GETPIPE_SZ);
+
+    if (n > 0 && (size_t) n < size) {
+        size = n;
+    }
+
+#else
+
+    if (size > 65536) {
+        size = 65536;
+    }
+
+#endif
+
+    file->fd = fd[0];
+    file->log = p->log;
+    file->pipe = 1;
+
+    p->splice_file = file;
+    p->splice_fd = fd[1];
+    p->splice_offset = 0;
+    p->splice_size = size;
+
+    cln->handler = ngx_event_pipe_splice_cleanup;
+    cln->data = p;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                   "pipe splice: %d %d, size: %uz", fd[0], fd[1], size);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_event_pipe_splice_upstream(ngx_event_pipe_t *p)
+{
+    size_t        size;
+    ssize_t       n;
+    ngx_err_t     err;
+    ngx_buf_t     b;
+    ngx_chain_t  *cl;
+
+    cl = p->free_raw_bufs;
+
+    if (cl && cl->buf->pos != cl->buf->last) {
+
+        /* pass the data read with the response header first */
+
+        p->free_raw_bufs = cl->next;
+
+        /* STUB */ cl->buf->num = p->num++;
+
+        if (p->input_filter(p, cl->buf) == NGX_ERROR) {
+            return NGX_ABORT;
+        }
+
+        ngx_free_chain(p->pool, cl);
+
+        return NGX_OK;
+    }
+
+    size = p->splice_size
+           - (size_t) (p->splice_offset - p->splice_file->offset);
+
+    if (p->length != -1 && (off_t) size > p->length) {
+        size = (size_t) p->length;
+    }
+
+    if (size == 0) {
+        return NGX_BUSY;
+    }
+
+    n = splice(p->upstream->fd, NULL, p->splice_fd, NULL, size,
+               SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                   "pipe splice: %z of %uz @%O", n, size, p->splice_offset);
+
+    if (n == -1) {
+        err = ngx_socket_errno;
+
+        if (err == NGX_EAGAIN) {
+
+            /*
+             * the pipe may run out of pages before it is full
+             * if the data come in small packets, so the upstream
+             * is treated as drained only if the pipe is empty
+             */
+
+            if (p->splice_offset == p->splice_file->offset) {
+                p->upstream->read->ready = 0;
+            }
+
+            return NGX_AGAIN;
+        }
+
+        if (err == NGX_EINTR) {
+            return NGX_OK;
+        }
+
+        p->upstream->read->error = 1;
+        ngx_connection_error(p->upstream, err, "splice() failed");
+
+        return NGX_ERROR;
+    }
+
+    p->read = 1;
+
+    if (n == 0) {
+        p->upstream->read->ready = 0;
+        p->upstream->read->eof = 1;
+        p->upstream_eof = 1;
+
+        return NGX_DONE;
+    }
+
+    p->read_length += n;
+
+    ngx_memzero(&b, sizeof(ngx_buf_t));
+
+    b.in_file = 1;
+    b.file = p->splice_file;
+    b.file_pos = p->splice_offset;
+    b.file_last = p->splice_offset + n;
+    b.tag = p->tag;
+
+    /* STUB */ b.num = p->num++;
+
+    p->splice_offset += n;
+
+    if (p->input_filter(p, &b) == NGX_ERROR) {
+        return NGX_ABORT;
+    }
+
+    /* the spliced data have no raw buf to return to p->free_raw_bufs */
+
+    ngx_event_pipe_remove_shadow_links(&b);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_event_pipe_splice_cleanup(void *data)
+{
+    ngx_event_pipe_t  *p = data;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                   "pipe splice cleanup: %d %d",
+                   p->splice_file->fd, p->splice_fd);
+
+    if (close(p->splice_file->fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, p->log, ngx_errno, "close() failed");
+    }
+
+    if (close(p->splice_fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, p->log, ngx_errno, "close() failed");
+    }
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_event_pipe_drain_chains(ngx_event_pipe_t *p)
 {
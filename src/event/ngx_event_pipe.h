@@ -79,6 +79,7 @@ struct ngx_event_pipe_s {
     unsigned           downstream_error:1;
 		/* 不建议置为1 */
     unsigned           cyclic_temp_file:1;
+    unsigned           splice:1;
 
 		/* 已经分配的缓冲区的数目，受bufs.num的限制 */
     ngx_int_t          allocated;
@@ -115,6 +116,13 @@ struct ngx_event_pipe_s {
 		/* 存放上游响应的临时文件 */
     ngx_temp_file_t   *temp_file;
 
+#if (NGX_HAVE_SPLICE)
+    ngx_file_t        *splice_file;
+    ngx_fd_t           splice_fd;
+    off_t              splice_offset;
+    size_t             splice_size;
+#endif
+
 		/* 已经使用的buf_t缓冲区的数目 */
     /* STUB */ int     num;
 };
@@ -123,6 +131,9 @@ struct ngx_event_pipe_s {
 ngx_int_t ngx_event_pipe(ngx_event_pipe_t *p, ngx_int_t do_write);
 ngx_int_t ngx_event_pipe_copy_input_filter(ngx_event_pipe_t *p, ngx_buf_t *buf);
 ngx_int_t ngx_event_pipe_add_free_buf(ngx_event_pipe_t *p, ngx_buf_t *b);
+#if (NGX_HAVE_SPLICE)
+ngx_int_t ngx_event_pipe_init_splice(ngx_event_pipe_t *p);
+#endif
 
 
 #endif /* _NGX_EVENT_PIPE_H_INCLUDED_ */
@@ -15,6 +15,50 @@ ngx_mutex_t  *ngx_event_timer_mutex;
 #endif
 
 
+#if (NGX_TIMER_WHEEL)
+
+/*
+ * The hierarchical timing wheel.  The first level has a slot for each
+ * millisecond, a slot of the next level covers the whole previous level.
+ * The timers are moved to the lower levels as the wheel time reaches
+ * their slots, so insertion, deletion and expiration take constant time.
+ */
+
+#define NGX_TIMER_WHEEL_BITS        8
+#define NGX_TIMER_WHEEL_SIZE        (1 << NGX_TIMER_WHEEL_BITS)
+#define NGX_TIMER_WHEEL_MASK        (NGX_TIMER_WHEEL_SIZE - 1)
+
+#define NGX_TIMER_WHEEL_LEVEL_BITS  6
+#define NGX_TIMER_WHEEL_LEVEL_SIZE  (1 << NGX_TIMER_WHEEL_LEVEL_BITS)
+#define NGX_TIMER_WHEEL_LEVEL_MASK  (NGX_TIMER_WHEEL_LEVEL_SIZE - 1)
+
+#define NGX_TIMER_WHEEL_LEVELS      4
+
+
+typedef struct {
+    /* the next millisecond to handle */
+    ngx_msec_t              now;
+
+    ngx_queue_t             expired;
+    ngx_queue_t             near[NGX_TIMER_WHEEL_SIZE];
+    ngx_queue_t             far[NGX_TIMER_WHEEL_LEVELS]
+                               [NGX_TIMER_WHEEL_LEVEL_SIZE];
+} ngx_event_timer_wheel_t;
+
+
+static void ngx_event_timer_wheel_init(void);
+static ngx_queue_t *ngx_event_timer_wheel_slot(ngx_msec_t key);
+static void ngx_event_timer_wheel_cascade(ngx_queue_t *slot);
+static ngx_msec_t ngx_event_timer_wheel_next(void);
+static ngx_int_t ngx_event_timer_wheel_expire(ngx_queue_t *slot);
+static ngx_int_t ngx_event_timer_wheel_cancelable(ngx_queue_t *slot);
+
+
+ngx_uint_t                       ngx_event_timer_wheel_count;
+static ngx_event_timer_wheel_t   ngx_event_timer_wheel;
+
+#else
+
 ngx_thread_volatile ngx_rbtree_t  ngx_event_timer_rbtree;
 static ngx_rbtree_node_t          ngx_event_timer_sentinel;
 
@@ -24,11 +68,18 @@ static ngx_rbtree_node_t          ngx_event_timer_sentinel;
  * a minimum timer value only
  */
 
+#endif
+
+
 ngx_int_t
 ngx_event_timer_init(ngx_log_t *log)
 {
+#if (NGX_TIMER_WHEEL)
+    ngx_event_timer_wheel_init();
+#else
     ngx_rbtree_init(&ngx_event_timer_rbtree, &ngx_event_timer_sentinel,
                     ngx_rbtree_insert_timer_value);
+#endif
 
 #if (NGX_THREADS)
 
@@ -48,6 +99,8 @@ ngx_event_timer_init(ngx_log_t *log)
 }
 
 
+#if !(NGX_TIMER_WHEEL)
+
 ngx_msec_t
 ngx_event_find_timer(void)
 {
@@ -156,3 +209,445 @@ ngx_event_expire_timers(void)
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 }
+
+
+ngx_int_t
+ngx_event_no_timers_left(void)
+{
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *node, *root, *sentinel;
+
+    if (ngx_event_timer_empty()) {
+        return NGX_OK;
+    }
+
+    sentinel = ngx_event_timer_rbtree.sentinel;
+    root = ngx_event_timer_rbtree.root;
+
+    for (node = ngx_rbtree_min(root, sentinel);
+         node;
+         node = ngx_rbtree_next((ngx_rbtree_t *) &ngx_event_timer_rbtree, node))
+    {
+        ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+        if (!ev->cancelable) {
+            return NGX_AGAIN;
+        }
+    }
+
+    /* only cancelable timers left */
+
+    return NGX_OK;
+}
+
+#else
+
+
+static void
+ngx_event_timer_wheel_init(void)
+{
+    ngx_uint_t  i, n;
+
+    ngx_queue_init(&ngx_event_timer_wheel.expired);
+
+    for (n = 0; n < NGX_TIMER_WHEEL_SIZE; n++) {
+        ngx_queue_init(&ngx_event_timer_wheel.near[n]);
+    }
+
+    for (i = 0; i < NGX_TIMER_WHEEL_LEVELS; i++) {
+        for (n = 0; n < NGX_TIMER_WHEEL_LEVEL_SIZE; n++) {
+            ngx_queue_init(&ngx_event_timer_wheel.far[i][n]);
+        }
+    }
+
+    ngx_event_timer_wheel.now = ngx_current_msec;
+    ngx_event_timer_wheel_count = 0;
+}
+
+
+void
+ngx_event_timer_wheel_insert(ngx_event_t *ev)
+{
+    ngx_queue_insert_tail(ngx_event_timer_wheel_slot(ev->timer.key),
+                          &ev->timer_queue);
+
+    ngx_event_timer_wheel_count++;
+}
+
+
+static ngx_queue_t *
+ngx_event_timer_wheel_slot(ngx_msec_t key)
+{
+    ngx_uint_t      i, shift;
+    ngx_msec_int_t  diff;
+
+    diff = (ngx_msec_int_t) (key - ngx_event_timer_wheel.now);
+
+    if (diff < 0) {
+        return &ngx_event_timer_wheel.expired;
+    }
+
+    if (diff < NGX_TIMER_WHEEL_SIZE) {
+        return &ngx_event_timer_wheel.near[key & NGX_TIMER_WHEEL_MASK];
+    }
+
+    shift = NGX_TIMER_WHEEL_BITS;
+
+    for (i = 0; i < NGX_TIMER_WHEEL_LEVELS - 1; i++) {
+
+        if ((diff >> shift) <= NGX_TIMER_WHEEL_LEVEL_MASK) {
+            break;
+        }
+
+        shift += NGX_TIMER_WHEEL_LEVEL_BITS;
+    }
+
+    if ((diff >> shift) > NGX_TIMER_WHEEL_LEVEL_MASK) {
+
+        /*
+         * the timers beyond the wheel range are kept in the farthest slot
+         * and are placed again when the slot is cascaded
+         */
+
+        key = ngx_event_timer_wheel.now
+              + ((ngx_msec_t) NGX_TIMER_WHEEL_LEVEL_MASK << shift);
+    }
+
+    return &ngx_event_timer_wheel.far[i][(key >> shift)
+                                         & NGX_TIMER_WHEEL_LEVEL_MASK];
+}
+
+
+static void
+ngx_event_timer_wheel_cascade(ngx_queue_t *slot)
+{
+    ngx_queue_t   list, *q;
+    ngx_event_t  *ev;
+
+    if (ngx_queue_empty(slot)) {
+        return;
+    }
+
+    ngx_queue_init(&list);
+    ngx_queue_add(&list, slot);
+    ngx_queue_init(slot);
+
+    while (!ngx_queue_empty(&list)) {
+
+        q = ngx_queue_head(&list);
+        ngx_queue_remove(q);
+
+        ev = ngx_queue_data(q, ngx_event_t, timer_queue);
+
+        ngx_queue_insert_tail(ngx_event_timer_wheel_slot(ev->timer.key), q);
+    }
+}
+
+
+ngx_msec_t
+ngx_event_find_timer(void)
+{
+    ngx_msec_t      key;
+    ngx_msec_int_t  timer;
+
+    if (ngx_event_timer_wheel_count == 0) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    ngx_mutex_lock(ngx_event_timer_mutex);
+
+    if (!ngx_queue_empty(&ngx_event_timer_wheel.expired)) {
+        ngx_mutex_unlock(ngx_event_timer_mutex);
+        return 0;
+    }
+
+    key = ngx_event_timer_wheel_next();
+
+    ngx_mutex_unlock(ngx_event_timer_mutex);
+
+    timer = (ngx_msec_int_t) (key - ngx_current_msec);
+
+    return (ngx_msec_t) (timer > 0 ? timer : 0);
+}
+
+
+static ngx_msec_t
+ngx_event_timer_wheel_next(void)
+{
+    ngx_msec_t  now, key, start;
+    ngx_uint_t  i, n, shift, found;
+
+    now = ngx_event_timer_wheel.now;
+    key = now;
+    found = 0;
+
+    for (n = 0; n < NGX_TIMER_WHEEL_SIZE; n++) {
+        if (!ngx_queue_empty(
+                 &ngx_event_timer_wheel.near[(now + n) & NGX_TIMER_WHEEL_MASK]))
+        {
+            key = now + n;
+            found = 1;
+            break;
+        }
+    }
+
+    /*
+     * a slot of the next levels gives the lower bound of its timers,
+     * it is enough as an early wakeup only cascades the slot
+     */
+
+    shift = NGX_TIMER_WHEEL_BITS;
+
+    for (i = 0; i < NGX_TIMER_WHEEL_LEVELS; i++) {
+
+        for (n = 0; n < NGX_TIMER_WHEEL_LEVEL_SIZE; n++) {
+
+            if (ngx_queue_empty(&ngx_event_timer_wheel.far[i]
+                   [((now >> shift) + n) & NGX_TIMER_WHEEL_LEVEL_MASK]))
+            {
+                continue;
+            }
+
+            start = ((now >> shift) + n) << shift;
+
+            if (n == 0 && (now & (((ngx_msec_t) 1 << shift) - 1))) {
+
+                /*
+                 * the current slot has been already cascaded,
+                 * so it keeps the timers of the next wheel turn
+                 */
+
+                start += (ngx_msec_t) NGX_TIMER_WHEEL_LEVEL_SIZE << shift;
+
+                if (!found || (ngx_msec_int_t) (start - key) < 0) {
+                    key = start;
+                    found = 1;
+                }
+
+                continue;
+            }
+
+            if (!found || (ngx_msec_int_t) (start - key) < 0) {
+                key = start;
+                found = 1;
+            }
+
+            break;
+        }
+
+        shift += NGX_TIMER_WHEEL_LEVEL_BITS;
+    }
+
+    return key;
+}
+
+
+void
+ngx_event_expire_timers(void)
+{
+    ngx_msec_t  next;
+    ngx_uint_t  i, n, shift;
+
+    ngx_mutex_lock(ngx_event_timer_mutex);
+
+    for ( ;; ) {
+
+        if (ngx_event_timer_wheel_expire(&ngx_event_timer_wheel.expired)
+            == NGX_BUSY)
+        {
+            break;
+        }
+
+        if (ngx_event_timer_wheel_count == 0) {
+            ngx_event_timer_wheel.now = ngx_current_msec + 1;
+            break;
+        }
+
+        if ((ngx_msec_int_t) (ngx_current_msec - ngx_event_timer_wheel.now)
+            < 0)
+        {
+            break;
+        }
+
+        n = ngx_event_timer_wheel.now & NGX_TIMER_WHEEL_MASK;
+
+        if (n == 0) {
+            shift = NGX_TIMER_WHEEL_BITS;
+
+            for (i = 0; i < NGX_TIMER_WHEEL_LEVELS; i++) {
+                n = (ngx_event_timer_wheel.now >> shift)
+                    & NGX_TIMER_WHEEL_LEVEL_MASK;
+
+                ngx_event_timer_wheel_cascade(
+                                          &ngx_event_timer_wheel.far[i][n]);
+
+                if (n) {
+                    break;
+                }
+
+                shift += NGX_TIMER_WHEEL_LEVEL_BITS;
+            }
+
+            n = 0;
+        }
+
+        if (ngx_queue_empty(&ngx_event_timer_wheel.near[n])) {
+
+            /*
+             * skip the empty slots at once: the next slot is either
+             * a non-empty one or the first slot of a block to cascade
+             */
+
+            next = ngx_event_timer_wheel_next();
+
+            if ((ngx_msec_int_t) (next - ngx_event_timer_wheel.now) > 0) {
+
+                if ((ngx_msec_int_t) (ngx_current_msec - next) < 0) {
+                    ngx_event_timer_wheel.now = ngx_current_msec + 1;
+                    break;
+                }
+
+                ngx_event_timer_wheel.now = next;
+                continue;
+            }
+        }
+
+        if (ngx_event_timer_wheel_expire(&ngx_event_timer_wheel.near[n])
+            == NGX_BUSY)
+        {
+            break;
+        }
+
+        ngx_event_timer_wheel.now++;
+    }
+
+    ngx_mutex_unlock(ngx_event_timer_mutex);
+}
+
+
+static ngx_int_t
+ngx_event_timer_wheel_expire(ngx_queue_t *slot)
+{
+    ngx_queue_t  *q;
+    ngx_event_t  *ev;
+
+    /* the handlers may add timers to the slot being expired */
+
+    while (!ngx_queue_empty(slot)) {
+
+        q = ngx_queue_head(slot);
+        ev = ngx_queue_data(q, ngx_event_t, timer_queue);
+
+#if (NGX_THREADS)
+
+        if (ngx_threaded && ngx_trylock(ev->lock) == 0) {
+
+            /*
+             * We cannot change the timer of the event that is being
+             * handled by another thread, so we stop until the next
+             * iteration.  It should be a rare case anyway.
+             */
+
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "event %p is busy in expire timers", ev);
+            return NGX_BUSY;
+        }
+#endif
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "event timer del: %d: %M",
+                       ngx_event_ident(ev->data), ev->timer.key);
+
+        ngx_queue_remove(q);
+        ngx_event_timer_wheel_count--;
+
+        ngx_mutex_unlock(ngx_event_timer_mutex);
+
+        ev->timer_set = 0;
+
+#if (NGX_THREADS)
+        if (ngx_threaded) {
+            ev->posted_timedout = 1;
+
+            ngx_post_event(ev, &ngx_posted_events);
+
+            ngx_unlock(ev->lock);
+
+            ngx_mutex_lock(ngx_event_timer_mutex);
+
+            continue;
+        }
+#endif
+
+        ev->timedout = 1;
+
+        ev->handler(ev);
+
+        ngx_mutex_lock(ngx_event_timer_mutex);
+    }
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_event_no_timers_left(void)
+{
+    ngx_uint_t  i, l;
+
+    if (ngx_event_timer_empty()) {
+        return NGX_OK;
+    }
+
+    if (ngx_event_timer_wheel_cancelable(&ngx_event_timer_wheel.expired)
+        != NGX_OK)
+    {
+        return NGX_AGAIN;
+    }
+
+    for (i = 0; i < NGX_TIMER_WHEEL_SIZE; i++) {
+        if (ngx_event_timer_wheel_cancelable(&ngx_event_timer_wheel.near[i])
+            != NGX_OK)
+        {
+            return NGX_AGAIN;
+        }
+    }
+
+    for (l = 0; l < NGX_TIMER_WHEEL_LEVELS; l++) {
+        for (i = 0; i < NGX_TIMER_WHEEL_LEVEL_SIZE; i++) {
+            if (ngx_event_timer_wheel_cancelable(
+                                            &ngx_event_timer_wheel.far[l][i])
+                != NGX_OK)
+            {
+                return NGX_AGAIN;
+            }
+        }
+    }
+
+    /* only cancelable timers left */
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_event_timer_wheel_cancelable(ngx_queue_t *slot)
+{
+    ngx_queue_t  *q;
+    ngx_event_t  *ev;
+
+    for (q = ngx_queue_head(slot);
+         q != ngx_queue_sentinel(slot);
+         q = ngx_queue_next(q))
+    {
+        ev = ngx_queue_data(q, ngx_event_t, timer_queue);
+
+        if (!ev->cancelable) {
+            return NGX_AGAIN;
+        }
+    }
+
+    return NGX_OK;
+}
+
+#endif
@@ -22,6 +22,7 @@
 ngx_int_t ngx_event_timer_init(ngx_log_t *log);
 ngx_msec_t ngx_event_find_timer(void);
 void ngx_event_expire_timers(void);
+ngx_int_t ngx_event_no_timers_left(void);
 
 
 #if (NGX_THREADS)
@@ -29,8 +30,23 @@ extern ngx_mutex_t  *ngx_event_timer_mutex;
 #endif
 
 
+#if (NGX_TIMER_WHEEL)
+
+void ngx_event_timer_wheel_insert(ngx_event_t *ev);
+
+extern ngx_uint_t  ngx_event_timer_wheel_count;
+
+#define ngx_event_timer_empty()  (ngx_event_timer_wheel_count == 0)
+
+#else
+
 extern ngx_thread_volatile ngx_rbtree_t  ngx_event_timer_rbtree;
 
+#define ngx_event_timer_empty()                                               \
+    (ngx_event_timer_rbtree.root == ngx_event_timer_rbtree.sentinel)
+
+#endif
+
 
 static ngx_inline void
 ngx_event_del_timer(ngx_event_t *ev)
@@ -41,7 +57,12 @@ ngx_event_del_timer(ngx_event_t *ev)
 
     ngx_mutex_lock(ngx_event_timer_mutex);
 
+#if (NGX_TIMER_WHEEL)
+    ngx_queue_remove(&ev->timer_queue);
+    ngx_event_timer_wheel_count--;
+#else
     ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+#endif
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 
@@ -91,7 +112,11 @@ ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer)
 
     ngx_mutex_lock(ngx_event_timer_mutex);
 
+#if (NGX_TIMER_WHEEL)
+    ngx_event_timer_wheel_insert(ev);
+#else
     ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+#endif
 
     ngx_mutex_unlock(ngx_event_timer_mutex);
 
@@ -8,6 +8,7 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include <ngx_md5.h>
 
 
 typedef struct {
@@ -18,16 +19,49 @@ typedef struct {
 } ngx_http_limit_conn_node_t;
 
 
+/*
+ * the striped zone layout: keys are kept in hash tables with preallocated
+ * entries, each table has its own lock; keys longer than
+ * NGX_HTTP_LIMIT_CONN_KEY_LEN are stored as their MD5 digests
+ */
+
+#define NGX_HTTP_LIMIT_CONN_KEY_LEN   32
+
+
+typedef struct ngx_http_limit_conn_entry_s  ngx_http_limit_conn_entry_t;
+
+struct ngx_http_limit_conn_entry_s {
+    ngx_http_limit_conn_entry_t  *next;
+    uint32_t                      hash;
+    u_char                        len;
+    u_short                       conn;
+    u_char                        data[NGX_HTTP_LIMIT_CONN_KEY_LEN];
+};
+
+
 typedef struct {
-    ngx_shm_zone_t     *shm_zone;
-    ngx_rbtree_node_t  *node;
+    ngx_shmtx_sh_t                 lock;
+    ngx_shmtx_t                    mutex;
+    ngx_uint_t                     size;
+    ngx_http_limit_conn_entry_t   *free;
+    ngx_http_limit_conn_entry_t  **buckets;
+} ngx_http_limit_conn_stripe_t;
+
+
+typedef struct {
+    ngx_shm_zone_t                *shm_zone;
+    ngx_rbtree_node_t             *node;
+    ngx_http_limit_conn_stripe_t  *stripe;
+    ngx_http_limit_conn_entry_t   *entry;
 } ngx_http_limit_conn_cleanup_t;
 
 
 typedef struct {
-    ngx_rbtree_t       *rbtree;
-    ngx_int_t           index;
-    ngx_str_t           var;
+    ngx_rbtree_t                  *rbtree;
+    ngx_int_t                      index;
+    ngx_str_t                      var;
+    ngx_uint_t                     nstripes;
+    ngx_http_limit_conn_stripe_t **stripes;
 } ngx_http_limit_conn_ctx_t;
 
 
@@ -46,7 +80,16 @@ typedef struct {
 
 static ngx_rbtree_node_t *ngx_http_limit_conn_lookup(ngx_rbtree_t *rbtree,
     ngx_http_variable_value_t *vv, uint32_t hash);
+static ngx_int_t ngx_http_limit_conn_lookup_striped(
+    ngx_http_limit_conn_limit_t *limit, ngx_http_variable_value_t *vv,
+    uint32_t hash, ngx_http_limit_conn_stripe_t **sp,
+    ngx_http_limit_conn_entry_t **ep);
+static ngx_int_t ngx_http_limit_conn_init_stripes(ngx_shm_zone_t *shm_zone);
+static void ngx_http_limit_conn_unlock_zone(ngx_shm_zone_t *shm_zone,
+    ngx_pid_t pid);
 static void ngx_http_limit_conn_cleanup(void *data);
+static void ngx_http_limit_conn_cleanup_striped(
+    ngx_http_limit_conn_cleanup_t *lccln);
 static ngx_inline void ngx_http_limit_conn_cleanup_all(ngx_pool_t *pool);
 
 static void *ngx_http_limit_conn_create_conf(ngx_conf_t *cf);
@@ -83,7 +126,7 @@ static ngx_conf_num_bounds_t  ngx_http_limit_conn_status_bounds = {
 static ngx_command_t  ngx_http_limit_conn_commands[] = {
 
     { ngx_string("limit_conn_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE2,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE23,
       ngx_http_limit_conn_zone,
       0,
       0,
@@ -157,6 +200,7 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
 {
     size_t                          len, n;
     uint32_t                        hash;
+    ngx_int_t                       rc;
     ngx_uint_t                      i;
     ngx_slab_pool_t                *shpool;
     ngx_rbtree_node_t              *node;
@@ -166,6 +210,8 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
     ngx_http_limit_conn_node_t     *lc;
     ngx_http_limit_conn_conf_t     *lccf;
     ngx_http_limit_conn_limit_t    *limits;
+    ngx_http_limit_conn_entry_t    *entry;
+    ngx_http_limit_conn_stripe_t   *stripe;
     ngx_http_limit_conn_cleanup_t  *lccln;
 
     if (r->main->limit_conn_set) {
@@ -202,6 +248,39 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
 
         hash = ngx_crc32_short(vv->data, len);
 
+        if (ctx->nstripes) {
+
+            rc = ngx_http_limit_conn_lookup_striped(&limits[i], vv, hash,
+                                                    &stripe, &entry);
+
+            if (rc == NGX_BUSY) {
+                ngx_log_error(lccf->log_level, r->connection->log, 0,
+                              "limiting connections by zone \"%V\"",
+                              &limits[i].shm_zone->shm.name);
+            }
+
+            if (rc != NGX_OK) {
+                ngx_http_limit_conn_cleanup_all(r->pool);
+                return lccf->status_code;
+            }
+
+            cln = ngx_pool_cleanup_add(r->pool,
+                                       sizeof(ngx_http_limit_conn_cleanup_t));
+            if (cln == NULL) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            }
+
+            cln->handler = ngx_http_limit_conn_cleanup;
+            lccln = cln->data;
+
+            lccln->shm_zone = limits[i].shm_zone;
+            lccln->node = NULL;
+            lccln->stripe = stripe;
+            lccln->entry = entry;
+
+            continue;
+        }
+
         shpool = (ngx_slab_pool_t *) limits[i].shm_zone->shm.addr;
 
         ngx_shmtx_lock(&shpool->mutex);
@@ -266,6 +345,8 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
 
         lccln->shm_zone = limits[i].shm_zone;
         lccln->node = node;
+        lccln->stripe = NULL;
+        lccln->entry = NULL;
     }
 
     return NGX_DECLINED;
@@ -353,6 +434,93 @@ ngx_http_limit_conn_lookup(ngx_rbtree_t *rbtree, ngx_http_variable_value_t *vv,
 }
 
 
+static ngx_int_t
+ngx_http_limit_conn_lookup_striped(ngx_http_limit_conn_limit_t *limit,
+    ngx_http_variable_value_t *vv, uint32_t hash,
+    ngx_http_limit_conn_stripe_t **sp, ngx_http_limit_conn_entry_t **ep)
+{
+    u_char                        *key;
+    size_t                         n;
+    ngx_md5_t                      md5;
+    ngx_http_limit_conn_ctx_t     *ctx;
+    ngx_http_limit_conn_entry_t   *e, **bucket;
+    ngx_http_limit_conn_stripe_t  *stripe;
+    u_char                         digest[16];
+
+    ctx = limit->shm_zone->data;
+
+    if (vv->len > NGX_HTTP_LIMIT_CONN_KEY_LEN) {
+        ngx_md5_init(&md5);
+        ngx_md5_update(&md5, vv->data, vv->len);
+        ngx_md5_final(digest, &md5);
+
+        key = digest;
+        n = 16;
+
+    } else {
+        key = vv->data;
+        n = vv->len;
+    }
+
+    stripe = ctx->stripes[hash % ctx->nstripes];
+    bucket = &stripe->buckets[(hash / ctx->nstripes) % stripe->size];
+
+    ngx_shmtx_lock(&stripe->mutex);
+
+    for (e = *bucket; e; e = e->next) {
+
+        if (e->hash != hash
+            || e->len != vv->len
+            || ngx_memcmp(e->data, key, n) != 0)
+        {
+            continue;
+        }
+
+        if ((ngx_uint_t) e->conn >= limit->conn) {
+            ngx_shmtx_unlock(&stripe->mutex);
+            return NGX_BUSY;
+        }
+
+        e->conn++;
+
+        goto done;
+    }
+
+    e = stripe->free;
+
+    if (e == NULL) {
+        ngx_shmtx_unlock(&stripe->mutex);
+
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, 0,
+                      "no free entries in limit_conn_zone \"%V\"",
+                      &limit->shm_zone->shm.name);
+        return NGX_ERROR;
+    }
+
+    stripe->free = e->next;
+
+    e->next = *bucket;
+    *bucket = e;
+
+    e->hash = hash;
+    e->len = (u_char) vv->len;
+    e->conn = 1;
+    ngx_memcpy(e->data, key, n);
+
+done:
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "limit conn: %08XD %d", e->hash, e->conn);
+
+    ngx_shmtx_unlock(&stripe->mutex);
+
+    *sp = stripe;
+    *ep = e;
+
+    return NGX_OK;
+}
+
+
 static void
 ngx_http_limit_conn_cleanup(void *data)
 {
@@ -363,6 +531,11 @@ ngx_http_limit_conn_cleanup(void *data)
     ngx_http_limit_conn_ctx_t   *ctx;
     ngx_http_limit_conn_node_t  *lc;
 
+    if (lccln->stripe) {
+        ngx_http_limit_conn_cleanup_striped(lccln);
+        return;
+    }
+
     ctx = lccln->shm_zone->data;
     shpool = (ngx_slab_pool_t *) lccln->shm_zone->shm.addr;
     node = lccln->node;
@@ -384,6 +557,41 @@ ngx_http_limit_conn_cleanup(void *data)
 }
 
 
+static void
+ngx_http_limit_conn_cleanup_striped(ngx_http_limit_conn_cleanup_t *lccln)
+{
+    ngx_http_limit_conn_ctx_t     *ctx;
+    ngx_http_limit_conn_entry_t   *e, **next;
+    ngx_http_limit_conn_stripe_t  *stripe;
+
+    ctx = lccln->shm_zone->data;
+    stripe = lccln->stripe;
+    e = lccln->entry;
+
+    ngx_shmtx_lock(&stripe->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, lccln->shm_zone->shm.log, 0,
+                   "limit conn cleanup: %08XD %d", e->hash, e->conn);
+
+    e->conn--;
+
+    if (e->conn == 0) {
+        next = &stripe->buckets[(e->hash / ctx->nstripes) % stripe->size];
+
+        while (*next != e) {
+            next = &(*next)->next;
+        }
+
+        *next = e->next;
+
+        e->next = stripe->free;
+        stripe->free = e;
+    }
+
+    ngx_shmtx_unlock(&stripe->mutex);
+}
+
+
 static ngx_inline void
 ngx_http_limit_conn_cleanup_all(ngx_pool_t *pool)
 {
@@ -421,7 +629,16 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
             return NGX_ERROR;
         }
 
+        if (ctx->nstripes != octx->nstripes) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_conn_zone \"%V\" uses %ui stripes "
+                          "while previously it used %ui stripes",
+                          &shm_zone->shm.name, ctx->nstripes, octx->nstripes);
+            return NGX_ERROR;
+        }
+
         ctx->rbtree = octx->rbtree;
+        ctx->stripes = octx->stripes;
 
         return NGX_OK;
     }
@@ -429,11 +646,21 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
     shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
     if (shm_zone->shm.exists) {
-        ctx->rbtree = shpool->data;
+
+        if (ctx->nstripes) {
+            ctx->stripes = shpool->data;
+
+        } else {
+            ctx->rbtree = shpool->data;
+        }
 
         return NGX_OK;
     }
 
+    if (ctx->nstripes) {
+        return ngx_http_limit_conn_init_stripes(shm_zone);
+    }
+
     ctx->rbtree = ngx_slab_alloc(shpool, sizeof(ngx_rbtree_t));
     if (ctx->rbtree == NULL) {
         return NGX_ERROR;
@@ -463,6 +690,122 @@ ngx_http_limit_conn_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 }
 
 
+static ngx_int_t
+ngx_http_limit_conn_init_stripes(ngx_shm_zone_t *shm_zone)
+{
+    size_t                         len, size;
+    ngx_uint_t                     i, k, n, pages;
+    ngx_slab_pool_t               *shpool;
+    ngx_http_limit_conn_ctx_t     *ctx;
+    ngx_http_limit_conn_entry_t   *entries;
+    ngx_http_limit_conn_stripe_t  *stripe;
+
+    ctx = shm_zone->data;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    ctx->stripes = ngx_slab_alloc(shpool, ctx->nstripes
+                                  * sizeof(ngx_http_limit_conn_stripe_t *));
+    if (ctx->stripes == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = ctx->stripes;
+
+    len = sizeof(" in limit_conn_zone \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in limit_conn_zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /*
+     * the rest of the zone is divided between the stripes,
+     * a stripe has a bucket for each entry
+     */
+
+    pages = shpool->pfree / ctx->nstripes;
+    size = pages << ngx_pagesize_shift;
+
+    n = 0;
+
+    if (size > sizeof(ngx_http_limit_conn_stripe_t)) {
+        n = (size - sizeof(ngx_http_limit_conn_stripe_t))
+            / (sizeof(ngx_http_limit_conn_entry_t)
+               + sizeof(ngx_http_limit_conn_entry_t *));
+    }
+
+    if (n == 0) {
+        ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                      "limit_conn_zone \"%V\" is too small for %ui stripes",
+                      &shm_zone->shm.name, ctx->nstripes);
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < ctx->nstripes; i++) {
+
+        stripe = ngx_slab_alloc(shpool, size);
+        if (stripe == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memzero(stripe, sizeof(ngx_http_limit_conn_stripe_t));
+
+        if (ngx_shmtx_create(&stripe->mutex, &stripe->lock, NULL) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        stripe->size = n;
+
+        stripe->buckets = (ngx_http_limit_conn_entry_t **) &stripe[1];
+        ngx_memzero(stripe->buckets,
+                    n * sizeof(ngx_http_limit_conn_entry_t *));
+
+        entries = (ngx_http_limit_conn_entry_t *) &stripe->buckets[n];
+
+        stripe->free = NULL;
+
+        for (k = n; k--; /* void */) {
+            entries[k].next = stripe->free;
+            stripe->free = &entries[k];
+        }
+
+        ctx->stripes[i] = stripe;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, shm_zone->shm.log, 0,
+                   "limit_conn_zone \"%V\": %ui stripes of %ui entries",
+                   &shm_zone->shm.name, ctx->nstripes, n);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_limit_conn_unlock_zone(ngx_shm_zone_t *shm_zone, ngx_pid_t pid)
+{
+    ngx_uint_t                  i;
+    ngx_http_limit_conn_ctx_t  *ctx;
+
+    ctx = shm_zone->data;
+
+    if (ctx->stripes == NULL) {
+        return;
+    }
+
+    for (i = 0; i < ctx->nstripes; i++) {
+        if (ngx_shmtx_force_unlock(&ctx->stripes[i]->mutex, pid)) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                          "limit_conn_zone \"%V\" stripe %ui "
+                          "was locked by %P",
+                          &shm_zone->shm.name, i, pid);
+        }
+    }
+}
+
+
 static void *
 ngx_http_limit_conn_create_conf(ngx_conf_t *cf)
 {
@@ -510,6 +853,7 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     u_char                     *p;
     ssize_t                     size;
     ngx_str_t                  *value, name, s;
+    ngx_int_t                   stripes;
     ngx_uint_t                  i;
     ngx_shm_zone_t             *shm_zone;
     ngx_http_limit_conn_ctx_t  *ctx;
@@ -518,6 +862,7 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     ctx = NULL;
     size = 0;
+    stripes = 0;
     name.len = 0;
 
     for (i = 1; i < cf->args->nelts; i++) {
@@ -556,6 +901,19 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "stripes=", 8) == 0) {
+
+            stripes = ngx_atoi(value[i].data + 8, value[i].len - 8);
+            if (stripes <= 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid number of stripes \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (value[i].data[0] == '$') {
 
             value[i].len--;
@@ -595,6 +953,8 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    ctx->nstripes = stripes;
+
     shm_zone = ngx_shared_memory_add(cf, &name, size,
                                      &ngx_http_limit_conn_module);
     if (shm_zone == NULL) {
@@ -613,6 +973,10 @@ ngx_http_limit_conn_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     shm_zone->init = ngx_http_limit_conn_init_zone;
     shm_zone->data = ctx;
 
+    if (ctx->nstripes) {
+        shm_zone->unlock = ngx_http_limit_conn_unlock_zone;
+    }
+
     return NGX_CONF_OK;
 }
 
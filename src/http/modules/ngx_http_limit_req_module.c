@@ -8,6 +8,7 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include <ngx_md5.h>
 
 
 typedef struct {
@@ -23,10 +24,40 @@ typedef struct {
 } ngx_http_limit_req_node_t;
 
 
+/*
+ * the striped zone layout: keys are kept in hash tables with preallocated
+ * entries, each table has its own lock and LRU queue; keys longer than
+ * NGX_HTTP_LIMIT_REQ_KEY_LEN are stored as their MD5 digests
+ */
+
+#define NGX_HTTP_LIMIT_REQ_KEY_LEN   32
+
+
+typedef struct ngx_http_limit_req_entry_s  ngx_http_limit_req_entry_t;
+
+struct ngx_http_limit_req_entry_s {
+    ngx_http_limit_req_entry_t  *next;
+    uint32_t                     hash;
+    ngx_http_limit_req_node_t    node;
+    u_char                       data[NGX_HTTP_LIMIT_REQ_KEY_LEN - 1];
+};
+
+
+typedef struct {
+    ngx_shmtx_sh_t               lock;
+    ngx_shmtx_t                  mutex;
+    ngx_queue_t                  queue;
+    ngx_uint_t                   size;
+    ngx_http_limit_req_entry_t  *free;
+    ngx_http_limit_req_entry_t **buckets;
+} ngx_http_limit_req_stripe_t;
+
+
 typedef struct {
     ngx_rbtree_t                  rbtree;
     ngx_rbtree_node_t             sentinel;
     ngx_queue_t                   queue;
+    ngx_http_limit_req_stripe_t **stripes;
 } ngx_http_limit_req_shctx_t;
 
 
@@ -37,7 +68,9 @@ typedef struct {
     ngx_uint_t                   rate;
     ngx_int_t                    index;
     ngx_str_t                    var;
+    ngx_uint_t                   nstripes;
     ngx_http_limit_req_node_t   *node;
+    ngx_http_limit_req_stripe_t *stripe;
 } ngx_http_limit_req_ctx_t;
 
 
@@ -65,6 +98,16 @@ static ngx_msec_t ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits,
     ngx_uint_t n, ngx_uint_t *ep, ngx_http_limit_req_limit_t **limit);
 static void ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx,
     ngx_uint_t n);
+static ngx_int_t ngx_http_limit_req_lookup_striped(
+    ngx_http_limit_req_limit_t *limit, ngx_uint_t hash, u_char *data,
+    size_t len, ngx_uint_t *ep, ngx_uint_t account);
+static void ngx_http_limit_req_expire_striped(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_stripe_t *stripe, ngx_uint_t n);
+static void ngx_http_limit_req_lock(ngx_http_limit_req_ctx_t *ctx);
+static void ngx_http_limit_req_unlock(ngx_http_limit_req_ctx_t *ctx);
+static ngx_int_t ngx_http_limit_req_init_stripes(ngx_shm_zone_t *shm_zone);
+static void ngx_http_limit_req_unlock_zone(ngx_shm_zone_t *shm_zone,
+    ngx_pid_t pid);
 
 static void *ngx_http_limit_req_create_conf(ngx_conf_t *cf);
 static char *ngx_http_limit_req_merge_conf(ngx_conf_t *cf, void *parent,
@@ -93,7 +136,7 @@ static ngx_conf_num_bounds_t  ngx_http_limit_req_status_bounds = {
 static ngx_command_t  ngx_http_limit_req_commands[] = {
 
     { ngx_string("limit_req_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3|NGX_CONF_TAKE4,
       ngx_http_limit_req_zone,
       0,
       0,
@@ -211,12 +254,19 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
 
         hash = ngx_crc32_short(vv->data, len);
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
+        if (ctx->nstripes) {
+            rc = ngx_http_limit_req_lookup_striped(limit, hash, vv->data, len,
+                                             &excess,
+                                             (n == lrcf->limits.nelts - 1));
 
-        rc = ngx_http_limit_req_lookup(limit, hash, vv->data, len, &excess,
-                                       (n == lrcf->limits.nelts - 1));
+        } else {
+            ngx_shmtx_lock(&ctx->shpool->mutex);
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+            rc = ngx_http_limit_req_lookup(limit, hash, vv->data, len, &excess,
+                                           (n == lrcf->limits.nelts - 1));
+
+            ngx_shmtx_unlock(&ctx->shpool->mutex);
+        }
 
         ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "limit_req[%ui]: %i %ui.%03ui",
@@ -249,11 +299,11 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
                 continue;
             }
 
-            ngx_shmtx_lock(&ctx->shpool->mutex);
+            ngx_http_limit_req_lock(ctx);
 
             ctx->node->count--;
 
-            ngx_shmtx_unlock(&ctx->shpool->mutex);
+            ngx_http_limit_req_unlock(ctx);
 
             ctx->node = NULL;
         }
@@ -483,6 +533,146 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
 }
 
 
+static ngx_int_t
+ngx_http_limit_req_lookup_striped(ngx_http_limit_req_limit_t *limit,
+    ngx_uint_t hash, u_char *data, size_t len, ngx_uint_t *ep,
+    ngx_uint_t account)
+{
+    u_char                        *key;
+    size_t                         n;
+    ngx_int_t                      excess;
+    ngx_md5_t                      md5;
+    ngx_time_t                    *tp;
+    ngx_msec_t                     now;
+    ngx_msec_int_t                 ms;
+    ngx_http_limit_req_ctx_t      *ctx;
+    ngx_http_limit_req_node_t     *lr;
+    ngx_http_limit_req_entry_t    *e, **bucket;
+    ngx_http_limit_req_stripe_t   *stripe;
+    u_char                         digest[16];
+
+    ctx = limit->shm_zone->data;
+
+    if (len > NGX_HTTP_LIMIT_REQ_KEY_LEN) {
+        ngx_md5_init(&md5);
+        ngx_md5_update(&md5, data, len);
+        ngx_md5_final(digest, &md5);
+
+        key = digest;
+        n = 16;
+
+    } else {
+        key = data;
+        n = len;
+    }
+
+    stripe = ctx->sh->stripes[hash % ctx->nstripes];
+    bucket = &stripe->buckets[(hash / ctx->nstripes) % stripe->size];
+
+    ngx_shmtx_lock(&stripe->mutex);
+
+    tp = ngx_timeofday();
+    now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
+
+    for (e = *bucket; e; e = e->next) {
+
+        if (e->hash != hash
+            || e->node.len != len
+            || ngx_memcmp(e->node.data, key, n) != 0)
+        {
+            continue;
+        }
+
+        lr = &e->node;
+
+        ngx_queue_remove(&lr->queue);
+        ngx_queue_insert_head(&stripe->queue, &lr->queue);
+
+        ms = (ngx_msec_int_t) (now - lr->last);
+
+        excess = lr->excess - ctx->rate * ngx_abs(ms) / 1000 + 1000;
+
+        if (excess < 0) {
+            excess = 0;
+        }
+
+        *ep = excess;
+
+        if ((ngx_uint_t) excess > limit->burst) {
+            ngx_shmtx_unlock(&stripe->mutex);
+            return NGX_BUSY;
+        }
+
+        if (account) {
+            lr->excess = excess;
+            lr->last = now;
+            ngx_shmtx_unlock(&stripe->mutex);
+            return NGX_OK;
+        }
+
+        lr->count++;
+
+        ngx_shmtx_unlock(&stripe->mutex);
+
+        ctx->node = lr;
+        ctx->stripe = stripe;
+
+        return NGX_AGAIN;
+    }
+
+    *ep = 0;
+
+    ngx_http_limit_req_expire_striped(ctx, stripe, 1);
+
+    if (stripe->free == NULL) {
+        ngx_http_limit_req_expire_striped(ctx, stripe, 0);
+
+        if (stripe->free == NULL) {
+            ngx_shmtx_unlock(&stripe->mutex);
+
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, 0,
+                          "no free entries in limit_req zone \"%V\"",
+                          &limit->shm_zone->shm.name);
+            return NGX_ERROR;
+        }
+    }
+
+    e = stripe->free;
+    stripe->free = e->next;
+
+    e->next = *bucket;
+    *bucket = e;
+
+    e->hash = (uint32_t) hash;
+
+    lr = &e->node;
+
+    lr->len = (u_short) len;
+    lr->excess = 0;
+
+    ngx_memcpy(lr->data, key, n);
+
+    ngx_queue_insert_head(&stripe->queue, &lr->queue);
+
+    if (account) {
+        lr->last = now;
+        lr->count = 0;
+        ngx_shmtx_unlock(&stripe->mutex);
+        return NGX_OK;
+    }
+
+    lr->last = 0;
+    lr->count = 1;
+
+    ngx_shmtx_unlock(&stripe->mutex);
+
+    ctx->node = lr;
+    ctx->stripe = stripe;
+
+    return NGX_AGAIN;
+}
+
+
 static ngx_msec_t
 ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
     ngx_uint_t *ep, ngx_http_limit_req_limit_t **limit)
@@ -512,7 +702,7 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
             continue;
         }
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
+        ngx_http_limit_req_lock(ctx);
 
         tp = ngx_timeofday();
 
@@ -529,7 +719,7 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
         lr->excess = excess;
         lr->count--;
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        ngx_http_limit_req_unlock(ctx);
 
         ctx->node = NULL;
 
@@ -619,6 +809,97 @@ ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
 }
 
 
+static void
+ngx_http_limit_req_expire_striped(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_stripe_t *stripe, ngx_uint_t n)
+{
+    ngx_int_t                    excess;
+    ngx_time_t                  *tp;
+    ngx_msec_t                   now;
+    ngx_queue_t                 *q;
+    ngx_msec_int_t               ms;
+    ngx_http_limit_req_node_t   *lr;
+    ngx_http_limit_req_entry_t  *e, **next;
+
+    tp = ngx_timeofday();
+
+    now = (ngx_msec_t) (tp->sec * 1000 + tp->msec);
+
+    /* the same rules as in ngx_http_limit_req_expire() */
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&stripe->queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&stripe->queue);
+
+        lr = ngx_queue_data(q, ngx_http_limit_req_node_t, queue);
+
+        if (lr->count) {
+            return;
+        }
+
+        if (n++ != 0) {
+
+            ms = (ngx_msec_int_t) (now - lr->last);
+            ms = ngx_abs(ms);
+
+            if (ms < 60000) {
+                return;
+            }
+
+            excess = lr->excess - ctx->rate * ms / 1000;
+
+            if (excess > 0) {
+                return;
+            }
+        }
+
+        ngx_queue_remove(q);
+
+        e = (ngx_http_limit_req_entry_t *)
+                ((u_char *) lr - offsetof(ngx_http_limit_req_entry_t, node));
+
+        next = &stripe->buckets[(e->hash / ctx->nstripes) % stripe->size];
+
+        while (*next != e) {
+            next = &(*next)->next;
+        }
+
+        *next = e->next;
+
+        e->next = stripe->free;
+        stripe->free = e;
+    }
+}
+
+
+static void
+ngx_http_limit_req_lock(ngx_http_limit_req_ctx_t *ctx)
+{
+    if (ctx->nstripes) {
+        ngx_shmtx_lock(&ctx->stripe->mutex);
+
+    } else {
+        ngx_shmtx_lock(&ctx->shpool->mutex);
+    }
+}
+
+
+static void
+ngx_http_limit_req_unlock(ngx_http_limit_req_ctx_t *ctx)
+{
+    if (ctx->nstripes) {
+        ngx_shmtx_unlock(&ctx->stripe->mutex);
+
+    } else {
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+    }
+}
+
+
 static ngx_int_t
 ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 {
@@ -638,6 +919,14 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
             return NGX_ERROR;
         }
 
+        if (ctx->nstripes != octx->nstripes) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_req \"%V\" uses %ui stripes "
+                          "while previously it used %ui stripes",
+                          &shm_zone->shm.name, ctx->nstripes, octx->nstripes);
+            return NGX_ERROR;
+        }
+
         ctx->sh = octx->sh;
         ctx->shpool = octx->shpool;
 
@@ -664,6 +953,8 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 
     ngx_queue_init(&ctx->sh->queue);
 
+    ctx->sh->stripes = NULL;
+
     len = sizeof(" in limit_req zone \"\"") + shm_zone->shm.name.len;
 
     ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
@@ -674,10 +965,115 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
     ngx_sprintf(ctx->shpool->log_ctx, " in limit_req zone \"%V\"%Z",
                 &shm_zone->shm.name);
 
+    if (ctx->nstripes) {
+        return ngx_http_limit_req_init_stripes(shm_zone);
+    }
+
     return NGX_OK;
 }
 
 
+static ngx_int_t
+ngx_http_limit_req_init_stripes(ngx_shm_zone_t *shm_zone)
+{
+    size_t                        size;
+    ngx_uint_t                    i, k, n, pages;
+    ngx_http_limit_req_ctx_t     *ctx;
+    ngx_http_limit_req_entry_t   *entries;
+    ngx_http_limit_req_stripe_t  *stripe;
+
+    ctx = shm_zone->data;
+
+    ctx->sh->stripes = ngx_slab_alloc(ctx->shpool, ctx->nstripes
+                                      * sizeof(ngx_http_limit_req_stripe_t *));
+    if (ctx->sh->stripes == NULL) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * the rest of the zone is divided between the stripes,
+     * a stripe has a bucket for each entry
+     */
+
+    pages = ctx->shpool->pfree / ctx->nstripes;
+    size = pages << ngx_pagesize_shift;
+
+    n = 0;
+
+    if (size > sizeof(ngx_http_limit_req_stripe_t)) {
+        n = (size - sizeof(ngx_http_limit_req_stripe_t))
+            / (sizeof(ngx_http_limit_req_entry_t)
+               + sizeof(ngx_http_limit_req_entry_t *));
+    }
+
+    if (n == 0) {
+        ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                      "limit_req zone \"%V\" is too small for %ui stripes",
+                      &shm_zone->shm.name, ctx->nstripes);
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < ctx->nstripes; i++) {
+
+        stripe = ngx_slab_alloc(ctx->shpool, size);
+        if (stripe == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memzero(stripe, sizeof(ngx_http_limit_req_stripe_t));
+
+        if (ngx_shmtx_create(&stripe->mutex, &stripe->lock, NULL) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ngx_queue_init(&stripe->queue);
+        stripe->size = n;
+
+        stripe->buckets = (ngx_http_limit_req_entry_t **) &stripe[1];
+        ngx_memzero(stripe->buckets, n * sizeof(ngx_http_limit_req_entry_t *));
+
+        entries = (ngx_http_limit_req_entry_t *) &stripe->buckets[n];
+
+        stripe->free = NULL;
+
+        for (k = n; k--; /* void */) {
+            entries[k].next = stripe->free;
+            stripe->free = &entries[k];
+        }
+
+        ctx->sh->stripes[i] = stripe;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, shm_zone->shm.log, 0,
+                   "limit_req zone \"%V\": %ui stripes of %ui entries",
+                   &shm_zone->shm.name, ctx->nstripes, n);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_limit_req_unlock_zone(ngx_shm_zone_t *shm_zone, ngx_pid_t pid)
+{
+    ngx_uint_t                 i;
+    ngx_http_limit_req_ctx_t  *ctx;
+
+    ctx = shm_zone->data;
+
+    if (ctx->sh == NULL || ctx->sh->stripes == NULL) {
+        return;
+    }
+
+    for (i = 0; i < ctx->nstripes; i++) {
+        if (ngx_shmtx_force_unlock(&ctx->sh->stripes[i]->mutex, pid)) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                          "limit_req zone \"%V\" stripe %ui was locked by %P",
+                          &shm_zone->shm.name, i, pid);
+        }
+    }
+}
+
+
 static void *
 ngx_http_limit_req_create_conf(ngx_conf_t *cf)
 {
@@ -731,7 +1127,7 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     size_t                     len;
     ssize_t                    size;
     ngx_str_t                 *value, name, s;
-    ngx_int_t                  rate, scale;
+    ngx_int_t                  rate, scale, stripes;
     ngx_uint_t                 i;
     ngx_shm_zone_t            *shm_zone;
     ngx_http_limit_req_ctx_t  *ctx;
@@ -742,6 +1138,7 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     size = 0;
     rate = 1;
     scale = 1;
+    stripes = 0;
     name.len = 0;
 
     for (i = 1; i < cf->args->nelts; i++) {
@@ -804,6 +1201,19 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "stripes=", 8) == 0) {
+
+            stripes = ngx_atoi(value[i].data + 8, value[i].len - 8);
+            if (stripes <= 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid number of stripes \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (value[i].data[0] == '$') {
 
             value[i].len--;
@@ -844,6 +1254,7 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     ctx->rate = rate * 1000 / scale;
+    ctx->nstripes = stripes;
 
     shm_zone = ngx_shared_memory_add(cf, &name, size,
                                      &ngx_http_limit_req_module);
@@ -863,6 +1274,10 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     shm_zone->init = ngx_http_limit_req_init_zone;
     shm_zone->data = ctx;
 
+    if (ctx->nstripes) {
+        shm_zone->unlock = ngx_http_limit_req_unlock_zone;
+    }
+
     return NGX_CONF_OK;
 }
 
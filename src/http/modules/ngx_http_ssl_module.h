@@ -20,6 +20,7 @@ typedef struct {
     ngx_ssl_t                       ssl;
 
     ngx_flag_t                      prefer_server_ciphers;
+    ngx_flag_t                      ktls;
 
     ngx_uint_t                      protocols;
 
@@ -30,6 +31,9 @@ typedef struct {
 
     time_t                          session_timeout;
 
+    size_t                          buffer_size;
+    ngx_ssl_dyn_rec_t               dyn_rec;
+
     ngx_str_t                       certificate;
     ngx_str_t                       certificate_key;
     ngx_str_t                       dhparam;
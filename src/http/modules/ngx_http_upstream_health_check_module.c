@@ -0,0 +1,761 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_UPSTREAM_CHECK_BUFFER_SIZE  4096
+
+
+typedef struct {
+    ngx_msec_t                        interval;
+    ngx_msec_t                        timeout;
+    ngx_uint_t                        fails;
+    ngx_uint_t                        passes;
+
+    ngx_str_t                         uri;
+    ngx_str_t                         request;
+
+    ngx_uint_t                        status_min;
+    ngx_uint_t                        status_max;
+    ngx_str_t                         body;
+} ngx_http_upstream_check_srv_conf_t;
+
+
+typedef struct {
+    ngx_event_t                       event;
+
+    ngx_http_upstream_rr_peer_t      *peer;
+    ngx_http_upstream_rr_peers_t     *peers;
+    ngx_http_upstream_check_srv_conf_t  *conf;
+
+    ngx_peer_connection_t             pc;
+    ngx_http_upstream_rr_peer_addr_t  addr;
+    size_t                            sent;
+    ngx_buf_t                        *buf;
+} ngx_http_upstream_check_peer_t;
+
+
+static ngx_int_t ngx_http_upstream_check_init_process(ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_upstream_check_add_peers(ngx_cycle_t *cycle,
+    ngx_http_upstream_check_srv_conf_t *ucscf,
+    ngx_http_upstream_rr_peers_t *peers);
+static void ngx_http_upstream_check_handler(ngx_event_t *ev);
+static void ngx_http_upstream_check_connect(ngx_http_upstream_check_peer_t *cp);
+static void ngx_http_upstream_check_send_handler(ngx_event_t *wev);
+static void ngx_http_upstream_check_recv_handler(ngx_event_t *rev);
+static void ngx_http_upstream_check_dummy_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_upstream_check_response(
+    ngx_http_upstream_check_peer_t *cp);
+static void ngx_http_upstream_check_finalize(ngx_http_upstream_check_peer_t *cp,
+    ngx_int_t rc);
+
+static void *ngx_http_upstream_check_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_check(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_upstream_check_init(ngx_conf_t *cf);
+
+
+static ngx_command_t  ngx_http_upstream_check_commands[] = {
+
+    { ngx_string("health_check"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_ANY,
+      ngx_http_upstream_check,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_health_check_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_upstream_check_init,          /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_check_create_conf,   /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_health_check_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_health_check_module_ctx, /* module context */
+    ngx_http_upstream_check_commands,      /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_http_upstream_check_init_process,  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_check_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                           i;
+    ngx_http_upstream_rr_peers_t        *peers;
+    ngx_http_upstream_srv_conf_t       **uscfp;
+    ngx_http_upstream_main_conf_t       *umcf;
+    ngx_http_upstream_check_srv_conf_t  *ucscf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL || uscfp[i]->shm_zone == NULL) {
+            continue;
+        }
+
+        ucscf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                         ngx_http_upstream_health_check_module);
+
+        if (ucscf->interval == 0) {
+            continue;
+        }
+
+        peers = uscfp[i]->peer.data;
+
+        if (ngx_http_upstream_check_add_peers(cycle, ucscf, peers) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (peers->next
+            && ngx_http_upstream_check_add_peers(cycle, ucscf, peers->next)
+               != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_check_add_peers(ngx_cycle_t *cycle,
+    ngx_http_upstream_check_srv_conf_t *ucscf,
+    ngx_http_upstream_rr_peers_t *peers)
+{
+    ngx_uint_t                       i;
+    ngx_http_upstream_check_peer_t  *cp;
+
+    cp = ngx_pcalloc(cycle->pool,
+                     sizeof(ngx_http_upstream_check_peer_t) * peers->number);
+    if (cp == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < peers->number; i++) {
+        cp[i].peer = &peers->peer[i];
+        cp[i].peers = peers;
+        cp[i].conf = ucscf;
+
+        cp[i].event.handler = ngx_http_upstream_check_handler;
+        cp[i].event.data = &cp[i];
+        cp[i].event.log = cycle->log;
+        cp[i].event.cancelable = 1;
+
+        /*
+         * each worker wakes up once per interval at a random moment,
+         * the first one past the peer's next check time does the check
+         */
+
+        ngx_add_timer(&cp[i].event, ngx_random() % ucscf->interval + 1);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_check_handler(ngx_event_t *ev)
+{
+    ngx_msec_t                       now;
+    ngx_atomic_uint_t                next;
+    ngx_http_upstream_check_peer_t  *cp;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    cp = ev->data;
+
+    ngx_add_timer(ev, cp->conf->interval);
+
+    if (cp->pc.connection || cp->peer->down) {
+        return;
+    }
+
+    now = ngx_current_msec;
+    next = cp->peer->check_next;
+
+    if ((ngx_msec_int_t) (now - (ngx_msec_t) next) < 0) {
+        return;
+    }
+
+    if (!ngx_atomic_cmp_set(&cp->peer->check_next, next,
+                            (ngx_atomic_uint_t) (now + cp->conf->interval)))
+    {
+        /* another worker took the check */
+        return;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "health check of %V in upstream \"%V\"",
+                   &cp->peer->name, cp->peers->name);
+
+    ngx_http_upstream_check_connect(cp);
+}
+
+
+static void
+ngx_http_upstream_check_connect(ngx_http_upstream_check_peer_t *cp)
+{
+    ngx_int_t          rc;
+    ngx_connection_t  *c;
+
+    if (cp->buf == NULL) {
+        cp->buf = ngx_create_temp_buf(ngx_cycle->pool,
+                                      NGX_HTTP_UPSTREAM_CHECK_BUFFER_SIZE);
+        if (cp->buf == NULL) {
+            return;
+        }
+    }
+
+    cp->buf->pos = cp->buf->start;
+    cp->buf->last = cp->buf->start;
+    cp->sent = 0;
+
+    ngx_memzero(&cp->pc, sizeof(ngx_peer_connection_t));
+
+    /* the address of a peer resolved at run time may be freed meanwhile */
+
+    ngx_http_upstream_rr_peers_rlock(cp->peers);
+    ngx_http_upstream_rr_peer_copy_address(&cp->addr, cp->peer);
+    cp->pc.socklen = cp->peer->socklen;
+    ngx_http_upstream_rr_peers_unlock(cp->peers);
+
+    cp->pc.sockaddr = &cp->addr.u.sockaddr;
+    cp->pc.name = &cp->addr.name;
+    cp->pc.get = ngx_event_get_peer;
+    cp->pc.log = cp->event.log;
+    cp->pc.log_error = NGX_ERROR_ERR;
+
+    rc = ngx_event_connect_peer(&cp->pc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_http_upstream_check_finalize(cp, NGX_ERROR);
+        return;
+    }
+
+    /* rc == NGX_OK || rc == NGX_AGAIN */
+
+    c = cp->pc.connection;
+
+    c->data = cp;
+    c->sendfile = 0;
+
+    c->write->handler = ngx_http_upstream_check_send_handler;
+    c->read->handler = ngx_http_upstream_check_recv_handler;
+
+    ngx_add_timer(c->write, cp->conf->timeout);
+
+    if (rc == NGX_OK) {
+        ngx_http_upstream_check_send_handler(c->write);
+    }
+}
+
+
+static void
+ngx_http_upstream_check_send_handler(ngx_event_t *wev)
+{
+    ssize_t                          n;
+    ngx_str_t                       *request;
+    ngx_connection_t                *c;
+    ngx_http_upstream_check_peer_t  *cp;
+
+    c = wev->data;
+    cp = c->data;
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                      "health check of %V in upstream \"%V\" timed out",
+                      &cp->addr.name, cp->peers->name);
+        ngx_http_upstream_check_finalize(cp, NGX_ERROR);
+        return;
+    }
+
+    request = &cp->conf->request;
+
+    while (cp->sent < request->len) {
+
+        n = c->send(c, request->data + cp->sent, request->len - cp->sent);
+
+        if (n == NGX_ERROR) {
+            ngx_http_upstream_check_finalize(cp, NGX_ERROR);
+            return;
+        }
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+                ngx_http_upstream_check_finalize(cp, NGX_ERROR);
+            }
+
+            return;
+        }
+
+        cp->sent += n;
+    }
+
+    wev->handler = ngx_http_upstream_check_dummy_handler;
+
+    if (wev->timer_set) {
+        ngx_del_timer(wev);
+    }
+
+    if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+        ngx_http_upstream_check_finalize(cp, NGX_ERROR);
+        return;
+    }
+
+    ngx_add_timer(c->read, cp->conf->timeout);
+
+    if (c->read->ready) {
+        ngx_http_upstream_check_recv_handler(c->read);
+        return;
+    }
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        ngx_http_upstream_check_finalize(cp, NGX_ERROR);
+    }
+}
+
+
+static void
+ngx_http_upstream_check_recv_handler(ngx_event_t *rev)
+{
+    ssize_t                          n;
+    ngx_buf_t                       *b;
+    ngx_connection_t                *c;
+    ngx_http_upstream_check_peer_t  *cp;
+
+    c = rev->data;
+    cp = c->data;
+
+    if (rev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                      "health check of %V in upstream \"%V\" timed out",
+                      &cp->addr.name, cp->peers->name);
+        ngx_http_upstream_check_finalize(cp, NGX_ERROR);
+        return;
+    }
+
+    if (cp->sent < cp->conf->request.len) {
+        /* the request is not sent yet */
+        return;
+    }
+
+    b = cp->buf;
+
+    /*
+     * the response is read until the connection is closed,
+     * only the beginning of a large response is checked
+     */
+
+    while (b->last < b->end) {
+
+        n = c->recv(c, b->last, b->end - b->last);
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+                ngx_http_upstream_check_finalize(cp, NGX_ERROR);
+            }
+
+            return;
+        }
+
+        if (n == NGX_ERROR) {
+            ngx_http_upstream_check_finalize(cp, NGX_ERROR);
+            return;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        b->last += n;
+    }
+
+    ngx_http_upstream_check_finalize(cp, ngx_http_upstream_check_response(cp));
+}
+
+
+static void
+ngx_http_upstream_check_dummy_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "health check dummy handler");
+}
+
+
+static ngx_int_t
+ngx_http_upstream_check_response(ngx_http_upstream_check_peer_t *cp)
+{
+    u_char                              *p, *last;
+    ngx_uint_t                           status;
+    ngx_http_upstream_check_srv_conf_t  *ucscf;
+
+    ucscf = cp->conf;
+
+    p = cp->buf->pos;
+    last = cp->buf->last;
+
+    /* "HTTP/1.x NNN" */
+
+    if (last - p < 12
+        || ngx_strncmp(p, "HTTP/1.", 7) != 0
+        || p[8] != ' '
+        || p[9] < '0' || p[9] > '9'
+        || p[10] < '0' || p[10] > '9'
+        || p[11] < '0' || p[11] > '9')
+    {
+        ngx_log_error(NGX_LOG_ERR, cp->event.log, 0,
+                      "health check of %V in upstream \"%V\": "
+                      "invalid response", &cp->addr.name, cp->peers->name);
+        return NGX_ERROR;
+    }
+
+    status = (p[9] - '0') * 100 + (p[10] - '0') * 10 + (p[11] - '0');
+
+    if (status < ucscf->status_min || status > ucscf->status_max) {
+        ngx_log_error(NGX_LOG_ERR, cp->event.log, 0,
+                      "health check of %V in upstream \"%V\": "
+                      "unexpected status %ui",
+                      &cp->addr.name, cp->peers->name, status);
+        return NGX_ERROR;
+    }
+
+    if (ucscf->body.len == 0) {
+        return NGX_OK;
+    }
+
+    p = ngx_strnstr(p, "\r\n\r\n", last - p);
+
+    if (p == NULL
+        || ngx_strnstr(p + 4, (char *) ucscf->body.data, last - p - 4) == NULL)
+    {
+        ngx_log_error(NGX_LOG_ERR, cp->event.log, 0,
+                      "health check of %V in upstream \"%V\": "
+                      "response body does not match",
+                      &cp->addr.name, cp->peers->name);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_check_finalize(ngx_http_upstream_check_peer_t *cp,
+    ngx_int_t rc)
+{
+    ngx_http_upstream_rr_peer_t         *peer;
+    ngx_http_upstream_rr_peers_t        *peers;
+    ngx_http_upstream_check_srv_conf_t  *ucscf;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, cp->event.log, 0,
+                   "health check of %V done: %i", &cp->addr.name, rc);
+
+    if (cp->pc.connection) {
+        ngx_close_connection(cp->pc.connection);
+        cp->pc.connection = NULL;
+    }
+
+    peer = cp->peer;
+    peers = cp->peers;
+    ucscf = cp->conf;
+
+    ngx_http_upstream_rr_peers_rlock(peers);
+    ngx_http_upstream_rr_peer_lock(peers, peer);
+
+    if (rc == NGX_OK) {
+        peer->check_fails = 0;
+        peer->check_passes++;
+
+        if (peer->unhealthy && peer->check_passes >= ucscf->passes) {
+            peer->unhealthy = 0;
+            peer->fails = 0;
+
+            ngx_log_error(NGX_LOG_NOTICE, cp->event.log, 0,
+                          "upstream server %V in upstream \"%V\" "
+                          "is healthy", &peer->name, peers->name);
+        }
+
+    } else {
+        peer->check_passes = 0;
+        peer->check_fails++;
+
+        if (!peer->unhealthy && peer->check_fails >= ucscf->fails) {
+            peer->unhealthy = 1;
+
+            ngx_log_error(NGX_LOG_WARN, cp->event.log, 0,
+                          "upstream server %V in upstream \"%V\" "
+                          "is unhealthy", &peer->name, peers->name);
+        }
+    }
+
+    ngx_http_upstream_rr_peer_unlock(peers, peer);
+    ngx_http_upstream_rr_peers_unlock(peers);
+}
+
+
+static void *
+ngx_http_upstream_check_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_check_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_check_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->interval = 0;
+     *     conf->uri = { 0, NULL };
+     *     conf->request = { 0, NULL };
+     *     conf->body = { 0, NULL };
+     */
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_check(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_check_srv_conf_t *ucscf = conf;
+
+    u_char                        *p;
+    ngx_str_t                     *value, s;
+    ngx_int_t                      n;
+    ngx_uint_t                     i;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    if (ucscf->interval) {
+        return "is duplicate";
+    }
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    ucscf->interval = 5000;
+    ucscf->timeout = 1000;
+    ucscf->fails = 1;
+    ucscf->passes = 1;
+    ucscf->status_min = 200;
+    ucscf->status_max = 399;
+    ngx_str_set(&ucscf->uri, "/");
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = &value[i].data[9];
+
+            ucscf->interval = ngx_parse_time(&s, 0);
+            if (ucscf->interval == (ngx_msec_t) NGX_ERROR
+                || ucscf->interval == 0)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = &value[i].data[8];
+
+            ucscf->timeout = ngx_parse_time(&s, 0);
+            if (ucscf->timeout == (ngx_msec_t) NGX_ERROR
+                || ucscf->timeout == 0)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "fails=", 6) == 0) {
+
+            n = ngx_atoi(&value[i].data[6], value[i].len - 6);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            ucscf->fails = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "passes=", 7) == 0) {
+
+            n = ngx_atoi(&value[i].data[7], value[i].len - 7);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            ucscf->passes = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "uri=", 4) == 0) {
+
+            ucscf->uri.len = value[i].len - 4;
+            ucscf->uri.data = &value[i].data[4];
+
+            if (ucscf->uri.len == 0 || ucscf->uri.data[0] != '/') {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "status=", 7) == 0) {
+
+            s.len = value[i].len - 7;
+            s.data = &value[i].data[7];
+
+            p = ngx_strlchr(s.data, s.data + s.len, '-');
+
+            if (p) {
+                n = ngx_atoi(s.data, p - s.data);
+                if (n < 100 || n > 599) {
+                    goto invalid;
+                }
+
+                ucscf->status_min = n;
+
+                n = ngx_atoi(p + 1, s.data + s.len - p - 1);
+
+            } else {
+                n = ngx_atoi(s.data, s.len);
+                ucscf->status_min = n;
+            }
+
+            if (n < 100 || n > 599 || (ngx_uint_t) n < ucscf->status_min) {
+                goto invalid;
+            }
+
+            ucscf->status_max = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "body=", 5) == 0) {
+
+            ucscf->body.len = value[i].len - 5;
+            ucscf->body.data = &value[i].data[5];
+
+            if (ucscf->body.len == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    ucscf->request.len = sizeof("GET  HTTP/1.0" CRLF "Host: " CRLF
+                                "Connection: close" CRLF CRLF) - 1
+                         + ucscf->uri.len + uscf->host.len;
+
+    ucscf->request.data = ngx_pnalloc(cf->pool, ucscf->request.len);
+    if (ucscf->request.data == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_sprintf(ucscf->request.data,
+                "GET %V HTTP/1.0" CRLF "Host: %V" CRLF
+                "Connection: close" CRLF CRLF,
+                &ucscf->uri, &uscf->host);
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_check_init(ngx_conf_t *cf)
+{
+    ngx_uint_t                           i;
+    ngx_http_upstream_srv_conf_t       **uscfp;
+    ngx_http_upstream_main_conf_t       *umcf;
+    ngx_http_upstream_check_srv_conf_t  *ucscf;
+
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        ucscf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                         ngx_http_upstream_health_check_module);
+
+        if (ucscf->interval && uscfp[i]->shm_zone == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "health checks require upstream \"%V\" "
+                          "to reside in shared memory in %s:%ui",
+                          &uscfp[i]->host, uscfp[i]->file_name,
+                          uscfp[i]->line);
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
@@ -170,6 +170,14 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
     pc->cached = 0;
     pc->connection = NULL;
 
+    ngx_http_upstream_rr_peers_wlock(iphp->rrp.peers);
+
+    if (iphp->rrp.peers->total_weight == 0) {
+        /* none of the names resolved at run time is known yet */
+        ngx_http_upstream_rr_peers_unlock(iphp->rrp.peers);
+        return iphp->get_rr_peer(pc, &iphp->rrp);
+    }
+
     hash = iphp->hash;
 
     for ( ;; ) {
@@ -204,9 +212,7 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
 
             peer = &iphp->rrp.peers->peer[p];
 
-            /* ngx_lock_mutex(iphp->rrp.peers->mutex); */
-
-            if (!peer->down) {
+            if (!peer->down && !peer->unhealthy) {
 
                 if (peer->max_fails == 0 || peer->fails < peer->max_fails) {
                     break;
@@ -220,23 +226,25 @@ ngx_http_upstream_get_ip_hash_peer(ngx_peer_connection_t *pc, void *data)
 
             iphp->rrp.tried[n] |= m;
 
-            /* ngx_unlock_mutex(iphp->rrp.peers->mutex); */
-
             pc->tries--;
         }
 
         if (++iphp->tries >= 20) {
+            ngx_http_upstream_rr_peers_unlock(iphp->rrp.peers);
             return iphp->get_rr_peer(pc, &iphp->rrp);
         }
     }
 
     iphp->rrp.current = p;
 
-    pc->sockaddr = peer->sockaddr;
-    pc->socklen = peer->socklen;
-    pc->name = &peer->name;
+    if (ngx_http_upstream_rr_peer_address(pc, &iphp->rrp, peer) != NGX_OK) {
+        ngx_http_upstream_rr_peers_unlock(iphp->rrp.peers);
+        return NGX_ERROR;
+    }
+
+    peer->conns++;
 
-    /* ngx_unlock_mutex(iphp->rrp.peers->mutex); */
+    ngx_http_upstream_rr_peers_unlock(iphp->rrp.peers);
 
     iphp->rrp.tried[n] |= m;
     iphp->hash = hash;
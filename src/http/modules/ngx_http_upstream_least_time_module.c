@@ -0,0 +1,442 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+typedef struct {
+    ngx_uint_t                          last_byte;   /* unsigned last_byte:1; */
+} ngx_http_upstream_least_time_srv_conf_t;
+
+
+typedef struct {
+    /* the round robin data must be first */
+    ngx_http_upstream_rr_peer_data_t          rrp;
+
+    ngx_http_request_t                       *request;
+    ngx_http_upstream_least_time_srv_conf_t  *conf;
+} ngx_http_upstream_least_time_peer_data_t;
+
+
+static ngx_int_t ngx_http_upstream_init_least_time_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_least_time_peer(
+    ngx_peer_connection_t *pc, void *data);
+static ngx_int_t ngx_http_upstream_least_time_usable(
+    ngx_http_upstream_rr_peer_data_t *rrp, ngx_uint_t p, time_t now);
+static ngx_int_t ngx_http_upstream_least_time_complete(ngx_http_request_t *r);
+static void ngx_http_upstream_free_least_time_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static void *ngx_http_upstream_least_time_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_least_time(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_least_time_commands[] = {
+
+    { ngx_string("least_time"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_http_upstream_least_time,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_least_time_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_least_time_create_conf, /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_least_time_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_least_time_module_ctx, /* module context */
+    ngx_http_upstream_least_time_commands, /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_init_least_time(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "init least time");
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_http_upstream_init_least_time_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_least_time_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_least_time_peer_data_t  *ltp;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init least time peer");
+
+    ltp = ngx_palloc(r->pool, sizeof(ngx_http_upstream_least_time_peer_data_t));
+    if (ltp == NULL) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.data = &ltp->rrp;
+
+    if (ngx_http_upstream_init_round_robin_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.get = ngx_http_upstream_get_least_time_peer;
+    r->upstream->peer.free = ngx_http_upstream_free_least_time_peer;
+
+    ltp->request = r;
+    ltp->conf = ngx_http_conf_upstream_srv_conf(us,
+                                          ngx_http_upstream_least_time_module);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_least_time_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_rr_peer_data_t  *rrp = data;
+
+    time_t                         now;
+    uintptr_t                      m;
+    ngx_uint_t                     n, p, x, y, tries;
+    ngx_http_upstream_rr_peer_t   *peer, *px, *py;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get least time peer, try: %ui", pc->tries);
+
+    if (rrp->peers->single) {
+        return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+    }
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    now = ngx_time();
+
+    peers = rrp->peers;
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    if (peers->number == 1) {
+
+        /* backup servers only, "single" is not set */
+
+        if (ngx_http_upstream_least_time_usable(rrp, 0, now)) {
+            p = 0;
+            goto found;
+        }
+
+        ngx_http_upstream_rr_peers_unlock(peers);
+
+        return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+    }
+
+    /*
+     * the power of two choices: of two random servers the one with
+     * the lower expected delay, that is, the average response time
+     * multiplied by the number of active connections, is chosen
+     */
+
+    for (tries = 0; tries < 20; tries++) {
+
+        x = ngx_random() % peers->number;
+        y = ngx_random() % (peers->number - 1);
+
+        if (y >= x) {
+            y++;
+        }
+
+        if (!ngx_http_upstream_least_time_usable(rrp, x, now)) {
+
+            if (!ngx_http_upstream_least_time_usable(rrp, y, now)) {
+                continue;
+            }
+
+            p = y;
+            goto found;
+        }
+
+        if (!ngx_http_upstream_least_time_usable(rrp, y, now)) {
+            p = x;
+            goto found;
+        }
+
+        px = &peers->peer[x];
+        py = &peers->peer[y];
+
+        /* (time + 1) * (conns + 1) / weight, 1 ms is 8 units */
+
+        if ((px->response_time + 8) * (px->conns + 1) * py->weight
+            <= (py->response_time + 8) * (py->conns + 1) * px->weight)
+        {
+            p = x;
+
+        } else {
+            p = y;
+        }
+
+        goto found;
+    }
+
+    /* no luck with random choices, let round robin find a server */
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+
+found:
+
+    peer = &peers->peer[p];
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get least time peer, chosen: %ui %M %ui",
+                   p, peer->response_time / 8, peer->conns);
+
+    rrp->current = p;
+
+    if (ngx_http_upstream_rr_peer_address(pc, rrp, peer) != NGX_OK) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return NGX_ERROR;
+    }
+
+    if (now - peer->checked > peer->fail_timeout) {
+        peer->checked = now;
+    }
+
+    n = p / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+    rrp->tried[n] |= m;
+    peer->conns++;
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    if (pc->tries == 1 && peers->next) {
+        pc->tries += peers->next->number;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_least_time_usable(ngx_http_upstream_rr_peer_data_t *rrp,
+    ngx_uint_t p, time_t now)
+{
+    uintptr_t                     m;
+    ngx_uint_t                    n;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    n = p / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+    if (rrp->tried[n] & m) {
+        return 0;
+    }
+
+    peer = &rrp->peers->peer[p];
+
+    if (peer->down || peer->unhealthy) {
+        return 0;
+    }
+
+    if (peer->max_fails
+        && peer->fails >= peer->max_fails
+        && now - peer->checked <= peer->fail_timeout)
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+static void
+ngx_http_upstream_free_least_time_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state)
+{
+    ngx_http_upstream_least_time_peer_data_t  *ltp = data;
+
+    ngx_msec_t                     response_time;
+    ngx_http_upstream_t           *u;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    u = ltp->request->upstream;
+
+    /*
+     * the time is only sampled for a response received in full,
+     * ngx_http_upstream_finalize_request() has already calculated
+     * the response time at this point
+     */
+
+    if (state == 0
+        && u->state
+        && ngx_http_upstream_least_time_complete(ltp->request))
+    {
+
+        if (ltp->conf->last_byte) {
+            response_time = (ngx_msec_t) (u->state->response_sec * 1000
+                                          + u->state->response_msec);
+
+        } else {
+            response_time = u->state->header_time;
+        }
+
+        peers = ltp->rrp.peers;
+        peer = &peers->peer[ltp->rrp.current];
+
+        ngx_http_upstream_rr_peers_rlock(peers);
+        ngx_http_upstream_rr_peer_lock(peers, peer);
+
+        /* exponentially weighted with alpha = 1/8 */
+
+        peer->response_time += response_time - peer->response_time / 8;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "free least time peer %V: %M, average %M",
+                       &peer->name, response_time, peer->response_time / 8);
+
+        ngx_http_upstream_rr_peer_unlock(peers, peer);
+        ngx_http_upstream_rr_peers_unlock(peers);
+    }
+
+    ngx_http_upstream_free_round_robin_peer(pc, &ltp->rrp, state);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_least_time_complete(ngx_http_request_t *r)
+{
+    ngx_event_pipe_t     *p;
+    ngx_connection_t     *c;
+    ngx_http_upstream_t  *u;
+
+    u = r->upstream;
+
+    /* a client closed the connection prematurely */
+
+    if (r->connection->error || u->headers_in.status_n == 0) {
+        return 0;
+    }
+
+    if (r->header_only) {
+        return 1;
+    }
+
+    if (u->buffering) {
+        p = u->pipe;
+
+        return (p->upstream_done || p->upstream_eof) && !p->upstream_error;
+    }
+
+    if (u->length == 0) {
+        return 1;
+    }
+
+    c = u->peer.connection;
+
+    return c && c->read->eof && !c->read->error;
+}
+
+
+static void *
+ngx_http_upstream_least_time_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_least_time_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool,
+                       sizeof(ngx_http_upstream_least_time_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->last_byte = 0;
+     */
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_least_time(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_least_time_srv_conf_t  *ltcf = conf;
+
+    ngx_str_t                     *value;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "header") == 0) {
+        ltcf->last_byte = 0;
+
+    } else if (ngx_strcmp(value[1].data, "last_byte") == 0) {
+        ltcf->last_byte = 1;
+
+    } else {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    if (uscf->peer.init_upstream) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "load balancing method redefined");
+    }
+
+    uscf->peer.init_upstream = ngx_http_upstream_init_least_time;
+
+    uscf->flags = NGX_HTTP_UPSTREAM_CREATE
+                  |NGX_HTTP_UPSTREAM_WEIGHT
+                  |NGX_HTTP_UPSTREAM_MAX_FAILS
+                  |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                  |NGX_HTTP_UPSTREAM_DOWN
+                  |NGX_HTTP_UPSTREAM_BACKUP;
+
+    return NGX_CONF_OK;
+}
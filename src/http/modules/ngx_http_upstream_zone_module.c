@@ -0,0 +1,899 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#if (NGX_HAVE_INET6)
+
+#define NGX_HTTP_UPSTREAM_ZONE_SOCKADDR_LEN  sizeof(struct sockaddr_in6)
+#define NGX_HTTP_UPSTREAM_ZONE_NAME_LEN                                       \
+    (NGX_INET6_ADDRSTRLEN + sizeof("[]:65535") - 1)
+
+#else
+
+#define NGX_HTTP_UPSTREAM_ZONE_SOCKADDR_LEN  sizeof(struct sockaddr_in)
+#define NGX_HTTP_UPSTREAM_ZONE_NAME_LEN                                       \
+    (NGX_INET_ADDRSTRLEN + sizeof(":65535") - 1)
+
+#endif
+
+
+typedef struct {
+    ngx_event_t                      event;
+
+    ngx_http_upstream_rr_peers_t    *peers;
+    ngx_uint_t                       first;
+    ngx_uint_t                       number;
+    ngx_http_upstream_server_t      *server;
+
+    ngx_resolver_t                  *resolver;
+    ngx_msec_t                       timeout;
+    ngx_resolver_ctx_t              *ctx;
+} ngx_http_upstream_zone_resolve_t;
+
+
+static char *ngx_http_upstream_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_http_upstream_rr_peers_t *ngx_http_upstream_zone_copy_peers(
+    ngx_slab_pool_t *shpool, ngx_http_upstream_rr_peers_t *src);
+static ngx_int_t ngx_http_upstream_zone_copy_addrs(ngx_slab_pool_t *shpool,
+    ngx_http_upstream_rr_peers_t *peers);
+
+static ngx_int_t ngx_http_upstream_zone_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_upstream_zone_init_process(ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_upstream_zone_add_resolve(ngx_cycle_t *cycle,
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_core_loc_conf_t *clcf);
+static void ngx_http_upstream_zone_resolve_timer(ngx_event_t *ev);
+static void ngx_http_upstream_zone_resolve_handler(ngx_resolver_ctx_t *ctx);
+static void ngx_http_upstream_zone_update_peers(
+    ngx_http_upstream_zone_resolve_t *zr, ngx_resolver_ctx_t *ctx);
+static ngx_addr_t *ngx_http_upstream_zone_targets(
+    ngx_http_upstream_zone_resolve_t *zr, ngx_resolver_ctx_t *ctx,
+    ngx_uint_t *n);
+
+
+static ngx_command_t  ngx_http_upstream_zone_commands[] = {
+
+    { ngx_string("zone"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      ngx_http_upstream_zone,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_zone_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_upstream_zone_init,           /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_zone_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_zone_module_ctx,    /* module context */
+    ngx_http_upstream_zone_commands,       /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_http_upstream_zone_init_process,   /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static char *
+ngx_http_upstream_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ssize_t                         size;
+    ngx_str_t                      *value;
+    ngx_http_upstream_srv_conf_t   *uscf;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+
+    if (uscf->shm_zone) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (!value[1].len) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone name \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (cf->args->nelts == 3) {
+        size = ngx_parse_size(&value[2]);
+
+        if (size == NGX_ERROR) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid zone size \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        if (size < (ssize_t) (8 * ngx_pagesize)) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "zone \"%V\" is too small", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+
+    } else {
+        size = 0;
+    }
+
+    uscf->shm_zone = ngx_shared_memory_add(cf, &value[1], size,
+                                           &ngx_http_upstream_module);
+    if (uscf->shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    uscf->shm_zone->init = ngx_http_upstream_init_zone;
+    uscf->shm_zone->data = umcf;
+
+    /*
+     * peers are copied anew on each reload as the configuration
+     * may have changed, so an old zone must not be reused
+     */
+
+    uscf->shm_zone->noreuse = 1;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    size_t                          len;
+    ngx_uint_t                      i;
+    ngx_slab_pool_t                *shpool;
+    ngx_http_upstream_rr_peers_t   *peers, **peersp;
+    ngx_http_upstream_srv_conf_t   *uscf, **uscfp;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    umcf = shm_zone->data;
+    uscfp = umcf->upstreams.elts;
+
+    if (shm_zone->shm.exists) {
+        peers = shpool->data;
+
+        for (i = 0; i < umcf->upstreams.nelts; i++) {
+            uscf = uscfp[i];
+
+            if (uscf->shm_zone != shm_zone) {
+                continue;
+            }
+
+            uscf->peer.data = peers;
+            peers = peers->zone_next;
+        }
+
+        return NGX_OK;
+    }
+
+    len = sizeof(" in upstream zone \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in upstream zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+
+    /* copy peers to shared memory */
+
+    peersp = (ngx_http_upstream_rr_peers_t **) (void *) &shpool->data;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        uscf = uscfp[i];
+
+        if (uscf->shm_zone != shm_zone) {
+            continue;
+        }
+
+        peers = ngx_http_upstream_zone_copy_peers(shpool, uscf->peer.data);
+        if (peers == NULL) {
+            return NGX_ERROR;
+        }
+
+        *peersp = peers;
+        peersp = &peers->zone_next;
+
+        uscf->peer.data = peers;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_http_upstream_rr_peers_t *
+ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
+    ngx_http_upstream_rr_peers_t *src)
+{
+    size_t                         size;
+    ngx_uint_t                     i;
+    ngx_http_upstream_rr_peers_t  *peers, *backup;
+
+    /*
+     * the peer addresses and names stay in the configuration memory
+     * which is inherited by all worker processes, only the state that
+     * is changed at run time is moved to the shared memory
+     */
+
+    size = sizeof(ngx_http_upstream_rr_peers_t)
+           + sizeof(ngx_http_upstream_rr_peer_t) * (src->number - 1);
+
+    peers = ngx_slab_alloc_locked(shpool, size);
+    if (peers == NULL) {
+        return NULL;
+    }
+
+    ngx_memcpy(peers, src, size);
+
+    peers->shpool = shpool;
+    peers->rwlock = 0;
+    peers->zone_next = NULL;
+
+    for (i = 0; i < peers->number; i++) {
+        peers->peer[i].lock = 0;
+    }
+
+    if (ngx_http_upstream_zone_copy_addrs(shpool, peers) != NGX_OK) {
+        return NULL;
+    }
+
+    if (src->next == NULL) {
+        return peers;
+    }
+
+    size = sizeof(ngx_http_upstream_rr_peers_t)
+           + sizeof(ngx_http_upstream_rr_peer_t) * (src->next->number - 1);
+
+    backup = ngx_slab_alloc_locked(shpool, size);
+    if (backup == NULL) {
+        return NULL;
+    }
+
+    ngx_memcpy(backup, src->next, size);
+
+    backup->shpool = shpool;
+    backup->rwlock = 0;
+    backup->zone_next = NULL;
+
+    for (i = 0; i < backup->number; i++) {
+        backup->peer[i].lock = 0;
+    }
+
+    if (ngx_http_upstream_zone_copy_addrs(shpool, backup) != NGX_OK) {
+        return NULL;
+    }
+
+    peers->next = backup;
+
+    return peers;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_zone_copy_addrs(ngx_slab_pool_t *shpool,
+    ngx_http_upstream_rr_peers_t *peers)
+{
+    u_char                       *name;
+    size_t                        len;
+    ngx_uint_t                    i;
+    struct sockaddr              *sockaddr;
+    struct sockaddr_in           *sin;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    /*
+     * addresses of servers resolved at run time are changed by one
+     * worker process and must be seen by others, so they are moved
+     * to the shared memory as well
+     */
+
+    for (i = 0; i < peers->number; i++) {
+        peer = &peers->peer[i];
+
+        if (peer->server == NULL) {
+            continue;
+        }
+
+        /* the name follows the address in the same allocation */
+
+        len = ngx_max(peer->name.len, NGX_HTTP_UPSTREAM_ZONE_NAME_LEN);
+
+        sockaddr = ngx_slab_alloc_locked(shpool,
+                                     NGX_HTTP_UPSTREAM_ZONE_SOCKADDR_LEN + len);
+        if (sockaddr == NULL) {
+            return NGX_ERROR;
+        }
+
+        name = (u_char *) sockaddr + NGX_HTTP_UPSTREAM_ZONE_SOCKADDR_LEN;
+
+        ngx_memzero(sockaddr, NGX_HTTP_UPSTREAM_ZONE_SOCKADDR_LEN);
+
+        if (peer->sockaddr) {
+            ngx_memcpy(sockaddr, peer->sockaddr, peer->socklen);
+
+        } else {
+            sin = (struct sockaddr_in *) sockaddr;
+            sin->sin_family = AF_INET;
+            sin->sin_port = htons(peer->server->port);
+
+            peer->socklen = sizeof(struct sockaddr_in);
+        }
+
+        peer->sockaddr = sockaddr;
+
+        ngx_memcpy(name, peer->name.data, peer->name.len);
+        peer->name.data = name;
+
+        peer->resolve_next = 0;
+        peer->retired = NULL;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_zone_init(ngx_conf_t *cf)
+{
+    ngx_uint_t                      i, j;
+    ngx_http_core_loc_conf_t       *clcf;
+    ngx_http_upstream_server_t     *server;
+    ngx_http_upstream_srv_conf_t  **uscfp;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->servers == NULL) {
+            continue;
+        }
+
+        server = uscfp[i]->servers->elts;
+
+        for (j = 0; j < uscfp[i]->servers->nelts; j++) {
+
+            if (!server[j].resolve) {
+                continue;
+            }
+
+            if (uscfp[i]->shm_zone == NULL) {
+                ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                              "resolving names at run time requires "
+                              "upstream \"%V\" in %s:%ui "
+                              "to be in shared memory",
+                              &uscfp[i]->host, uscfp[i]->file_name,
+                              uscfp[i]->line);
+                return NGX_ERROR;
+            }
+
+            if (clcf->resolver == NULL
+                || clcf->resolver->udp_connections.nelts == 0)
+            {
+                ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                              "no resolver defined to resolve names "
+                              "at run time in upstream \"%V\" in %s:%ui",
+                              &uscfp[i]->host, uscfp[i]->file_name,
+                              uscfp[i]->line);
+                return NGX_ERROR;
+            }
+
+            break;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_zone_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                      i;
+    ngx_http_conf_ctx_t            *ctx;
+    ngx_http_core_loc_conf_t       *clcf;
+    ngx_http_upstream_rr_peers_t   *peers;
+    ngx_http_upstream_srv_conf_t  **uscfp;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    ctx = (ngx_http_conf_ctx_t *) ngx_get_conf(cycle->conf_ctx,
+                                               ngx_http_module);
+
+    if (ctx == NULL) {
+        return NGX_OK;
+    }
+
+    clcf = ctx->loc_conf[ngx_http_core_module.ctx_index];
+    umcf = ctx->main_conf[ngx_http_upstream_module.ctx_index];
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->shm_zone == NULL) {
+            continue;
+        }
+
+        peers = uscfp[i]->peer.data;
+
+        if (ngx_http_upstream_zone_add_resolve(cycle, peers, clcf) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (peers->next
+            && ngx_http_upstream_zone_add_resolve(cycle, peers->next, clcf)
+               != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_zone_add_resolve(ngx_cycle_t *cycle,
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_core_loc_conf_t *clcf)
+{
+    ngx_uint_t                         i;
+    ngx_http_upstream_server_t        *server;
+    ngx_http_upstream_zone_resolve_t  *zr;
+
+    i = 0;
+
+    while (i < peers->number) {
+
+        server = peers->peer[i].server;
+
+        if (server == NULL) {
+            i++;
+            continue;
+        }
+
+        /* addresses of a name occupy consecutive peers */
+
+        i += server->naddrs;
+
+        if (server->down) {
+            continue;
+        }
+
+        zr = ngx_pcalloc(cycle->pool, sizeof(ngx_http_upstream_zone_resolve_t));
+        if (zr == NULL) {
+            return NGX_ERROR;
+        }
+
+        zr->peers = peers;
+        zr->first = i - server->naddrs;
+        zr->number = server->naddrs;
+        zr->server = server;
+        zr->resolver = clcf->resolver;
+        zr->timeout = (clcf->resolver_timeout == NGX_CONF_UNSET_MSEC)
+                      ? 30000 : clcf->resolver_timeout;
+
+        zr->event.handler = ngx_http_upstream_zone_resolve_timer;
+        zr->event.data = zr;
+        zr->event.log = cycle->log;
+        zr->event.cancelable = 1;
+
+        ngx_add_timer(&zr->event, ngx_random() % 1000 + 1);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_zone_resolve_timer(ngx_event_t *ev)
+{
+    ngx_msec_t                         now;
+    ngx_atomic_uint_t                  next;
+    ngx_resolver_ctx_t                *ctx;
+    ngx_http_upstream_rr_peer_t       *peer;
+    ngx_http_upstream_zone_resolve_t  *zr;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    zr = ev->data;
+
+    ngx_add_timer(ev, 1000);
+
+    if (zr->ctx) {
+        return;
+    }
+
+    /*
+     * the first peer of the name keeps the time of the next resolution,
+     * the worker process which updates it does the resolution
+     */
+
+    peer = &zr->peers->peer[zr->first];
+
+    now = ngx_current_msec;
+    next = peer->resolve_next;
+
+    if ((ngx_msec_int_t) (now - (ngx_msec_t) next) < 0) {
+        return;
+    }
+
+    if (!ngx_atomic_cmp_set(&peer->resolve_next, next,
+                            (ngx_atomic_uint_t) (now + zr->timeout + 1000)))
+    {
+        return;
+    }
+
+    ctx = ngx_resolve_start(zr->resolver, NULL);
+    if (ctx == NULL) {
+        return;
+    }
+
+    if (ctx == NGX_NO_RESOLVER) {
+        ngx_log_error(NGX_LOG_ERR, ev->log, 0,
+                      "no resolver defined to resolve %V", &zr->server->host);
+        return;
+    }
+
+    if (zr->server->service.len) {
+        ctx->name = zr->server->service;
+        ctx->type = NGX_RESOLVE_SRV;
+
+    } else {
+        ctx->name = zr->server->host;
+        ctx->type = NGX_RESOLVE_A;
+    }
+    ctx->handler = ngx_http_upstream_zone_resolve_handler;
+    ctx->data = zr;
+    ctx->timeout = zr->timeout;
+
+    zr->ctx = ctx;
+
+    if (ngx_resolve_name(ctx) != NGX_OK) {
+        zr->ctx = NULL;
+    }
+}
+
+
+static void
+ngx_http_upstream_zone_resolve_handler(ngx_resolver_ctx_t *ctx)
+{
+    ngx_http_upstream_zone_resolve_t  *zr = ctx->data;
+
+    time_t                        valid;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    if (ctx->state) {
+        ngx_log_error(NGX_LOG_ERR, zr->event.log, 0,
+                      "%V could not be resolved (%i: %s)",
+                      &ctx->name, ctx->state,
+                      ngx_resolver_strerror(ctx->state));
+
+        /* the old addresses are kept, retry later */
+
+        valid = 10;
+
+    } else {
+        ngx_http_upstream_zone_update_peers(zr, ctx);
+
+        valid = ctx->valid - ngx_time();
+
+        if (valid < 1) {
+            valid = 1;
+        }
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, zr->event.log, 0,
+                   "upstream resolve %V next in %T", &ctx->name, valid);
+
+    peer = &zr->peers->peer[zr->first];
+
+    peer->resolve_next = (ngx_atomic_uint_t)
+                         (ngx_current_msec + (ngx_msec_t) valid * 1000);
+
+    ngx_resolve_name_done(ctx);
+    zr->ctx = NULL;
+}
+
+
+static void
+ngx_http_upstream_zone_update_peers(ngx_http_upstream_zone_resolve_t *zr,
+    ngx_resolver_ctx_t *ctx)
+{
+    u_char                        *name;
+    void                          *retired[NGX_HTTP_UPSTREAM_MAX_RESOLVED];
+    ngx_uint_t                     i, j, n, k, last;
+    ngx_addr_t                    *addrs;
+    struct sockaddr               *sockaddr;
+    ngx_slab_pool_t               *shpool;
+    ngx_http_upstream_rr_peer_t   *peer, *slot;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    addrs = ngx_http_upstream_zone_targets(zr, ctx, &n);
+    if (addrs == NULL) {
+        return;
+    }
+
+    peers = zr->peers;
+    shpool = peers->shpool;
+    last = zr->first + zr->number;
+
+    k = 0;
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    /* addresses which are gone are marked down */
+
+    for (i = zr->first; i < last; i++) {
+        peer = &peers->peer[i];
+
+        if (peer->down) {
+            continue;
+        }
+
+        for (j = 0; j < n; j++) {
+            if (ngx_cmp_sockaddr(peer->sockaddr, addrs[j].sockaddr, 1)
+                == NGX_OK)
+            {
+                break;
+            }
+        }
+
+        if (j == n) {
+            ngx_log_error(NGX_LOG_NOTICE, zr->event.log, 0,
+                          "upstream server %V of \"%V\" in upstream \"%V\" "
+                          "removed", &peer->name, &ctx->name, peers->name);
+
+            peers->total_weight -= peer->weight;
+
+            peer->weight = 0;
+            peer->effective_weight = 0;
+            peer->down = 1;
+        }
+    }
+
+    /* new addresses take free slots, the existing ones keep their state */
+
+    for (j = 0; j < n; j++) {
+
+        slot = NULL;
+
+        for (i = zr->first; i < last; i++) {
+            peer = &peers->peer[i];
+
+            if (peer->down) {
+                if (slot == NULL) {
+                    slot = peer;
+                }
+
+                continue;
+            }
+
+            if (ngx_cmp_sockaddr(peer->sockaddr, addrs[j].sockaddr, 1)
+                == NGX_OK)
+            {
+                break;
+            }
+        }
+
+        if (i < last) {
+            continue;
+        }
+
+        if (slot == NULL) {
+            ngx_log_error(NGX_LOG_WARN, zr->event.log, 0,
+                          "\"%V\" in upstream \"%V\" resolved to more "
+                          "than %ui addresses", &ctx->name, peers->name,
+                          zr->number);
+            break;
+        }
+
+        peer = slot;
+
+        /*
+         * the address and the name of the peer are copied by requests
+         * and health checks with the peers locked, but may still be read
+         * unlocked for logging, so they are not changed in place: new
+         * ones are allocated and the old ones are freed on the next
+         * change of the peer
+         */
+
+        sockaddr = ngx_slab_alloc(shpool, NGX_HTTP_UPSTREAM_ZONE_SOCKADDR_LEN
+                                          + NGX_HTTP_UPSTREAM_ZONE_NAME_LEN);
+        if (sockaddr == NULL) {
+            break;
+        }
+
+        name = (u_char *) sockaddr + NGX_HTTP_UPSTREAM_ZONE_SOCKADDR_LEN;
+
+        ngx_memzero(sockaddr, NGX_HTTP_UPSTREAM_ZONE_SOCKADDR_LEN);
+        ngx_memcpy(sockaddr, addrs[j].sockaddr, addrs[j].socklen);
+
+        if (peer->retired) {
+            retired[k++] = peer->retired;
+        }
+
+        peer->retired = peer->sockaddr;
+
+        peer->sockaddr = sockaddr;
+        peer->socklen = addrs[j].socklen;
+        peer->name.len = ngx_sock_ntop(sockaddr, name,
+                                       NGX_HTTP_UPSTREAM_ZONE_NAME_LEN, 1);
+        peer->name.data = name;
+
+        peer->weight = zr->server->weight;
+        peer->effective_weight = peer->weight;
+        peer->current_weight = 0;
+
+        peers->total_weight += peer->weight;
+
+        peer->fails = 0;
+        peer->accessed = 0;
+        peer->checked = 0;
+        peer->response_time = 0;
+        peer->unhealthy = 0;
+        peer->check_fails = 0;
+        peer->check_passes = 0;
+        peer->down = 0;
+
+        ngx_log_error(NGX_LOG_NOTICE, zr->event.log, 0,
+                      "upstream server %V of \"%V\" in upstream \"%V\" added",
+                      &peer->name, &ctx->name, peers->name);
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    for (i = 0; i < k; i++) {
+        ngx_slab_free(shpool, retired[i]);
+    }
+
+    ngx_free(addrs);
+}
+
+
+static ngx_addr_t *
+ngx_http_upstream_zone_targets(ngx_http_upstream_zone_resolve_t *zr,
+    ngx_resolver_ctx_t *ctx, ngx_uint_t *n)
+{
+    u_char                    (*sockaddr)[NGX_SOCKADDRLEN];
+    in_port_t                  port;
+    ngx_uint_t                 i, j, k, priority;
+    ngx_addr_t                *addrs;
+    ngx_resolver_srv_name_t   *srv;
+
+    /*
+     * the addresses the servers should have: those of the name with
+     * the port of the server, or those of the SRV records with the
+     * lowest priority which were resolved, with the ports of the records
+     */
+
+    k = 0;
+    priority = 0;
+
+    if (ctx->type == NGX_RESOLVE_SRV) {
+        priority = NGX_MAX_UINT32_VALUE;
+
+        for (i = 0; i < ctx->nsrvs; i++) {
+            srv = &ctx->srvs[i];
+
+            if (srv->state == NGX_OK && srv->priority < priority) {
+                priority = srv->priority;
+            }
+        }
+
+        for (i = 0; i < ctx->nsrvs; i++) {
+            srv = &ctx->srvs[i];
+
+            if (srv->state == NGX_OK && srv->priority == priority) {
+                k += srv->naddrs;
+            }
+        }
+
+    } else {
+        k = ctx->naddrs;
+    }
+
+    addrs = ngx_alloc(k * (sizeof(ngx_addr_t) + NGX_SOCKADDRLEN) + 1,
+                      zr->event.log);
+    if (addrs == NULL) {
+        return NULL;
+    }
+
+    sockaddr = (u_char (*)[NGX_SOCKADDRLEN]) &addrs[k];
+
+    k = 0;
+
+    if (ctx->type != NGX_RESOLVE_SRV) {
+        port = htons(zr->server->port);
+
+        for (i = 0; i < ctx->naddrs; i++) {
+            ngx_memcpy(sockaddr[k], ctx->addrs[i].sockaddr,
+                       ctx->addrs[i].socklen);
+
+            addrs[k].sockaddr = (struct sockaddr *) sockaddr[k];
+            addrs[k].socklen = ctx->addrs[i].socklen;
+
+            switch (addrs[k].sockaddr->sa_family) {
+#if (NGX_HAVE_INET6)
+            case AF_INET6:
+                ((struct sockaddr_in6 *) addrs[k].sockaddr)->sin6_port = port;
+                break;
+#endif
+            default: /* AF_INET */
+                ((struct sockaddr_in *) addrs[k].sockaddr)->sin_port = port;
+            }
+
+            k++;
+        }
+
+        *n = k;
+
+        return addrs;
+    }
+
+    /* the ports of SRV records are set by the resolver */
+
+    for (i = 0; i < ctx->nsrvs; i++) {
+        srv = &ctx->srvs[i];
+
+        if (srv->state != NGX_OK || srv->priority != priority) {
+            continue;
+        }
+
+        for (j = 0; j < srv->naddrs; j++) {
+            ngx_memcpy(sockaddr[k], srv->addrs[j].sockaddr,
+                       srv->addrs[j].socklen);
+
+            addrs[k].sockaddr = (struct sockaddr *) sockaddr[k];
+            addrs[k].socklen = srv->addrs[j].socklen;
+
+            k++;
+        }
+    }
+
+    *n = k;
+
+    return addrs;
+}
@@ -19,10 +19,14 @@
 #define NGX_HTTP_CACHE_EXPIRED       3
 #define NGX_HTTP_CACHE_STALE         4
 #define NGX_HTTP_CACHE_UPDATING      5
-#define NGX_HTTP_CACHE_HIT           6
-#define NGX_HTTP_CACHE_SCARCE        7
+#define NGX_HTTP_CACHE_REVALIDATED   6
+#define NGX_HTTP_CACHE_HIT           7
+#define NGX_HTTP_CACHE_SCARCE        8
 
 #define NGX_HTTP_CACHE_KEY_LEN       16
+#define NGX_HTTP_CACHE_ETAG_LEN      42
+
+#define NGX_HTTP_CACHE_VERSION       1
 
 
 typedef struct {
@@ -45,7 +49,9 @@ typedef struct {
     unsigned                         exists:1;
     unsigned                         updating:1;
     unsigned                         deleting:1;
-                                     /* 11 unused bits */
+    unsigned                         waiting:1;
+    unsigned                         promoted:1;
+                                     /* 9 unused bits */
 
     ngx_file_uniq_t                  uniq;
     time_t                           expire;
@@ -66,8 +72,11 @@ struct ngx_http_cache_s {
     time_t                           last_modified;
     time_t                           date;
 
+    ngx_str_t                        etag;
+
     size_t                           header_start;
     size_t                           body_start;
+    size_t                           buffer_size;
     off_t                            length;
     off_t                            fs_size;
 
@@ -84,6 +93,11 @@ struct ngx_http_cache_s {
     ngx_msec_t                       wait_time;
 
     ngx_event_t                      wait_event;
+    ngx_queue_t                      wait_queue;
+
+#if (NGX_THREAD_POOL)
+    ngx_thread_task_t               *thread_task;
+#endif
 
     unsigned                         lock:1;
     unsigned                         waiting:1;
@@ -92,10 +106,13 @@ struct ngx_http_cache_s {
     unsigned                         updating:1;
     unsigned                         exists:1;
     unsigned                         temp_file:1;
+    unsigned                         background:1;
+    unsigned                         mem:1;
 };
 
 
 typedef struct {
+    ngx_uint_t                       version;
     time_t                           valid_sec;
     time_t                           last_modified;
     time_t                           date;
@@ -103,16 +120,80 @@ typedef struct {
     u_short                          valid_msec;
     u_short                          header_start;
     u_short                          body_start;
+    u_char                           etag_len;
+    u_char                           etag[NGX_HTTP_CACHE_ETAG_LEN];
 } ngx_http_file_cache_header_t;
 
 
+typedef struct {
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN];
+    off_t                            fs_size;    /* -1 for deleted keys */
+} ngx_http_file_cache_index_entry_t;
+
+
+/* the same layout of the first fields as in ngx_http_file_cache_node_t */
+
+typedef struct {
+    ngx_rbtree_node_t                node;
+    ngx_queue_t                      queue;
+
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN
+                                         - sizeof(ngx_rbtree_key_t)];
+
+    ngx_file_uniq_t                  uniq;
+    size_t                           len;
+    u_char                           data[1];
+} ngx_http_file_cache_mem_node_t;
+
+
 typedef struct {
     ngx_rbtree_t                     rbtree;
     ngx_rbtree_node_t                sentinel;
     ngx_queue_t                      queue;
+    size_t                           size;
+    ngx_uint_t                       count;
+} ngx_http_file_cache_mem_sh_t;
+
+
+typedef struct {
+    ngx_uint_t                       gen;
+    /* the master process the index is written for */
+    ngx_pid_t                        pid;
+    time_t                           checkpoint;
+    ngx_uint_t                       overflow;
+    ngx_uint_t                       head;
+    ngx_uint_t                       tail;
+    ngx_uint_t                       size;
+    ngx_http_file_cache_index_entry_t  entries[1];
+} ngx_http_file_cache_journal_t;
+
+
+typedef struct {
+    ngx_uint_t                       mask;
+    ngx_uint_t                       additions;
+    ngx_uint_t                       sample;
+    ngx_uint_t                       aging;
+    u_char                           counters[1];
+} ngx_http_file_cache_sketch_t;
+
+
+typedef struct {
+    ngx_rbtree_t                     rbtree;
+    ngx_rbtree_node_t                sentinel;
+    ngx_queue_t                      queue;
+    ngx_queue_t                      promoted;
+    ngx_uint_t                       nodes;
+    ngx_uint_t                       promoted_nodes;
     ngx_atomic_t                     cold;
     ngx_atomic_t                     loading;
     off_t                            size;
+    ngx_http_file_cache_journal_t   *journal;
+    ngx_http_file_cache_sketch_t    *sketch;
+
+    ngx_atomic_t                     lookups;
+    ngx_atomic_t                     hits;
+    ngx_atomic_t                     rejected;
+    ngx_atomic_t                     evicted;
 } ngx_http_file_cache_sh_t;
 
 
@@ -133,7 +214,19 @@ struct ngx_http_file_cache_s {
     ngx_msec_t                       loader_sleep;
     ngx_msec_t                       loader_threshold;
 
+    ngx_flag_t                       tinylfu;
+    ngx_flag_t                       slru;
+
+    ngx_str_t                        index;
+    ngx_str_t                        index_journal;
+    ngx_str_t                        index_temp;
+    time_t                           index_interval;
+
+    ngx_http_file_cache_mem_sh_t    *mem_sh;
+    ngx_slab_pool_t                 *mem_shpool;
+
     ngx_shm_zone_t                  *shm_zone;
+    ngx_shm_zone_t                  *mem_zone;
 };
 
 
@@ -143,9 +236,11 @@ void ngx_http_file_cache_create_key(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_open(ngx_http_request_t *r);
 void ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf);
 void ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf);
+void ngx_http_file_cache_update_header(ngx_http_request_t *r);
 ngx_int_t ngx_http_cache_send(ngx_http_request_t *);
 void ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf);
 time_t ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status);
+void ngx_http_file_cache_exit_master(ngx_cycle_t *cycle);
 
 char *ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
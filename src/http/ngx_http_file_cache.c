@@ -11,9 +11,40 @@
 #include <ngx_md5.h>
 
 
+#define NGX_HTTP_FILE_CACHE_INDEX_MAGIC  0x31786469     /* "idx1" */
+#define NGX_HTTP_FILE_CACHE_INDEX_CHUNK  4096
+
+/* percentage of nodes which may reside in the protected segment */
+#define NGX_HTTP_FILE_CACHE_PROTECTED    80
+
+#define NGX_HTTP_FILE_CACHE_SKETCH_HALF  ((uintptr_t) -1 / 0xff * 0x7f)
+
+/* words of the sketch counters halved on each addition while aging */
+#define NGX_HTTP_FILE_CACHE_SKETCH_AGING 64
+
+
+#define ngx_http_file_cache_queue(cache, fcn)                                 \
+    ((fcn)->promoted ? &(cache)->sh->promoted : &(cache)->sh->queue)
+
+
+typedef struct {
+    uint32_t                         magic;
+    uint32_t                         crc32;
+    ngx_uint_t                       gen;
+    ngx_uint_t                       clean;
+    ngx_uint_t                       n;
+    size_t                           bsize;
+    ngx_pid_t                        pid;
+} ngx_http_file_cache_index_header_t;
+
+
 static ngx_int_t ngx_http_file_cache_lock(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev);
+static void ngx_http_file_cache_lock_notify_handler(ngx_event_t *ev);
+static void ngx_http_file_cache_lock_notify(ngx_log_t *log);
+static void ngx_http_file_cache_lock_wakeup(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_read(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static ssize_t ngx_http_file_cache_aio_read(ngx_http_request_t *r,
@@ -21,6 +52,11 @@ static ssize_t ngx_http_file_cache_aio_read(ngx_http_request_t *r,
 #if (NGX_HAVE_FILE_AIO)
 static void ngx_http_cache_aio_event_handler(ngx_event_t *ev);
 #endif
+#if (NGX_THREAD_POOL)
+static ngx_int_t ngx_http_cache_thread_handler(ngx_thread_task_t *task,
+    ngx_file_t *file);
+static void ngx_http_cache_thread_event_handler(ngx_event_t *ev);
+#endif
 static ngx_int_t ngx_http_file_cache_exists(ngx_http_file_cache_t *cache,
     ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_name(ngx_http_request_t *r,
@@ -29,9 +65,32 @@ static ngx_http_file_cache_node_t *
     ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key);
 static void ngx_http_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_http_file_cache_mem_init(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_int_t ngx_http_file_cache_mem_read(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_mem_store(ngx_http_file_cache_t *cache,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_mem_delete(ngx_http_file_cache_t *cache,
+    u_char *key);
+static ngx_http_file_cache_mem_node_t *
+    ngx_http_file_cache_mem_lookup(ngx_http_file_cache_t *cache, u_char *key);
+static void ngx_http_file_cache_mem_free(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_mem_node_t *mn);
+static ngx_int_t ngx_http_file_cache_sketch_init(ngx_http_file_cache_t *cache,
+    size_t size);
+static ngx_uint_t ngx_http_file_cache_sketch_add(
+    ngx_http_file_cache_sketch_t *sketch, u_char *key);
+static ngx_uint_t ngx_http_file_cache_sketch_estimate(
+    ngx_http_file_cache_sketch_t *sketch, u_char *key);
+static ngx_int_t ngx_http_file_cache_admit(ngx_http_file_cache_t *cache,
+    ngx_uint_t freq);
+static void ngx_http_file_cache_promote(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
 static void ngx_http_file_cache_cleanup(void *data);
 static time_t ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache);
 static time_t ngx_http_file_cache_expire(ngx_http_file_cache_t *cache);
+static ngx_queue_t *ngx_http_file_cache_last(ngx_http_file_cache_t *cache);
 static void ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
     ngx_queue_t *q, u_char *name);
 static void ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache);
@@ -45,6 +104,31 @@ static ngx_int_t ngx_http_file_cache_add(ngx_http_file_cache_t *cache,
     ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
+static ngx_int_t ngx_http_file_cache_journal_init(ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_journal(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, off_t fs_size);
+static void ngx_http_file_cache_index_key(u_char *key,
+    ngx_http_file_cache_node_t *fcn);
+static uint32_t ngx_http_file_cache_index_crc(ngx_http_file_cache_t *cache);
+static ngx_int_t ngx_http_file_cache_index_open(ngx_http_file_cache_t *cache,
+    ngx_file_t *file, ngx_http_file_cache_index_header_t *h, off_t *size);
+static void ngx_http_file_cache_index_load(ngx_http_file_cache_t *cache,
+    ngx_log_t *log);
+static ngx_int_t ngx_http_file_cache_index_replay(ngx_http_file_cache_t *cache,
+    ngx_file_t *file, ngx_uint_t n, ngx_http_file_cache_index_entry_t *buf);
+static ngx_int_t ngx_http_file_cache_index_apply(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_index_entry_t *e, ngx_uint_t n);
+static ngx_uint_t ngx_http_file_cache_index_taken(
+    ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_index_sync(ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_index_checkpoint(
+    ngx_http_file_cache_t *cache);
+static ngx_rbtree_node_t *ngx_http_file_cache_index_find(
+    ngx_http_file_cache_t *cache, u_char *key);
+static ngx_rbtree_node_t *ngx_http_file_cache_index_next(
+    ngx_http_file_cache_t *cache, ngx_rbtree_node_t *node);
+static ngx_int_t ngx_http_file_cache_index_flush(ngx_http_file_cache_t *cache,
+    ngx_log_t *log);
 
 
 ngx_str_t  ngx_http_cache_status[] = {
@@ -53,6 +137,7 @@ ngx_str_t  ngx_http_cache_status[] = {
     ngx_string("EXPIRED"),
     ngx_string("STALE"),
     ngx_string("UPDATING"),
+    ngx_string("REVALIDATED"),
     ngx_string("HIT")
 };
 
@@ -60,17 +145,33 @@ ngx_str_t  ngx_http_cache_status[] = {
 static u_char  ngx_http_file_cache_key[] = { LF, 'K', 'E', 'Y', ':', ' ' };
 
 
+static ngx_queue_t  ngx_http_file_cache_waiters;
+static ngx_event_t  ngx_http_file_cache_notify_event;
+
+
 static ngx_int_t
 ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 {
     ngx_http_file_cache_t  *ocache = data;
 
-    size_t                  len;
-    ngx_uint_t              n;
-    ngx_http_file_cache_t  *cache;
+    size_t                       len;
+    ngx_uint_t                   n;
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_node_t  *fcn;
 
     cache = shm_zone->data;
 
+    ngx_queue_init(&ngx_http_file_cache_waiters);
+
+    ngx_http_file_cache_notify_event.handler =
+                                       ngx_http_file_cache_lock_notify_handler;
+    ngx_http_file_cache_notify_event.log = shm_zone->shm.log;
+
+#if !(NGX_WIN32)
+    ngx_notify_event = &ngx_http_file_cache_notify_event;
+#endif
+
     if (ocache) {
         if (ngx_strcmp(cache->path->name.data, ocache->path->name.data) != 0) {
             ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
@@ -102,6 +203,51 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
             cache->path->loader = NULL;
         }
 
+        if (cache->index.len) {
+
+            if (cache->sh->journal == NULL) {
+                if (ngx_http_file_cache_journal_init(cache) != NGX_OK) {
+                    return NGX_ERROR;
+                }
+            }
+
+            if (ocache->index.len == 0
+                || ngx_strcmp(cache->index.data, ocache->index.data) != 0)
+            {
+                cache->sh->journal->overflow = 1;
+                cache->sh->journal->checkpoint = 0;
+            }
+        }
+
+        if (cache->tinylfu && cache->sh->sketch == NULL) {
+            if (ngx_http_file_cache_sketch_init(cache, shm_zone->shm.size)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+
+        if (!cache->slru) {
+
+            /* the protected segment is merged back into the queue */
+
+            ngx_shmtx_lock(&cache->shpool->mutex);
+
+            while (!ngx_queue_empty(&cache->sh->promoted)) {
+                q = ngx_queue_last(&cache->sh->promoted);
+                ngx_queue_remove(q);
+
+                fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+                fcn->promoted = 0;
+
+                ngx_queue_insert_head(&cache->sh->queue, q);
+            }
+
+            cache->sh->promoted_nodes = 0;
+
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+        }
+
         return NGX_OK;
     }
 
@@ -125,10 +271,20 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
                     ngx_http_file_cache_rbtree_insert_value);
 
     ngx_queue_init(&cache->sh->queue);
+    ngx_queue_init(&cache->sh->promoted);
 
+    cache->sh->nodes = 0;
+    cache->sh->promoted_nodes = 0;
     cache->sh->cold = 1;
     cache->sh->loading = 0;
     cache->sh->size = 0;
+    cache->sh->journal = NULL;
+    cache->sh->sketch = NULL;
+
+    cache->sh->lookups = 0;
+    cache->sh->hits = 0;
+    cache->sh->rejected = 0;
+    cache->sh->evicted = 0;
 
     cache->bsize = ngx_fs_bsize(cache->path->name.data);
 
@@ -144,6 +300,95 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
     ngx_sprintf(cache->shpool->log_ctx, " in cache keys zone \"%V\"%Z",
                 &shm_zone->shm.name);
 
+    if (cache->tinylfu) {
+        if (ngx_http_file_cache_sketch_init(cache, shm_zone->shm.size)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    if (cache->index.len) {
+
+        if (ngx_http_file_cache_journal_init(cache) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ngx_http_file_cache_index_load(cache, shm_zone->shm.log);
+
+        if (!cache->sh->cold) {
+            cache->path->loader = NULL;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_mem_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_file_cache_t  *ocache = data;
+
+    size_t                  len;
+    ngx_http_file_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        if (ocache->mem_zone == NULL
+            || ocache->mem_zone->shm.addr != shm_zone->shm.addr)
+        {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "cache memory zone \"%V\" was previously used "
+                          "for other purpose", &shm_zone->shm.name);
+            return NGX_ERROR;
+        }
+
+        cache->mem_sh = ocache->mem_sh;
+        cache->mem_shpool = ocache->mem_shpool;
+
+        return NGX_OK;
+    }
+
+    cache->mem_shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->mem_sh = cache->mem_shpool->data;
+
+        return NGX_OK;
+    }
+
+    cache->mem_sh = ngx_slab_alloc(cache->mem_shpool,
+                                   sizeof(ngx_http_file_cache_mem_sh_t));
+    if (cache->mem_sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->mem_shpool->data = cache->mem_sh;
+
+    ngx_rbtree_init(&cache->mem_sh->rbtree, &cache->mem_sh->sentinel,
+                    ngx_http_file_cache_rbtree_insert_value);
+
+    ngx_queue_init(&cache->mem_sh->queue);
+
+    cache->mem_sh->size = 0;
+    cache->mem_sh->count = 0;
+
+    len = sizeof(" in cache memory zone \"\"") + shm_zone->shm.name.len;
+
+    cache->mem_shpool->log_ctx = ngx_slab_alloc(cache->mem_shpool, len);
+    if (cache->mem_shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->mem_shpool->log_ctx, " in cache memory zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /* a full zone is expected, the least recently used objects are evicted */
+
+    cache->mem_shpool->log_nomem = 0;
+
     return NGX_OK;
 }
 
@@ -239,6 +484,7 @@ ngx_int_t
 ngx_http_file_cache_open(ngx_http_request_t *r)
 {
     ngx_int_t                  rc, rv;
+    ngx_buf_t                 *b;
     ngx_uint_t                 cold, test;
     ngx_http_cache_t          *c;
     ngx_pool_cleanup_t        *cln;
@@ -319,6 +565,19 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         goto done;
     }
 
+    if (c->exists && cache->mem_sh) {
+
+        rc = ngx_http_file_cache_mem_read(r, c);
+
+        if (rc == NGX_OK) {
+            return ngx_http_file_cache_read(r, c);
+        }
+
+        if (rc == NGX_ERROR) {
+            return rc;
+        }
+    }
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     ngx_memzero(&of, sizeof(ngx_open_file_info_t));
@@ -358,11 +617,20 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
     c->length = of.size;
     c->fs_size = (of.fs_size + cache->bsize - 1) / cache->bsize;
 
-    c->buf = ngx_create_temp_buf(r->pool, c->body_start);
-    if (c->buf == NULL) {
+    if (cache->mem_sh && c->length <= (off_t) c->buffer_size) {
+
+        /* read the whole file to place it into the memory zone */
+
+        c->body_start = c->buffer_size;
+    }
+
+    b = ngx_create_temp_buf(r->pool, c->body_start);
+    if (b == NULL) {
         return NGX_ERROR;
     }
 
+    c->buf = b;
+
     return ngx_http_file_cache_read(r, c);
 
 done:
@@ -392,6 +660,9 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
     if (!c->node->updating) {
         c->node->updating = 1;
         c->updating = 1;
+
+    } else {
+        c->node->waiting = 1;
     }
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
@@ -416,9 +687,16 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
         c->wait_event.log = r->connection->log;
     }
 
+    /*
+     * the request is woken up by the lock notify handler as soon as
+     * the entry is updated, the timer only limits the time to wait
+     */
+
     timer = c->wait_time - now;
 
-    ngx_add_timer(&c->wait_event, (timer > 500) ? 500 : timer);
+    ngx_add_timer(&c->wait_event, ((ngx_msec_int_t) timer > 0) ? timer : 0);
+
+    ngx_queue_insert_tail(&ngx_http_file_cache_waiters, &c->wait_queue);
 
     r->main->blocked++;
 
@@ -429,49 +707,104 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
 static void
 ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev)
 {
-    ngx_uint_t                 wait;
-    ngx_msec_t                 timer;
-    ngx_http_cache_t          *c;
-    ngx_http_request_t        *r;
-    ngx_http_file_cache_t     *cache;
+    ngx_http_cache_t    *c;
+    ngx_http_request_t  *r;
 
     r = ev->data;
     c = r->cache;
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ev->log, 0,
-                   "http file cache wait handler wt:%M cur:%M",
+                   "http file cache lock timeout wt:%M cur:%M",
                    c->wait_time, ngx_current_msec);
 
-    timer = c->wait_time - ngx_current_msec;
+    c->lock = 0;
+
+    ngx_http_file_cache_lock_wakeup(r, c);
+}
+
+
+static void
+ngx_http_file_cache_lock_notify_handler(ngx_event_t *ev)
+{
+    ngx_uint_t              wait;
+    ngx_queue_t            *q, *next, ready;
+    ngx_http_cache_t       *c;
+    ngx_http_file_cache_t  *cache;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http file cache lock notify");
+
+    ngx_queue_init(&ready);
+
+    for (q = ngx_queue_head(&ngx_http_file_cache_waiters);
+         q != ngx_queue_sentinel(&ngx_http_file_cache_waiters);
+         q = next)
+    {
+        next = ngx_queue_next(q);
+
+        c = ngx_queue_data(q, ngx_http_cache_t, wait_queue);
+        cache = c->file_cache;
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        wait = c->node->updating;
+
+        if (wait) {
+            /* the entry may be locked by another request by now */
+            c->node->waiting = 1;
+        }
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        if (wait) {
+            continue;
+        }
 
-    if ((ngx_msec_int_t) timer <= 0) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
-                       "http file cache lock timeout");
-        c->lock = 0;
-        goto wakeup;
+        ngx_queue_remove(q);
+        ngx_queue_insert_tail(&ready, q);
     }
 
-    cache = c->file_cache;
-    wait = 0;
+    /* a woken up request may finalize other waiting requests */
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    while (!ngx_queue_empty(&ready)) {
+        q = ngx_queue_head(&ready);
+        c = ngx_queue_data(q, ngx_http_cache_t, wait_queue);
 
-    if (c->node->updating) {
-        wait = 1;
+        ngx_http_file_cache_lock_wakeup(c->wait_event.data, c);
     }
+}
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
 
-    if (wait) {
-        ngx_add_timer(ev, (timer > 500) ? 500 : timer);
-        return;
+static void
+ngx_http_file_cache_lock_notify(ngx_log_t *log)
+{
+    ngx_event_t  *ev;
+
+    ev = &ngx_http_file_cache_notify_event;
+
+    ngx_post_event(ev, &ngx_posted_events);
+
+#if !(NGX_WIN32)
+    ngx_notify_processes(log);
+#endif
+}
+
+
+static void
+ngx_http_file_cache_lock_wakeup(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    if (c->wait_event.timer_set) {
+        ngx_del_timer(&c->wait_event);
     }
 
-wakeup:
+    ngx_queue_remove(&c->wait_queue);
 
     c->waiting = 0;
     r->main->blocked--;
-    r->connection->write->handler(r->connection->write);
+
+    r->write_event_handler(r);
+
+    ngx_http_run_posted_requests(r->connection);
 }
 
 
@@ -484,10 +817,15 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
     ngx_http_file_cache_t         *cache;
     ngx_http_file_cache_header_t  *h;
 
-    n = ngx_http_file_cache_aio_read(r, c);
+    if (c->mem) {
+        n = (ssize_t) c->length;
 
-    if (n < 0) {
-        return n;
+    } else {
+        n = ngx_http_file_cache_aio_read(r, c);
+
+        if (n < 0) {
+            return n;
+        }
     }
 
     if ((size_t) n < c->header_start) {
@@ -498,6 +836,12 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     h = (ngx_http_file_cache_header_t *) c->buf->pos;
 
+    if (h->version != NGX_HTTP_CACHE_VERSION) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "cache file \"%s\" version mismatch", c->file.name.data);
+        return NGX_DECLINED;
+    }
+
     if (h->crc32 != c->crc32) {
         ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
                       "cache file \"%s\" has md5 collision", c->file.name.data);
@@ -519,6 +863,8 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
     c->valid_msec = h->valid_msec;
     c->header_start = h->header_start;
     c->body_start = h->body_start;
+    c->etag.len = h->etag_len;
+    c->etag.data = h->etag;
 
     r->cached = 1;
 
@@ -565,6 +911,12 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         return rc;
     }
 
+    (void) ngx_atomic_fetch_add(&cache->sh->hits, 1);
+
+    if (cache->mem_sh && !c->mem && (off_t) n == c->length) {
+        ngx_http_file_cache_mem_store(cache, c);
+    }
+
     return NGX_OK;
 }
 
@@ -572,17 +924,32 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 static ssize_t
 ngx_http_file_cache_aio_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-#if (NGX_HAVE_FILE_AIO)
+#if (NGX_HAVE_FILE_AIO || NGX_THREAD_POOL)
     ssize_t                    n;
     ngx_http_core_loc_conf_t  *clcf;
 
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+#endif
+
+#if (NGX_THREAD_POOL)
+
+    if (clcf->aio == NGX_HTTP_AIO_THREADS) {
+        c->file.thread_handler = ngx_http_cache_thread_handler;
+        c->file.thread_ctx = r;
+
+        return ngx_thread_read(&c->thread_task, &c->file, c->buf->pos,
+                               c->body_start, 0, r->pool);
+    }
+
+#endif
+
+#if (NGX_HAVE_FILE_AIO)
+
     if (!ngx_file_aio) {
         goto noaio;
     }
 
-    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
-
-    if (!clcf->aio) {
+    if (clcf->aio != NGX_HTTP_AIO_ON && clcf->aio != NGX_HTTP_AIO_SENDFILE) {
         goto noaio;
     }
 
@@ -622,7 +989,53 @@ ngx_http_cache_aio_event_handler(ngx_event_t *ev)
     r->main->blocked--;
     r->aio = 0;
 
-    r->connection->write->handler(r->connection->write);
+    r->write_event_handler(r);
+
+    ngx_http_run_posted_requests(r->connection);
+}
+
+#endif
+
+
+#if (NGX_THREAD_POOL)
+
+static ngx_int_t
+ngx_http_cache_thread_handler(ngx_thread_task_t *task, ngx_file_t *file)
+{
+    ngx_http_request_t        *r;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    r = file->thread_ctx;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    task->event.data = r;
+    task->event.handler = ngx_http_cache_thread_event_handler;
+
+    if (ngx_thread_task_post(clcf->thread_pool, task) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->main->blocked++;
+    r->aio = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_cache_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    r->write_event_handler(r);
+
+    ngx_http_run_posted_requests(r->connection);
 }
 
 #endif
@@ -632,13 +1045,23 @@ static ngx_int_t
 ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 {
     ngx_int_t                    rc;
+    ngx_uint_t                   freq, admitted;
     ngx_http_file_cache_node_t  *fcn;
 
+    freq = 0;
+    admitted = 0;
+
     ngx_shmtx_lock(&cache->shpool->mutex);
 
     fcn = c->node;
 
     if (fcn == NULL) {
+        (void) ngx_atomic_fetch_add(&cache->sh->lookups, 1);
+
+        if (cache->tinylfu) {
+            freq = ngx_http_file_cache_sketch_add(cache->sh->sketch, c->key);
+        }
+
         fcn = ngx_http_file_cache_lookup(cache, c->key);
     }
 
@@ -678,9 +1101,37 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
         goto done;
     }
 
+    if (cache->tinylfu) {
+
+        /*
+         * a node is only allocated for a key which was requested
+         * at least min_uses times recently, and if the cache is full,
+         * more often than the key to be evicted; while the cache is
+         * cold, the key may have a file which is not loaded yet
+         */
+
+        if ((freq < c->min_uses && !cache->sh->cold)
+            || (cache->sh->size >= cache->max_size
+                && ngx_http_file_cache_admit(cache, freq) != NGX_OK))
+        {
+            (void) ngx_atomic_fetch_add(&cache->sh->rejected, 1);
+            rc = NGX_AGAIN;
+            goto failed;
+        }
+
+        admitted = 1;
+    }
+
     fcn = ngx_slab_alloc_locked(cache->shpool,
                                 sizeof(ngx_http_file_cache_node_t));
     if (fcn == NULL) {
+
+        if (admitted && ngx_http_file_cache_admit(cache, freq) != NGX_OK) {
+            (void) ngx_atomic_fetch_add(&cache->sh->rejected, 1);
+            rc = NGX_AGAIN;
+            goto failed;
+        }
+
         ngx_shmtx_unlock(&cache->shpool->mutex);
 
         (void) ngx_http_file_cache_forced_expire(cache);
@@ -702,10 +1153,14 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 
     ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
 
-    fcn->uses = 1;
+    cache->sh->nodes++;
+
+    fcn->uses = admitted ? freq : 1;
     fcn->count = 1;
     fcn->updating = 0;
     fcn->deleting = 0;
+    fcn->waiting = 0;
+    fcn->promoted = 0;
 
 renew:
 
@@ -719,11 +1174,27 @@ renew:
     fcn->body_start = 0;
     fcn->fs_size = 0;
 
+    if (fcn->promoted) {
+        fcn->promoted = 0;
+        cache->sh->promoted_nodes--;
+    }
+
+    if (admitted && !cache->sh->cold) {
+
+        /* the uses were already counted by the frequency sketch */
+
+        rc = NGX_OK;
+    }
+
 done:
 
     fcn->expire = ngx_time() + cache->inactive;
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+    if (cache->slru && c->node == NULL && fcn->exists && !fcn->error) {
+        ngx_http_file_cache_promote(cache, fcn);
+    }
+
+    ngx_queue_insert_head(ngx_http_file_cache_queue(cache, fcn), &fcn->queue);
 
     c->uniq = fcn->uniq;
     c->error = fcn->error;
@@ -860,6 +1331,398 @@ ngx_http_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
 }
 
 
+static ngx_int_t
+ngx_http_file_cache_mem_read(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    ngx_buf_t                       *b;
+    ngx_http_file_cache_t           *cache;
+    ngx_http_file_cache_mem_node_t  *mn;
+
+    cache = c->file_cache;
+
+    ngx_shmtx_lock(&cache->mem_shpool->mutex);
+
+    mn = ngx_http_file_cache_mem_lookup(cache, c->key);
+
+    if (mn == NULL) {
+        goto declined;
+    }
+
+    if (mn->uniq != c->uniq) {
+
+        /* the cache file was replaced */
+
+        ngx_http_file_cache_mem_free(cache, mn);
+        goto declined;
+    }
+
+    b = ngx_create_temp_buf(r->pool, mn->len);
+    if (b == NULL) {
+        ngx_shmtx_unlock(&cache->mem_shpool->mutex);
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(b->pos, mn->data, mn->len);
+    c->length = mn->len;
+
+    ngx_queue_remove(&mn->queue);
+    ngx_queue_insert_head(&cache->mem_sh->queue, &mn->queue);
+
+    ngx_shmtx_unlock(&cache->mem_shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache memory: %O", c->length);
+
+    c->buf = b;
+    c->mem = 1;
+
+    c->file.fd = NGX_INVALID_FILE;
+    c->file.log = r->connection->log;
+
+    return NGX_OK;
+
+declined:
+
+    ngx_shmtx_unlock(&cache->mem_shpool->mutex);
+
+    return NGX_DECLINED;
+}
+
+
+static void
+ngx_http_file_cache_mem_store(ngx_http_file_cache_t *cache,
+    ngx_http_cache_t *c)
+{
+    size_t                           len;
+    ngx_uint_t                       tries;
+    ngx_queue_t                     *q;
+    ngx_file_uniq_t                  uniq;
+    ngx_http_file_cache_mem_node_t  *mn;
+
+    /* the nodes added by the cache loader do not know the file yet */
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (c->node->uniq == 0) {
+        c->node->uniq = c->uniq;
+    }
+
+    uniq = c->node->uniq;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (uniq != c->uniq) {
+        return;
+    }
+
+    len = (size_t) c->length;
+
+    ngx_shmtx_lock(&cache->mem_shpool->mutex);
+
+    mn = ngx_http_file_cache_mem_lookup(cache, c->key);
+
+    if (mn) {
+        if (mn->uniq == uniq) {
+            goto done;
+        }
+
+        ngx_http_file_cache_mem_free(cache, mn);
+    }
+
+    for (tries = 0; /* void */ ; tries++) {
+
+        mn = ngx_slab_alloc_locked(cache->mem_shpool,
+                         offsetof(ngx_http_file_cache_mem_node_t, data) + len);
+        if (mn) {
+            break;
+        }
+
+        if (tries == 20 || ngx_queue_empty(&cache->mem_sh->queue)) {
+            goto done;
+        }
+
+        q = ngx_queue_last(&cache->mem_sh->queue);
+
+        ngx_http_file_cache_mem_free(cache,
+                     ngx_queue_data(q, ngx_http_file_cache_mem_node_t, queue));
+    }
+
+    ngx_memcpy((u_char *) &mn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(mn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    mn->uniq = uniq;
+    mn->len = len;
+    ngx_memcpy(mn->data, c->buf->pos, len);
+
+    ngx_rbtree_insert(&cache->mem_sh->rbtree, &mn->node);
+    ngx_queue_insert_head(&cache->mem_sh->queue, &mn->queue);
+
+    cache->mem_sh->size += len;
+    cache->mem_sh->count++;
+
+done:
+
+    ngx_shmtx_unlock(&cache->mem_shpool->mutex);
+}
+
+
+static void
+ngx_http_file_cache_mem_delete(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_http_file_cache_mem_node_t  *mn;
+
+    ngx_shmtx_lock(&cache->mem_shpool->mutex);
+
+    mn = ngx_http_file_cache_mem_lookup(cache, key);
+
+    if (mn) {
+        ngx_http_file_cache_mem_free(cache, mn);
+    }
+
+    ngx_shmtx_unlock(&cache->mem_shpool->mutex);
+}
+
+
+static ngx_http_file_cache_mem_node_t *
+ngx_http_file_cache_mem_lookup(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_int_t                        rc;
+    ngx_rbtree_key_t                 node_key;
+    ngx_rbtree_node_t               *node, *sentinel;
+    ngx_http_file_cache_mem_node_t  *mn;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = cache->mem_sh->rbtree.root;
+    sentinel = cache->mem_sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        mn = (ngx_http_file_cache_mem_node_t *) node;
+
+        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], mn->key,
+                        NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (rc == 0) {
+            return mn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    /* not found */
+
+    return NULL;
+}
+
+
+static void
+ngx_http_file_cache_mem_free(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_mem_node_t *mn)
+{
+    ngx_queue_remove(&mn->queue);
+    ngx_rbtree_delete(&cache->mem_sh->rbtree, &mn->node);
+
+    cache->mem_sh->size -= mn->len;
+    cache->mem_sh->count--;
+
+    ngx_slab_free_locked(cache->mem_shpool, mn);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_sketch_init(ngx_http_file_cache_t *cache, size_t size)
+{
+    ngx_uint_t                     n;
+    ngx_http_file_cache_sketch_t  *sketch;
+
+    /* a counter for each node which fits into the keys zone */
+
+    size /= sizeof(ngx_http_file_cache_node_t);
+
+    for (n = 1024; n < size; n <<= 1) { /* void */ }
+
+    sketch = ngx_slab_alloc(cache->shpool,
+                            offsetof(ngx_http_file_cache_sketch_t, counters)
+                            + n);
+    if (sketch == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(sketch->counters, n);
+
+    sketch->mask = n - 1;
+    sketch->additions = 0;
+    sketch->sample = 10 * n;
+    sketch->aging = n / sizeof(uintptr_t);
+
+    cache->sh->sketch = sketch;
+
+    return NGX_OK;
+}
+
+
+/*
+ * a count-min sketch with 4 saturating counters per a key; as the key
+ * is an MD5 hash, its 4 words are used as independent hashes
+ */
+
+static ngx_uint_t
+ngx_http_file_cache_sketch_add(ngx_http_file_cache_sketch_t *sketch,
+    u_char *key)
+{
+    u_char      *p;
+    uint32_t     h[4];
+    uintptr_t   *w;
+    ngx_uint_t   i, n, last, min;
+
+    ngx_memcpy(h, key, sizeof(h));
+
+    min = ngx_http_file_cache_sketch_estimate(sketch, key);
+
+    if (min < 15) {
+
+        /* conservative update: only the smallest counters are incremented */
+
+        for (i = 0; i < 4; i++) {
+            p = &sketch->counters[h[i] & sketch->mask];
+
+            if (*p == min) {
+                (*p)++;
+            }
+        }
+
+        min++;
+    }
+
+    n = (sketch->mask + 1) / sizeof(uintptr_t);
+
+    if (++sketch->additions == sketch->sample) {
+
+        /*
+         * aging: all counters are halved; this is done in parts on
+         * the following additions to keep the keys zone mutex held
+         * for a short time regardless of the sketch size
+         */
+
+        sketch->additions /= 2;
+        sketch->aging = 0;
+    }
+
+    if (sketch->aging < n) {
+
+        w = (uintptr_t *) sketch->counters;
+
+        last = ngx_min(sketch->aging + NGX_HTTP_FILE_CACHE_SKETCH_AGING, n);
+
+        for (i = sketch->aging; i < last; i++) {
+            w[i] = (w[i] >> 1) & NGX_HTTP_FILE_CACHE_SKETCH_HALF;
+        }
+
+        sketch->aging = last;
+    }
+
+    return min;
+}
+
+
+static ngx_uint_t
+ngx_http_file_cache_sketch_estimate(ngx_http_file_cache_sketch_t *sketch,
+    u_char *key)
+{
+    uint32_t    h[4];
+    ngx_uint_t  i, n, min;
+
+    ngx_memcpy(h, key, sizeof(h));
+
+    min = 15;
+
+    for (i = 0; i < 4; i++) {
+        n = sketch->counters[h[i] & sketch->mask];
+
+        if (n < min) {
+            min = n;
+        }
+    }
+
+    return min;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_admit(ngx_http_file_cache_t *cache, ngx_uint_t freq)
+{
+    u_char                       key[NGX_HTTP_CACHE_KEY_LEN];
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_node_t  *fcn;
+
+    /* the candidate should be more frequent than the eviction victim */
+
+    q = &cache->sh->queue;
+
+    if (ngx_queue_empty(q)) {
+        q = &cache->sh->promoted;
+
+        if (ngx_queue_empty(q)) {
+            return NGX_OK;
+        }
+    }
+
+    fcn = ngx_queue_data(ngx_queue_last(q), ngx_http_file_cache_node_t, queue);
+
+    ngx_http_file_cache_index_key(key, fcn);
+
+    if (freq > ngx_http_file_cache_sketch_estimate(cache->sh->sketch, key)) {
+        return NGX_OK;
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static void
+ngx_http_file_cache_promote(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_node_t  *lru;
+
+    if (!fcn->promoted) {
+        fcn->promoted = 1;
+        cache->sh->promoted_nodes++;
+    }
+
+    /* the least recently used protected nodes are moved to probation */
+
+    while (cache->sh->promoted_nodes * 100
+           > cache->sh->nodes * NGX_HTTP_FILE_CACHE_PROTECTED
+           && !ngx_queue_empty(&cache->sh->promoted))
+    {
+        q = ngx_queue_last(&cache->sh->promoted);
+        ngx_queue_remove(q);
+
+        lru = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+        lru->promoted = 0;
+        cache->sh->promoted_nodes--;
+
+        ngx_queue_insert_head(&cache->sh->queue, q);
+    }
+}
+
+
 void
 ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
 {
@@ -875,6 +1738,9 @@ ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
 
     c = r->cache;
 
+    ngx_memzero(h, sizeof(ngx_http_file_cache_header_t));
+
+    h->version = NGX_HTTP_CACHE_VERSION;
     h->valid_sec = c->valid_sec;
     h->last_modified = c->last_modified;
     h->date = c->date;
@@ -883,6 +1749,11 @@ ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
     h->header_start = (u_short) c->header_start;
     h->body_start = (u_short) c->body_start;
 
+    if (c->etag.len <= NGX_HTTP_CACHE_ETAG_LEN) {
+        h->etag_len = (u_char) c->etag.len;
+        ngx_memcpy(h->etag, c->etag.data, c->etag.len);
+    }
+
     p = buf + sizeof(ngx_http_file_cache_header_t);
 
     p = ngx_cpymem(p, ngx_http_file_cache_key, sizeof(ngx_http_file_cache_key));
@@ -901,6 +1772,7 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 {
     off_t                   fs_size;
     ngx_int_t               rc;
+    ngx_uint_t              waiting;
     ngx_file_uniq_t         uniq;
     ngx_file_info_t         fi;
     ngx_http_cache_t        *c;
@@ -962,56 +1834,195 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 
     if (rc == NGX_OK) {
         c->node->exists = 1;
+
+        ngx_http_file_cache_journal(cache, c->node, fs_size);
     }
 
     c->node->updating = 0;
 
+    waiting = c->node->waiting;
+    c->node->waiting = 0;
+
     ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (cache->mem_sh) {
+        ngx_http_file_cache_mem_delete(cache, c->key);
+    }
+
+    if (waiting) {
+        ngx_http_file_cache_lock_notify(r->connection->log);
+    }
 }
 
 
-ngx_int_t
-ngx_http_cache_send(ngx_http_request_t *r)
+void
+ngx_http_file_cache_update_header(ngx_http_request_t *r)
 {
-    ngx_int_t          rc;
-    ngx_buf_t         *b;
-    ngx_chain_t        out;
-    ngx_http_cache_t  *c;
+    ssize_t                        n;
+    ngx_err_t                      err;
+    ngx_file_t                     file;
+    ngx_file_info_t                fi;
+    ngx_http_cache_t              *c;
+    ngx_http_file_cache_header_t   h;
 
     c = r->cache;
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http file cache send: %s", c->file.name.data);
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache update header");
 
-    if (r != r->main && c->length - c->body_start == 0) {
-        return ngx_http_send_header(r);
-    }
+    ngx_memzero(&file, sizeof(ngx_file_t));
 
-    /* we need to allocate all before the header would be sent */
+    file.name = c->file.name;
+    file.log = r->connection->log;
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDWR, NGX_FILE_OPEN, 0);
 
-    b = ngx_pcalloc(r->pool, sizeof(ngx_buf_t));
-    if (b == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
-    }
+    if (file.fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
 
-    b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
-    if (b->file == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
-    }
+        /* cache file may have been deleted */
 
-    rc = ngx_http_send_header(r);
+        if (err == NGX_ENOENT) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http file cache \"%s\" not found",
+                           file.name.data);
+            return;
+        }
 
-    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
-        return rc;
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, err,
+                      ngx_open_file_n " \"%s\" failed", file.name.data);
+        return;
     }
 
-    b->file_pos = c->body_start;
-    b->file_last = c->length;
+    /*
+     * make sure cache file wasn't replaced;
+     * if it was, do nothing
+     */
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", file.name.data);
+        goto done;
+    }
+
+    if (c->uniq != ngx_file_uniq(&fi)
+        || c->length != ngx_file_size(&fi))
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache \"%s\" changed",
+                       file.name.data);
+        goto done;
+    }
+
+    n = ngx_read_file(&file, (u_char *) &h,
+                      sizeof(ngx_http_file_cache_header_t), 0);
+
+    if (n == NGX_ERROR) {
+        goto done;
+    }
+
+    if ((size_t) n != sizeof(ngx_http_file_cache_header_t)) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, 0,
+                      ngx_read_file_n " read only %z of %z from \"%s\"",
+                      n, sizeof(ngx_http_file_cache_header_t), file.name.data);
+        goto done;
+    }
+
+    if (h.version != NGX_HTTP_CACHE_VERSION
+        || h.last_modified != c->last_modified
+        || h.crc32 != c->crc32
+        || h.header_start != c->header_start
+        || h.body_start != c->body_start)
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http file cache \"%s\" content changed",
+                       file.name.data);
+        goto done;
+    }
+
+    /*
+     * update cache file header with new data,
+     * notably h.valid_sec and h.date
+     */
+
+    h.valid_sec = c->valid_sec;
+    h.date = c->date;
+    h.valid_msec = (u_short) c->valid_msec;
+
+    (void) ngx_write_file(&file, (u_char *) &h,
+                          sizeof(ngx_http_file_cache_header_t), 0);
+
+    if (c->file_cache->mem_sh) {
+        ngx_http_file_cache_mem_delete(c->file_cache, c->key);
+    }
+
+done:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+}
+
+
+ngx_int_t
+ngx_http_cache_send(ngx_http_request_t *r)
+{
+    ngx_int_t          rc;
+    ngx_buf_t         *b;
+    ngx_chain_t        out;
+    ngx_http_cache_t  *c;
+
+    c = r->cache;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache send: %s", c->file.name.data);
+
+    if (r != r->main && c->length - c->body_start == 0) {
+        return ngx_http_send_header(r);
+    }
+
+    /* we need to allocate all before the header would be sent */
+
+    b = ngx_pcalloc(r->pool, sizeof(ngx_buf_t));
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (!c->mem) {
+        b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+        if (b->file == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+    }
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
 
-    b->in_file = (c->length - c->body_start) ? 1: 0;
     b->last_buf = (r == r->main) ? 1: 0;
     b->last_in_chain = 1;
 
+    if (c->mem) {
+
+        /* the whole cached response is in c->buf */
+
+        b->pos = c->buf->pos + c->body_start;
+        b->last = c->buf->pos + c->length;
+        b->memory = (c->length - c->body_start) ? 1: 0;
+
+        out.buf = b;
+        out.next = NULL;
+
+        return ngx_http_output_filter(r, &out);
+    }
+
+    b->file_pos = c->body_start;
+    b->file_last = c->length;
+
+    b->in_file = (c->length - c->body_start) ? 1: 0;
+
     b->file->fd = c->file.fd;
     b->file->name = c->file.name;
     b->file->log = r->connection->log;
@@ -1026,6 +2037,7 @@ ngx_http_cache_send(ngx_http_request_t *r)
 void
 ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 {
+    ngx_uint_t                   waiting;
     ngx_http_file_cache_t       *cache;
     ngx_http_file_cache_node_t  *fcn;
 
@@ -1043,8 +2055,13 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
     fcn = c->node;
     fcn->count--;
 
+    waiting = 0;
+
     if (c->updating) {
         fcn->updating = 0;
+
+        waiting = fcn->waiting;
+        fcn->waiting = 0;
     }
 
     if (c->error) {
@@ -1059,11 +2076,16 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
         ngx_queue_remove(&fcn->queue);
         ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
         ngx_slab_free_locked(cache->shpool, fcn);
+        cache->sh->nodes--;
         c->node = NULL;
     }
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
 
+    if (waiting) {
+        ngx_http_file_cache_lock_notify(c->file.log);
+    }
+
     c->updated = 1;
     c->updating = 0;
 
@@ -1084,6 +2106,11 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
     if (c->wait_event.timer_set) {
         ngx_del_timer(&c->wait_event);
     }
+
+    if (c->waiting) {
+        ngx_queue_remove(&c->wait_queue);
+        c->waiting = 0;
+    }
 }
 
 
@@ -1099,7 +2126,7 @@ ngx_http_file_cache_cleanup(void *data)
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
                    "http file cache cleanup");
 
-    if (c->updating) {
+    if (c->updating && !c->background) {
         ngx_log_error(NGX_LOG_ALERT, c->file.log, 0,
                       "stalled cache updating, error:%ui", c->error);
     }
@@ -1114,9 +2141,9 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
     u_char                      *name;
     size_t                       len;
     time_t                       wait;
-    ngx_uint_t                   tries;
+    ngx_uint_t                   i, tries;
     ngx_path_t                  *path;
-    ngx_queue_t                 *q;
+    ngx_queue_t                 *q, *queue[2];
     ngx_http_file_cache_node_t  *fcn;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
@@ -1135,32 +2162,41 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
     wait = 10;
     tries = 20;
 
+    /* the probationary segment is evicted first */
+
+    queue[0] = &cache->sh->queue;
+    queue[1] = &cache->sh->promoted;
+
     ngx_shmtx_lock(&cache->shpool->mutex);
 
-    for (q = ngx_queue_last(&cache->sh->queue);
-         q != ngx_queue_sentinel(&cache->sh->queue);
-         q = ngx_queue_prev(q))
-    {
-        fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+    for (i = 0; i < 2 && wait == 10; i++) {
 
-        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+        for (q = ngx_queue_last(queue[i]);
+             q != ngx_queue_sentinel(queue[i]);
+             q = ngx_queue_prev(q))
+        {
+            fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+
+            ngx_log_debug6(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
                   "http file cache forced expire: #%d %d %02xd%02xd%02xd%02xd",
                   fcn->count, fcn->exists,
                   fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
 
-        if (fcn->count == 0) {
-            ngx_http_file_cache_delete(cache, q, name);
-            wait = 0;
+            if (fcn->count == 0) {
+                ngx_http_file_cache_delete(cache, q, name);
+                (void) ngx_atomic_fetch_add(&cache->sh->evicted, 1);
+                wait = 0;
 
-        } else {
-            if (--tries) {
-                continue;
+            } else {
+                if (--tries) {
+                    continue;
+                }
+
+                wait = 1;
             }
 
-            wait = 1;
+            break;
         }
-
-        break;
     }
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
@@ -1201,13 +2237,13 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
 
     for ( ;; ) {
 
-        if (ngx_queue_empty(&cache->sh->queue)) {
+        q = ngx_http_file_cache_last(cache);
+
+        if (q == NULL) {
             wait = 10;
             break;
         }
 
-        q = ngx_queue_last(&cache->sh->queue);
-
         fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
         wait = fcn->expire - now;
@@ -1245,7 +2281,8 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
 
         ngx_queue_remove(q);
         fcn->expire = ngx_time() + cache->inactive;
-        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+        ngx_queue_insert_head(ngx_http_file_cache_queue(cache, fcn),
+                              &fcn->queue);
 
         ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
                       "ignore long locked inactive cache entry %*s, count:%d",
@@ -1260,6 +2297,38 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
 }
 
 
+static ngx_queue_t *
+ngx_http_file_cache_last(ngx_http_file_cache_t *cache)
+{
+    ngx_queue_t                 *q, *p;
+    ngx_http_file_cache_node_t  *fcn, *pcn;
+
+    /* the least recently used node of both segments */
+
+    if (ngx_queue_empty(&cache->sh->promoted)) {
+
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            return NULL;
+        }
+
+        return ngx_queue_last(&cache->sh->queue);
+    }
+
+    p = ngx_queue_last(&cache->sh->promoted);
+
+    if (ngx_queue_empty(&cache->sh->queue)) {
+        return p;
+    }
+
+    q = ngx_queue_last(&cache->sh->queue);
+
+    fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
+    pcn = ngx_queue_data(p, ngx_http_file_cache_node_t, queue);
+
+    return (pcn->expire < fcn->expire) ? p : q;
+}
+
+
 static void
 ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
     u_char *name)
@@ -1268,12 +2337,15 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
     size_t                       len;
     ngx_path_t                  *path;
     ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[NGX_HTTP_CACHE_KEY_LEN];
 
     fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
     if (fcn->exists) {
         cache->sh->size -= fcn->fs_size;
 
+        ngx_http_file_cache_journal(cache, fcn, -1);
+
         path = cache->path;
         p = name + path->name.len + 1 + path->len;
         p = ngx_hex_dump(p, (u_char *) &fcn->node.key,
@@ -1286,6 +2358,11 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
         fcn->deleting = 1;
         ngx_shmtx_unlock(&cache->shpool->mutex);
 
+        if (cache->mem_sh) {
+            ngx_http_file_cache_index_key(key, fcn);
+            ngx_http_file_cache_mem_delete(cache, key);
+        }
+
         len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
         ngx_create_hashed_filename(path, name, len);
 
@@ -1303,6 +2380,13 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
     }
 
     if (fcn->count == 0) {
+
+        if (fcn->promoted) {
+            cache->sh->promoted_nodes--;
+        }
+
+        cache->sh->nodes--;
+
         ngx_queue_remove(q);
         ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
         ngx_slab_free_locked(cache->shpool, fcn);
@@ -1320,6 +2404,14 @@ ngx_http_file_cache_manager(void *data)
 
     next = ngx_http_file_cache_expire(cache);
 
+    if (cache->index.len) {
+        ngx_http_file_cache_index_sync(cache);
+
+        if (next > 1) {
+            next = 1;
+        }
+    }
+
     cache->last = ngx_current_msec;
     cache->files = 0;
 
@@ -1396,165 +2488,1153 @@ ngx_http_file_cache_loader(void *data)
 }
 
 
-static ngx_int_t
-ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+static ngx_int_t
+ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_msec_t              elapsed;
+    ngx_http_file_cache_t  *cache;
+
+    cache = ctx->data;
+
+    if (cache->index.len
+        && path->len >= cache->index.len
+        && ngx_strncmp(path->data, cache->index.data, cache->index.len) == 0)
+    {
+        return NGX_OK;
+    }
+
+    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
+        (void) ngx_http_file_cache_delete_file(ctx, path);
+    }
+
+    if (++cache->files >= cache->loader_files) {
+        ngx_http_file_cache_loader_sleep(cache);
+
+    } else {
+        ngx_time_update();
+
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache loader time elapsed: %M", elapsed);
+
+        if (elapsed >= cache->loader_threshold) {
+            ngx_http_file_cache_loader_sleep(cache);
+        }
+    }
+
+    return (ngx_quit || ngx_terminate) ? NGX_ABORT : NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache)
+{
+    ngx_msleep(cache->loader_sleep);
+
+    ngx_time_update();
+
+    cache->last = ngx_current_msec;
+    cache->files = 0;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
+{
+    u_char                 *p;
+    ngx_int_t               n;
+    ngx_uint_t              i;
+    ngx_http_cache_t        c;
+    ngx_http_file_cache_t  *cache;
+
+    if (name->len < 2 * NGX_HTTP_CACHE_KEY_LEN) {
+        return NGX_ERROR;
+    }
+
+    if (ctx->size < (off_t) sizeof(ngx_http_file_cache_header_t)) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, 0,
+                      "cache file \"%s\" is too small", name->data);
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&c, sizeof(ngx_http_cache_t));
+    cache = ctx->data;
+
+    c.length = ctx->size;
+    c.fs_size = (ctx->fs_size + cache->bsize - 1) / cache->bsize;
+
+    p = &name->data[name->len - 2 * NGX_HTTP_CACHE_KEY_LEN];
+
+    for (i = 0; i < NGX_HTTP_CACHE_KEY_LEN; i++) {
+        n = ngx_hextoi(p, 2);
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        p += 2;
+
+        c.key[i] = (u_char) n;
+    }
+
+    return ngx_http_file_cache_add(cache, &c);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+{
+    ngx_http_file_cache_node_t  *fcn;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    fcn = ngx_http_file_cache_lookup(cache, c->key);
+
+    if (fcn == NULL) {
+
+        fcn = ngx_slab_alloc_locked(cache->shpool,
+                                    sizeof(ngx_http_file_cache_node_t));
+        if (fcn == NULL) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+
+        ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+
+        cache->sh->nodes++;
+
+        fcn->uses = 1;
+        fcn->count = 0;
+        fcn->valid_msec = 0;
+        fcn->error = 0;
+        fcn->exists = 1;
+        fcn->updating = 0;
+        fcn->deleting = 0;
+        fcn->waiting = 0;
+        fcn->promoted = 0;
+        fcn->uniq = 0;
+        fcn->valid_sec = 0;
+        fcn->body_start = 0;
+        fcn->fs_size = c->fs_size;
+
+        cache->sh->size += c->fs_size;
+
+    } else {
+        ngx_queue_remove(&fcn->queue);
+    }
+
+    fcn->expire = ngx_time() + cache->inactive;
+
+    ngx_queue_insert_head(ngx_http_file_cache_queue(cache, fcn), &fcn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
+                   "http file cache delete: \"%s\"", path->data);
+
+    if (ngx_delete_file(path->data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", path->data);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_journal_init(ngx_http_file_cache_t *cache)
+{
+    ngx_uint_t                      n;
+    ngx_http_file_cache_journal_t  *j;
+
+    n = cache->shm_zone->shm.size / 256
+        / sizeof(ngx_http_file_cache_index_entry_t);
+
+    if (n < 64) {
+        n = 64;
+    }
+
+    j = ngx_slab_alloc(cache->shpool, sizeof(ngx_http_file_cache_journal_t)
+                       + (n - 1) * sizeof(ngx_http_file_cache_index_entry_t));
+    if (j == NULL) {
+        return NGX_ERROR;
+    }
+
+    j->gen = 0;
+    j->pid = ngx_pid;
+    j->checkpoint = 0;
+    j->overflow = 1;
+    j->head = 0;
+    j->tail = 0;
+    j->size = n;
+
+    cache->sh->journal = j;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_journal(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, off_t fs_size)
+{
+    ngx_http_file_cache_journal_t      *j;
+    ngx_http_file_cache_index_entry_t  *e;
+
+    j = cache->sh->journal;
+
+    if (cache->index.len == 0 || j == NULL || j->overflow) {
+        return;
+    }
+
+    if (j->head - j->tail == j->size) {
+        j->overflow = 1;
+        return;
+    }
+
+    e = &j->entries[j->head % j->size];
+
+    ngx_http_file_cache_index_key(e->key, fcn);
+    e->fs_size = fs_size;
+
+    j->head++;
+}
+
+
+static void
+ngx_http_file_cache_index_key(u_char *key, ngx_http_file_cache_node_t *fcn)
+{
+    ngx_memcpy(key, (u_char *) &fcn->node.key, sizeof(ngx_rbtree_key_t));
+
+    ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+}
+
+
+static uint32_t
+ngx_http_file_cache_index_crc(ngx_http_file_cache_t *cache)
+{
+    uint32_t  crc;
+
+    ngx_crc32_init(crc);
+    ngx_crc32_update(&crc, cache->path->name.data, cache->path->name.len);
+    ngx_crc32_update(&crc, (u_char *) cache->path->level,
+                     sizeof(cache->path->level));
+    ngx_crc32_final(crc);
+
+    return crc;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_open(ngx_http_file_cache_t *cache, ngx_file_t *file,
+    ngx_http_file_cache_index_header_t *h, off_t *size)
+{
+    ssize_t          n;
+    ngx_err_t        err;
+    ngx_file_info_t  fi;
+
+    file->fd = ngx_open_file(file->name.data, NGX_FILE_RDWR, NGX_FILE_OPEN, 0);
+
+    if (file->fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
+
+        if (err != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, file->log, err,
+                          ngx_open_file_n " \"%s\" failed", file->name.data);
+        }
+
+        return NGX_DECLINED;
+    }
+
+    if (ngx_fd_info(file->fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, file->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", file->name.data);
+        goto failed;
+    }
+
+    *size = ngx_file_size(&fi);
+
+    n = ngx_read_file(file, (u_char *) h,
+                      sizeof(ngx_http_file_cache_index_header_t), 0);
+
+    if (n == NGX_ERROR) {
+        goto failed;
+    }
+
+    if ((size_t) n != sizeof(ngx_http_file_cache_index_header_t)
+        || h->magic != NGX_HTTP_FILE_CACHE_INDEX_MAGIC
+        || h->crc32 != ngx_http_file_cache_index_crc(cache)
+        || h->bsize != cache->bsize)
+    {
+        ngx_log_error(NGX_LOG_WARN, file->log, 0,
+                      "cache index \"%s\" is invalid", file->name.data);
+        goto failed;
+    }
+
+    return NGX_OK;
+
+failed:
+
+    if (ngx_close_file(file->fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, file->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file->name.data);
+    }
+
+    file->fd = NGX_INVALID_FILE;
+
+    return NGX_DECLINED;
+}
+
+
+static void
+ngx_http_file_cache_index_load(ngx_http_file_cache_t *cache, ngx_log_t *log)
+{
+    off_t                                size;
+    ngx_uint_t                           n, clean;
+    ngx_file_t                           file, journal;
+    ngx_http_file_cache_journal_t       *j;
+    ngx_http_file_cache_index_entry_t   *buf;
+    ngx_http_file_cache_index_header_t   h, jh;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+    file.name = cache->index;
+    file.log = log;
+
+    if (ngx_http_file_cache_index_open(cache, &file, &h, &size) != NGX_OK) {
+        return;
+    }
+
+    buf = NULL;
+    clean = h.clean;
+
+    if (size != (off_t) (sizeof(ngx_http_file_cache_index_header_t)
+                         + h.n * sizeof(ngx_http_file_cache_index_entry_t)))
+    {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "cache index \"%s\" is truncated", file.name.data);
+        goto done;
+    }
+
+    buf = ngx_alloc(NGX_HTTP_FILE_CACHE_INDEX_CHUNK
+                    * sizeof(ngx_http_file_cache_index_entry_t), log);
+    if (buf == NULL) {
+        goto done;
+    }
+
+    if (ngx_http_file_cache_index_replay(cache, &file, h.n, buf) != NGX_OK) {
+        goto done;
+    }
+
+    ngx_memzero(&journal, sizeof(ngx_file_t));
+    journal.name = cache->index_journal;
+    journal.log = log;
+
+    if (ngx_http_file_cache_index_open(cache, &journal, &jh, &size) == NGX_OK) {
+
+        if (jh.gen == h.gen) {
+            n = (size - sizeof(ngx_http_file_cache_index_header_t))
+                / sizeof(ngx_http_file_cache_index_entry_t);
+
+            if (ngx_http_file_cache_index_replay(cache, &journal, n, buf)
+                != NGX_OK)
+            {
+                clean = 0;
+            }
+
+        } else {
+            clean = 0;
+        }
+
+        if (ngx_close_file(journal.fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed",
+                          journal.name.data);
+        }
+
+    } else {
+        clean = 0;
+    }
+
+    /*
+     * the index stays dirty until the master process exits gracefully,
+     * and during a binary upgrade it is taken over by the new master
+     */
+
+    j = cache->sh->journal;
+
+    h.clean = 0;
+    h.pid = j->pid;
+
+    if (ngx_write_file(&file, (u_char *) &h,
+                       sizeof(ngx_http_file_cache_index_header_t), 0)
+        == NGX_ERROR)
+    {
+        goto done;
+    }
+
+    j->gen = h.gen;
+    j->checkpoint = ngx_time();
+
+    if (clean) {
+        j->overflow = 0;
+        cache->sh->cold = 0;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "http file cache: %V %.3fM, bsize: %uz, "
+                  "%ui keys loaded from %s index",
+                  &cache->path->name,
+                  ((double) cache->sh->size * cache->bsize) / (1024 * 1024),
+                  cache->bsize, h.n, clean ? "clean" : "dirty");
+
+done:
+
+    if (buf) {
+        ngx_free(buf);
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_replay(ngx_http_file_cache_t *cache,
+    ngx_file_t *file, ngx_uint_t n, ngx_http_file_cache_index_entry_t *buf)
+{
+    off_t       offset;
+    size_t      size;
+    ssize_t     rc;
+    ngx_uint_t  chunk;
+
+    offset = sizeof(ngx_http_file_cache_index_header_t);
+
+    while (n) {
+        chunk = ngx_min(n, NGX_HTTP_FILE_CACHE_INDEX_CHUNK);
+        size = chunk * sizeof(ngx_http_file_cache_index_entry_t);
+
+        rc = ngx_read_file(file, (u_char *) buf, size, offset);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if ((size_t) rc != size) {
+            ngx_log_error(NGX_LOG_WARN, file->log, 0,
+                          "cache index \"%s\" is truncated", file->name.data);
+            return NGX_ERROR;
+        }
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        rc = ngx_http_file_cache_index_apply(cache, buf, chunk);
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        if (rc != NGX_OK) {
+            ngx_log_error(NGX_LOG_WARN, file->log, 0,
+                          "cache index \"%s\" does not fit into keys zone",
+                          file->name.data);
+            return NGX_ERROR;
+        }
+
+        offset += size;
+        n -= chunk;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_apply(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_index_entry_t *e, ngx_uint_t n)
+{
+    time_t                       expire;
+    ngx_uint_t                   i;
+    ngx_http_file_cache_node_t  *fcn;
+
+    expire = ngx_time() + cache->inactive;
+
+    for (i = 0; i < n; i++) {
+
+        fcn = ngx_http_file_cache_lookup(cache, e[i].key);
+
+        if (e[i].fs_size < 0) {
+
+            if (fcn) {
+                cache->sh->size -= fcn->fs_size;
+
+                if (fcn->promoted) {
+                    cache->sh->promoted_nodes--;
+                }
+
+                cache->sh->nodes--;
+
+                ngx_queue_remove(&fcn->queue);
+                ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
+                ngx_slab_free_locked(cache->shpool, fcn);
+            }
+
+            continue;
+        }
+
+        if (fcn == NULL) {
+
+            fcn = ngx_slab_alloc_locked(cache->shpool,
+                                        sizeof(ngx_http_file_cache_node_t));
+            if (fcn == NULL) {
+                return NGX_ERROR;
+            }
+
+            ngx_memcpy((u_char *) &fcn->node.key, e[i].key,
+                       sizeof(ngx_rbtree_key_t));
+
+            ngx_memcpy(fcn->key, &e[i].key[sizeof(ngx_rbtree_key_t)],
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+            ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+
+            cache->sh->nodes++;
+
+            fcn->uses = 1;
+            fcn->count = 0;
+            fcn->valid_msec = 0;
+            fcn->error = 0;
+            fcn->exists = 1;
+            fcn->updating = 0;
+            fcn->deleting = 0;
+            fcn->waiting = 0;
+            fcn->promoted = 0;
+            fcn->uniq = 0;
+            fcn->valid_sec = 0;
+            fcn->body_start = 0;
+            fcn->fs_size = 0;
+
+        } else {
+            ngx_queue_remove(&fcn->queue);
+        }
+
+        cache->sh->size += e[i].fs_size - fcn->fs_size;
+        fcn->fs_size = e[i].fs_size;
+
+        fcn->expire = expire;
+
+        ngx_queue_insert_head(ngx_http_file_cache_queue(cache, fcn),
+                              &fcn->queue);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_file_cache_index_taken(ngx_http_file_cache_t *cache)
+{
+    off_t                                size;
+    ngx_pid_t                            pid;
+    ngx_file_t                           file;
+    ngx_http_file_cache_index_header_t   h;
+
+    /*
+     * during a binary upgrade both master processes use the same index,
+     * it is written only for the master that has loaded it last,
+     * or for any master if that one has exited
+     */
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+    file.name = cache->index;
+    file.log = ngx_cycle->log;
+
+    if (ngx_http_file_cache_index_open(cache, &file, &h, &size) != NGX_OK) {
+        return 0;
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+
+    pid = cache->sh->journal->pid;
+
+    if (h.pid == pid) {
+        return 0;
+    }
+
+#if !(NGX_WIN32)
+
+    if (kill(h.pid, 0) == -1 && ngx_errno == NGX_ESRCH) {
+        return 0;
+    }
+
+#endif
+
+    ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                  "cache index \"%V\" is used by the master process %P",
+                  &cache->index, h.pid);
+
+    return 1;
+}
+
+
+static void
+ngx_http_file_cache_index_sync(ngx_http_file_cache_t *cache)
+{
+    time_t                          interval;
+#if !(NGX_WIN32)
+    ngx_pid_t                       ppid;
+#endif
+    ngx_uint_t                      checkpoint;
+    ngx_http_file_cache_journal_t  *j;
+
+    j = cache->sh->journal;
+
+    if (j == NULL) {
+        return;
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+#if !(NGX_WIN32)
+
+    /*
+     * the index is written for the master process, and its pid changes
+     * if it becomes a daemon after the keys zone has been created
+     */
+
+    ppid = getppid();
+
+    if (ppid != 1 && ppid != j->pid) {
+        j->pid = ppid;
+    }
+
+#endif
+
+    if (cache->sh->cold) {
+
+        /* the loader adds keys without journaling them */
+
+        j->tail = j->head;
+        j->overflow = 1;
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        return;
+    }
+
+    interval = cache->index_interval;
+
+    if (j->overflow && interval > 60) {
+        interval = 60;
+    }
+
+    checkpoint = (ngx_time() - j->checkpoint >= interval);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (checkpoint) {
+        ngx_http_file_cache_index_checkpoint(cache);
+        return;
+    }
+
+    (void) ngx_http_file_cache_index_flush(cache, ngx_cycle->log);
+}
+
+
+static void
+ngx_http_file_cache_index_checkpoint(ngx_http_file_cache_t *cache)
+{
+    off_t                                offset;
+    size_t                               len;
+    ngx_uint_t                           i, n, gen;
+    ngx_file_t                           file;
+    ngx_rbtree_node_t                   *node, *root, *sentinel;
+    ngx_http_file_cache_node_t          *fcn;
+    ngx_http_file_cache_journal_t       *j;
+    ngx_http_file_cache_index_entry_t   *buf, *e;
+    ngx_http_file_cache_index_header_t   h;
+    u_char                               key[NGX_HTTP_CACHE_KEY_LEN];
+
+    j = cache->sh->journal;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+    file.fd = NGX_INVALID_FILE;
+    file.name = cache->index_temp;
+    file.log = ngx_cycle->log;
+
+    buf = NULL;
+
+    if (ngx_http_file_cache_index_taken(cache)) {
+        goto failed;
+    }
+
+    buf = ngx_alloc(NGX_HTTP_FILE_CACHE_INDEX_CHUNK
+                    * sizeof(ngx_http_file_cache_index_entry_t),
+                    ngx_cycle->log);
+    if (buf == NULL) {
+        goto failed;
+    }
+
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_WRONLY,
+                            NGX_FILE_TRUNCATE, NGX_FILE_OWNER_ACCESS);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", file.name.data);
+        goto failed;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache index checkpoint: \"%V\"", &cache->index);
+
+    h.magic = NGX_HTTP_FILE_CACHE_INDEX_MAGIC;
+    h.crc32 = ngx_http_file_cache_index_crc(cache);
+    h.clean = 0;
+    h.n = 0;
+    h.bsize = cache->bsize;
+    h.pid = j->pid;
+
+    offset = sizeof(ngx_http_file_cache_index_header_t);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    /*
+     * the keys changed after this point are journaled again,
+     * so the snapshot and the new journal together are consistent
+     */
+
+    gen = j->gen + 1;
+
+    j->tail = j->head;
+    j->overflow = 0;
+
+    root = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    node = (root == sentinel) ? NULL : ngx_rbtree_min(root, sentinel);
+
+    for ( ;; ) {
+
+        e = buf;
+
+        for (i = 0; node && i < NGX_HTTP_FILE_CACHE_INDEX_CHUNK; i++) {
+            fcn = (ngx_http_file_cache_node_t *) node;
+
+            if (fcn->exists && !fcn->deleting) {
+                ngx_http_file_cache_index_key(e->key, fcn);
+                e->fs_size = fcn->fs_size;
+                e++;
+            }
+
+            node = ngx_http_file_cache_index_next(cache, node);
+        }
+
+        if (node) {
+            ngx_http_file_cache_index_key(key,
+                                         (ngx_http_file_cache_node_t *) node);
+        }
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        if (e != buf) {
+            len = (u_char *) e - (u_char *) buf;
+
+            if (ngx_write_file(&file, (u_char *) buf, len, offset)
+                == NGX_ERROR)
+            {
+                goto failed;
+            }
+
+            offset += len;
+            h.n += e - buf;
+        }
+
+        if (node == NULL) {
+            break;
+        }
+
+        if (ngx_quit || ngx_terminate) {
+            goto failed;
+        }
+
+        ngx_shmtx_lock(&cache->shpool->mutex);
+
+        node = ngx_http_file_cache_index_find(cache, key);
+    }
+
+    h.gen = gen;
+
+    if (ngx_write_file(&file, (u_char *) &h,
+                       sizeof(ngx_http_file_cache_index_header_t), 0)
+        == NGX_ERROR)
+    {
+        goto failed;
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+
+    file.fd = NGX_INVALID_FILE;
+
+    if (ngx_rename_file(file.name.data, cache->index.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      file.name.data, cache->index.data);
+        goto failed;
+    }
+
+    /* start a new journal */
+
+    n = h.n;
+
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_WRONLY,
+                            NGX_FILE_TRUNCATE, NGX_FILE_OWNER_ACCESS);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", file.name.data);
+        goto failed;
+    }
+
+    h.n = 0;
+
+    if (ngx_write_file(&file, (u_char *) &h,
+                       sizeof(ngx_http_file_cache_index_header_t), 0)
+        == NGX_ERROR)
+    {
+        goto failed;
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+
+    file.fd = NGX_INVALID_FILE;
+
+    if (ngx_rename_file(file.name.data, cache->index_journal.data)
+        == NGX_FILE_ERROR)
+    {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      file.name.data, cache->index_journal.data);
+        goto failed;
+    }
+
+    ngx_free(buf);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    j->gen = gen;
+    j->checkpoint = ngx_time();
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                  "http file cache: %ui keys saved to index \"%V\"",
+                  n, &cache->index);
+
+    return;
+
+failed:
+
+    if (buf) {
+        ngx_free(buf);
+    }
+
+    if (file.fd != NGX_INVALID_FILE) {
+        if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", file.name.data);
+        }
+
+        if (ngx_delete_file(file.name.data) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", file.name.data);
+        }
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    j->tail = j->head;
+    j->overflow = 1;
+    j->checkpoint = ngx_time();
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+
+static ngx_rbtree_node_t *
+ngx_http_file_cache_index_find(ngx_http_file_cache_t *cache, u_char *key)
 {
-    return NGX_OK;
-}
+    ngx_int_t                    rc;
+    ngx_rbtree_key_t             node_key;
+    ngx_rbtree_node_t           *node, *sentinel, *next;
+    ngx_http_file_cache_node_t  *fcn;
 
+    /* the first node with a key that is not less than the given one */
 
-static ngx_int_t
-ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
-{
-    ngx_msec_t              elapsed;
-    ngx_http_file_cache_t  *cache;
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
 
-    cache = ctx->data;
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+    next = NULL;
 
-    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
-        (void) ngx_http_file_cache_delete_file(ctx, path);
-    }
+    while (node != sentinel) {
 
-    if (++cache->files >= cache->loader_files) {
-        ngx_http_file_cache_loader_sleep(cache);
+        if (node_key < node->key) {
+            next = node;
+            node = node->left;
+            continue;
+        }
 
-    } else {
-        ngx_time_update();
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
 
-        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+        /* node_key == node->key */
 
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache loader time elapsed: %M", elapsed);
+        fcn = (ngx_http_file_cache_node_t *) node;
 
-        if (elapsed >= cache->loader_threshold) {
-            ngx_http_file_cache_loader_sleep(cache);
+        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                        NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (rc == 0) {
+            return node;
+        }
+
+        if (rc < 0) {
+            next = node;
+            node = node->left;
+
+        } else {
+            node = node->right;
         }
     }
 
-    return (ngx_quit || ngx_terminate) ? NGX_ABORT : NGX_OK;
+    return next;
 }
 
 
-static void
-ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache)
+static ngx_rbtree_node_t *
+ngx_http_file_cache_index_next(ngx_http_file_cache_t *cache,
+    ngx_rbtree_node_t *node)
 {
-    ngx_msleep(cache->loader_sleep);
+    ngx_rbtree_node_t  *root, *sentinel, *parent;
 
-    ngx_time_update();
+    root = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
+    if (node->right != sentinel) {
+        return ngx_rbtree_min(node->right, sentinel);
+    }
+
+    for ( ;; ) {
+
+        if (node == root) {
+            return NULL;
+        }
+
+        parent = node->parent;
+
+        if (node == parent->left) {
+            return parent;
+        }
+
+        node = parent;
+    }
 }
 
 
 static ngx_int_t
-ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
+ngx_http_file_cache_index_flush(ngx_http_file_cache_t *cache, ngx_log_t *log)
 {
-    u_char                 *p;
-    ngx_int_t               n;
-    ngx_uint_t              i;
-    ngx_http_cache_t        c;
-    ngx_http_file_cache_t  *cache;
+    off_t                                size, offset;
+    ngx_int_t                            rc;
+    ngx_uint_t                           n;
+    ngx_file_t                           file;
+    ngx_http_file_cache_journal_t       *j;
+    ngx_http_file_cache_index_entry_t   *buf;
+    ngx_http_file_cache_index_header_t   h;
 
-    if (name->len < 2 * NGX_HTTP_CACHE_KEY_LEN) {
-        return NGX_ERROR;
-    }
+    j = cache->sh->journal;
 
-    if (ctx->size < (off_t) sizeof(ngx_http_file_cache_header_t)) {
-        ngx_log_error(NGX_LOG_CRIT, ctx->log, 0,
-                      "cache file \"%s\" is too small", name->data);
-        return NGX_ERROR;
-    }
+    ngx_shmtx_lock(&cache->shpool->mutex);
 
-    ngx_memzero(&c, sizeof(ngx_http_cache_t));
-    cache = ctx->data;
+    n = j->head - j->tail;
 
-    c.length = ctx->size;
-    c.fs_size = (ctx->fs_size + cache->bsize - 1) / cache->bsize;
+    ngx_shmtx_unlock(&cache->shpool->mutex);
 
-    p = &name->data[name->len - 2 * NGX_HTTP_CACHE_KEY_LEN];
+    if (n == 0) {
+        return NGX_OK;
+    }
 
-    for (i = 0; i < NGX_HTTP_CACHE_KEY_LEN; i++) {
-        n = ngx_hextoi(p, 2);
+    ngx_memzero(&file, sizeof(ngx_file_t));
+    file.name = cache->index_journal;
+    file.log = log;
 
-        if (n == NGX_ERROR) {
-            return NGX_ERROR;
-        }
+    if (ngx_http_file_cache_index_open(cache, &file, &h, &size) != NGX_OK) {
+        goto failed;
+    }
 
-        p += 2;
+    rc = NGX_ERROR;
 
-        c.key[i] = (u_char) n;
+    buf = NULL;
+
+    if (h.gen != j->gen || h.pid != j->pid) {
+        goto done;
     }
 
-    return ngx_http_file_cache_add(cache, &c);
-}
+    buf = ngx_alloc(NGX_HTTP_FILE_CACHE_INDEX_CHUNK
+                    * sizeof(ngx_http_file_cache_index_entry_t), log);
+    if (buf == NULL) {
+        goto done;
+    }
 
+    /* a partially written record is overwritten */
 
-static ngx_int_t
-ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
-{
-    ngx_http_file_cache_node_t  *fcn;
+    offset = size - (size - sizeof(ngx_http_file_cache_index_header_t))
+                    % sizeof(ngx_http_file_cache_index_entry_t);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    for ( ;; ) {
+        ngx_shmtx_lock(&cache->shpool->mutex);
 
-    fcn = ngx_http_file_cache_lookup(cache, c->key);
+        for (n = 0;
+             n < NGX_HTTP_FILE_CACHE_INDEX_CHUNK && j->tail != j->head;
+             n++)
+        {
+            buf[n] = j->entries[j->tail++ % j->size];
+        }
 
-    if (fcn == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
 
-        fcn = ngx_slab_alloc_locked(cache->shpool,
-                                    sizeof(ngx_http_file_cache_node_t));
-        if (fcn == NULL) {
-            ngx_shmtx_unlock(&cache->shpool->mutex);
-            return NGX_ERROR;
+        if (n == 0) {
+            rc = NGX_OK;
+            break;
         }
 
-        ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+        n *= sizeof(ngx_http_file_cache_index_entry_t);
 
-        ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
-                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+        if (ngx_write_file(&file, (u_char *) buf, n, offset) == NGX_ERROR) {
+            break;
+        }
 
-        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+        offset += n;
+    }
 
-        fcn->uses = 1;
-        fcn->count = 0;
-        fcn->valid_msec = 0;
-        fcn->error = 0;
-        fcn->exists = 1;
-        fcn->updating = 0;
-        fcn->deleting = 0;
-        fcn->uniq = 0;
-        fcn->valid_sec = 0;
-        fcn->body_start = 0;
-        fcn->fs_size = c->fs_size;
+done:
 
-        cache->sh->size += c->fs_size;
+    if (buf) {
+        ngx_free(buf);
+    }
 
-    } else {
-        ngx_queue_remove(&fcn->queue);
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
     }
 
-    fcn->expire = ngx_time() + cache->inactive;
+    if (rc == NGX_OK) {
+        return NGX_OK;
+    }
+
+failed:
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    j->tail = j->head;
+    j->overflow = 1;
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
 
-    return NGX_OK;
+    return NGX_ERROR;
 }
 
 
-static ngx_int_t
-ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+void
+ngx_http_file_cache_exit_master(ngx_cycle_t *cycle)
 {
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
-                   "http file cache delete: \"%s\"", path->data);
+    off_t                                size;
+    ngx_uint_t                           i;
+    ngx_path_t                         **path;
+    ngx_file_t                           file;
+    ngx_http_file_cache_t               *cache;
+    ngx_http_file_cache_journal_t       *j;
+    ngx_http_file_cache_index_header_t   h;
+
+    path = cycle->paths.elts;
+    for (i = 0; i < cycle->paths.nelts; i++) {
+
+        if (path[i]->manager != ngx_http_file_cache_manager) {
+            continue;
+        }
 
-    if (ngx_delete_file(path->data) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
-                      ngx_delete_file_n " \"%s\" failed", path->data);
-    }
+        cache = path[i]->data;
 
-    return NGX_OK;
+        if (cache->index.len == 0 || cache->sh == NULL) {
+            continue;
+        }
+
+        j = cache->sh->journal;
+
+        if (j == NULL || cache->sh->cold || j->overflow) {
+            continue;
+        }
+
+        if (ngx_http_file_cache_index_flush(cache, cycle->log) != NGX_OK) {
+            continue;
+        }
+
+        ngx_memzero(&file, sizeof(ngx_file_t));
+        file.name = cache->index;
+        file.log = cycle->log;
+
+        if (ngx_http_file_cache_index_open(cache, &file, &h, &size) != NGX_OK) {
+            continue;
+        }
+
+        if (h.gen == j->gen
+            && h.pid == j->pid
+            && size == (off_t) (sizeof(ngx_http_file_cache_index_header_t)
+                          + h.n * sizeof(ngx_http_file_cache_index_entry_t)))
+        {
+            h.clean = 1;
+
+            (void) ngx_write_file(&file, (u_char *) &h,
+                                  sizeof(ngx_http_file_cache_index_header_t),
+                                  0);
+        }
+
+        if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", file.name.data);
+        }
+    }
 }
 
 
@@ -1590,9 +3670,10 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     off_t                   max_size;
     u_char                 *last, *p;
     time_t                  inactive;
-    ssize_t                 size;
-    ngx_str_t               s, name, *value;
+    ssize_t                 size, mem_size;
+    ngx_str_t               s, name, mem_name, *value;
     ngx_int_t               loader_files;
+    time_t                  index_interval;
     ngx_msec_t              loader_sleep, loader_threshold;
     ngx_uint_t              i, n;
     ngx_http_file_cache_t  *cache;
@@ -1611,11 +3692,15 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     loader_files = 100;
     loader_sleep = 50;
     loader_threshold = 200;
+    index_interval = 3600;
 
     name.len = 0;
     size = 0;
     max_size = NGX_MAX_OFF_T_VALUE;
 
+    mem_name.len = 0;
+    mem_size = 0;
+
     value = cf->args->elts;
 
     cache->path->name = value[1];
@@ -1692,6 +3777,31 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             return NGX_CONF_ERROR;
         }
 
+        if (ngx_strncmp(value[i].data, "mem_zone=", 9) == 0) {
+
+            mem_name.data = value[i].data + 9;
+
+            p = (u_char *) ngx_strchr(mem_name.data, ':');
+
+            if (p) {
+                mem_name.len = p - mem_name.data;
+
+                p++;
+
+                s.len = value[i].data + value[i].len - p;
+                s.data = p;
+
+                mem_size = ngx_parse_size(&s);
+                if (mem_size > 8191) {
+                    continue;
+                }
+            }
+
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid memory zone size \"%V\"", &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
         if (ngx_strncmp(value[i].data, "inactive=", 9) == 0) {
 
             s.len = value[i].len - 9;
@@ -1764,6 +3874,59 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "index=", 6) == 0) {
+
+            cache->index.len = value[i].len - 6;
+            cache->index.data = value[i].data + 6;
+
+            if (cache->index.len == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid index \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (ngx_conf_full_name(cf->cycle, &cache->index, 0) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "index_interval=", 15) == 0) {
+
+            s.len = value[i].len - 15;
+            s.data = value[i].data + 15;
+
+            index_interval = ngx_parse_time(&s, 1);
+            if (index_interval == (time_t) NGX_ERROR || index_interval == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid index_interval value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "admission=uses") == 0) {
+            cache->tinylfu = 0;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "admission=tinylfu") == 0) {
+            cache->tinylfu = 1;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "eviction=lru") == 0) {
+            cache->slru = 0;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "eviction=slru") == 0) {
+            cache->slru = 1;
+            continue;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -1784,6 +3947,27 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cache->loader_files = loader_files;
     cache->loader_sleep = loader_sleep;
     cache->loader_threshold = loader_threshold;
+    cache->index_interval = index_interval;
+
+    if (cache->index.len) {
+        cache->index_journal.len = cache->index.len + sizeof(".journal") - 1;
+        cache->index_journal.data = ngx_pnalloc(cf->pool,
+                                                cache->index_journal.len + 1);
+        if (cache->index_journal.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_sprintf(cache->index_journal.data, "%V.journal%Z", &cache->index);
+
+        cache->index_temp.len = cache->index.len + sizeof(".tmp") - 1;
+        cache->index_temp.data = ngx_pnalloc(cf->pool,
+                                             cache->index_temp.len + 1);
+        if (cache->index_temp.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_sprintf(cache->index_temp.data, "%V.tmp%Z", &cache->index);
+    }
 
     if (ngx_add_path(cf, &cache->path) != NGX_OK) {
         return NGX_CONF_ERROR;
@@ -1804,6 +3988,23 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cache->shm_zone->init = ngx_http_file_cache_init;
     cache->shm_zone->data = cache;
 
+    if (mem_name.len) {
+        cache->mem_zone = ngx_shared_memory_add(cf, &mem_name, mem_size,
+                                                cmd->post);
+        if (cache->mem_zone == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        if (cache->mem_zone->data) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "duplicate zone \"%V\"", &mem_name);
+            return NGX_CONF_ERROR;
+        }
+
+        cache->mem_zone->init = ngx_http_file_cache_mem_init;
+        cache->mem_zone->data = cache;
+    }
+
     cache->inactive = inactive;
     cache->max_size = max_size;
 
@@ -98,12 +98,29 @@ static uint32_t  usual[] = {
 #endif
 
 
+#if (NGX_HAVE_SSE2)
+
+static u_char *ngx_http_parse_scan(u_char *p, u_char *last, u_char c0,
+    u_char c1);
+#if (NGX_HAVE_AVX2)
+static u_char *ngx_http_parse_scan_avx2(u_char *p, u_char *last, u_char c0,
+    u_char c1) __attribute__ ((target ("avx2")));
+#endif
+static u_char *ngx_http_parse_scan_uri(u_char *p, u_char *last);
+static ngx_uint_t ngx_http_parse_scan_name(u_char *p);
+
+#endif
+
+
 /* gcc, icc, msvc and others compile these switches as an jump table */
 
 ngx_int_t
 ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
 {
     u_char  c, ch, *p, *m;
+#if (NGX_HAVE_SSE2)
+    u_char  *q;
+#endif
     enum {
         sw_start = 0,
         sw_method,
@@ -570,6 +587,17 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         /* check "/", "%" and "\" (Win32) in URI */
         case sw_check_uri:
 
+#if (NGX_HAVE_SSE2)
+            if (b->last - p >= 16) {
+                q = ngx_http_parse_scan_uri(p, b->last);
+
+                if (q != p) {
+                    p = q - 1;
+                    break;
+                }
+            }
+#endif
+
             if (usual[ch >> 5] & (1 << (ch & 0x1f))) {
                 break;
             }
@@ -655,6 +683,17 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         /* URI */
         case sw_uri:
 
+#if (NGX_HAVE_SSE2)
+            if (b->last - p >= 16) {
+                q = ngx_http_parse_scan(p, b->last, ' ', '#');
+
+                if (q != p) {
+                    p = q - 1;
+                    break;
+                }
+            }
+#endif
+
             if (usual[ch >> 5] & (1 << (ch & 0x1f))) {
                 break;
             }
@@ -868,6 +907,10 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
 {
     u_char      c, ch, *p;
     ngx_uint_t  hash, i;
+#if (NGX_HAVE_SSE2)
+    u_char     *q, *t;
+    ngx_uint_t  n;
+#endif
     enum {
         sw_start = 0,
         sw_name,
@@ -944,6 +987,30 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
 
         /* header name */
         case sw_name:
+
+#if (NGX_HAVE_SSE2)
+            if (b->last - p >= 16) {
+
+                /* [A-Za-z0-9-] are lowercased by setting the bit 5 */
+
+                n = ngx_http_parse_scan_name(p);
+
+                for (q = p + n; p < q; p++) {
+                    c = (u_char) (*p | 0x20);
+                    hash = ngx_hash(hash, c);
+                    r->lowcase_header[i++] = c;
+                    i &= (NGX_HTTP_LC_HEADER_LEN - 1);
+                }
+
+                if (n == 16) {
+                    p--;
+                    break;
+                }
+
+                ch = *p;
+            }
+#endif
+
             /* 转为小写再求hash */
             c = lowcase[ch];
 
@@ -1035,6 +1102,28 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
 
         /* header value */
         case sw_value:
+
+#if (NGX_HAVE_SSE2)
+            if (b->last - p >= 16) {
+                q = ngx_http_parse_scan(p, b->last, CR, LF);
+
+                if (q != p) {
+
+                    /* trailing spaces are not a part of the value */
+
+                    for (t = q; t > p && t[-1] == ' '; t--) { /* void */ }
+
+                    if (t != q) {
+                        r->header_end = t;
+                        state = sw_space_after_value;
+                    }
+
+                    p = q - 1;
+                    break;
+                }
+            }
+#endif
+
             switch (ch) {
             case ' ':
                 /* value后可能存在空格 */
@@ -2289,3 +2378,199 @@ invalid:
 
     return NGX_ERROR;
 }
+
+
+#if (NGX_HAVE_SSE2)
+
+/*
+ * the scanners return a pointer to the first NUL, CR, LF, c0, or c1
+ * character, or the last pointer; there must be at least a vector
+ * of data, so the tail is tested by a vector overlapping the bytes
+ * already tested
+ */
+
+static u_char *
+ngx_http_parse_scan(u_char *p, u_char *last, u_char c0, u_char c1)
+{
+    int      m;
+    __m128i  x, nul, cr, lf, v0, v1;
+
+#if (NGX_HAVE_AVX2)
+    if ((ngx_cpu_features & NGX_CPU_AVX2) && last - p >= 32) {
+        return ngx_http_parse_scan_avx2(p, last, c0, c1);
+    }
+#endif
+
+    nul = _mm_setzero_si128();
+    cr = _mm_set1_epi8(CR);
+    lf = _mm_set1_epi8(LF);
+    v0 = _mm_set1_epi8(c0);
+    v1 = _mm_set1_epi8(c1);
+
+    for ( ;; ) {
+
+        if (last - p < 16) {
+            if (p == last) {
+                return last;
+            }
+
+            p = last - 16;
+        }
+
+        x = _mm_loadu_si128((__m128i *) p);
+
+        x = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, nul),
+                                      _mm_cmpeq_epi8(x, cr)),
+                         _mm_or_si128(_mm_cmpeq_epi8(x, lf),
+                                      _mm_or_si128(_mm_cmpeq_epi8(x, v0),
+                                                   _mm_cmpeq_epi8(x, v1))));
+
+        m = _mm_movemask_epi8(x);
+
+        if (m) {
+            return p + __builtin_ctz(m);
+        }
+
+        p += 16;
+    }
+}
+
+
+#if (NGX_HAVE_AVX2)
+
+static u_char *
+ngx_http_parse_scan_avx2(u_char *p, u_char *last, u_char c0, u_char c1)
+{
+    int      m;
+    __m256i  x, nul, cr, lf, v0, v1;
+
+    nul = _mm256_setzero_si256();
+    cr = _mm256_set1_epi8(CR);
+    lf = _mm256_set1_epi8(LF);
+    v0 = _mm256_set1_epi8(c0);
+    v1 = _mm256_set1_epi8(c1);
+
+    for ( ;; ) {
+
+        if (last - p < 32) {
+            if (p == last) {
+                break;
+            }
+
+            p = last - 32;
+        }
+
+        x = _mm256_loadu_si256((__m256i *) p);
+
+        x = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(x, nul),
+                                _mm256_cmpeq_epi8(x, cr)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(x, lf),
+                                _mm256_or_si256(_mm256_cmpeq_epi8(x, v0),
+                                                _mm256_cmpeq_epi8(x, v1))));
+
+        m = _mm256_movemask_epi8(x);
+
+        if (m) {
+            p += __builtin_ctz(m);
+            break;
+        }
+
+        p += 32;
+    }
+
+    /*
+     * the upper halves of the registers are cleared explicitly,
+     * otherwise the SSE code of the callers runs much slower
+     */
+
+    _mm256_zeroupper();
+
+    return p;
+}
+
+#endif
+
+
+/*
+ * returns a pointer to the first character which is not "usual" in URI,
+ * that is, NUL, CR, LF, space, "#", "%", "+", ".", "/", "?", or "\" on
+ * Win32, or the last pointer; there must be at least 16 bytes of data
+ */
+
+static u_char *
+ngx_http_parse_scan_uri(u_char *p, u_char *last)
+{
+    int      m;
+    __m128i  x, c;
+
+    for ( ;; ) {
+
+        if (last - p < 16) {
+            if (p == last) {
+                return last;
+            }
+
+            p = last - 16;
+        }
+
+        x = _mm_loadu_si128((__m128i *) p);
+
+        c = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(x, _mm_setzero_si128()),
+                             _mm_cmpeq_epi8(x, _mm_set1_epi8(CR))),
+                _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(LF)),
+                             _mm_cmpeq_epi8(x, _mm_set1_epi8(' '))));
+
+        c = _mm_or_si128(c,
+                _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('#')),
+                                 _mm_cmpeq_epi8(x, _mm_set1_epi8('%'))),
+                    _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('+')),
+                                 _mm_cmpeq_epi8(x, _mm_set1_epi8('?')))));
+
+        c = _mm_or_si128(c,
+                _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('.')),
+                             _mm_cmpeq_epi8(x, _mm_set1_epi8('/'))));
+
+#if (NGX_WIN32)
+        c = _mm_or_si128(c, _mm_cmpeq_epi8(x, _mm_set1_epi8('\\')));
+#endif
+
+        m = _mm_movemask_epi8(c);
+
+        if (m) {
+            return p + __builtin_ctz(m);
+        }
+
+        p += 16;
+    }
+}
+
+
+/* returns the length of the [A-Za-z0-9-] prefix of the 16 bytes */
+
+static ngx_uint_t
+ngx_http_parse_scan_name(u_char *p)
+{
+    int      m;
+    __m128i  x, lc;
+
+    x = _mm_loadu_si128((__m128i *) p);
+    lc = _mm_or_si128(x, _mm_set1_epi8(0x20));
+
+    /* the signed comparisons also reject the bytes above 0x7f */
+
+    m = _mm_movemask_epi8(
+            _mm_or_si128(
+                _mm_and_si128(_mm_cmpgt_epi8(lc, _mm_set1_epi8('a' - 1)),
+                              _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), lc)),
+                _mm_or_si128(
+                    _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), x)),
+                    _mm_cmpeq_epi8(x, _mm_set1_epi8('-')))));
+
+    return __builtin_ctz(~m);
+}
+
+#endif
@@ -569,7 +569,7 @@ ngx_http_create_request(ngx_connection_t *c)
     }
 
 #if (NGX_HTTP_SSL)
-    if (c->ssl) {
+    if (c->ssl && !c->ssl->sendfile) {
         r->main_filter_need_in_memory = 1;
     }
 #endif
@@ -852,6 +852,22 @@ ngx_http_ssl_servername(ngx_ssl_conn_t *ssl_conn, int *ad, void *arg)
 #endif
 
         SSL_set_options(ssl_conn, SSL_CTX_get_options(sscf->ssl.ctx));
+
+#ifdef SSL_OP_ENABLE_KTLS
+
+        /* the keys are not yet set, so kTLS may still be switched */
+
+        if (sscf->ktls) {
+            SSL_set_options(ssl_conn, SSL_OP_ENABLE_KTLS);
+
+        } else {
+            SSL_clear_options(ssl_conn, SSL_OP_ENABLE_KTLS);
+        }
+
+#endif
+
+        c->ssl->buffer_size = sscf->buffer_size;
+        c->ssl->dyn_rec = sscf->dyn_rec;
     }
 
     return SSL_TLSEXT_ERR_OK;
@@ -2299,6 +2315,30 @@ ngx_http_finalize_request(ngx_http_request_t *r, ngx_int_t rc)
             return;
         }
 
+        if (r->background) {
+
+            if (!r->logged) {
+
+                clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+                if (clcf->log_subrequest) {
+                    ngx_http_log_request(r);
+                }
+
+                r->logged = 1;
+
+            } else {
+                ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                              "subrequest: \"%V?%V\" logged again",
+                              &r->uri, &r->args);
+            }
+
+            r->done = 1;
+
+            ngx_http_finalize_connection(r);
+            return;
+        }
+
         pr = r->parent;
 
         if (r == c->data) {
@@ -2491,6 +2531,13 @@ ngx_http_finalize_connection(ngx_http_request_t *r)
         return;
     }
 
+    r = r->main;
+
+    if (r->reading_body) {
+        r->keepalive = 0;
+        r->lingering_close = 1;
+    }
+
     if (!ngx_terminate
          && !ngx_exiting
          && r->keepalive
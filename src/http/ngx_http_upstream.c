@@ -15,8 +15,16 @@ static ngx_int_t ngx_http_upstream_cache(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static ngx_int_t ngx_http_upstream_cache_send(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_cache_background_update(
+    ngx_http_request_t *r, ngx_http_upstream_t *u);
 static ngx_int_t ngx_http_upstream_cache_status(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_upstream_cache_last_modified(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_upstream_cache_etag(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_upstream_cache_counter(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
 #endif
 
 static void ngx_http_upstream_init_request(ngx_http_request_t *r);
@@ -30,9 +38,12 @@ static void ngx_http_upstream_connect(ngx_http_request_t *r,
 static ngx_int_t ngx_http_upstream_reinit(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static void ngx_http_upstream_send_request(ngx_http_request_t *r,
-    ngx_http_upstream_t *u);
+    ngx_http_upstream_t *u, ngx_uint_t do_write);
+static ngx_int_t ngx_http_upstream_send_request_body(ngx_http_request_t *r,
+    ngx_http_upstream_t *u, ngx_uint_t do_write);
 static void ngx_http_upstream_send_request_handler(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
+static void ngx_http_upstream_read_request_handler(ngx_http_request_t *r);
 static void ngx_http_upstream_process_header(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static ngx_int_t ngx_http_upstream_test_next(ngx_http_request_t *r,
@@ -56,6 +67,13 @@ static void ngx_http_upstream_upgraded_write_upstream(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static void ngx_http_upstream_process_upgraded(ngx_http_request_t *r,
     ngx_uint_t from_upstream, ngx_uint_t do_write);
+#if (NGX_HAVE_SPLICE)
+static ngx_int_t ngx_http_upstream_init_upgraded_splice(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_splice_upgraded(ngx_connection_t *src,
+    ngx_connection_t *dst, ngx_http_upstream_splice_t *sp);
+static void ngx_http_upstream_upgraded_splice_cleanup(void *data);
+#endif
 static void
     ngx_http_upstream_process_non_buffered_downstream(ngx_http_request_t *r);
 static void
@@ -143,6 +161,10 @@ static ngx_int_t ngx_http_upstream_response_length_variable(
 static char *ngx_http_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy);
 static char *ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+#if (NGX_HTTP_UPSTREAM_ZONE)
+static ngx_int_t ngx_http_upstream_server_resolve(ngx_conf_t *cf,
+    ngx_http_upstream_server_t *us, ngx_url_t *u);
+#endif
 
 static ngx_addr_t *ngx_http_upstream_get_local(ngx_http_request_t *r,
     ngx_http_upstream_local_t *local);
@@ -329,7 +351,11 @@ ngx_module_t  ngx_http_upstream_module = {
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
+#if (NGX_HTTP_CACHE)
+    ngx_http_file_cache_exit_master,       /* exit master */
+#else
     NULL,                                  /* exit master */
+#endif
     NGX_MODULE_V1_PADDING
 };
 
@@ -358,6 +384,34 @@ static ngx_http_variable_t  ngx_http_upstream_vars[] = {
       ngx_http_upstream_cache_status, 0,
       NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+    { ngx_string("upstream_cache_last_modified"), NULL,
+      ngx_http_upstream_cache_last_modified, 0,
+      NGX_HTTP_VAR_NOCACHEABLE|NGX_HTTP_VAR_NOHASH, 0 },
+
+    { ngx_string("upstream_cache_etag"), NULL,
+      ngx_http_upstream_cache_etag, 0,
+      NGX_HTTP_VAR_NOCACHEABLE|NGX_HTTP_VAR_NOHASH, 0 },
+
+    { ngx_string("upstream_cache_lookups"), NULL,
+      ngx_http_upstream_cache_counter,
+      offsetof(ngx_http_file_cache_sh_t, lookups),
+      NGX_HTTP_VAR_NOCACHEABLE|NGX_HTTP_VAR_NOHASH, 0 },
+
+    { ngx_string("upstream_cache_hits"), NULL,
+      ngx_http_upstream_cache_counter,
+      offsetof(ngx_http_file_cache_sh_t, hits),
+      NGX_HTTP_VAR_NOCACHEABLE|NGX_HTTP_VAR_NOHASH, 0 },
+
+    { ngx_string("upstream_cache_rejected"), NULL,
+      ngx_http_upstream_cache_counter,
+      offsetof(ngx_http_file_cache_sh_t, rejected),
+      NGX_HTTP_VAR_NOCACHEABLE|NGX_HTTP_VAR_NOHASH, 0 },
+
+    { ngx_string("upstream_cache_evicted"), NULL,
+      ngx_http_upstream_cache_counter,
+      offsetof(ngx_http_file_cache_sh_t, evicted),
+      NGX_HTTP_VAR_NOCACHEABLE|NGX_HTTP_VAR_NOHASH, 0 },
+
 #endif
 
     { ngx_null_string, NULL, NULL, 0, 0, 0 }
@@ -555,8 +609,11 @@ ngx_http_upstream_init_request(ngx_http_request_t *r)
     u->output.pool = r->pool;
     u->output.bufs.num = 1;
     u->output.bufs.size = clcf->client_body_buffer_size;
-    u->output.output_filter = ngx_chain_writer;
-    u->output.filter_ctx = &u->writer;
+
+    if (u->output.output_filter == NULL) {
+        u->output.output_filter = ngx_chain_writer;
+        u->output.filter_ctx = &u->writer;
+    }
 
     u->writer.pool = r->pool;
 
@@ -759,6 +816,7 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
         c->min_uses = u->conf->cache_min_uses;
         c->body_start = u->conf->buffer_size;
+        c->buffer_size = u->conf->buffer_size;
         c->file_cache = u->conf->cache->data;
 
         c->lock = u->conf->cache_lock;
@@ -774,9 +832,29 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     switch (rc) {
 
+    case NGX_HTTP_CACHE_STALE:
+
+        /*
+         * the expired entry is locked for update by this request:
+         * send it as is and refresh it by a background subrequest
+         */
+
+        if ((u->conf->cache_use_stale & NGX_HTTP_UPSTREAM_FT_UPDATING)
+            && u->conf->cache_background_update
+            && !r->background)
+        {
+            c->background = 1;
+            u->cache_status = rc;
+            rc = NGX_OK;
+        }
+
+        break;
+
     case NGX_HTTP_CACHE_UPDATING:
 
-        if (u->conf->cache_use_stale & NGX_HTTP_UPSTREAM_FT_UPDATING) {
+        if ((u->conf->cache_use_stale & NGX_HTTP_UPSTREAM_FT_UPDATING)
+            && !r->background)
+        {
             u->cache_status = rc;
             rc = NGX_OK;
 
@@ -797,9 +875,23 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
         rc = ngx_http_upstream_cache_send(r, u);
 
         if (rc != NGX_HTTP_UPSTREAM_INVALID_HEADER) {
+
+            if (rc != NGX_ERROR && rc != NGX_DONE
+                && ngx_http_upstream_cache_background_update(r, u) != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
             return rc;
         }
 
+        if (c->background) {
+            c->background = 0;
+            c->valid_sec = 0;
+            u->buffer.start = NULL;
+            u->cache_status = NGX_HTTP_CACHE_EXPIRED;
+        }
+
         break;
 
     case NGX_HTTP_CACHE_STALE:
@@ -902,6 +994,32 @@ ngx_http_upstream_cache_send(ngx_http_request_t *r, ngx_http_upstream_t *u)
     return rc;
 }
 
+
+static ngx_int_t
+ngx_http_upstream_cache_background_update(ngx_http_request_t *r,
+    ngx_http_upstream_t *u)
+{
+    ngx_http_request_t  *sr;
+
+    if (!r->cache->background) {
+        return NGX_OK;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream cache background update");
+
+    if (ngx_http_subrequest(r, &r->uri, &r->args, &sr, NULL,
+                            NGX_HTTP_SUBREQUEST_BACKGROUND)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    sr->header_only = 1;
+
+    return NGX_OK;
+}
+
 #endif
 
 
@@ -934,16 +1052,18 @@ ngx_http_upstream_resolve_handler(ngx_resolver_ctx_t *ctx)
 
 #if (NGX_DEBUG)
     {
-    in_addr_t   addr;
+    u_char      text[NGX_SOCKADDR_STRLEN];
+    ngx_str_t   addr;
     ngx_uint_t  i;
 
+    addr.data = text;
+
     for (i = 0; i < ctx->naddrs; i++) {
-        addr = ntohl(ur->addrs[i]);
+        addr.len = ngx_sock_ntop(ur->addrs[i].sockaddr, text,
+                                 NGX_SOCKADDR_STRLEN, 0);
 
-        ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "name was resolved to %ud.%ud.%ud.%ud",
-                       (addr >> 24) & 0xff, (addr >> 16) & 0xff,
-                       (addr >> 8) & 0xff, addr & 0xff);
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "name was resolved to %V", &addr);
     }
     }
 #endif
@@ -1310,6 +1430,7 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
     }
 
     u->request_sent = 0;
+    u->request_body_sent = 0;
 
 		/* 如果非阻塞连接尚未建立成功，则将写事件添加到定时器，之前这个套接字
 		 * 已经加入到epoll监控中啦，其实就是设置建立tcp连接超时事件。*/
@@ -1328,7 +1449,7 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
 #endif
 
 		/* 如果连接直接建立成功，则在这直接向上游发送请求。 */
-    ngx_http_upstream_send_request(r, u);
+    ngx_http_upstream_send_request(r, u, 1);
 }
 
 
@@ -1391,7 +1512,7 @@ ngx_http_upstream_ssl_handshake(ngx_connection_t *c)
         c->write->handler = ngx_http_upstream_handler;
         c->read->handler = ngx_http_upstream_handler;
 
-        ngx_http_upstream_send_request(r, u);
+        ngx_http_upstream_send_request(r, u, 1);
 
         return;
     }
@@ -1473,7 +1594,8 @@ ngx_http_upstream_reinit(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
 /* 发送数据到后端upstream */
 static void
-ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u)
+ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u,
+    ngx_uint_t do_write)
 {
     ngx_int_t          rc;
     ngx_connection_t  *c;
@@ -1500,24 +1622,27 @@ ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u)
      * 调用filter链，那么nginx是怎么做的呢，是这样子的，在upstream的
      * 初始化的时候，已经将u->output.output_filter改成ngx_chain_writer了 
      */
-    rc = ngx_output_chain(&u->output, u->request_sent ? NULL : u->request_bufs);
-
-    u->request_sent = 1;
+    rc = ngx_http_upstream_send_request_body(r, u, do_write);
 
     if (rc == NGX_ERROR) {
         ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_ERROR);
         return;
     }
 
-		/* 为1表示事件仍在定时器中，则删除定时器事件，再根据rc的值判断是否需要将写事件加入定时器 */
-    if (c->write->timer_set) {
-        ngx_del_timer(c->write);
+    if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+        ngx_http_upstream_finalize_request(r, u, rc);
+        return;
     }
 
     /* 和request的处理类似，如果again，则说明数据没有发送完毕，为写事件添加定时器，
 		 * 防止发送请求超时，同时将写事件注册到epoll中，然后返回。 */
     if (rc == NGX_AGAIN) {
-        ngx_add_timer(c->write, u->conf->send_timeout);
+        if (!c->write->ready) {
+            ngx_add_timer(c->write, u->conf->send_timeout);
+
+        } else if (c->write->timer_set) {
+            ngx_del_timer(c->write);
+        }
 
         if (ngx_handle_write_event(c->write, u->conf->send_lowat) != NGX_OK) {
             ngx_http_upstream_finalize_request(r, u,
@@ -1530,6 +1655,12 @@ ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     /* rc == NGX_OK */
 
+    u->request_body_sent = 1;
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
     /* 设置tcp_cork,和前面的keepalive部分的处理类似 */
     if (c->tcp_nopush == NGX_TCP_NOPUSH_SET) {
         if (ngx_tcp_push(c->fd) == NGX_ERROR) {
@@ -1543,6 +1674,20 @@ ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u)
         c->tcp_nopush = NGX_TCP_NOPUSH_UNSET;
     }
 
+    if (u->read_event_handler != ngx_http_upstream_process_header) {
+
+        /*
+         * an unbuffered request body was sent after the response
+         * header, the response is already being processed
+         */
+
+        u->write_event_handler = ngx_http_upstream_dummy_handler;
+
+        (void) ngx_handle_write_event(c->write, 0);
+
+        return;
+    }
+
 		/* 发送成功，准备读取响应，为读事件添加定时器 */
     ngx_add_timer(c->read, u->conf->read_timeout);
 
@@ -1575,6 +1720,130 @@ ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u)
     }
 }
 
+
+static ngx_int_t
+ngx_http_upstream_send_request_body(ngx_http_request_t *r,
+    ngx_http_upstream_t *u, ngx_uint_t do_write)
+{
+    int                        tcp_nodelay;
+    ngx_int_t                  rc;
+    ngx_chain_t               *out, *cl, *ln;
+    ngx_connection_t          *c;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream send request body");
+
+    if (!r->request_body_no_buffering) {
+
+        /* buffered request body */
+
+        if (!u->request_sent) {
+            u->request_sent = 1;
+            out = u->request_bufs;
+
+        } else {
+            out = NULL;
+        }
+
+        return ngx_output_chain(&u->output, out);
+    }
+
+    /*
+     * the request body is sent as it is read from the client,
+     * the client connection is read only when the body buffers
+     * already passed to the upstream were sent
+     */
+
+    if (!u->request_sent) {
+        u->request_sent = 1;
+        out = u->request_bufs;
+
+        if (r->request_body->bufs) {
+            for (cl = out; cl->next; cl = cl->next) { /* void */ }
+            cl->next = r->request_body->bufs;
+            r->request_body->bufs = NULL;
+        }
+
+        c = u->peer.connection;
+        clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+        if (clcf->tcp_nodelay && c->tcp_nodelay == NGX_TCP_NODELAY_UNSET) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "tcp_nodelay");
+
+            tcp_nodelay = 1;
+
+            if (setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY,
+                           (const void *) &tcp_nodelay, sizeof(int)) == -1)
+            {
+                ngx_connection_error(c, ngx_socket_errno,
+                                     "setsockopt(TCP_NODELAY) failed");
+                return NGX_ERROR;
+            }
+
+            c->tcp_nodelay = NGX_TCP_NODELAY_SET;
+        }
+
+        r->read_event_handler = ngx_http_upstream_read_request_handler;
+
+    } else {
+        out = NULL;
+    }
+
+    for ( ;; ) {
+
+        if (do_write) {
+            rc = ngx_output_chain(&u->output, out);
+
+            if (rc == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            while (out) {
+                ln = out;
+                out = out->next;
+                ngx_free_chain(r->pool, ln);
+            }
+
+            if (rc == NGX_OK && !r->reading_body) {
+                break;
+            }
+        }
+
+        if (r->reading_body) {
+            /* read client request body */
+
+            rc = ngx_http_read_unbuffered_request_body(r);
+
+            if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+                return rc;
+            }
+
+            out = r->request_body->bufs;
+            r->request_body->bufs = NULL;
+        }
+
+        /* stop if there is nothing to send */
+
+        if (out == NULL) {
+            rc = NGX_AGAIN;
+            break;
+        }
+
+        do_write = 1;
+    }
+
+    if (!r->reading_body) {
+        if (!u->store && !r->post_action && !u->conf->ignore_client_abort) {
+            r->read_event_handler =
+                                  ngx_http_upstream_rd_check_broken_connection;
+        }
+    }
+
+    return rc;
+}
+
+
 /* 因为请求大小是未知的，所以可能要多次调用epoll发送请求，该方法负责反复发送请求 */
 static void
 ngx_http_upstream_send_request_handler(ngx_http_request_t *r,
@@ -1617,7 +1886,29 @@ ngx_http_upstream_send_request_handler(ngx_http_request_t *r,
         return;
     }
 
-    ngx_http_upstream_send_request(r, u);
+    ngx_http_upstream_send_request(r, u, 1);
+}
+
+
+static void
+ngx_http_upstream_read_request_handler(ngx_http_request_t *r)
+{
+    ngx_connection_t     *c;
+    ngx_http_upstream_t  *u;
+
+    c = r->connection;
+    u = r->upstream;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream read request handler");
+
+    if (c->read->timedout) {
+        c->timedout = 1;
+        ngx_http_upstream_finalize_request(r, u, NGX_HTTP_REQUEST_TIME_OUT);
+        return;
+    }
+
+    ngx_http_upstream_send_request(r, u, 0);
 }
 
 
@@ -1627,6 +1918,7 @@ ngx_http_upstream_process_header(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
     ssize_t            n;
     ngx_int_t          rc;
+    ngx_time_t        *tp;
     ngx_connection_t  *c;
 
     c = u->peer.connection;
@@ -1765,6 +2057,11 @@ ngx_http_upstream_process_header(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     /* rc == NGX_OK */
 
+    tp = ngx_timeofday();
+    u->state->header_time = (ngx_msec_t)
+                            ((tp->sec - u->state->response_sec) * 1000
+                             + tp->msec - u->state->response_msec);
+
 		/* 错误处理 NGX_HTTP_SPECIAL_RESPONSE=300 */
     if (u->headers_in.status_n >= NGX_HTTP_SPECIAL_RESPONSE) {
 
@@ -1849,6 +2146,56 @@ ngx_http_upstream_test_next(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     status = u->headers_in.status_n;
 
+#if (NGX_HTTP_CACHE)
+
+    if (status == NGX_HTTP_NOT_MODIFIED
+        && u->cache_status == NGX_HTTP_CACHE_EXPIRED
+        && u->conf->cache_revalidate)
+    {
+        time_t     now, valid;
+        ngx_int_t  rc;
+
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http upstream not modified");
+
+        now = ngx_time();
+        valid = r->cache->valid_sec;
+
+        rc = u->reinit_request(r);
+
+        if (rc != NGX_OK) {
+            ngx_http_upstream_finalize_request(r, u, rc);
+            return NGX_OK;
+        }
+
+        u->cache_status = NGX_HTTP_CACHE_REVALIDATED;
+        rc = ngx_http_upstream_cache_send(r, u);
+
+        if (valid == 0) {
+            valid = r->cache->valid_sec;
+        }
+
+        if (valid == 0) {
+            valid = ngx_http_file_cache_valid(u->conf->cache_valid,
+                                              u->headers_in.status_n);
+            if (valid) {
+                valid = now + valid;
+            }
+        }
+
+        if (valid) {
+            r->cache->valid_sec = valid;
+            r->cache->date = now;
+
+            ngx_http_file_cache_update_header(r);
+        }
+
+        ngx_http_upstream_finalize_request(r, u, rc);
+        return NGX_OK;
+    }
+
+#endif
+
     for (un = ngx_http_upstream_next_errors; un->status; un++) {
 
         if (status != un->status) {
@@ -2255,7 +2602,18 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
     c = r->connection;
 
 		/* 客户端的请求只有包头？ */
-    if (r->header_only) {
+    if (r->background) {
+
+        /* background cache update, the response body goes to cache only */
+
+        if (!u->buffering || !(u->cacheable || u->store)) {
+            ngx_http_upstream_finalize_request(r, u, rc);
+            return;
+        }
+
+        u->pipe->downstream_error = 1;
+
+    } else if (r->header_only) {
 
         if (u->cacheable || u->store) {
 
@@ -2418,6 +2776,13 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
         if (valid) {
             r->cache->last_modified = r->headers_out.last_modified_time;
             r->cache->date = now;
+
+            if (u->headers_in.etag) {
+                r->cache->etag = u->headers_in.etag->value;
+
+            } else {
+                ngx_str_null(&r->cache->etag);
+            }
             r->cache->body_start = (u_short) (u->buffer.pos - u->buffer.start);
 
             ngx_http_file_cache_set_header(r, u->buffer.start);
@@ -2543,6 +2908,42 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
         return;
     }
 
+#if (NGX_HAVE_SPLICE)
+
+    /*
+     * p->splice is set by the input filter if it can pass the data
+     * spliced to a pipe; the data are not touched until they are spliced
+     * to the client, so this is not possible if they should be saved,
+     * any filter needs them in memory, or an SSL client connection
+     * is not encrypted by the kernel
+     */
+
+    if (p->splice) {
+
+        if (!u->conf->splice
+            || p->cacheable
+            || r->main_filter_need_in_memory
+            || r->filter_need_in_memory
+            || r->filter_need_temporary
+            || (ngx_event_flags & NGX_USE_AIO_EVENT)
+#if (NGX_HTTP_SSL)
+            || u->peer.connection->ssl
+            || (r->connection->ssl && !r->connection->ssl->sendfile)
+#endif
+#if (NGX_HTTP_SPDY)
+            || r->spdy_stream
+#endif
+           )
+        {
+            p->splice = 0;
+
+        } else if (ngx_event_pipe_init_splice(p) != NGX_OK) {
+            p->splice = 0;
+        }
+    }
+
+#endif
+
     u->read_event_handler = ngx_http_upstream_process_upstream;
     r->write_event_handler = ngx_http_upstream_process_downstream;
 
@@ -2554,7 +2955,10 @@ static void
 ngx_http_upstream_upgrade(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
     int                        tcp_nodelay;
+    ngx_int_t                  i;
+    ngx_chain_t               *cl, *bl;
     ngx_connection_t          *c;
+    ngx_http_connection_t     *hc;
     ngx_http_core_loc_conf_t  *clcf;
 
     c = r->connection;
@@ -2610,13 +3014,84 @@ ngx_http_upstream_upgrade(ngx_http_request_t *r, ngx_http_upstream_t *u)
         return;
     }
 
-    if (u->peer.connection->read->ready
-        || u->buffer.pos != u->buffer.last)
-    {
-        ngx_http_upstream_process_upgraded(r, 1, 1);
-    }
+    /*
+     * the upgraded connection may last for hours, so free the memory
+     * that is not needed anymore: the unused large header buffers,
+     * the request sent to the upstream but the request body,
+     * and the SSL write buffer
+     */
 
-    if (c->read->ready
+    hc = r->http_connection;
+
+    if (hc->free) {
+        for (i = 0; i < hc->nfree; i++) {
+            ngx_pfree(c->pool, hc->free[i]->start);
+            hc->free[i] = NULL;
+        }
+
+        hc->nfree = 0;
+    }
+
+    if (u->request_body_sent && !r->request_body_no_buffering) {
+
+        for (cl = u->request_bufs; cl; cl = cl->next) {
+
+            if (!cl->buf->temporary || cl->buf->start == NULL) {
+                continue;
+            }
+
+            /* the request body buffers are still used by $request_body */
+
+            if (r->request_body) {
+                for (bl = r->request_body->bufs; bl; bl = bl->next) {
+                    if (bl->buf->start == cl->buf->start) {
+                        break;
+                    }
+                }
+
+                if (bl) {
+                    continue;
+                }
+            }
+
+            ngx_pfree(r->pool, cl->buf->start);
+        }
+
+        u->request_bufs = NULL;
+    }
+
+#if (NGX_HTTP_SSL)
+    if (c->ssl && !c->buffered) {
+        ngx_ssl_free_buffer(c);
+    }
+#endif
+
+#if (NGX_HAVE_SPLICE)
+
+    if (u->conf->splice
+#if (NGX_HTTP_SSL)
+        && c->ssl == NULL
+        && u->peer.connection->ssl == NULL
+#endif
+#if (NGX_HTTP_SPDY)
+        && r->spdy_stream == NULL
+#endif
+       )
+    {
+        if (ngx_http_upstream_init_upgraded_splice(r, u) != NGX_OK) {
+            u->upgraded_splice = NULL;
+        }
+    }
+
+#endif
+
+    if (u->peer.connection->read->ready
+        || u->buffer.pos != u->buffer.last)
+    {
+        ngx_http_upstream_process_upgraded(r, 1, 1);
+    }
+
+    if (c->read->ready
         || r->header_in->pos != r->header_in->last)
     {
         ngx_http_upstream_process_upgraded(r, 0, 1);
@@ -2703,7 +3178,12 @@ ngx_http_upstream_process_upgraded(ngx_http_request_t *r,
             do_write = 1;
         }
 
-        if (b->start == NULL) {
+        if (b->start == NULL
+#if (NGX_HAVE_SPLICE)
+            && u->upgraded_splice == NULL
+#endif
+           )
+        {
             b->start = ngx_palloc(r->pool, u->conf->buffer_size);
             if (b->start == NULL) {
                 ngx_http_upstream_finalize_request(r, u, 0);
@@ -2744,6 +3224,17 @@ ngx_http_upstream_process_upgraded(ngx_http_request_t *r,
             }
         }
 
+#if (NGX_HAVE_SPLICE)
+
+        if (u->upgraded_splice) {
+
+            /* the buffer is only used for the data read with the headers */
+
+            break;
+        }
+
+#endif
+
         size = b->end - b->last;
 
         if (size && src->read->ready) {
@@ -2769,6 +3260,35 @@ ngx_http_upstream_process_upgraded(ngx_http_request_t *r,
         break;
     }
 
+#if (NGX_HAVE_SPLICE)
+
+    /*
+     * the data are spliced directly to the socket, so the data still
+     * buffered by the connection, if any, are sent first
+     */
+
+    if (u->upgraded_splice && b->pos == b->last && !dst->buffered) {
+
+        if (b == &u->buffer && b->start) {
+            ngx_pfree(r->pool, b->start);
+
+            b->start = NULL;
+            b->pos = NULL;
+            b->last = NULL;
+            b->end = NULL;
+        }
+
+        if (ngx_http_upstream_splice_upgraded(src, dst,
+                                              &u->upgraded_splice[from_upstream])
+            != NGX_OK)
+        {
+            ngx_http_upstream_finalize_request(r, u, 0);
+            return;
+        }
+    }
+
+#endif
+
     if ((upstream->read->eof && u->buffer.pos == u->buffer.last)
         || (downstream->read->eof && u->from_client.pos == u->from_client.last)
         || (downstream->read->eof && upstream->read->eof))
@@ -2828,6 +3348,210 @@ ngx_http_upstream_process_upgraded(ngx_http_request_t *r,
 }
 
 
+#if (NGX_HAVE_SPLICE)
+
+static ngx_int_t
+ngx_http_upstream_init_upgraded_splice(ngx_http_request_t *r,
+    ngx_http_upstream_t *u)
+{
+    int                          fd[2], n;
+    size_t                       size;
+    ngx_uint_t                   i;
+    ngx_pool_cleanup_t          *cln;
+    ngx_http_upstream_splice_t  *sp;
+
+    sp = ngx_pcalloc(r->pool, 2 * sizeof(ngx_http_upstream_splice_t));
+    if (sp == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    sp[0].fd[0] = -1;
+    sp[0].fd[1] = -1;
+    sp[1].fd[0] = -1;
+    sp[1].fd[1] = -1;
+
+    cln->handler = ngx_http_upstream_upgraded_splice_cleanup;
+    cln->data = sp;
+
+    for (i = 0; i < 2; i++) {
+
+        if (pipe(fd) == -1) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, ngx_errno,
+                          "pipe() failed");
+            return NGX_ERROR;
+        }
+
+        sp[i].fd[0] = fd[0];
+        sp[i].fd[1] = fd[1];
+
+        if (ngx_nonblocking(fd[0]) == -1 || ngx_nonblocking(fd[1]) == -1) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, ngx_errno,
+                          ngx_nonblocking_n " failed");
+            return NGX_ERROR;
+        }
+
+        /*
+         * an upgraded connection is mostly idle, so the pipe is shrunk
+         * to the buffer size to save the kernel memory
+         */
+
+        size = u->conf->buffer_size;
+
+#if defined F_SETPIPE_SZ && defined F_GETPIPE_SZ
+
+        if (fcntl(fd[1], F_SETPIPE_SZ, size) == -1) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, ngx_errno,
+                           "fcntl(F_SETPIPE_SZ, %uz) failed", size);
+        }
+
+        n = fcntl(fd[1], F_GETPIPE_SZ);
+
+        if (n > 0 && (size_t) n < size) {
+            size = n;
+        }
+
+#else
+
+        if (size > 65536) {
+            size = 65536;
+        }
+
+#endif
+
+        sp[i].size = size;
+    }
+
+    u->upgraded_splice = sp;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream upgraded splice: %uz %uz",
+                   sp[0].size, sp[1].size);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_splice_upgraded(ngx_connection_t *src, ngx_connection_t *dst,
+    ngx_http_upstream_splice_t *sp)
+{
+    ssize_t    n;
+    ngx_err_t  err;
+
+    for ( ;; ) {
+
+        if (sp->busy && dst->write->ready) {
+
+            n = splice(sp->fd[0], NULL, dst->fd, NULL, sp->busy,
+                       SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, dst->log, 0,
+                           "splice to %d: %z", dst->fd, n);
+
+            if (n == -1) {
+                err = ngx_errno;
+
+                if (err == NGX_EAGAIN) {
+                    dst->write->ready = 0;
+
+                } else if (err != NGX_EINTR) {
+                    dst->write->error = 1;
+                    ngx_connection_error(dst, err, "splice() failed");
+                    return NGX_ERROR;
+                }
+
+            } else {
+                sp->busy -= n;
+                dst->sent += n;
+            }
+
+            continue;
+        }
+
+        if (sp->busy < sp->size && src->read->ready) {
+
+            n = splice(src->fd, NULL, sp->fd[1], NULL, sp->size - sp->busy,
+                       SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, src->log, 0,
+                           "splice from %d: %z", src->fd, n);
+
+            if (n > 0) {
+                sp->busy += n;
+                continue;
+            }
+
+            if (n == 0) {
+
+                /* the eof is reported when the pipe is drained */
+
+                if (sp->busy == 0) {
+                    src->read->ready = 0;
+                    src->read->eof = 1;
+                }
+
+                break;
+            }
+
+            err = ngx_errno;
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            if (err == NGX_EAGAIN) {
+
+                /* the pipe may be full even if sp->busy < sp->size */
+
+                if (sp->busy == 0) {
+                    src->read->ready = 0;
+                }
+
+                break;
+            }
+
+            src->read->ready = 0;
+            src->read->eof = 1;
+            src->read->error = 1;
+
+            ngx_connection_error(src, err, "splice() failed");
+        }
+
+        break;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_upgraded_splice_cleanup(void *data)
+{
+    ngx_http_upstream_splice_t  *sp = data;
+
+    ngx_uint_t  i;
+
+    for (i = 0; i < 4; i++) {
+
+        if (sp[i / 2].fd[i % 2] == -1) {
+            continue;
+        }
+
+        if (close(sp[i / 2].fd[i % 2]) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                          "close() pipe failed");
+        }
+    }
+}
+
+#endif
+
+
 static void
 ngx_http_upstream_process_non_buffered_downstream(ngx_http_request_t *r)
 {
@@ -3396,7 +4120,10 @@ ngx_http_upstream_next(ngx_http_request_t *r, ngx_http_upstream_t *u,
     if (status) {
         u->state->status = status;
 
-        if (u->peer.tries == 0 || !(u->conf->next_upstream & ft_type)) {
+        if (u->peer.tries == 0
+            || !(u->conf->next_upstream & ft_type)
+            || (u->request_sent && r->request_body_no_buffering))
+        {
 
 #if (NGX_HTTP_CACHE)
 
@@ -4592,6 +5319,88 @@ ngx_http_upstream_cache_status(ngx_http_request_t *r,
     return NGX_OK;
 }
 
+
+static ngx_int_t
+ngx_http_upstream_cache_last_modified(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char  *p;
+
+    if (r->upstream == NULL
+        || !r->upstream->conf->cache_revalidate
+        || r->upstream->cache_status != NGX_HTTP_CACHE_EXPIRED
+        || r->cache->last_modified == -1)
+    {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(r->pool, sizeof("Mon, 28 Sep 1970 06:00:00 GMT") - 1);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_http_time(p, r->cache->last_modified) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_cache_etag(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    if (r->upstream == NULL
+        || !r->upstream->conf->cache_revalidate
+        || r->upstream->cache_status != NGX_HTTP_CACHE_EXPIRED
+        || r->cache->etag.len == 0)
+    {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->len = r->cache->etag.len;
+    v->data = r->cache->etag.data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_cache_counter(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char        *p;
+    ngx_atomic_t  *counter;
+
+    if (r->cache == NULL || r->cache->file_cache == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(r->pool, NGX_ATOMIC_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    counter = (ngx_atomic_t *) ((char *) r->cache->file_cache->sh + data);
+
+    v->len = ngx_sprintf(p, "%uA", *counter) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
 #endif
 
 
@@ -4733,20 +5542,6 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     value = cf->args->elts;
 
-    ngx_memzero(&u, sizeof(ngx_url_t));
-
-    u.url = value[1];
-    u.default_port = 80;
-
-    if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
-        if (u.err) {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                               "%s in upstream \"%V\"", u.err, &u.url);
-        }
-
-        return NGX_CONF_ERROR;
-    }
-
     weight = 1;
     max_fails = 1;
     fail_timeout = 10;
@@ -4823,11 +5618,82 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (ngx_strcmp(value[i].data, "resolve") == 0) {
+            us->resolve = 1;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "service=", 8) == 0) {
+
+            us->service.len = value[i].len - 8;
+            us->service.data = &value[i].data[8];
+
+            if (us->service.len == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+#endif
+
         goto invalid;
     }
 
-    us->addrs = u.addrs;
-    us->naddrs = u.naddrs;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (us->service.len && !us->resolve) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "service upstream \"%V\" requires "
+                           "\"resolve\" parameter", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+#endif
+
+    ngx_memzero(&u, sizeof(ngx_url_t));
+
+    u.url = value[1];
+    u.default_port = 80;
+    u.no_resolve = us->resolve;
+
+    if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
+        if (u.err) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "%s in upstream \"%V\"", u.err, &u.url);
+        }
+
+        return NGX_CONF_ERROR;
+    }
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (us->resolve) {
+
+        if (u.naddrs) {
+
+            if (us->service.len) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "service upstream \"%V\" may not have "
+                                   "an address", &u.url);
+                return NGX_CONF_ERROR;
+            }
+
+            /* an address or a unix socket, nothing to resolve */
+            us->resolve = 0;
+
+        } else if (ngx_http_upstream_server_resolve(cf, us, &u) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    if (!us->resolve)
+#endif
+    {
+        us->addrs = u.addrs;
+        us->naddrs = u.naddrs;
+    }
+
+    us->name = u.url;
+    us->host = u.host;
+    us->port = u.port;
     us->weight = weight;
     us->max_fails = max_fails;
     us->fail_timeout = fail_timeout;
@@ -4843,6 +5709,115 @@ invalid:
 }
 
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+static ngx_int_t
+ngx_http_upstream_server_resolve(ngx_conf_t *cf, ngx_http_upstream_server_t *us,
+    ngx_url_t *u)
+{
+    u_char      *p;
+    ngx_url_t    url;
+    ngx_uint_t   i, n;
+    ngx_addr_t  *addr;
+
+    /*
+     * a fixed number of addresses is reserved for the name, the ones
+     * not known yet have no sockaddr and are marked down; the name
+     * is resolved here once, so the servers are usable right away
+     */
+
+    addr = ngx_pcalloc(cf->pool,
+                       NGX_HTTP_UPSTREAM_MAX_RESOLVED * sizeof(ngx_addr_t));
+    if (addr == NULL) {
+        return NGX_ERROR;
+    }
+
+    n = 0;
+
+    if (us->service.len) {
+
+        if (!u->no_port) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "service upstream \"%V\" may not have port",
+                               &u->url);
+            return NGX_ERROR;
+        }
+
+        /*
+         * the SRV records are only looked up at run time,
+         * "service=http" stands for the "_http._tcp.host" name,
+         * a service starting with an underscore is used as is
+         */
+
+        p = ngx_pnalloc(cf->pool, us->service.len + u->host.len
+                                  + sizeof("_._tcp."));
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (us->service.data[0] == '_') {
+            us->service.len = ngx_sprintf(p, "%V.%V", &us->service, &u->host)
+                              - p;
+
+        } else {
+            us->service.len = ngx_sprintf(p, "_%V._tcp.%V", &us->service,
+                                          &u->host)
+                              - p;
+        }
+
+        us->service.data = p;
+
+        goto done;
+    }
+
+    ngx_memzero(&url, sizeof(ngx_url_t));
+
+    url.host = u->host;
+    url.port = u->port;
+
+    if (ngx_inet_resolve_host(cf->pool, &url) == NGX_OK) {
+
+        for (i = 0; i < url.naddrs; i++) {
+
+            switch (url.addrs[i].sockaddr->sa_family) {
+#if (NGX_HAVE_INET6)
+            case AF_INET6:
+#endif
+            case AF_INET:
+                break;
+
+            default:
+                continue;
+            }
+
+            addr[n++] = url.addrs[i];
+
+            if (n == NGX_HTTP_UPSTREAM_MAX_RESOLVED) {
+                break;
+            }
+        }
+
+    } else {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "host \"%V\" in upstream is not resolved yet",
+                           &u->host);
+    }
+
+done:
+
+    for (i = n; i < NGX_HTTP_UPSTREAM_MAX_RESOLVED; i++) {
+        addr[i].name = u->url;
+    }
+
+    us->addrs = addr;
+    us->naddrs = NGX_HTTP_UPSTREAM_MAX_RESOLVED;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 ngx_http_upstream_srv_conf_t *
 ngx_http_upstream_add(ngx_conf_t *cf, ngx_url_t *u, ngx_uint_t flags)
 {
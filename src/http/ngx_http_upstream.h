@@ -60,6 +60,7 @@ typedef struct {
     time_t                           response_sec;
     ngx_uint_t                       response_msec;
     off_t                            response_length;
+    ngx_msec_t                       header_time;
 
     ngx_str_t                       *peer;
 } ngx_http_upstream_state_t;
@@ -93,8 +94,14 @@ typedef struct {
     ngx_uint_t                       max_fails;
     time_t                           fail_timeout;
 
+    ngx_str_t                        name;
+    ngx_str_t                        host;
+    in_port_t                        port;
+    ngx_str_t                        service;
+
     unsigned                         down:1;
     unsigned                         backup:1;
+    unsigned                         resolve:1;
 } ngx_http_upstream_server_t;
 
 
@@ -105,6 +112,9 @@ typedef struct {
 #define NGX_HTTP_UPSTREAM_DOWN          0x0010
 #define NGX_HTTP_UPSTREAM_BACKUP        0x0020
 
+/* addresses kept for a server name which is resolved at run time */
+#define NGX_HTTP_UPSTREAM_MAX_RESOLVED  16
+
 
 struct ngx_http_upstream_srv_conf_s {
     ngx_http_upstream_peer_t         peer;
@@ -119,6 +129,10 @@ struct ngx_http_upstream_srv_conf_s {
     in_port_t                        port;
     in_port_t                        default_port;
     ngx_uint_t                       no_port;  /* unsigned no_port:1 */
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_shm_zone_t                  *shm_zone;
+#endif
 };
 
 
@@ -135,7 +149,7 @@ typedef struct {
     ngx_http_upstream_srv_conf_t    *upstream;
 
 		/* 与上游服务器的连接，发送，接收超时时间 */
-    ngx_msec_t                       connect_timeout
+    ngx_msec_t                       connect_timeout;
     ngx_msec_t                       send_timeout;
     ngx_msec_t                       read_timeout;
 		/* 现在没有用到 */
@@ -172,6 +186,8 @@ typedef struct {
     ngx_uint_t                       store_access;
 		/* 决定转发响应方式的标志位 */
     ngx_flag_t                       buffering;
+    ngx_flag_t                       request_buffering;
+    ngx_flag_t                       splice;
 		/* 这俩参数目前无意义 */
     ngx_flag_t                       pass_request_headers;
     ngx_flag_t                       pass_request_body;
@@ -210,6 +226,9 @@ typedef struct {
     ngx_flag_t                       cache_lock;
     ngx_msec_t                       cache_lock_timeout;
 
+    ngx_flag_t                       cache_revalidate;
+    ngx_flag_t                       cache_background_update;
+
     ngx_array_t                     *cache_valid;
     ngx_array_t                     *cache_bypass;
     ngx_array_t                     *no_cache;
@@ -296,7 +315,7 @@ typedef struct {
 
 		/* 地址个数 */
     ngx_uint_t                       naddrs;
-    in_addr_t                       *addrs;
+    ngx_addr_t                      *addrs;
 
 		/* 设置上游服务器地址 */
     struct sockaddr                 *sockaddr;
@@ -306,6 +325,17 @@ typedef struct {
 } ngx_http_upstream_resolved_t;
 
 
+#if (NGX_HAVE_SPLICE)
+
+typedef struct {
+    ngx_fd_t                         fd[2];
+    size_t                           size;
+    size_t                           busy;
+} ngx_http_upstream_splice_t;
+
+#endif
+
+
 typedef void (*ngx_http_upstream_handler_pt)(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 
@@ -343,6 +373,10 @@ struct ngx_http_upstream_s {
 
     ngx_buf_t                        from_client;
 
+#if (NGX_HAVE_SPLICE)
+    ngx_http_upstream_splice_t      *upgraded_splice;
+#endif
+
 		/* buffer存储接收自上游服务器发送来的响应，由于它会被复用，所以有以下多种含义：
 		 * 1）在process_header解析上游响应包头时，buffer保存完整的响应包头，
 		 * 2）当下面的buffering为1时，且此时upstream是向下游转发上游的包体时，buffer
@@ -434,6 +468,7 @@ struct ngx_http_upstream_s {
 		 * request_bufs链表，为防止重复发送请求，必须有这样一个标志为记录是否调用啦该方法
 		 */
     unsigned                         request_sent:1;
+    unsigned                         request_body_sent:1;
 		/* 直接把响应转发给客户端时，表示包体是否发送，如果不转发响应到客户端则无意义 */
     unsigned                         header_sent:1;
 };
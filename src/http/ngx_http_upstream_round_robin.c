@@ -28,7 +28,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
     ngx_http_upstream_srv_conf_t *us)
 {
     ngx_url_t                      u;
-    ngx_uint_t                     i, j, n, w;
+    ngx_uint_t                     i, j, n, r, w;
     ngx_http_upstream_server_t    *server;
     ngx_http_upstream_rr_peers_t  *peers, *backup;
 
@@ -39,6 +39,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 
         n = 0;
         w = 0;
+        r = 0;
 
         for (i = 0; i < us->servers->nelts; i++) {
             if (server[i].backup) {
@@ -46,7 +47,20 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
             }
 
             n += server[i].naddrs;
-            w += server[i].naddrs * server[i].weight;
+
+            /*
+             * the addresses reserved for a name resolved at run time
+             * have no weight until they are known
+             */
+
+            for (j = 0; j < server[i].naddrs; j++) {
+                if (server[i].addrs[j].sockaddr) {
+                    w += server[i].weight;
+
+                } else {
+                    r++;
+                }
+            }
         }
 
         if (n == 0) {
@@ -64,7 +78,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 
         peers->single = (n == 1);
         peers->number = n;
-        peers->weighted = (w != n);
+        peers->weighted = (w != n || r);
         peers->total_weight = w;
         peers->name = &us->host;
 
@@ -81,10 +95,15 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                 peers->peer[n].name = server[i].addrs[j].name;
                 peers->peer[n].max_fails = server[i].max_fails;
                 peers->peer[n].fail_timeout = server[i].fail_timeout;
-                peers->peer[n].down = server[i].down;
-                peers->peer[n].weight = server[i].weight;
-                peers->peer[n].effective_weight = server[i].weight;
+                peers->peer[n].down = server[i].down
+                                     || server[i].addrs[j].sockaddr == NULL;
+                peers->peer[n].weight = server[i].addrs[j].sockaddr
+                                        ? server[i].weight : 0;
+                peers->peer[n].effective_weight = peers->peer[n].weight;
                 peers->peer[n].current_weight = 0;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+                peers->peer[n].server = server[i].resolve ? &server[i] : NULL;
+#endif
                 n++;
             }
         }
@@ -95,6 +114,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 
         n = 0;
         w = 0;
+        r = 0;
 
         for (i = 0; i < us->servers->nelts; i++) {
             if (!server[i].backup) {
@@ -102,7 +122,15 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
             }
 
             n += server[i].naddrs;
-            w += server[i].naddrs * server[i].weight;
+
+            for (j = 0; j < server[i].naddrs; j++) {
+                if (server[i].addrs[j].sockaddr) {
+                    w += server[i].weight;
+
+                } else {
+                    r++;
+                }
+            }
         }
 
         if (n == 0) {
@@ -118,7 +146,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
         peers->single = 0;
         backup->single = 0;
         backup->number = n;
-        backup->weighted = (w != n);
+        backup->weighted = (w != n || r);
         backup->total_weight = w;
         backup->name = &us->host;
 
@@ -133,12 +161,17 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                 backup->peer[n].sockaddr = server[i].addrs[j].sockaddr;
                 backup->peer[n].socklen = server[i].addrs[j].socklen;
                 backup->peer[n].name = server[i].addrs[j].name;
-                backup->peer[n].weight = server[i].weight;
-                backup->peer[n].effective_weight = server[i].weight;
+                backup->peer[n].weight = server[i].addrs[j].sockaddr
+                                         ? server[i].weight : 0;
+                backup->peer[n].effective_weight = backup->peer[n].weight;
                 backup->peer[n].current_weight = 0;
                 backup->peer[n].max_fails = server[i].max_fails;
                 backup->peer[n].fail_timeout = server[i].fail_timeout;
-                backup->peer[n].down = server[i].down;
+                backup->peer[n].down = server[i].down
+                                     || server[i].addrs[j].sockaddr == NULL;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+                backup->peer[n].server = server[i].resolve ? &server[i] : NULL;
+#endif
                 n++;
             }
         }
@@ -227,6 +260,10 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
     rrp->peers = us->peer.data;
     rrp->current = 0;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    rrp->pool = rrp->peers->shpool ? r->pool : NULL;
+#endif
+
     n = rrp->peers->number;
 
     if (rrp->peers->next && rrp->peers->next->number > n) {
@@ -266,8 +303,9 @@ ngx_http_upstream_create_round_robin_peer(ngx_http_request_t *r,
 {
     u_char                            *p;
     size_t                             len;
+    socklen_t                          socklen;
     ngx_uint_t                         i, n;
-    struct sockaddr_in                *sin;
+    struct sockaddr                   *sockaddr;
     ngx_http_upstream_rr_peers_t      *peers;
     ngx_http_upstream_rr_peer_data_t  *rrp;
 
@@ -306,27 +344,35 @@ ngx_http_upstream_create_round_robin_peer(ngx_http_request_t *r,
 
         for (i = 0; i < ur->naddrs; i++) {
 
-            len = NGX_INET_ADDRSTRLEN + sizeof(":65536") - 1;
+            socklen = ur->addrs[i].socklen;
 
-            p = ngx_pnalloc(r->pool, len);
-            if (p == NULL) {
+            sockaddr = ngx_palloc(r->pool, socklen);
+            if (sockaddr == NULL) {
                 return NGX_ERROR;
             }
 
-            len = ngx_inet_ntop(AF_INET, &ur->addrs[i], p, NGX_INET_ADDRSTRLEN);
-            len = ngx_sprintf(&p[len], ":%d", ur->port) - p;
+            ngx_memcpy(sockaddr, ur->addrs[i].sockaddr, socklen);
+
+            switch (sockaddr->sa_family) {
+#if (NGX_HAVE_INET6)
+            case AF_INET6:
+                ((struct sockaddr_in6 *) sockaddr)->sin6_port
+                                                         = htons(ur->port);
+                break;
+#endif
+            default: /* AF_INET */
+                ((struct sockaddr_in *) sockaddr)->sin_port = htons(ur->port);
+            }
 
-            sin = ngx_pcalloc(r->pool, sizeof(struct sockaddr_in));
-            if (sin == NULL) {
+            p = ngx_pnalloc(r->pool, NGX_SOCKADDR_STRLEN);
+            if (p == NULL) {
                 return NGX_ERROR;
             }
 
-            sin->sin_family = AF_INET;
-            sin->sin_port = htons(ur->port);
-            sin->sin_addr.s_addr = ur->addrs[i];
+            len = ngx_sock_ntop(sockaddr, p, NGX_SOCKADDR_STRLEN, 1);
 
-            peers->peer[i].sockaddr = (struct sockaddr *) sin;
-            peers->peer[i].socklen = sizeof(struct sockaddr_in);
+            peers->peer[i].sockaddr = sockaddr;
+            peers->peer[i].socklen = socklen;
             peers->peer[i].name.len = len;
             peers->peer[i].name.data = p;
             peers->peer[i].weight = 1;
@@ -339,6 +385,9 @@ ngx_http_upstream_create_round_robin_peer(ngx_http_request_t *r,
 
     rrp->peers = peers;
     rrp->current = 0;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    rrp->pool = NULL;
+#endif
 
     if (rrp->peers->number <= 8 * sizeof(uintptr_t)) {
         rrp->tried = &rrp->data;
@@ -379,15 +428,17 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get rr peer, try: %ui", pc->tries);
 
-    /* ngx_lock_mutex(rrp->peers->mutex); */
-
     pc->cached = 0;
     pc->connection = NULL;
 
-    if (rrp->peers->single) {
-        peer = &rrp->peers->peer[0];
+    peers = rrp->peers;
 
-        if (peer->down) {
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    if (peers->single) {
+        peer = &peers->peer[0];
+
+        if (peer->down || peer->unhealthy) {
             goto failed;
         }
 
@@ -406,25 +457,26 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
                        rrp->current, peer->current_weight);
     }
 
-    pc->sockaddr = peer->sockaddr;
-    pc->socklen = peer->socklen;
-    pc->name = &peer->name;
+    if (ngx_http_upstream_rr_peer_address(pc, rrp, peer) != NGX_OK) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return NGX_ERROR;
+    }
 
-    /* ngx_unlock_mutex(rrp->peers->mutex); */
+    peer->conns++;
+
+    ngx_http_upstream_rr_peers_unlock(peers);
 
-    if (pc->tries == 1 && rrp->peers->next) {
-        pc->tries += rrp->peers->next->number;
+    if (pc->tries == 1 && peers->next) {
+        pc->tries += peers->next->number;
     }
 
     return NGX_OK;
 
 failed:
 
-    peers = rrp->peers;
-
     if (peers->next) {
 
-        /* ngx_unlock_mutex(peers->mutex); */
+        ngx_http_upstream_rr_peers_unlock(peers);
 
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0, "backup servers");
 
@@ -444,7 +496,7 @@ failed:
             return rc;
         }
 
-        /* ngx_lock_mutex(peers->mutex); */
+        ngx_http_upstream_rr_peers_wlock(peers);
     }
 
     /* all peers failed, mark them as live for quick recovery */
@@ -453,7 +505,7 @@ failed:
         peers->peer[i].fails = 0;
     }
 
-    /* ngx_unlock_mutex(peers->mutex); */
+    ngx_http_upstream_rr_peers_unlock(peers);
 
     pc->name = peers->name;
 
@@ -461,6 +513,59 @@ failed:
 }
 
 
+ngx_int_t
+ngx_http_upstream_rr_peer_address(ngx_peer_connection_t *pc,
+    ngx_http_upstream_rr_peer_data_t *rrp, ngx_http_upstream_rr_peer_t *peer)
+{
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    ngx_http_upstream_rr_peer_addr_t  *addr;
+
+    /*
+     * the address of a peer resolved at run time is freed by the worker
+     * process which changes it, while the connection and $upstream_addr
+     * of each try still need it, so a copy is made for every try
+     */
+
+    if (rrp->pool && peer->server) {
+        addr = ngx_palloc(rrp->pool, sizeof(ngx_http_upstream_rr_peer_addr_t));
+        if (addr == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_http_upstream_rr_peer_copy_address(addr, peer);
+
+        pc->sockaddr = &addr->u.sockaddr;
+        pc->socklen = peer->socklen;
+        pc->name = &addr->name;
+
+        return NGX_OK;
+    }
+
+#endif
+
+    pc->sockaddr = peer->sockaddr;
+    pc->socklen = peer->socklen;
+    pc->name = &peer->name;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_upstream_rr_peer_copy_address(ngx_http_upstream_rr_peer_addr_t *addr,
+    ngx_http_upstream_rr_peer_t *peer)
+{
+    /* called with the peers locked */
+
+    ngx_memcpy(&addr->u, peer->sockaddr, peer->socklen);
+
+    addr->name.len = ngx_min(peer->name.len, NGX_SOCKADDR_STRLEN);
+    addr->name.data = addr->text;
+    ngx_memcpy(addr->text, peer->name.data, addr->name.len);
+}
+
+
 static ngx_http_upstream_rr_peer_t *
 ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
 {
@@ -486,7 +591,7 @@ ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
 
         peer = &rrp->peers->peer[i];
 
-        if (peer->down) {
+        if (peer->down || peer->unhealthy) {
             continue;
         }
 
@@ -538,26 +643,34 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 {
     ngx_http_upstream_rr_peer_data_t  *rrp = data;
 
-    time_t                       now;
-    ngx_http_upstream_rr_peer_t  *peer;
+    time_t                         now;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *peers;
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "free rr peer %ui %ui", pc->tries, state);
 
     /* TODO: NGX_PEER_KEEPALIVE */
 
-    if (rrp->peers->single) {
+    peers = rrp->peers;
+    peer = &peers->peer[rrp->current];
+
+    ngx_http_upstream_rr_peers_rlock(peers);
+    ngx_http_upstream_rr_peer_lock(peers, peer);
+
+    peer->conns--;
+
+    if (peers->single) {
+        ngx_http_upstream_rr_peer_unlock(peers, peer);
+        ngx_http_upstream_rr_peers_unlock(peers);
+
         pc->tries = 0;
         return;
     }
 
-    peer = &rrp->peers->peer[rrp->current];
-
     if (state & NGX_PEER_FAILED) {
         now = ngx_time();
 
-        /* ngx_lock_mutex(rrp->peers->mutex); */
-
         peer->fails++;
         peer->accessed = now;
         peer->checked = now;
@@ -574,8 +687,6 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
             peer->effective_weight = 0;
         }
 
-        /* ngx_unlock_mutex(rrp->peers->mutex); */
-
     } else {
 
         /* mark peer live if check passed */
@@ -585,11 +696,12 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
         }
     }
 
+    ngx_http_upstream_rr_peer_unlock(peers, peer);
+    ngx_http_upstream_rr_peers_unlock(peers);
+
     if (pc->tries) {
         pc->tries--;
     }
-
-    /* ngx_unlock_mutex(rrp->peers->mutex); */
 }
 
 
@@ -605,6 +717,13 @@ ngx_http_upstream_set_round_robin_peer_session(ngx_peer_connection_t *pc,
     ngx_ssl_session_t            *ssl_session;
     ngx_http_upstream_rr_peer_t  *peer;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (rrp->peers->shpool) {
+        /* sessions are local to a process and cannot be shared */
+        return NGX_OK;
+    }
+#endif
+
     peer = &rrp->peers->peer[rrp->current];
 
     /* TODO: threads only mutex */
@@ -614,9 +733,8 @@ ngx_http_upstream_set_round_robin_peer_session(ngx_peer_connection_t *pc,
 
     rc = ngx_ssl_set_session(pc->connection, ssl_session);
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
-                   "set session: %p:%d",
-                   ssl_session, ssl_session ? ssl_session->references : 0);
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "set session: %p", ssl_session);
 
     /* ngx_unlock_mutex(rrp->peers->mutex); */
 
@@ -633,14 +751,20 @@ ngx_http_upstream_save_round_robin_peer_session(ngx_peer_connection_t *pc,
     ngx_ssl_session_t            *old_ssl_session, *ssl_session;
     ngx_http_upstream_rr_peer_t  *peer;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (rrp->peers->shpool) {
+        return;
+    }
+#endif
+
     ssl_session = ngx_ssl_get_session(pc->connection);
 
     if (ssl_session == NULL) {
         return;
     }
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
-                   "save session: %p:%d", ssl_session, ssl_session->references);
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "save session: %p", ssl_session);
 
     peer = &rrp->peers->peer[rrp->current];
 
@@ -654,9 +778,8 @@ ngx_http_upstream_save_round_robin_peer_session(ngx_peer_connection_t *pc,
 
     if (old_ssl_session) {
 
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
-                       "old session: %p:%d",
-                       old_ssl_session, old_ssl_session->references);
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "old session: %p", old_ssl_session);
 
         /* TODO: may block */
 
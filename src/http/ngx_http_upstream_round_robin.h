@@ -14,6 +14,28 @@
 #include <ngx_http.h>
 
 
+/*
+ * a private copy of the address and the name of a peer: those of a peer
+ * resolved at run time are freed once the peer gets another address
+ */
+
+typedef struct {
+    union {
+        struct sockaddr             sockaddr;
+        struct sockaddr_in          sockaddr_in;
+#if (NGX_HAVE_INET6)
+        struct sockaddr_in6         sockaddr_in6;
+#endif
+#if (NGX_HAVE_UNIX_DOMAIN)
+        struct sockaddr_un          sockaddr_un;
+#endif
+    } u;
+
+    ngx_str_t                       name;
+    u_char                          text[NGX_SOCKADDR_STRLEN];
+} ngx_http_upstream_rr_peer_addr_t;
+
+
 typedef struct {
     struct sockaddr                *sockaddr;
     socklen_t                       socklen;
@@ -23,6 +45,11 @@ typedef struct {
     ngx_int_t                       effective_weight;
     ngx_int_t                       weight;
 
+    ngx_uint_t                      conns;
+
+    /* moving average of response time, in 1/8 of milliseconds */
+    ngx_msec_t                      response_time;
+
     ngx_uint_t                      fails;
     time_t                          accessed;
     time_t                          checked;
@@ -31,10 +58,24 @@ typedef struct {
     time_t                          fail_timeout;
 
     ngx_uint_t                      down;          /* unsigned  down:1; */
+    ngx_uint_t                      unhealthy;     /* unsigned  unhealthy:1; */
 
 #if (NGX_HTTP_SSL)
     ngx_ssl_session_t              *ssl_session;   /* local to a process */
 #endif
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_atomic_t                    lock;
+
+    ngx_atomic_t                    check_next;
+    ngx_uint_t                      check_fails;
+    ngx_uint_t                      check_passes;
+
+    /* the server whose name is resolved at run time */
+    ngx_http_upstream_server_t     *server;
+    ngx_atomic_t                    resolve_next;
+    void                           *retired;
+#endif
 } ngx_http_upstream_rr_peer_t;
 
 
@@ -43,7 +84,11 @@ typedef struct ngx_http_upstream_rr_peers_s  ngx_http_upstream_rr_peers_t;
 struct ngx_http_upstream_rr_peers_s {
     ngx_uint_t                      number;
 
- /* ngx_mutex_t                    *mutex; */
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_slab_pool_t                *shpool;
+    ngx_atomic_t                    rwlock;
+    ngx_http_upstream_rr_peers_t   *zone_next;
+#endif
 
     ngx_uint_t                      total_weight;
 
@@ -58,11 +103,58 @@ struct ngx_http_upstream_rr_peers_s {
 };
 
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+#define ngx_http_upstream_rr_peers_rlock(peers)                               \
+                                                                              \
+    if (peers->shpool) {                                                      \
+        ngx_rwlock_rlock(&peers->rwlock);                                     \
+    }
+
+#define ngx_http_upstream_rr_peers_wlock(peers)                               \
+                                                                              \
+    if (peers->shpool) {                                                      \
+        ngx_rwlock_wlock(&peers->rwlock);                                     \
+    }
+
+#define ngx_http_upstream_rr_peers_unlock(peers)                              \
+                                                                              \
+    if (peers->shpool) {                                                      \
+        ngx_rwlock_unlock(&peers->rwlock);                                    \
+    }
+
+
+#define ngx_http_upstream_rr_peer_lock(peers, peer)                           \
+                                                                              \
+    if (peers->shpool) {                                                      \
+        ngx_rwlock_wlock(&peer->lock);                                        \
+    }
+
+#define ngx_http_upstream_rr_peer_unlock(peers, peer)                         \
+                                                                              \
+    if (peers->shpool) {                                                      \
+        ngx_rwlock_unlock(&peer->lock);                                       \
+    }
+
+#else
+
+#define ngx_http_upstream_rr_peers_rlock(peers)
+#define ngx_http_upstream_rr_peers_wlock(peers)
+#define ngx_http_upstream_rr_peers_unlock(peers)
+#define ngx_http_upstream_rr_peer_lock(peers, peer)
+#define ngx_http_upstream_rr_peer_unlock(peers, peer)
+
+#endif
+
+
 typedef struct {
     ngx_http_upstream_rr_peers_t   *peers;
     ngx_uint_t                      current;
     uintptr_t                      *tried;
     uintptr_t                       data;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_pool_t                     *pool;
+#endif
 } ngx_http_upstream_rr_peer_data_t;
 
 
@@ -76,6 +168,10 @@ ngx_int_t ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc,
     void *data);
 void ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t state);
+ngx_int_t ngx_http_upstream_rr_peer_address(ngx_peer_connection_t *pc,
+    ngx_http_upstream_rr_peer_data_t *rrp, ngx_http_upstream_rr_peer_t *peer);
+void ngx_http_upstream_rr_peer_copy_address(
+    ngx_http_upstream_rr_peer_addr_t *addr, ngx_http_upstream_rr_peer_t *peer);
 
 #if (NGX_HTTP_SSL)
 ngx_int_t
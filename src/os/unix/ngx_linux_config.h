@@ -69,6 +69,12 @@
 #endif
 
 
+#if (NGX_HAVE_FUTEX)
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+
 #if (NGX_HAVE_SENDFILE64)
 #include <sys/sendfile.h>
 #else
@@ -87,6 +93,12 @@ extern ssize_t sendfile(int s, int fd, int32_t *offset, size_t size);
 #endif
 
 
+#if (NGX_HAVE_IO_URING)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+
 #if (NGX_HAVE_FILE_AIO)
 #include <sys/syscall.h>
 #include <linux/aio_abi.h>
@@ -228,7 +228,7 @@ ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
                     aligned = (cl->buf->file_pos + size + ngx_pagesize - 1)
                                & ~((off_t) ngx_pagesize - 1);
 
-                    if (aligned <= cl->buf->file_last) {
+                    if (aligned <= cl->buf->file_last && !file->file->pipe) {
                         size = aligned - cl->buf->file_pos;
                     }
                 }
@@ -245,6 +245,51 @@ ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
                      && fprev == cl->buf->file_pos);
         }
 
+#if (NGX_HAVE_SPLICE)
+
+        if (file && file->file->pipe) {
+
+            /* the file buf is the data spliced to a pipe from a socket */
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "splice: @%O %uz", file->file_pos, file_size);
+
+            rc = splice(file->file->fd, NULL, c->fd, NULL, file_size,
+                        SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+            if (rc == -1) {
+                err = ngx_errno;
+
+                switch (err) {
+                case NGX_EAGAIN:
+                    break;
+
+                case NGX_EINTR:
+                    eintr = 1;
+                    break;
+
+                default:
+                    wev->error = 1;
+                    ngx_connection_error(c, err, "splice() failed");
+                    return NGX_CHAIN_ERROR;
+                }
+
+                ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                               "splice() is not ready");
+            }
+
+            sent = rc > 0 ? rc : 0;
+
+            file->file->offset += sent;
+
+            ngx_log_debug4(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "splice: %d, @%O %O:%uz",
+                           rc, file->file_pos, sent, file_size);
+
+        } else
+
+#endif
+
         if (file) {
 #if 1
             if (file_size == 0) {
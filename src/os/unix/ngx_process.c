@@ -593,6 +593,14 @@ ngx_unlock_mutexes(ngx_pid_t pid)
                           "shared memory zone \"%V\" was locked by %P",
                           &shm_zone[i].shm.name, pid);
         }
+
+        ngx_slab_release_caches(sp, pid);
+
+        /* the locks of the zone data, if any */
+
+        if (shm_zone[i].unlock) {
+            shm_zone[i].unlock(&shm_zone[i], pid);
+        }
     }
 }
 
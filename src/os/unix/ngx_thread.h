@@ -109,6 +109,10 @@ ngx_int_t ngx_cond_signal(ngx_cond_t *cv);
 
 #else /* !NGX_THREADS */
 
+#if (NGX_THREAD_POOL)
+#include <pthread.h>
+#endif
+
 #define ngx_thread_volatile
 
 #define ngx_log_tid           0